@@ -1,8 +1,10 @@
 FRAMEWORKRLIB = ./DualFramework
 # List of all the Userlib files
 FRAMEWORKSRC =  $(FRAMEWORKRLIB)/src/DataLinkLayer.c \
+				$(FRAMEWORKRLIB)/src/DataLinkDma.c \
 				$(FRAMEWORKRLIB)/src/NetworkLayer.c \
 				$(FRAMEWORKRLIB)/src/crc.c \
+				$(FRAMEWORKRLIB)/src/cobs.c \
           
 # Required include directories
 FRAMEWORKINC =  $(FRAMEWORKRLIB) \
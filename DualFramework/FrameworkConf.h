@@ -30,9 +30,196 @@
 
 #define DEFAULT_BAUDRATE 921600
 #define INPUT_FRAME_BUFFER 10
-#define OUTPUT_FRAME_BUFFER 97
+#define OUTPUT_FRAME_BUFFER 128
 
 #define MAX_FRAME_PER_PACKET 97
 #define MAX_AVAILABLE_PACKET 2
 
+/**
+ * @brief   Number of frame slots shared by the packets being filled and the
+ *          frames being sent.
+ * @details This is the only buffer depth to tune, a slot takes 16 byte. The
+ *          packets take their frames from here one by one and the
+ *          DataLinkLayer gives them back as it sends them.
+ */
+#define DLL_FRAME_SLOTS 224
+
+/**
+ * @brief   Framing modes of the serial line.
+ */
+#define DLL_FRAMING_FIXED           0   /**< 15 byte frames, sync procedure */
+#define DLL_FRAMING_COBS            1   /**< COBS encoded, 0x00 delimited   */
+
+/**
+ * @brief   Selects the framing of the serial line.
+ * @details @p DLL_FRAMING_FIXED is understood by every ESP firmware, the
+ *          frame boundaries are found by counting bytes and a sync procedure
+ *          realigns the two sides after an error.
+ *          @p DLL_FRAMING_COBS delimits every frame with 0x00, the receivers
+ *          realign themselves at the next frame.
+ */
+#if !defined(DLL_FRAMING) || defined(__DOXYGEN__)
+#define DLL_FRAMING                 DLL_FRAMING_FIXED
+#endif
+
+/**
+ * @brief   Number of frames of the COBS transmit buffer.
+ * @details The DMA backend encodes a batch into one half of the buffer while
+ *          the other half is on the line, a transfer takes up to half of
+ *          these frames. A reliable mode batch takes the whole buffer.
+ */
+#define DLL_COBS_TX_BATCH 16
+
+/**
+ * @brief   Stack size of the receiving thread of the DataLinkLayer.
+ * @details The receive callback of the application (rxcb) runs on this
+ *          stack, on top of the frame decoding. With CH_DBG_FILL_THREADS the
+ *          'threads' shell command shows the stack never used.
+ */
+#if !defined(DLL_RX_THREAD_STACK) || defined(__DOXYGEN__)
+#define DLL_RX_THREAD_STACK         384
+#endif
+
+/**
+ * @brief   Stack size of the sending thread of the DataLinkLayer.
+ */
+#if !defined(DLL_TX_THREAD_STACK) || defined(__DOXYGEN__)
+#define DLL_TX_THREAD_STACK         384
+#endif
+
+/**
+ * @brief   Enables the compact encoding of the user data frames which carry
+ *          a CAN descriptor.
+ * @details These frames go on the line with only the identifier and data
+ *          bytes the CAN frame really has. The option serves the producers
+ *          of such FTYPE_USERDATA frames other than the CAN forwarding.
+ * @note    Requires @p DLL_FRAMING_COBS.
+ * @note    The CAN forwarding of the application sends FTYPE_CANSTREAM
+ *          frames, which are packed already and carry no descriptor, so
+ *          this option does not change its traffic.
+ */
+#if !defined(DLL_USE_COMPACT_FRAMES) || defined(__DOXYGEN__)
+#define DLL_USE_COMPACT_FRAMES      FALSE
+#endif
+
+/**
+ * @brief   Enables the reliable mode of the DataLinkLayer.
+ * @details Every frame sent to the peer carries a sequence number and stays
+ *          in the output ring until the peer acknowledges it. The missing
+ *          frames are retransmitted selectively.
+ * @note    Requires @p DLL_FRAMING_COBS.
+ */
+#if !defined(DLL_USE_ARQ) || defined(__DOXYGEN__)
+#define DLL_USE_ARQ                 FALSE
+#endif
+
+/**
+ * @brief   Retransmission timeout of the reliable mode in milliseconds.
+ */
+#define DLL_ARQ_TIMEOUT_MS 100
+
+/**
+ * @brief   Enables the credit based flow control of the DataLinkLayer.
+ * @details The peer tells with CREDIT control frames how many frames it can
+ *          take, the sending thread holds the frames in the output ring
+ *          while it has no credit.
+ * @note    Requires @p DLL_FRAMING_COBS.
+ */
+#if !defined(DLL_USE_CREDITS) || defined(__DOXYGEN__)
+#define DLL_USE_CREDITS             FALSE
+#endif
+
+/**
+ * @brief   Number of frames which may be sent before the first CREDIT frame.
+ */
+#define DLL_CREDIT_INITIAL 32
+
+/**
+ * @brief   Enables the priority lane of the DataLinkLayer.
+ * @details The frames put with DLLPutPriorityFrame() wait in a small ring of
+ *          their own and the sending thread serves them before the output
+ *          ring, they overtake the packets already queued.
+ * @note    Not available in reliable mode, the sequence numbers are the
+ *          positions of the output ring.
+ */
+#if !defined(DLL_USE_PRIORITY_LANE) || defined(__DOXYGEN__)
+#if DLL_USE_ARQ
+#define DLL_USE_PRIORITY_LANE       FALSE
+#else
+#define DLL_USE_PRIORITY_LANE       TRUE
+#endif
+#endif
+
+/**
+ * @brief   Number of entries of the priority lane.
+ * @note    Must be a power of two not greater than 128.
+ */
+#define DLL_PRIORITY_QUEUE 16
+
+/**
+ * @brief   Default number of priority frames sent in a row while the output
+ *          ring is waiting, 0 is strict priority.
+ */
+#define DLL_PRIORITY_WEIGHT 4
+
+/**
+ * @brief   Maximum number of frames of the output ring sent in one transfer
+ *          of the DMA backend while priority frames are expected.
+ * @details A priority frame waits for the transfer in progress, 4 frames take
+ *          0.65 ms at 921600 baud. The application applies the limit with
+ *          DLLSetPriorityBatch() while its priority table is not empty, the
+ *          transfers are not cut otherwise.
+ */
+#define DLL_PRIORITY_BULK_BATCH 4
+
+/**
+ * @brief   Selects the DMA serial backend of the DataLinkLayer.
+ * @details If TRUE the DataLinkLayer drives USART1 itself and sends the
+ *          queued frames in batches, one DMA transfer each, instead of
+ *          writing the frames one by one into the SerialDriver queue. A
+ *          batch is the run of consecutive frame slots with the fixed
+ *          framing, up to @p DLL_COBS_TX_BATCH frames with COBS.
+ * @note    USART1 must not be used by the SerialDriver or the UARTDriver
+ *          when this option is enabled (see mcuconf.h).
+ */
+#if !defined(DLL_USE_DMA_BACKEND) || defined(__DOXYGEN__)
+#define DLL_USE_DMA_BACKEND         FALSE
+#endif
+
+/**
+ * @brief   Size of the circular receive buffer of the DMA backend in bytes.
+ * @note    Must be a power of two.
+ */
+#define DLL_DMA_RX_RING_SIZE 256
+
+/**
+ * @brief   USART1 and DMA interrupt priority of the DMA backend.
+ */
+#define DLL_DMA_IRQ_PRIORITY 12
+
+/**
+ * @brief   DMA stream priority of the DMA backend (0..3).
+ */
+#define DLL_DMA_PRIORITY 0
+
+/**
+ * @brief   CRC-8 engines of the frame check, both give the same CRC.
+ */
+#define CRC8_ENGINE_TABLE           0   /**< One byte per step.             */
+#define CRC8_ENGINE_SLICED          1   /**< Four bytes per step, +768 byte */
+
+/**
+ * @brief   Selects the CRC-8 engine of the frame check.
+ * @details The frames are checked in bulk with the DMA backend and in COBS
+ *          framing mode, the sliced engine pays off there. The fixed
+ *          framing with the SerialDriver keeps the smaller table engine.
+ */
+#if !defined(DLL_CRC8_ENGINE) || defined(__DOXYGEN__)
+#if DLL_USE_DMA_BACKEND || DLL_FRAMING == DLL_FRAMING_COBS
+#define DLL_CRC8_ENGINE             CRC8_ENGINE_SLICED
+#else
+#define DLL_CRC8_ENGINE             CRC8_ENGINE_TABLE
+#endif
+#endif
+
 #endif /* DUALFRAMEWORK_FRAMEWORKCONF_H_ */
@@ -0,0 +1,116 @@
+/**
+ * @file    DataLinkDma.h
+ * @brief   DMA serial backend of the DataLink Layer header.
+ *
+ * @addtogroup DUALFRAMEWORK
+ * @{
+ */
+
+#ifndef DUALFRAMEWORK_INCLUDE_DATALINKDMA_H_
+#define DUALFRAMEWORK_INCLUDE_DATALINKDMA_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "FrameworkConf.h"
+
+#if DLL_USE_DMA_BACKEND || defined(__DOXYGEN__)
+
+#if STM32_SERIAL_USE_USART1 || STM32_UART_USE_USART1
+#error "DLL_USE_DMA_BACKEND requires USART1 to be disabled for the SerialDriver and the UARTDriver"
+#endif
+
+#if (DLL_DMA_RX_RING_SIZE & (DLL_DMA_RX_RING_SIZE - 1)) != 0
+#error "DLL_DMA_RX_RING_SIZE must be a power of two"
+#endif
+
+/**
+ * @brief   Receive events reported by @p DLLDmaRxWait()
+ */
+#define DLL_DMA_RX_DATA 0x01      /**< Half or full buffer received.        */
+#define DLL_DMA_RX_IDLE 0x02      /**< The line went idle.                  */
+
+/**
+ * @brief   DMA serial backend structure
+ * @details Owns USART1, the DMA1 channel 4 used for the transmission and
+ *          the DMA1 channel 5 which streams the received bytes into a
+ *          circular buffer.
+ */
+typedef struct {
+  /**
+   * @brief Pointer to the USART registers.
+   */
+  USART_TypeDef *usart;
+
+  /**
+   * @brief Transmit and receive DMA streams and their common mode bits.
+   */
+  const stm32_dma_stream_t *dmatx;
+  const stm32_dma_stream_t *dmarx;
+  uint32_t dmamode;
+
+  /**
+   * @brief True while a DMA transfer is in progress.
+   */
+  volatile bool TxBusy;
+
+  /**
+   * @brief The thread waiting for the end of the transfer.
+   */
+  thread_reference_t TxThread;
+
+  /**
+   * @brief Circular receive buffer written by the DMA and the number of
+   *        bytes consumed by the receiving thread, free running, whose low
+   *        bits are the read position.
+   */
+  uint8_t RxRing[DLL_DMA_RX_RING_SIZE];
+  uint32_t RxRead;
+
+  /**
+   * @brief Halves of the buffer filled by the DMA, free running, counted
+   *        by the half and full transfer interrupts.
+   */
+  volatile uint32_t RxHalves;
+
+  /**
+   * @brief Receive events not yet seen by the receiving thread.
+   */
+  volatile uint8_t RxEvents;
+
+  /**
+   * @brief The thread waiting for received bytes.
+   */
+  thread_reference_t RxThread;
+
+  /**
+   * @brief Number of overrun, noise and framing errors.
+   */
+  long RxErrors;
+
+  /**
+   * @brief Number of times the DMA overwrote bytes not yet consumed.
+   */
+  long RxOverruns;
+}DLLDmaDriver;
+
+/**
+ * @brief Declaration of the DMA backend on USART1
+ */
+extern DLLDmaDriver DLLDMA1;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+void DLLDmaStart(DLLDmaDriver *dmap, uint32_t baudrate);
+void DLLDmaStartSend(DLLDmaDriver *dmap, const void *buf, size_t n);
+void DLLDmaWaitSend(DLLDmaDriver *dmap);
+void DLLDmaWrite(DLLDmaDriver *dmap, const void *buf, size_t n);
+size_t DLLDmaReadTimeout(DLLDmaDriver *dmap, void *buf, size_t n, systime_t timeout);
+uint8_t DLLDmaRxWait(DLLDmaDriver *dmap, systime_t timeout);
+size_t DLLDmaRxAvailable(DLLDmaDriver *dmap);
+size_t DLLDmaRxSpan(DLLDmaDriver *dmap, size_t offset, const uint8_t **p);
+void DLLDmaRxCopy(DLLDmaDriver *dmap, void *buf, size_t n);
+void DLLDmaRxConsume(DLLDmaDriver *dmap, size_t n);
+
+#endif /* DLL_USE_DMA_BACKEND */
+#endif /* DUALFRAMEWORK_INCLUDE_DATALINKDMA_H_ */
@@ -12,6 +12,9 @@
 #include "ch.h"
 #include "hal.h"
 #include "FrameworkConf.h"
+#include "DataLinkDma.h"
+#include "cobs.h"
+#include "crc.h"
 
 
 #if DUALFRAMEWORK_USE_WIFI || defined(__DOXYGEN__)
@@ -23,9 +26,102 @@
 
 /**
  * @brief  Define the number of Sync Timeout
+ * @details The sync frame is sent again if the peer does not answer within
+ *          SYNC_TIMEOUT_THRS milliseconds.
  */
 #define SYNC_TIMEOUT_THRS 100
 
+/**
+ * @brief  Sync timeout and the polling period of the receiver while a sync
+ *         is in progress, in system ticks
+ */
+#define DLL_SYNC_TIMEOUT MS2ST(SYNC_TIMEOUT_THRS)
+#define DLL_SYNC_POLL    MS2ST(1)
+
+#if DLL_USE_ARQ && DLL_FRAMING != DLL_FRAMING_COBS
+#error "DLL_USE_ARQ requires DLL_FRAMING_COBS"
+#endif
+
+#if DLL_USE_CREDITS && DLL_FRAMING != DLL_FRAMING_COBS
+#error "DLL_USE_CREDITS requires DLL_FRAMING_COBS"
+#endif
+
+#if DLL_USE_COMPACT_FRAMES && DLL_FRAMING != DLL_FRAMING_COBS
+#error "DLL_USE_COMPACT_FRAMES requires DLL_FRAMING_COBS"
+#endif
+
+#if DLL_USE_PRIORITY_LANE && DLL_USE_ARQ
+#error "DLL_USE_PRIORITY_LANE is not available with DLL_USE_ARQ"
+#endif
+
+/**
+ * @brief  CAN descriptor of a user data frame
+ * @details The application describes the CAN frame in data[DLL_CANINFO_INDEX]
+ *          of a user data frame (Id 0x00), the data bytes are in data[0..7]
+ *          and the identifier in data[8..10], low byte first.
+ * @note    The CAN record stream (FTYPE_CANSTREAM) does not use it.
+ */
+#define DLL_CANINFO_INDEX 11
+#define DLL_CANINFO_VALID 0x80      /**< The descriptor is present.        */
+#define DLL_CANINFO_IDE   0x40      /**< Extended identifier.              */
+#define DLL_CANINFO_RTR   0x20      /**< Remote frame, no data bytes.      */
+#define DLL_CANINFO_DLC   0x0F      /**< Data length code.                 */
+
+/**
+ * @brief  Compact frame on the serial line
+ * @details | header | FrameNumber | identifier (2 or 3) | data (DLC) | CRC |
+ *          The header is the CAN descriptor with DLL_COMPACT_WIDE set if the
+ *          identifier needs 3 bytes. Bit 7 of the header tells the compact
+ *          frames from the full frames whose first byte is the Id.
+ */
+#define DLL_COMPACT_WIDE  0x10
+
+/**
+ * @brief  Size of a data frame on the serial line
+ * @details In reliable mode the frame is preceded by its sequence number and
+ *          the CRC covers the sequence number too.
+ */
+#if DLL_USE_ARQ
+#define DLL_WIRE_FRAME_SIZE (FRAME_SIZE_BYTE + 1)
+#else
+#define DLL_WIRE_FRAME_SIZE FRAME_SIZE_BYTE
+#endif
+
+/**
+ * @brief  Control frames sent by the peer
+ * @details A control frame is shorter than a data frame, its first byte is
+ *          the type and the last one is the CRC of the whole frame.
+ *          - ACK: type, the next expected sequence number, and a 16 bit
+ *            little endian bitmap of the frames received after the missing
+ *            one (bit 0 is the next expected + 1).
+ *          - CREDIT: type and a 16 bit little endian limit. The peer may
+ *            receive data frames until the number of frames sent since the
+ *            start (modulo 65536) reaches the limit. A lost CREDIT frame is
+ *            covered by the next one.
+ */
+#define DLL_CTRL_ACK         0x01
+#define DLL_CTRL_ACK_SIZE    5
+#define DLL_CTRL_CREDIT      0x02
+#define DLL_CTRL_CREDIT_SIZE 4
+
+/**
+ * @brief  Retransmission timeout of the reliable mode in system ticks
+ */
+#define DLL_ARQ_TIMEOUT MS2ST(DLL_ARQ_TIMEOUT_MS)
+
+/**
+ * @brief  Number of words of the slot bitmaps of the reliable mode
+ */
+#define DLL_ARQ_BITMAP_WORDS ((OUTPUT_FRAME_BUFFER + 31) / 32)
+
+/**
+ * @brief  States of the sync state machine
+ */
+typedef enum {
+  DLL_SYNC_IDLE = 0,              /**< Frames are being received.           */
+  DLL_SYNC_REQUESTED              /**< Waiting for the echo of the peer.    */
+}DLLSyncState_t;
+
 /**
  * @brief  Represents a Frame.
  */
@@ -46,22 +142,82 @@ typedef struct{
   long SyncTimeout;
   long SyncCounter;
   long SyncFrameSentCounter;
-  int FreeFilledBuffer;
-  int FreeFreeBuffer;
+  long DmaTransfers;
+  long RealignCounter;
+  long FrameErrors;
+  long RxOverruns;
+  long Retransmissions;
+  long ArqTimeouts;
+  long CreditStalls;
+  long CreditStarvedMs;
+  long SentBytes;
+  long PriorityFrames;
+  int MinFreeSlots;
+  int QueuedFrames;
+  int PeakQueuedFrames;
 }DataLinkStatistics;
 
+#if (OUTPUT_FRAME_BUFFER & (OUTPUT_FRAME_BUFFER - 1)) != 0 || OUTPUT_FRAME_BUFFER > 128
+#error "OUTPUT_FRAME_BUFFER must be a power of two not greater than 128"
+#endif
+
+#if (DLL_PRIORITY_QUEUE & (DLL_PRIORITY_QUEUE - 1)) != 0 || DLL_PRIORITY_QUEUE > 128
+#error "DLL_PRIORITY_QUEUE must be a power of two not greater than 128"
+#endif
+
+#if DLL_FRAME_SLOTS <= MAX_FRAME_PER_PACKET || DLL_FRAME_SLOTS > 255
+#error "DLL_FRAME_SLOTS must be greater than MAX_FRAME_PER_PACKET and less than 256"
+#endif
+
+/**
+ * @brief   Marks the end of a slot chain and an empty free list.
+ */
+#define DLL_SLOT_NONE 0xFF
+
 /*
  * @brief The 'DLLBufferPark' contains all the buffers (array) which used by the
  *        DataLinkLayer
+ * @details Every frame which is being sent or collected into a packet lives
+ *          in a slot of 'DLLFrameSlots'. A slot is linked into a chain
+ *          (packet) or into the free list by 'DLLSlotLinks', the free list
+ *          is a FIFO so the slots are reused in the order they are sent and
+ *          the frames of a packet tend to be contiguous.
+ *          'DLLOutputQueue' is a single producer/single consumer ring of slot
+ *          numbers. The head is moved only by the producer, the tail only by
+ *          the 'SDSending' thread, both are free running 8 bit counters. The
+ *          slots return to the free list as the tail passes them.
+ *          'DLLPriorityQueue' is the priority lane, a second ring of the same
+ *          kind with a producer of its own. It is always served first.
  */
 typedef struct{
-  FrameStruct DLLOutputBuffer[OUTPUT_FRAME_BUFFER];
+  FrameStruct DLLFrameSlots[DLL_FRAME_SLOTS];
+  uint8_t DLLSlotLinks[DLL_FRAME_SLOTS];
+  uint8_t DLLSlotFirst;
+  uint8_t DLLSlotLast;
+
+  /**
+   * @brief Counts the free slots.
+   */
+  semaphore_t DLLSlotsFree;
+
+  uint8_t DLLOutputQueue[OUTPUT_FRAME_BUFFER];
+
+  volatile uint8_t DLLOutputHead;
+  volatile uint8_t DLLOutputTail;
+
+  /**
+   * @brief The producer waiting for a free slot and the consumer waiting for
+   *        a frame.
+   */
+  thread_reference_t DLLProducer;
+  thread_reference_t DLLConsumer;
 
-  msg_t DLLFreeOutputBufferQueue[OUTPUT_FRAME_BUFFER];
-  mailbox_t DLLFreeOutputBuffer;
+#if DLL_USE_PRIORITY_LANE
+  uint8_t DLLPriorityQueue[DLL_PRIORITY_QUEUE];
 
-  msg_t DLLFilledOutputBufferQueue[OUTPUT_FRAME_BUFFER];
-  mailbox_t DLLFilledOutputBuffer;
+  volatile uint8_t DLLPriorityHead;
+  volatile uint8_t DLLPriorityTail;
+#endif
 
   FrameStruct DLLInputBuffer[INPUT_FRAME_BUFFER];
 }DLLBufferPark;
@@ -75,13 +231,26 @@ typedef enum {
   DLL_ACTIVE = 2,                   /**< Active.                            */
 } DLLSerial_state_t;
 
+/**
+ * @brief   Receive callback type.
+ * @details Called by the receiving thread for every frame with valid CRC,
+ *          it must return quickly.
+ */
+typedef void (*DLLReceiveCallback)(const FrameStruct *Frame);
+
 /**
  * @brief   DataLinkLayer config.
- * @details Contains the driver ID and the speed of the serial communication
+ * @details Contains the driver ID, the speed of the serial communication
+ *          and the receive callback
  */
 typedef struct{
+#if DLL_USE_DMA_BACKEND
+  DLLDmaDriver *DDriver;
+#else
   SerialDriver *SDriver;
+#endif
   uint32_t baudrate;
+  DLLReceiveCallback rxcb;          /**< May be NULL.                       */
 }DLLSerialConfig;
 
 /**
@@ -109,16 +278,100 @@ typedef struct {
    */
   char DLLTempBuffer[FRAME_SIZE_BYTE];
 
+#if DLL_FRAMING == DLL_FRAMING_COBS
+  /**
+   * @brief Decoder of the received COBS frames, it writes into DLLTempBuffer
+   */
+  CobsDecoder DLLRxDecoder;
+#if DLL_USE_DMA_BACKEND || DLL_USE_ARQ
+  /**
+   * @brief The encoded frames are collected here for a single write
+   */
+  uint8_t DLLTxBuffer[DLL_COBS_TX_BATCH * COBS_ENCODED_SIZE(DLL_WIRE_FRAME_SIZE)];
+#endif
+#endif
+
+#if DLL_USE_ARQ
+  /**
+   * @brief Reliable mode: the frames between the tail of the output ring and
+   *        DLLArqSend are waiting for the acknowledgement of the peer.
+   */
+  uint8_t DLLArqSend;
+
+  /**
+   * @brief Selectively acknowledged frames and frames to be retransmitted,
+   *        one bit per slot of the output ring.
+   */
+  uint32_t DLLArqAcked[DLL_ARQ_BITMAP_WORDS];
+  uint32_t DLLArqResend[DLL_ARQ_BITMAP_WORDS];
+  uint8_t DLLArqResendCount;
+
+  /**
+   * @brief Start of the retransmission timeout and the missing frame which
+   *        was already retransmitted on a selective acknowledgement.
+   */
+  systime_t DLLArqTimer;
+  uint8_t DLLArqHole;
+  bool DLLArqHoleSent;
+
+  /**
+   * @brief The latest acknowledgement, passed by the 'SDReceiving' thread.
+   */
+  uint8_t DLLArqRxAck;
+  uint16_t DLLArqRxSack;
+  volatile bool DLLArqAckPending;
+#endif
+
+#if DLL_USE_CREDITS
+  /**
+   * @brief Flow control: the limit granted by the peer and the number of
+   *        frames sent, both modulo 65536.
+   */
+  volatile uint16_t DLLCreditLimit;
+  uint16_t DLLCreditSent;
+
+  /**
+   * @brief True while frames are waiting for credit, and since when.
+   */
+  bool DLLCreditStarved;
+  systime_t DLLCreditStarvedSince;
+#endif
+
   /**
    * @brief DLLSyncFrame contains a SyncFrame which generated in the DLLStartFunction
    */
   char DLLSyncFrame[FRAME_SIZE_BYTE];
 
+#if DLL_FRAMING == DLL_FRAMING_FIXED
+  /**
+   * @brief State of the sync, the number of 0xFF bytes received in a row and
+   *        the time the last sync frame was requested.
+   */
+  DLLSyncState_t DLLSyncState;
+  uint8_t DLLSyncFFs;
+  systime_t DLLSyncStart;
+#endif
+
+#if DLL_USE_PRIORITY_LANE
+  /**
+   * @brief Priority frames which may be sent in a row while the output ring
+   *        is waiting (0: no limit), and the frames sent in the current row.
+   */
+  uint8_t DLLPriorityWeight;
+  uint8_t DLLPriorityRun;
+
+  /**
+   * @brief Maximum number of frames of the output ring in one transfer of
+   *        the DMA backend (0: no limit).
+   */
+  uint8_t DLLPriorityBatch;
+#endif
+
   /**
-   * @brief This mutex used to sync the datastream between the sync protocol and
-   *        the user data.
+   * @brief Set by the receiver when the 'SDSending' thread has to send the
+   *        sync frame before the next user frames.
    */
-  mutex_t DLLSerialSendMutex;
+  volatile bool DLLSyncRequest;
 
   /**
    * @brief Declaration of the buffers used in the DLL driver
@@ -133,32 +386,67 @@ typedef struct {
 
 } DLLDriver;
 
-/**
- * @brief   DLL serial line cfg
- */
-static SerialConfig SerialDCfg =
-{
-DEFAULT_BAUDRATE, // bit rate
-0,
-0,
-0
-};
 
 /**
  * @brief Declaration of the DataLinkLayer
  */
 extern DLLDriver DLLS1;
 
+/**
+ * @brief   The frame stored in a slot.
+ */
+#define DLLSlotFrame(dllp, slot) (&(dllp)->DLLBuffers.DLLFrameSlots[slot])
+
+/**
+ * @brief   The slot after @p slot in its chain.
+ */
+#define DLLSlotNext(dllp, slot) ((dllp)->DLLBuffers.DLLSlotLinks[slot])
+
+/*===========================================================================*/
+/* Frame check.                                                              */
+/*===========================================================================*/
+
+/**
+ * @brief   Computes the CRC of a frame, it goes into the last byte.
+ *
+ * @param[in] frame   the frame
+ */
+static inline uint8_t CreateCRC(const FrameStruct *frame){
+  return UpdateCRC(0, (const uint8_t *)frame, FRAME_SIZE_BYTE - 1);
+}
+
+/**
+ * @brief   Checks the CRC of a received frame.
+ *
+ * @param[in] frame   the frame
+ * @return            zero if the frame is valid
+ */
+static inline uint8_t CheckCRC(const uint8_t *frame){
+  return UpdateCRC(0, frame, FRAME_SIZE_BYTE);
+}
+
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
 void DLLInit(void);
 void DLLStart(DLLDriver *dllp, DLLSerialConfig *config);
 void DLLCreateSyncFrame(DLLDriver *dllp);
-void DLLSyncProcedure(DLLDriver *driver);
+#if DLL_FRAMING == DLL_FRAMING_FIXED
+void DLLStartSync(DLLDriver *driver);
+#endif
 DataLinkStatistics *DLLGetStats(DLLDriver *dllp);
 msg_t DLLPutFrameInQueue(DLLDriver *dllp, FrameStruct *Frame);
-bool DLLSendSingleFrameSerial(DLLDriver *driver, FrameStruct *Frame);
+msg_t DLLPutChainInQueue(DLLDriver *dllp, uint8_t first, uint8_t n);
+uint8_t DLLSlotAlloc(DLLDriver *dllp, systime_t timeout);
+void DLLSlotFree(DLLDriver *dllp, uint8_t slot);
+int DLLSlotsAvailable(DLLDriver *dllp);
+void DLLRingRelease(DLLDriver *dllp, uint8_t n);
+#if DLL_USE_PRIORITY_LANE
+msg_t DLLPutPriorityFrame(DLLDriver *dllp, FrameStruct *Frame);
+void DLLSetPriorityWeight(DLLDriver *dllp, uint8_t weight);
+void DLLSetPriorityBatch(DLLDriver *dllp, uint8_t n);
+#endif
+void DLLSendSingleFrameSerial(DLLDriver *driver, FrameStruct *Frame);
 
 
 #endif /* DUALFRAMEWORK_USE_WIFI */
@@ -21,7 +21,10 @@
  */
 typedef struct{
   char FrameNumber;
+  char PriorityNumber;
   long SentPacket;
+  long SentPriority;
+  long DroppedFrames;
 }NetworkStatistics;
 
 /**
@@ -62,10 +65,24 @@ typedef struct {
 
 /*
  * @brief   Frame type constants
- * @details These constants determines the type of a single frame
+ * @details These constants determines the type of a single frame. The low
+ *          nibble of a FTYPE_CANSTREAM frame carries an offset in its data,
+ *          the low nibble of a FTYPE_CANPRIORITY frame a length.
+ *          A FTYPE_CANPRIORITY frame is a packet by itself, the receiver
+ *          sends it at once in its own UDP packet to the destination of the
+ *          latest FTYPE_UDPSEND frame, even between the frames of another
+ *          packet.
+ * @note    A FTYPE_CANPRIORITY frame carries the microsecond receive time
+ *          in the bits its identifier and data leave free, 19 bits at least
+ *          which the receiver extends with the last time it got. An
+ *          extended CAN frame with more than 5 data bytes leaves no room,
+ *          the receiver stamps it on arrival.
  */
 #define FTYPE_USERDATA 0x00
+#define FTYPE_CANSTREAM 0x10
 #define FTYPE_UDPSEND 0x20
+#define FTYPE_CANFILTER 0x30
+#define FTYPE_CANPRIORITY 0x40
 
 /**
  * @brief 'IPAddress' structure represents a data type which can store a whole
@@ -81,18 +98,26 @@ typedef struct{
 /**
  * @brief   'PacketStruct' structure represents a data type which can store
  *          'MAX_FRAME_PER_PACKET' piece of frames.
- * @details 'length' contains the how many frames are inside the packet
+ * @details The frames are in the frame slots of the DataLinkLayer, chained
+ *          from 'first' to 'last'. 'length' contains the how many frames are
+ *          inside the packet.
  */
 typedef struct{
+  WIFIDriver *wifip;
   uint8_t length;
-  FrameStruct FrameSlot[MAX_FRAME_PER_PACKET];
+  uint8_t first;
+  uint8_t last;
 }PacketStruct;
 
-/**
- * @brief   'PacketBuffer' is the memory space (buffer) of the memory_pool
- *          object which declared in the 'WiFiDriver' structure
- */
-static PacketStruct PacketBuffer[MAX_AVAILABLE_PACKET] __attribute__((aligned(sizeof(stkalign_t))));
+#if MAX_FRAME_PER_PACKET >= OUTPUT_FRAME_BUFFER
+#error "a packet and its control frame must fit into the output ring"
+#endif
+
+/*===========================================================================*/
+/* Function macros (NWL APIs).                                               */
+/*===========================================================================*/
+#define NWLSendSingleFramePacket(X, Y) wifiSendSFP(X, Y)
+#define NWLSendPacketUDP(X, Y, Z, I) wifiSendUDP(X, Y, Z, I)
 
 /*===========================================================================*/
 /* External declarations.                                                    */
@@ -105,17 +130,15 @@ extern WIFIDriver WIFID1;
 
 
 void wifiInit(void);
+void wifiObjectInit(WIFIDriver *wifid);
 void wifiStart(WIFIDriver *wifip, DLLDriver *dllp, DLLSerialConfig *config);
 void NWLAssignFNtoPacket(WIFIDriver *wifip, PacketStruct *Packet);
-void NWLAddFrameToPacket(PacketStruct *Packet, FrameStruct *Frame);
+msg_t NWLAddFrameToPacket(PacketStruct *Packet, FrameStruct *Frame);
 PacketStruct *NWLCreatePacket(WIFIDriver *wifip);
 void NWLSendPacketUDP(WIFIDriver *wifip, PacketStruct *Packet, IPAddress ipaddr, int portnum);
-
-/*===========================================================================*/
-/* Function macros (NWL APIs).                                               */
-/*===========================================================================*/
-#define NWLSendSingleFramePacket(X, Y) wifiSendSFP(X, Y)
-#define NWLSendPacketUDP(X, Y, Z, I) wifiSendUDP(X, Y, Z, I)
+#if DLL_USE_PRIORITY_LANE
+msg_t NWLSendSingleFramePacket(WIFIDriver *wifip, FrameStruct *Frame);
+#endif
 
 
 #endif /* DUALFRAMEWORK_USE_WIFI */
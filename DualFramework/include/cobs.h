@@ -0,0 +1,44 @@
+/**
+ * @file    cobs.h
+ * @brief   Consistent Overhead Byte Stuffing header.
+ *
+ * @addtogroup DUALFRAMEWORK
+ * @{
+ */
+
+#ifndef DUALFRAMEWORK_INCLUDE_COBS_H_
+#define DUALFRAMEWORK_INCLUDE_COBS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief  Maximum size of @p n bytes after encoding, including the 0x00
+ *         delimiter.
+ */
+#define COBS_ENCODED_SIZE(n) ((n) + ((n) / 254) + 2)
+
+/**
+ * @brief  Return values of @p CobsDecodeByte()
+ */
+#define COBS_MORE 0                 /**< The frame is not finished yet.      */
+#define COBS_ERROR -1               /**< Too long or truncated frame.        */
+
+/**
+ * @brief  Streaming decoder state.
+ */
+typedef struct{
+  uint8_t *buf;
+  size_t size;
+  size_t length;
+  uint8_t code;
+  uint8_t left;
+  bool overflow;
+}CobsDecoder;
+
+size_t CobsEncode(const uint8_t *in, size_t n, uint8_t *out);
+void CobsDecoderInit(CobsDecoder *dp, uint8_t *buf, size_t size);
+int CobsDecodeByte(CobsDecoder *dp, uint8_t b);
+
+#endif /* DUALFRAMEWORK_INCLUDE_COBS_H_ */
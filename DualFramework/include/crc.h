@@ -10,9 +10,20 @@
 
 #include "ch.h"
 #include "hal.h"
-#include "DataLinkLayer.h"
+#include "FrameworkConf.h"
 
-uint8_t CreateCRC(volatile FrameStruct *s);
-uint8_t CheckCRC(volatile uint8_t *s);
+/**
+ * @brief   Selected CRC-8 engine of the frame check.
+ */
+#if DLL_CRC8_ENGINE == CRC8_ENGINE_SLICED
+#define UpdateCRC(crc, s, n) Crc8Sliced(crc, s, n)
+#else
+#define UpdateCRC(crc, s, n) Crc8Table(crc, s, n)
+#endif
+
+extern const uint8_t crctmb[];
+
+uint8_t Crc8Table(uint8_t crc, const uint8_t *s, size_t n);
+uint8_t Crc8Sliced(uint8_t crc, const uint8_t *s, size_t n);
 
 #endif /* INCLUDE_CRC_H_ */
@@ -0,0 +1,336 @@
+/**
+ * @file    DataLinkDma.c
+ * @brief   DMA serial backend of the DataLink Layer.
+ * @details The backend drives USART1 directly: the transmission goes through
+ *          DMA1 channel 4 so a whole batch of frames costs one interrupt,
+ *          the reception is streamed by DMA1 channel 5 into a circular
+ *          buffer. The receiving thread is woken up by the half/full
+ *          transfer interrupts and by the idle line detection of the USART.
+ *          The interrupts count the halves of the buffer filled, so a
+ *          reader which fell a whole buffer behind the DMA is detected.
+ *
+ * @addtogroup DUALFRAMEWORK
+ * @{
+ */
+
+#include <string.h>
+
+#include "DataLinkDma.h"
+
+#if DLL_USE_DMA_BACKEND || defined(__DOXYGEN__)
+
+/**
+ * @brief   DMA backend on USART1.
+ */
+DLLDmaDriver DLLDMA1;
+
+/*===========================================================================*/
+/* Interrupt handlers.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Notifies the receiving thread.
+ * @note    Must be called from a locked state.
+ *
+ * @param[in] dmap    pointer to the @p DLLDmaDriver object
+ * @param[in] event   the receive event
+ */
+static void DLLDmaRxEventI(DLLDmaDriver *dmap, uint8_t event){
+  dmap->RxEvents |= event;
+  chThdResumeI(&dmap->RxThread, MSG_OK);
+}
+
+/**
+ * @brief   End of the DMA transmission.
+ * @details Stops the stream and wakes up the thread waiting for the transfer.
+ *
+ * @param[in] p       pointer to the @p DLLDmaDriver object
+ * @param[in] flags   DMA interrupt flags
+ */
+static void DLLDmaTxEndIsr(void *p, uint32_t flags){
+  DLLDmaDriver *dmap = p;
+
+  if(flags & STM32_DMA_ISR_TEIF)
+    osalSysHalt("DualFramework: USART1 TX DMA failure");
+
+  dmaStreamDisable(dmap->dmatx);
+
+  osalSysLockFromISR();
+  dmap->TxBusy = false;
+  chThdResumeI(&dmap->TxThread, MSG_OK);
+  osalSysUnlockFromISR();
+}
+
+/**
+ * @brief   Half and full transfer of the circular receive DMA.
+ * @details Both flags are set if the interrupt was served late.
+ *
+ * @param[in] p       pointer to the @p DLLDmaDriver object
+ * @param[in] flags   DMA interrupt flags
+ */
+static void DLLDmaRxIsr(void *p, uint32_t flags){
+  DLLDmaDriver *dmap = p;
+
+  if(flags & STM32_DMA_ISR_TEIF)
+    osalSysHalt("DualFramework: USART1 RX DMA failure");
+
+  osalSysLockFromISR();
+  if(flags & STM32_DMA_ISR_HTIF)
+    dmap->RxHalves++;
+  if(flags & STM32_DMA_ISR_TCIF)
+    dmap->RxHalves++;
+  DLLDmaRxEventI(dmap, DLL_DMA_RX_DATA);
+  osalSysUnlockFromISR();
+}
+
+/**
+ * @brief   USART1 interrupt handler.
+ * @details Serves the idle line detection and the receive errors. Both flags
+ *          are cleared by the SR read followed by the DR read, the received
+ *          bytes themselves never pass through here.
+ */
+OSAL_IRQ_HANDLER(STM32_USART1_HANDLER) {
+  DLLDmaDriver *dmap = &DLLDMA1;
+  uint16_t sr;
+
+  OSAL_IRQ_PROLOGUE();
+
+  sr = dmap->usart->SR;
+  (void)dmap->usart->DR;
+
+  osalSysLockFromISR();
+  if(sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE))
+    dmap->RxErrors++;
+  if(sr & USART_SR_IDLE)
+    DLLDmaRxEventI(dmap, DLL_DMA_RX_IDLE);
+  osalSysUnlockFromISR();
+
+  OSAL_IRQ_EPILOGUE();
+}
+
+/*===========================================================================*/
+/* Exported functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Configures and activates USART1 and its DMA streams.
+ * @details The receive stream runs in circular mode for the whole life of
+ *          the driver.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ * @param[in] baudrate  speed of the serial line
+ */
+void DLLDmaStart(DLLDmaDriver *dmap, uint32_t baudrate){
+  bool b;
+
+  osalDbgCheck((dmap != NULL) && (baudrate != 0));
+
+  dmap->usart = USART1;
+  dmap->dmatx = STM32_DMA_STREAM(STM32_DMA_STREAM_ID(1, 4));
+  dmap->dmarx = STM32_DMA_STREAM(STM32_DMA_STREAM_ID(1, 5));
+  dmap->dmamode = STM32_DMA_CR_PL(DLL_DMA_PRIORITY) |
+                  STM32_DMA_CR_PSIZE_BYTE | STM32_DMA_CR_MSIZE_BYTE;
+  dmap->TxBusy = false;
+  dmap->TxThread = NULL;
+  dmap->RxRead = 0;
+  dmap->RxHalves = 0;
+  dmap->RxEvents = 0;
+  dmap->RxThread = NULL;
+  dmap->RxErrors = 0;
+  dmap->RxOverruns = 0;
+
+  b = dmaStreamAllocate(dmap->dmatx, DLL_DMA_IRQ_PRIORITY, DLLDmaTxEndIsr, (void *)dmap);
+  osalDbgAssert(!b, "DLLDmaStart(), stream already allocated");
+  b = dmaStreamAllocate(dmap->dmarx, DLL_DMA_IRQ_PRIORITY, DLLDmaRxIsr, (void *)dmap);
+  osalDbgAssert(!b, "DLLDmaStart(), stream already allocated");
+  (void)b;
+  dmaStreamSetPeripheral(dmap->dmatx, &dmap->usart->DR);
+  dmaStreamSetPeripheral(dmap->dmarx, &dmap->usart->DR);
+
+  dmaStreamSetMemory0(dmap->dmarx, dmap->RxRing);
+  dmaStreamSetTransactionSize(dmap->dmarx, DLL_DMA_RX_RING_SIZE);
+  dmaStreamSetMode(dmap->dmarx, dmap->dmamode | STM32_DMA_CR_DIR_P2M |
+                   STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC |
+                   STM32_DMA_CR_HTIE | STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE);
+  dmaStreamEnable(dmap->dmarx);
+
+  rccEnableUSART1(FALSE);
+  dmap->usart->BRR = STM32_PCLK2 / baudrate;
+  dmap->usart->CR2 = 0;
+  dmap->usart->CR3 = USART_CR3_DMAT | USART_CR3_DMAR | USART_CR3_EIE;
+  dmap->usart->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE | USART_CR1_IDLEIE;
+  nvicEnableVector(STM32_USART1_NUMBER, DLL_DMA_IRQ_PRIORITY);
+}
+
+/**
+ * @brief   Waits for the end of the current DMA transfer.
+ * @note    Only one thread may wait for the same transfer.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ */
+void DLLDmaWaitSend(DLLDmaDriver *dmap){
+  chSysLock();
+  if(dmap->TxBusy)
+    (void)chThdSuspendS(&dmap->TxThread);
+  chSysUnlock();
+}
+
+/**
+ * @brief   Starts the DMA transmission of a buffer.
+ * @details The function waits for the previous transfer then returns
+ *          immediately, the buffer must not be modified until the next
+ *          @p DLLDmaWaitSend() returns.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ * @param[in] buf       the bytes to be sent
+ * @param[in] n         number of bytes
+ */
+void DLLDmaStartSend(DLLDmaDriver *dmap, const void *buf, size_t n){
+  DLLDmaWaitSend(dmap);
+
+  dmap->TxBusy = true;
+  dmaStreamSetMemory0(dmap->dmatx, buf);
+  dmaStreamSetTransactionSize(dmap->dmatx, n);
+  dmaStreamSetMode(dmap->dmatx, dmap->dmamode | STM32_DMA_CR_DIR_M2P |
+                   STM32_DMA_CR_MINC | STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE);
+  dmaStreamEnable(dmap->dmatx);
+}
+
+/**
+ * @brief   Sends a buffer and waits until the DMA has finished with it.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ * @param[in] buf       the bytes to be sent
+ * @param[in] n         number of bytes
+ */
+void DLLDmaWrite(DLLDmaDriver *dmap, const void *buf, size_t n){
+  DLLDmaStartSend(dmap, buf, n);
+  DLLDmaWaitSend(dmap);
+}
+
+/**
+ * @brief   Waits for a receive event.
+ * @details Returns immediately if an event arrived since the last call.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ * @param[in] timeout   the number of ticks before the operation timeouts
+ * @return              the @p DLL_DMA_RX_DATA and @p DLL_DMA_RX_IDLE events,
+ *                      zero on timeout
+ */
+uint8_t DLLDmaRxWait(DLLDmaDriver *dmap, systime_t timeout){
+  uint8_t events;
+
+  chSysLock();
+  if(dmap->RxEvents == 0)
+    (void)chThdSuspendTimeoutS(&dmap->RxThread, timeout);
+  events = dmap->RxEvents;
+  dmap->RxEvents = 0;
+  chSysUnlock();
+
+  return events;
+}
+
+/**
+ * @brief   Number of received bytes not yet consumed.
+ * @details The write position of the DMA is counted from the start: the
+ *          halves of the buffer counted by the interrupt plus the bytes
+ *          written since the last one, which is less than a whole buffer
+ *          even if the interrupt is still pending. If the DMA is a whole
+ *          buffer ahead of the read position, the oldest bytes are
+ *          overwritten: the received bytes are dropped, the read position
+ *          moves to the write position and @p RxOverruns is incremented.
+ *          The reader has to find the next frame boundary.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ */
+size_t DLLDmaRxAvailable(DLLDmaDriver *dmap){
+  uint32_t halves, pos, write;
+
+  chSysLock();
+  halves = dmap->RxHalves;
+  pos = DLL_DMA_RX_RING_SIZE - dmaStreamGetTransactionSize(dmap->dmarx);
+  chSysUnlock();
+
+  write = halves * (DLL_DMA_RX_RING_SIZE / 2) +
+          ((pos - (halves & 1) * (DLL_DMA_RX_RING_SIZE / 2)) & (DLL_DMA_RX_RING_SIZE - 1));
+  if(write - dmap->RxRead >= DLL_DMA_RX_RING_SIZE)
+  {
+    dmap->RxRead = write;
+    dmap->RxOverruns++;
+  }
+  return write - dmap->RxRead;
+}
+
+/**
+ * @brief   Gives access to the received bytes inside the circular buffer.
+ *
+ * @param[in]  dmap     pointer to the @p DLLDmaDriver object
+ * @param[in]  offset   offset from the read position
+ * @param[out] p        pointer to the byte at @p offset
+ * @return              the number of bytes readable at @p p without wrapping
+ */
+size_t DLLDmaRxSpan(DLLDmaDriver *dmap, size_t offset, const uint8_t **p){
+  size_t pos = (dmap->RxRead + offset) & (DLL_DMA_RX_RING_SIZE - 1);
+  *p = &dmap->RxRing[pos];
+  return DLL_DMA_RX_RING_SIZE - pos;
+}
+
+/**
+ * @brief   Drops received bytes.
+ *
+ * @param[in] dmap      pointer to the @p DLLDmaDriver object
+ * @param[in] n         number of bytes
+ */
+void DLLDmaRxConsume(DLLDmaDriver *dmap, size_t n){
+  dmap->RxRead += n;
+}
+
+/**
+ * @brief   Copies and consumes received bytes.
+ * @note    The caller must check @p DLLDmaRxAvailable() first.
+ *
+ * @param[in]  dmap     pointer to the @p DLLDmaDriver object
+ * @param[out] buf      the received bytes
+ * @param[in]  n        number of bytes
+ */
+void DLLDmaRxCopy(DLLDmaDriver *dmap, void *buf, size_t n){
+  const uint8_t *p;
+  size_t l = DLLDmaRxSpan(dmap, 0, &p);
+
+  if(l > n)
+    l = n;
+  memcpy(buf, p, l);
+  memcpy((uint8_t *)buf + l, dmap->RxRing, n - l);
+  DLLDmaRxConsume(dmap, n);
+}
+
+/**
+ * @brief   Reads the received bytes with timeout.
+ *
+ * @param[in]  dmap     pointer to the @p DLLDmaDriver object
+ * @param[out] buf      the received bytes
+ * @param[in]  n        number of bytes to read
+ * @param[in]  timeout  the number of ticks before the operation timeouts
+ * @return              the number of bytes read
+ */
+size_t DLLDmaReadTimeout(DLLDmaDriver *dmap, void *buf, size_t n, systime_t timeout){
+  size_t done = 0;
+
+  while(done < n)
+  {
+    size_t l = DLLDmaRxAvailable(dmap);
+    if(l == 0)
+    {
+      if(DLLDmaRxWait(dmap, timeout) == 0)
+        break;
+      continue;
+    }
+    if(l > n - done)
+      l = n - done;
+    DLLDmaRxCopy(dmap, (uint8_t *)buf + done, l);
+    done += l;
+  }
+  return done;
+}
+
+#endif /* DLL_USE_DMA_BACKEND */
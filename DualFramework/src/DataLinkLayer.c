@@ -6,7 +6,10 @@
  * @{
  */
 
+#include <string.h>
+
 #include "DataLinkLayer.h"
+#include "crc.h"
 
 #if DUALFRAMEWORK_USE_WIFI || defined(__DOXYGEN__)
 
@@ -20,78 +23,567 @@ DLLDriver DLLS1;
  */
 char DLLSyncFrame[FRAME_SIZE_BYTE];
 
+#if !DLL_USE_DMA_BACKEND
+/**
+ * @brief   DLL serial line cfg
+ */
+static SerialConfig SerialDCfg =
+{
+DEFAULT_BAUDRATE, // bit rate
+0,
+0,
+0
+};
+#endif
+
+/*===========================================================================*/
+/* Serial backend functions                                                  */
+/*===========================================================================*/
+
+/**
+ * @brief   Writes bytes to the serial line through the selected backend.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] buf     the bytes to be sent
+ * @param[in] n       number of bytes
+ */
+static void DLLSerialWrite(DLLDriver *driver, const void *buf, size_t n){
+  driver->DLLStats.SentBytes += n;
+#if DLL_USE_DMA_BACKEND
+  DLLDmaWrite(driver->config->DDriver, buf, n);
+#else
+  sdWrite(driver->config->SDriver, buf, n);
+#endif
+}
+
+#if DLL_USE_DMA_BACKEND && !DLL_USE_ARQ
+/**
+ * @brief   Starts sending bytes through the DMA backend.
+ * @details The function waits for the transfer in progress but not for the
+ *          new one, @p buf must not be modified until the next write.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] buf     the bytes to be sent
+ * @param[in] n       number of bytes
+ */
+static void DLLSerialStart(DLLDriver *driver, const void *buf, size_t n){
+  driver->DLLStats.SentBytes += n;
+  DLLDmaStartSend(driver->config->DDriver, buf, n);
+}
+#endif
+
+#if DLL_FRAMING == DLL_FRAMING_FIXED && !DLL_USE_DMA_BACKEND
+/**
+ * @brief   Reads bytes from the serial line through the SerialDriver.
+ *
+ * @param[in]  driver   pointer to the DataLinkLayer driver object
+ * @param[out] buf      the received bytes
+ * @param[in]  n        number of bytes to read
+ * @param[in]  timeout  the number of ticks before the operation timeouts
+ * @return              the number of bytes read
+ */
+static size_t DLLSerialRead(DLLDriver *driver, void *buf, size_t n, systime_t timeout){
+  return sdReadTimeout(driver->config->SDriver, buf, n, timeout);
+}
+#endif
+
+/**
+ * @brief   Wakes up the thread waiting on the output ring, if any.
+ *
+ * @param[in] trp     reference of the waiting thread
+ */
+static void DLLRingWakeup(thread_reference_t *trp){
+  if(*(volatile thread_reference_t *)trp != NULL)
+    chThdResume(trp, MSG_OK);
+}
+
+/**
+ * @brief   Called for every received frame with valid CRC.
+ * @details The frame is in the @p DLLTempBuffer.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ */
+static void DLLFrameReceived(DLLDriver *driver){
+  driver->DLLStats.ReceivedFrames++;
+  if(driver->config->rxcb != NULL)
+    driver->config->rxcb((const FrameStruct *)driver->DLLTempBuffer);
+}
+
+#if DLL_FRAMING == DLL_FRAMING_FIXED
+/**
+ * @brief   Starts the synchronization with the ESP/RPi.
+ * @details The sync frame is queued for the 'SDSending' thread which sends
+ *          it between two user frames, then the receiver looks for the
+ *          echo of the peer in the incoming bytes. Neither of the threads
+ *          blocks in the meantime.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ */
+void DLLStartSync(DLLDriver *driver){
+  driver->DLLSyncState = DLL_SYNC_REQUESTED;
+  driver->DLLSyncFFs = 0;
+  driver->DLLSyncStart = chVTGetSystemTimeX();
+  driver->DLLStats.SyncCounter++;
+
+  driver->DLLSyncRequest = true;
+  DLLRingWakeup(&driver->DLLBuffers.DLLConsumer);
+}
+
+/**
+ * @brief   Feeds received bytes into the sync state machine.
+ * @details The sync is over when @p FRAME_SIZE_BYTE consecutive 0xFF bytes
+ *          are received, the bytes after them belong to the next frame and
+ *          are not consumed.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] p       the received bytes
+ * @param[in] n       number of bytes
+ * @return            the number of bytes consumed
+ */
+static size_t DLLSyncFeed(DLLDriver *driver, const uint8_t *p, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i++)
+  {
+    if(p[i] != 0xFF)
+    {
+      driver->DLLSyncFFs = 0;
+      continue;
+    }
+    if(++driver->DLLSyncFFs == FRAME_SIZE_BYTE)
+    {
+      driver->DLLSyncState = DLL_SYNC_IDLE;
+      return i + 1;
+    }
+  }
+  return n;
+}
+
+/**
+ * @brief   Repeats the sync frame if the echo of the peer did not arrive in
+ *          time.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ */
+static void DLLSyncPoll(DLLDriver *driver){
+  if(driver->DLLSyncState == DLL_SYNC_IDLE)
+    return;
+
+  if(chVTTimeElapsedSinceX(driver->DLLSyncStart) >= DLL_SYNC_TIMEOUT)
+  {
+    driver->DLLStats.SyncTimeout++;
+    driver->DLLSyncStart = chVTGetSystemTimeX();
+    driver->DLLSyncRequest = true;
+    DLLRingWakeup(&driver->DLLBuffers.DLLConsumer);
+  }
+}
+#endif
+
+
+#if DLL_FRAMING == DLL_FRAMING_COBS
+/*===========================================================================*/
+/* Frame encoding                                                            */
+/*===========================================================================*/
+
+#if DLL_USE_COMPACT_FRAMES
+/**
+ * @brief   Builds the compact form of a user data frame.
+ * @details Only the identifier bytes in use and the DLC data bytes are kept,
+ *          the remote frames have no data bytes.
+ *
+ * @param[in]  frame  the frame in the output ring
+ * @param[out] out    the compact frame without the CRC
+ * @return            the length of the compact frame, zero if the frame has
+ *                    no CAN descriptor
+ */
+static size_t DLLCompactEncode(const FrameStruct *frame, uint8_t *out){
+  const uint8_t *d = (const uint8_t *)frame->data;
+  uint8_t info = d[DLL_CANINFO_INDEX] & ~DLL_COMPACT_WIDE;
+  uint8_t dlc = info & DLL_CANINFO_DLC;
+  size_t n = 0;
+
+  if(frame->Id != 0x00 || !(info & DLL_CANINFO_VALID) || dlc > 8)
+    return 0;
+  if(info & DLL_CANINFO_RTR)
+    dlc = 0;
+
+  out[n++] = info | (d[10] != 0 ? DLL_COMPACT_WIDE : 0);
+  out[n++] = frame->FrameNumber;
+  out[n++] = d[8];
+  out[n++] = d[9];
+  if(d[10] != 0)
+    out[n++] = d[10];
+  memcpy(&out[n], d, dlc);
+  return n + dlc;
+}
+
+/**
+ * @brief   Restores a user data frame from its compact form.
+ *
+ * @param[in]  p      the received compact frame
+ * @param[in]  n      length of the compact frame with the CRC
+ * @param[out] frame  the restored frame with a new CRC
+ * @return            false if the CRC or the length is invalid
+ */
+static bool DLLCompactDecode(const uint8_t *p, size_t n, FrameStruct *frame){
+  uint8_t hdr = p[0];
+  uint8_t dlc = hdr & DLL_CANINFO_DLC;
+  size_t idlen = (hdr & DLL_COMPACT_WIDE) ? 3 : 2;
+
+  if(dlc > 8 || UpdateCRC(0, p, n) != 0)
+    return false;
+  if(hdr & DLL_CANINFO_RTR)
+    dlc = 0;
+  if(n != 2 + idlen + dlc + 1)
+    return false;
+
+  memset(frame, 0, sizeof(FrameStruct));
+  frame->FrameNumber = p[1];
+  memcpy(&frame->data[8], &p[2], idlen);
+  memcpy(frame->data, &p[2 + idlen], dlc);
+  frame->data[DLL_CANINFO_INDEX] = hdr & ~DLL_COMPACT_WIDE;
+  frame->CrcHex = CreateCRC(frame);
+  return true;
+}
+#endif
+
+/**
+ * @brief   COBS encodes a frame of the output ring as it goes on the line.
+ * @details In reliable mode the frame is preceded by its sequence number,
+ *          with compact frames enabled the user data frames are sent in
+ *          compact form.
+ *
+ * @param[in]  frame  the frame in the output ring
+ * @param[in]  seq    sequence number of the frame, reliable mode only
+ * @param[out] out    the encoded frame
+ * @return            the length of the encoded frame
+ */
+static size_t DLLEncodeFrame(const FrameStruct *frame, uint8_t seq, uint8_t *out){
+  uint8_t wire[DLL_WIRE_FRAME_SIZE];
+  size_t n = 0;
+
+#if DLL_USE_ARQ
+  wire[n++] = seq;
+#else
+  (void)seq;
+#endif
+#if DLL_USE_COMPACT_FRAMES
+  size_t l = DLLCompactEncode(frame, &wire[n]);
+  if(l > 0)
+  {
+    n += l;
+    wire[n] = UpdateCRC(0, wire, n);
+    return CobsEncode(wire, n + 1, out);
+  }
+#endif
+  memcpy(&wire[n], frame, FRAME_SIZE_BYTE);
+  return CobsEncode(wire, n + FRAME_SIZE_BYTE, out);
+}
+#endif
 
 /*===========================================================================*/
 /* Receiving and Sync functions                                              */
 /*===========================================================================*/
 
+#if DLL_USE_DMA_BACKEND
+/**
+ * @brief   Accounts the overruns of the DMA receive buffer.
+ * @details The bytes overwritten by the DMA were dropped by
+ *          @p DLLDmaRxAvailable(), the receiver has to look for the next
+ *          frame boundary.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in,out] seen  overruns already accounted
+ * @return            true if bytes were dropped since the last call
+ */
+static bool DLLDmaOverrun(DLLDriver *driver, long *seen){
+  long n = driver->config->DDriver->RxOverruns;
+
+  if(n == *seen)
+    return false;
+  driver->DLLStats.RxOverruns += n - *seen;
+  *seen = n;
+  return true;
+}
+#endif
+
+#if DLL_FRAMING == DLL_FRAMING_COBS
+#if DLL_USE_ARQ
+static void DLLArqAckReceived(DLLDriver *driver, uint8_t ack, uint16_t sack);
+#endif
+#if DLL_USE_CREDITS
+static void DLLCreditReceived(DLLDriver *driver, uint16_t limit);
+#endif
+
+/**
+ * @brief   Called for every received control frame.
+ * @details The unknown or damaged control frames are counted as frame errors.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] p       the control frame
+ * @param[in] n       length of the control frame
+ */
+static void DLLControlReceived(DLLDriver *driver, const uint8_t *p, size_t n){
+  if(n >= 2 && UpdateCRC(0, p, n) == 0)
+  {
+    switch(p[0])
+    {
+#if DLL_USE_ARQ
+    case DLL_CTRL_ACK:
+      if(n == DLL_CTRL_ACK_SIZE)
+      {
+        DLLArqAckReceived(driver, p[1], p[2] | (p[3] << 8));
+        return;
+      }
+      break;
+#endif
+#if DLL_USE_CREDITS
+    case DLL_CTRL_CREDIT:
+      if(n == DLL_CTRL_CREDIT_SIZE)
+      {
+        DLLCreditReceived(driver, p[1] | (p[2] << 8));
+        return;
+      }
+      break;
+#endif
+    default:
+      break;
+    }
+  }
+  driver->DLLStats.FrameErrors++;
+}
+
+/**
+ * @brief   Decodes received bytes in COBS framing mode.
+ * @details A frame is accepted if its length and CRC are valid, the shorter
+ *          frames are control frames or compact frames, anything else is
+ *          counted as a frame error and dropped. The decoder starts
+ *          over at the next 0x00 delimiter so no sync procedure is needed.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] p       the received bytes
+ * @param[in] n       number of bytes
+ */
+static void DLLCobsReceive(DLLDriver *driver, const uint8_t *p, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i++)
+  {
+    int ret = CobsDecodeByte(&driver->DLLRxDecoder, p[i]);
+    if(ret == COBS_MORE)
+      continue;
+#if DLL_USE_COMPACT_FRAMES
+    if(ret > 0 && (driver->DLLTempBuffer[0] & DLL_CANINFO_VALID))
+    {
+      FrameStruct frame;
+      if(DLLCompactDecode((uint8_t *)driver->DLLTempBuffer, ret, &frame))
+      {
+        memcpy(driver->DLLTempBuffer, &frame, FRAME_SIZE_BYTE);
+        DLLFrameReceived(driver);
+      }else
+        driver->DLLStats.FrameErrors++;
+      continue;
+    }
+#endif
+    if(ret == FRAME_SIZE_BYTE && CheckCRC((uint8_t *)driver->DLLTempBuffer) == 0)
+      DLLFrameReceived(driver);
+    else if(ret > 0 && ret < FRAME_SIZE_BYTE)
+      DLLControlReceived(driver, (uint8_t *)driver->DLLTempBuffer, ret);
+    else
+      driver->DLLStats.FrameErrors++;
+  }
+}
+
 /**
  * @brief   The Main receiving function.
- * @details The SDReceiving thread responsible for receiving frames
- *          continuously from the serial.
+ * @details The SDReceiving thread passes every received byte to the COBS
+ *          decoder. With the DMA backend the bytes are decoded directly
+ *          from the receive buffer.
  */
 static THD_FUNCTION(SDReceiving, arg) {
   chRegSetThreadName("Main Receiving Func");
   DLLDriver *driver = arg;
+#if DLL_USE_DMA_BACKEND
+  DLLDmaDriver *dmap = driver->config->DDriver;
+  long overruns = dmap->RxOverruns;
+  const uint8_t *p;
+#else
+  uint8_t chunk[FRAME_SIZE_BYTE];
+#endif
+
+  CobsDecoderInit(&driver->DLLRxDecoder, (uint8_t *)driver->DLLTempBuffer, FRAME_SIZE_BYTE);
   while(true)
   {
-    int i;
-    for(i = 0; i < FRAME_SIZE_BYTE; i++)
-      sdRead(driver->config->SDriver, &driver->DLLTempBuffer[i], 1);
-
-    if(CheckCRC(&driver->DLLTempBuffer) == 0)
+#if DLL_USE_DMA_BACKEND
+    size_t n = DLLDmaRxAvailable(dmap);
+    /* The frame being decoded lost its end, the decoder drops it at the
+       next delimiter.*/
+    if(DLLDmaOverrun(driver, &overruns))
+      CobsDecoderInit(&driver->DLLRxDecoder, (uint8_t *)driver->DLLTempBuffer, FRAME_SIZE_BYTE);
+    if(n == 0)
     {
-      driver->DLLStats.ReceivedFrames++;
-    }else
-    {
-      chMtxLock(&driver->DLLSerialSendMutex);
-      DLLSyncProcedure(driver);
-      chMtxUnlock(&driver->DLLSerialSendMutex);
+      (void)DLLDmaRxWait(dmap, TIME_INFINITE);
+      continue;
     }
+    size_t l = DLLDmaRxSpan(dmap, 0, &p);
+    if(l > n)
+      l = n;
+    DLLCobsReceive(driver, p, l);
+    DLLDmaRxConsume(dmap, l);
+#else
+    /* Blocks for the first byte then takes everything already queued.*/
+    chunk[0] = (uint8_t)sdGet(driver->config->SDriver);
+    size_t n = 1 + sdAsynchronousRead(driver->config->SDriver, &chunk[1], sizeof(chunk) - 1);
+    DLLCobsReceive(driver, chunk, n);
+#endif
   }
 }
-
+#elif DLL_USE_DMA_BACKEND
 /**
- * @brief   Send a single SYNC Frame via serial.
+ * @brief   Checks the CRC of a frame inside the DMA receive buffer.
  *
+ * @param[in] dmap    pointer to the DMA backend
+ * @param[in] offset  position of the frame from the read position
+ * @return            zero if the frame is valid
  */
-void DLLSendSyncFrame(DLLDriver *driver){
-  driver->DLLStats.SyncFrameSentCounter++;
-  sdWrite(driver->config->SDriver, driver->DLLSyncFrame, FRAME_SIZE_BYTE);
+static uint8_t DLLRingCRC(DLLDmaDriver *dmap, size_t offset){
+  const uint8_t *p;
+  uint8_t crc = 0;
+  size_t n = FRAME_SIZE_BYTE;
+
+  while(n > 0)
+  {
+    size_t l = DLLDmaRxSpan(dmap, offset, &p);
+    if(l > n)
+      l = n;
+    crc = UpdateCRC(crc, p, l);
+    offset += l;
+    n -= l;
+  }
+  return crc;
 }
 
 /**
- * @brief   Sync procedure.
- * @details This function implements the synchronization protocol
- *          between the STM and ESP/RPi
+ * @brief   Looks for the frame boundary inside the received bytes.
+ * @details A position is accepted if two consecutive frames are valid from
+ *          there, so a byte lost or duplicated on the line costs only the
+ *          damaged frame instead of a whole sync procedure.
  *
- * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] dmap    pointer to the DMA backend
+ * @param[in] avail   number of received bytes
+ * @return            the number of bytes to skip, zero if not found
  */
-void DLLSyncProcedure(DLLDriver *driver)
-{
-  int FFs = 0;
-  char c;
-  DLLSendSyncFrame(driver);
-  driver->DLLStats.SyncCounter++;
+static size_t DLLRealign(DLLDmaDriver *dmap, size_t avail){
+  size_t skip;
 
-  while(FFs != FRAME_SIZE_BYTE)
+  for(skip = 1; skip < FRAME_SIZE_BYTE; skip++)
   {
-    driver->DLLStats.SyncTimeout++;
-    sdReadTimeout(driver->config->SDriver, &c, 1, US2ST(1000));
-    if(c == 0xFF)
+    if(skip + 2 * FRAME_SIZE_BYTE > avail)
+      break;
+    if(DLLRingCRC(dmap, skip) == 0 && DLLRingCRC(dmap, skip + FRAME_SIZE_BYTE) == 0)
+      return skip;
+  }
+  return 0;
+}
+
+/**
+ * @brief   The Main receiving function.
+ * @details The SDReceiving thread wakes up when the DMA filled half of the
+ *          receive buffer or the line went idle, then checks every complete
+ *          frame directly inside the buffer. Only the valid frames are
+ *          copied into the @p DLLTempBuffer.
+ */
+static THD_FUNCTION(SDReceiving, arg) {
+  chRegSetThreadName("Main Receiving Func");
+  DLLDriver *driver = arg;
+  DLLDmaDriver *dmap = driver->config->DDriver;
+  long overruns = dmap->RxOverruns;
+  while(true)
+  {
+    uint8_t events = DLLDmaRxWait(dmap, driver->DLLSyncState == DLL_SYNC_IDLE ?
+                                        TIME_INFINITE : DLL_SYNC_POLL);
+    size_t avail = DLLDmaRxAvailable(dmap);
+
+    /* The stream goes on at an unknown position, the frame boundary is
+       found again by the realignment below.*/
+    (void)DLLDmaOverrun(driver, &overruns);
+
+    while(avail > 0)
     {
-      FFs++;
-      c = 0x00;
-    }
-    if(driver->DLLStats.SyncTimeout >= SYNC_TIMEOUT_THRS){
-      DLLSendSyncFrame(driver);
-      driver->DLLStats.SyncTimeout = 0;
+      if(driver->DLLSyncState != DLL_SYNC_IDLE)
+      {
+        const uint8_t *p;
+        size_t l = DLLDmaRxSpan(dmap, 0, &p);
+        if(l > avail)
+          l = avail;
+        l = DLLSyncFeed(driver, p, l);
+        DLLDmaRxConsume(dmap, l);
+        avail -= l;
+        continue;
+      }
+
+      if(avail < FRAME_SIZE_BYTE)
+        break;
+
+      if(DLLRingCRC(dmap, 0) == 0)
+      {
+        DLLDmaRxCopy(dmap, driver->DLLTempBuffer, FRAME_SIZE_BYTE);
+        avail -= FRAME_SIZE_BYTE;
+        DLLFrameReceived(driver);
+        continue;
+      }
+
+      size_t skip = DLLRealign(dmap, avail);
+      if(skip > 0)
+      {
+        DLLDmaRxConsume(dmap, skip);
+        avail -= skip;
+        driver->DLLStats.RealignCounter++;
+        continue;
+      }
+
+      /* No boundary found although every possible position could be tested,
+         or nothing more is coming: the ESP has to be synchronized.*/
+      if(avail >= 3 * FRAME_SIZE_BYTE - 1 || (events & DLL_DMA_RX_IDLE))
+      {
+        DLLStartSync(driver);
+        continue;
+      }
+      break;
     }
+    DLLSyncPoll(driver);
   }
-  driver->DLLStats.SyncTimeout = 0;
-  return;
 }
+#else
+/**
+ * @brief   The Main receiving function.
+ * @details The SDReceiving thread responsible for receiving frames
+ *          continuously from the serial. While a sync is in progress the
+ *          bytes are read one by one and passed to the sync state machine.
+ */
+static THD_FUNCTION(SDReceiving, arg) {
+  chRegSetThreadName("Main Receiving Func");
+  DLLDriver *driver = arg;
+  while(true)
+  {
+    if(driver->DLLSyncState == DLL_SYNC_IDLE)
+    {
+      DLLSerialRead(driver, driver->DLLTempBuffer, FRAME_SIZE_BYTE, TIME_INFINITE);
 
+      if(CheckCRC((uint8_t *)driver->DLLTempBuffer) == 0)
+        DLLFrameReceived(driver);
+      else
+        DLLStartSync(driver);
+    }else
+    {
+      uint8_t c;
+      if(DLLSerialRead(driver, &c, 1, DLL_SYNC_POLL) == 1)
+        (void)DLLSyncFeed(driver, &c, 1);
+      DLLSyncPoll(driver);
+    }
+  }
+}
+#endif
 
 /**
  * @brief   Create a single SYNC Frame into the SyncFrame array.
@@ -108,80 +600,877 @@ void DLLCreateSyncFrame(DLLDriver *dllp){
 /* Sending functions                                                         */
 /*===========================================================================*/
 
+/*===========================================================================*/
+/* Flow control                                                              */
+/*===========================================================================*/
+
+#if DLL_USE_CREDITS
+/**
+ * @brief   Stores the limit granted by the peer and wakes up the
+ *          'SDSending' thread.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] limit   the new limit
+ */
+static void DLLCreditReceived(DLLDriver *driver, uint16_t limit){
+  driver->DLLCreditLimit = limit;
+  DLLRingWakeup(&driver->DLLBuffers.DLLConsumer);
+}
+#endif
+
+/**
+ * @brief   Number of frames the peer can take now.
+ * @details Also measures the time spent without credit while frames are
+ *          waiting. Can be called from a locked state.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] wanted  number of frames waiting to be sent
+ * @return            the number of frames which may be sent
+ */
+static uint8_t DLLCreditAvailable(DLLDriver *dllp, uint8_t wanted){
+#if DLL_USE_CREDITS
+  int16_t credit = (int16_t)(dllp->DLLCreditLimit - dllp->DLLCreditSent);
+
+  if(credit < 0)
+    credit = 0;
+
+  if(wanted > 0 && credit == 0)
+  {
+    if(!dllp->DLLCreditStarved)
+    {
+      dllp->DLLCreditStarved = true;
+      dllp->DLLCreditStarvedSince = chVTGetSystemTimeX();
+      dllp->DLLStats.CreditStalls++;
+    }
+  }else if(dllp->DLLCreditStarved && credit > 0)
+  {
+    dllp->DLLCreditStarved = false;
+    dllp->DLLStats.CreditStarvedMs += ST2MS(chVTTimeElapsedSinceX(dllp->DLLCreditStarvedSince));
+  }
+  return wanted < credit ? wanted : credit;
+#else
+  (void)dllp;
+  return wanted;
+#endif
+}
+
+/**
+ * @brief   Takes the credit of the sent frames.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] n       number of frames sent
+ */
+static void DLLCreditConsume(DLLDriver *dllp, uint8_t n){
+#if DLL_USE_CREDITS
+  dllp->DLLCreditSent += n;
+#else
+  (void)dllp;
+  (void)n;
+#endif
+}
+
+#if !DLL_USE_ARQ
+#if DLL_USE_PRIORITY_LANE
+/**
+ * @brief   Number of frames waiting in the priority lane.
+ */
+#define DLLLanePending(bp) ((uint8_t)((bp)->DLLPriorityHead - (bp)->DLLPriorityTail))
+#else
+#define DLLLanePending(bp) 0
+#endif
+
+/**
+ * @brief   Number of frames waiting in the output ring and in the priority
+ *          lane.
+ */
+#define DLLRingWanted(bp) \
+  ((uint8_t)((bp)->DLLOutputHead - (bp)->DLLOutputTail) + DLLLanePending(bp))
+
+/**
+ * @brief   Waits until the output ring or the priority lane contains frames
+ *          which may be sent or a sync frame has to be sent.
+ * @details Only the 'SDSending' thread may call this function.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] busy    number of frames at the tail of the output ring which
+ *                    are on the line already, the function does not wait
+ *                    if there are any
+ * @return            the number of frames which may be sent
+ */
+static uint8_t DLLRingWaitFrames(DLLDriver *dllp, uint8_t busy){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t n = DLLCreditAvailable(dllp, DLLRingWanted(bp) - busy);
+
+  if(n == 0 && busy == 0 && !dllp->DLLSyncRequest)
+  {
+    chSysLock();
+    while((n = DLLCreditAvailable(dllp, DLLRingWanted(bp))) == 0 &&
+          !dllp->DLLSyncRequest)
+      (void)chThdSuspendS(&bp->DLLConsumer);
+    chSysUnlock();
+  }
+  return n;
+}
+
+/**
+ * @brief   Sends the sync frame if the receiver asked for it.
+ * @details The sync frame goes out between two transfers of user frames,
+ *          the user frames stay in the ring meanwhile.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static void DLLSendSyncFrame(DLLDriver *dllp){
+#if DLL_FRAMING == DLL_FRAMING_FIXED
+  if(dllp->DLLSyncRequest)
+  {
+    dllp->DLLSyncRequest = false;
+    dllp->DLLStats.SyncFrameSentCounter++;
+    DLLSerialWrite(dllp, dllp->DLLSyncFrame, FRAME_SIZE_BYTE);
+  }
+#else
+  (void)dllp;
+#endif
+}
+#endif
+
+/**
+ * @brief   Appends a slot to the free list.
+ * @note    Called with the system locked.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] slot    the slot
+ */
+static void DLLSlotFreeS(DLLDriver *dllp, uint8_t slot){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+
+  bp->DLLSlotLinks[slot] = DLL_SLOT_NONE;
+  if(bp->DLLSlotLast == DLL_SLOT_NONE)
+    bp->DLLSlotFirst = slot;
+  else
+    bp->DLLSlotLinks[bp->DLLSlotLast] = slot;
+  bp->DLLSlotLast = slot;
+  chSemSignalI(&bp->DLLSlotsFree);
+}
+
+/**
+ * @brief   Gives back the oldest frames of the output ring to the producer.
+ * @details Their slots return to the free list.
+ * @note    Only the consumer of the output ring calls it, normally the
+ *          sending thread once the frames are on the line.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] n       number of frames
+ */
+void DLLRingRelease(DLLDriver *dllp, uint8_t n){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t tail = bp->DLLOutputTail, i;
+
+  chSysLock();
+  for(i = 0; i < n; i++)
+    DLLSlotFreeS(dllp, bp->DLLOutputQueue[(uint8_t)(tail + i) & (OUTPUT_FRAME_BUFFER - 1)]);
+  chSchRescheduleS();
+  chSysUnlock();
+
+  __DMB();
+  bp->DLLOutputTail = tail + n;
+  DLLRingWakeup(&bp->DLLProducer);
+}
+
+/**
+ * @brief   Updates the output ring statistics.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] used    number of frames waiting in the ring
+ */
+static void DLLRingStats(DLLDriver *dllp, uint8_t used){
+  dllp->DLLStats.QueuedFrames = used;
+  if(used > dllp->DLLStats.PeakQueuedFrames)
+    dllp->DLLStats.PeakQueuedFrames = used;
+}
+
+#if DLL_USE_PRIORITY_LANE
+/**
+ * @brief   Tells whether the next frame comes from the priority lane.
+ * @details The lane goes first, but after @p DLLPriorityWeight frames in a
+ *          row one transfer of the waiting output ring goes in between.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static bool DLLLaneTurn(DLLDriver *dllp){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+
+  if(DLLLanePending(bp) == 0)
+  {
+    dllp->DLLPriorityRun = 0;
+    return false;
+  }
+  if(dllp->DLLPriorityWeight != 0 && dllp->DLLPriorityRun >= dllp->DLLPriorityWeight &&
+     bp->DLLOutputHead != bp->DLLOutputTail)
+  {
+    dllp->DLLPriorityRun = 0;
+    return false;
+  }
+  dllp->DLLPriorityRun++;
+  return true;
+}
+
+/**
+ * @brief   Sends the oldest frame of the priority lane and frees its slot.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static void DLLLaneSend(DLLDriver *dllp){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t tail = bp->DLLPriorityTail;
+  uint8_t slot = bp->DLLPriorityQueue[tail & (DLL_PRIORITY_QUEUE - 1)];
+
+  DLLSendSingleFrameSerial(dllp, DLLSlotFrame(dllp, slot));
+  dllp->DLLStats.SentFrames++;
+  dllp->DLLStats.PriorityFrames++;
+#if DLL_USE_DMA_BACKEND
+  dllp->DLLStats.DmaTransfers++;
+#endif
+  DLLCreditConsume(dllp, 1);
+
+  DLLSlotFree(dllp, slot);
+  __DMB();
+  bp->DLLPriorityTail = tail + 1;
+}
+#endif
+
+#if DLL_USE_ARQ
+/*===========================================================================*/
+/* Reliable mode                                                             */
+/*===========================================================================*/
+
+/**
+ * @brief   Slot bitmap accessors of the reliable mode.
+ */
+#define DLL_ARQ_WORD(seq) (((seq) & (OUTPUT_FRAME_BUFFER - 1)) >> 5)
+#define DLL_ARQ_BIT(seq)  (1UL << ((seq) & 31))
+
+static bool DLLArqTest(const uint32_t *map, uint8_t seq){
+  return (map[DLL_ARQ_WORD(seq)] & DLL_ARQ_BIT(seq)) != 0;
+}
+
+static void DLLArqSet(uint32_t *map, uint8_t seq){
+  map[DLL_ARQ_WORD(seq)] |= DLL_ARQ_BIT(seq);
+}
+
+static void DLLArqClear(uint32_t *map, uint8_t seq){
+  map[DLL_ARQ_WORD(seq)] &= ~DLL_ARQ_BIT(seq);
+}
+
+/**
+ * @brief   Passes an acknowledgement of the peer to the 'SDSending' thread.
+ * @details Only the latest acknowledgement is kept, it covers the earlier
+ *          ones.
+ *
+ * @param[in] driver  pointer to the DataLinkLayer driver object
+ * @param[in] ack     the next sequence number expected by the peer
+ * @param[in] sack    the frames received after the missing one
+ */
+static void DLLArqAckReceived(DLLDriver *driver, uint8_t ack, uint16_t sack){
+  chSysLock();
+  driver->DLLArqRxAck = ack;
+  driver->DLLArqRxSack = sack;
+  driver->DLLArqAckPending = true;
+  chSysUnlock();
+  DLLRingWakeup(&driver->DLLBuffers.DLLConsumer);
+}
+
+/**
+ * @brief   Marks a frame for retransmission unless the peer already has it.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] seq     sequence number of the frame
+ */
+static void DLLArqMarkResend(DLLDriver *dllp, uint8_t seq){
+  if(!DLLArqTest(dllp->DLLArqAcked, seq) && !DLLArqTest(dllp->DLLArqResend, seq))
+  {
+    DLLArqSet(dllp->DLLArqResend, seq);
+    dllp->DLLArqResendCount++;
+  }
+}
+
+/**
+ * @brief   Marks a frame as received by the peer.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] seq     sequence number of the frame
+ */
+static void DLLArqMarkAcked(DLLDriver *dllp, uint8_t seq){
+  DLLArqSet(dllp->DLLArqAcked, seq);
+  if(DLLArqTest(dllp->DLLArqResend, seq))
+  {
+    DLLArqClear(dllp->DLLArqResend, seq);
+    dllp->DLLArqResendCount--;
+  }
+}
+
+/**
+ * @brief   Processes the latest acknowledgement of the peer.
+ * @details The slots up to the cumulative acknowledgement are given back to
+ *          the producer. If the peer reports frames received after a missing
+ *          one, the missing frame is retransmitted at once, but only once
+ *          until the acknowledgement moves on.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static void DLLArqProcessAck(DLLDriver *dllp){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t inflight = dllp->DLLArqSend - bp->DLLOutputTail;
+  uint8_t ack, n, i;
+  uint16_t sack;
+
+  chSysLock();
+  ack = dllp->DLLArqRxAck;
+  sack = dllp->DLLArqRxSack;
+  dllp->DLLArqAckPending = false;
+  chSysUnlock();
+
+  /* An acknowledgement outside of the frames in flight is a late one.*/
+  n = ack - bp->DLLOutputTail;
+  if(n > inflight)
+    return;
+
+  if(n > 0)
+  {
+    for(i = 0; i < n; i++)
+    {
+      DLLArqMarkAcked(dllp, bp->DLLOutputTail + i);
+      DLLArqClear(dllp->DLLArqAcked, bp->DLLOutputTail + i);
+    }
+    inflight -= n;
+    dllp->DLLArqTimer = chVTGetSystemTimeX();
+    dllp->DLLArqHoleSent = false;
+    DLLRingRelease(dllp, n);
+  }
+
+  if(sack == 0 || inflight == 0)
+    return;
+
+  for(i = 0; i < 16 && i + 1 < inflight; i++)
+    if(sack & (1U << i))
+      DLLArqMarkAcked(dllp, ack + 1 + i);
+
+  if(!dllp->DLLArqHoleSent || dllp->DLLArqHole != ack)
+  {
+    DLLArqMarkResend(dllp, ack);
+    dllp->DLLArqHole = ack;
+    dllp->DLLArqHoleSent = true;
+  }
+}
+
+/**
+ * @brief   Retransmits every unacknowledged frame if the oldest one timed
+ *          out.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static void DLLArqCheckTimeout(DLLDriver *dllp){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t seq;
+
+  if(dllp->DLLArqSend == bp->DLLOutputTail ||
+     chVTTimeElapsedSinceX(dllp->DLLArqTimer) < DLL_ARQ_TIMEOUT)
+    return;
+
+  for(seq = bp->DLLOutputTail; seq != dllp->DLLArqSend; seq++)
+    DLLArqMarkResend(dllp, seq);
+  dllp->DLLArqTimer = chVTGetSystemTimeX();
+  dllp->DLLStats.ArqTimeouts++;
+}
+
+/**
+ * @brief   Number of frames waiting for the first transmission or for a
+ *          retransmission, at most one batch.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static uint8_t DLLArqPending(DLLDriver *dllp){
+  unsigned n = dllp->DLLArqResendCount +
+               (uint8_t)(dllp->DLLBuffers.DLLOutputHead - dllp->DLLArqSend);
+  return n < DLL_COBS_TX_BATCH ? n : DLL_COBS_TX_BATCH;
+}
+
+/**
+ * @brief   Waits until there is a frame to send and credit for it, an
+ *          acknowledgement to process or the retransmission timeout expires.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+static void DLLArqWait(DLLDriver *dllp){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+
+  chSysLock();
+  while(!dllp->DLLArqAckPending && DLLCreditAvailable(dllp, DLLArqPending(dllp)) == 0)
+  {
+    systime_t timeout = TIME_INFINITE;
+    if(dllp->DLLArqSend != bp->DLLOutputTail)
+    {
+      systime_t elapsed = chVTTimeElapsedSinceX(dllp->DLLArqTimer);
+      if(elapsed >= DLL_ARQ_TIMEOUT)
+        break;
+      timeout = DLL_ARQ_TIMEOUT - elapsed;
+    }
+    if(chThdSuspendTimeoutS(&bp->DLLConsumer, timeout) == MSG_TIMEOUT)
+      break;
+  }
+  chSysUnlock();
+}
+
+/**
+ * @brief   COBS encodes a frame of the output ring with its sequence number.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] seq     sequence number of the frame
+ * @param[out] out    the encoded frame
+ * @return            the length of the encoded frame
+ */
+static size_t DLLArqEncode(DLLDriver *dllp, uint8_t seq, uint8_t *out){
+  return DLLEncodeFrame(DLLSlotFrame(dllp, dllp->DLLBuffers.DLLOutputQueue[seq & (OUTPUT_FRAME_BUFFER - 1)]),
+                        seq, out);
+}
+#endif
+
 /**
  * @brief   Continuous serial sending thread.
  * @details The SDSending thread responsible for the continuous frame sending
- *          via serial. It receives the frames from the application through a
- *          mailbox.
+ *          via serial. It receives the frames from the application through
+ *          the output ring.
+ *          With the DMA backend the frames waiting in the ring which are in
+ *          consecutive slots are sent in a single transfer directly from
+ *          where they are, or from the transmit buffer after the COBS
+ *          encoding. The slots are given back when the transfer is over.
+ *          In reliable mode the retransmissions go first, then the new
+ *          frames, and the slots are given back only when the peer
+ *          acknowledges them.
  */
+#if DLL_USE_ARQ
+static THD_FUNCTION(SDSending, arg) {
+  chRegSetThreadName("Sending Thread");
+  DLLDriver *dllp = arg;
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  while(true)
+  {
+      uint8_t seq, max, n = 0, resent;
+      size_t len = 0;
+
+      DLLArqWait(dllp);
+      if(dllp->DLLArqAckPending)
+        DLLArqProcessAck(dllp);
+      DLLArqCheckTimeout(dllp);
+      DLLRingStats(dllp, bp->DLLOutputHead - bp->DLLOutputTail);
+      max = DLLCreditAvailable(dllp, DLLArqPending(dllp));
+
+      for(seq = bp->DLLOutputTail; dllp->DLLArqResendCount > 0 &&
+          seq != dllp->DLLArqSend && n < max; seq++)
+      {
+        if(!DLLArqTest(dllp->DLLArqResend, seq))
+          continue;
+        DLLArqClear(dllp->DLLArqResend, seq);
+        dllp->DLLArqResendCount--;
+        len += DLLArqEncode(dllp, seq, &dllp->DLLTxBuffer[len]);
+        n++;
+      }
+      resent = n;
+
+      /* The timeout runs from the oldest frame in flight.*/
+      if(dllp->DLLArqSend == bp->DLLOutputTail)
+        dllp->DLLArqTimer = chVTGetSystemTimeX();
+      while(dllp->DLLArqSend != bp->DLLOutputHead && n < max)
+      {
+        len += DLLArqEncode(dllp, dllp->DLLArqSend++, &dllp->DLLTxBuffer[len]);
+        n++;
+      }
+      if(n == 0)
+        continue;
+
+      DLLSerialWrite(dllp, dllp->DLLTxBuffer, len);
+      palTogglePad(GPIOB, GPIOB_LED1);
+      dllp->DLLStats.SentFrames += n - resent;
+      dllp->DLLStats.Retransmissions += resent;
+      DLLCreditConsume(dllp, n);
+#if DLL_USE_DMA_BACKEND
+      dllp->DLLStats.DmaTransfers++;
+#endif
+  }
+}
+#elif DLL_USE_DMA_BACKEND
+static THD_FUNCTION(SDSending, arg) {
+  chRegSetThreadName("Sending Thread");
+  DLLDriver *dllp = arg;
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  /* The frames of the transfer on the line stay in the ring until the next
+     transfer has started, the next batch is prepared meanwhile.*/
+  uint8_t busy = 0;
+#if DLL_FRAMING == DLL_FRAMING_COBS
+  uint8_t half = 0;
+#endif
+  while(true)
+  {
+      uint8_t n = DLLRingWaitFrames(dllp, busy);
+      uint8_t first = (bp->DLLOutputTail + busy) & (OUTPUT_FRAME_BUFFER - 1);
+      const void *buf;
+      size_t len;
+      DLLRingStats(dllp, bp->DLLOutputHead - bp->DLLOutputTail);
+      DLLSendSyncFrame(dllp);
+      if(n == 0)
+      {
+        /* Nothing to prepare, the transfer on the line ends before the
+           thread goes to sleep.*/
+        if(busy != 0)
+        {
+          DLLDmaWaitSend(dllp->config->DDriver);
+          DLLRingRelease(dllp, busy);
+          busy = 0;
+        }
+        continue;
+      }
+
+#if DLL_USE_PRIORITY_LANE
+      /* While priority frames are expected the transfers of the output ring
+         are kept short so a priority frame does not wait long behind them.*/
+      if(DLLLaneTurn(dllp))
+      {
+        DLLLaneSend(dllp);
+        continue;
+      }
+      if(n > (uint8_t)(bp->DLLOutputHead - bp->DLLOutputTail - busy))
+        n = bp->DLLOutputHead - bp->DLLOutputTail - busy;
+      if(dllp->DLLPriorityBatch != 0 && n > dllp->DLLPriorityBatch)
+        n = dllp->DLLPriorityBatch;
+      /* The lane gave its turn but only the frames on the line are in the
+         ring, the lane goes next.*/
+      if(n == 0)
+        continue;
+#endif
+
+#if DLL_FRAMING == DLL_FRAMING_COBS
+      /* The frames are encoded one after the other into one half of the
+         transmit buffer, the other half is on the line.*/
+      uint8_t *tx = &dllp->DLLTxBuffer[half * (sizeof(dllp->DLLTxBuffer) / 2)];
+      uint8_t i;
+      if(n > DLL_COBS_TX_BATCH / 2)
+        n = DLL_COBS_TX_BATCH / 2;
+      for(i = 0, len = 0; i < n; i++)
+        len += DLLEncodeFrame(DLLSlotFrame(dllp, bp->DLLOutputQueue[(first + i) & (OUTPUT_FRAME_BUFFER - 1)]),
+                              0, &tx[len]);
+      buf = tx;
+      half ^= 1;
+#else
+      /* The frames in consecutive slots are contiguous, the rest goes in the
+         next transfer.*/
+      uint8_t start = bp->DLLOutputQueue[first];
+      for(len = 1; len < n; len++)
+        if(bp->DLLOutputQueue[(first + len) & (OUTPUT_FRAME_BUFFER - 1)] != start + len)
+          break;
+      n = len;
+      buf = DLLSlotFrame(dllp, start);
+      len = n * FRAME_SIZE_BYTE;
+#endif
+
+      /* The new transfer starts as soon as the previous one ends, then the
+         slots of the previous one are freed.*/
+      DLLSerialStart(dllp, buf, len);
+      palTogglePad(GPIOB, GPIOB_LED1);
+      dllp->DLLStats.SentFrames += n;
+      dllp->DLLStats.DmaTransfers++;
+      DLLCreditConsume(dllp, n);
+
+      if(busy != 0)
+        DLLRingRelease(dllp, busy);
+      busy = n;
+  }
+}
+#else
 static THD_FUNCTION(SDSending, arg) {
   chRegSetThreadName("Sending Thread");
   DLLDriver *dllp = arg;
-  void *pbuf;
+  DLLBufferPark *bp = &dllp->DLLBuffers;
   FrameStruct *Temp;
   while(true)
   {
-      dllp->DLLStats.FreeFilledBuffer = chMBGetFreeCountI(&dllp->DLLBuffers.DLLFilledOutputBuffer);
-      dllp->DLLStats.FreeFreeBuffer = chMBGetFreeCountI(&dllp->DLLBuffers.DLLFreeOutputBuffer);
-      msg_t msg = chMBFetch(&dllp->DLLBuffers.DLLFilledOutputBuffer, (msg_t *)&pbuf, TIME_INFINITE);
+      uint8_t n = DLLRingWaitFrames(dllp, 0);
+      DLLRingStats(dllp, bp->DLLOutputHead - bp->DLLOutputTail);
+      DLLSendSyncFrame(dllp);
+      if(n == 0)
+        continue;
 
-      if(msg == MSG_OK)
+#if DLL_USE_PRIORITY_LANE
+      if(DLLLaneTurn(dllp))
       {
-        Temp = pbuf;
-        if(DLLSendSingleFrameSerial(dllp, Temp))
-          dllp->DLLStats.SentFrames++;
-        else
-          dllp->DLLStats.LostFrames++;
-        (void)chMBPost(&dllp->DLLBuffers.DLLFreeOutputBuffer, (msg_t)pbuf, TIME_INFINITE);
+        DLLLaneSend(dllp);
+        continue;
       }
+#endif
+
+      Temp = DLLSlotFrame(dllp, bp->DLLOutputQueue[bp->DLLOutputTail & (OUTPUT_FRAME_BUFFER - 1)]);
+      DLLSendSingleFrameSerial(dllp, Temp);
+      dllp->DLLStats.SentFrames++;
+      DLLCreditConsume(dllp, 1);
+
+      DLLRingRelease(dllp, 1);
   }
 }
+#endif
 
 /**
  * @brief   Send a 'FrameStruct' type pointer via serial
- * @details If a sync happens the serial sending blocked by a mutex variable
- *          and the frame which need to be sent will lost.
+ * @note    Only the 'SDSending' thread writes the serial line, the sync
+ *          frames are sent by the same thread so a frame is never lost
+ *          because of a sync.
  *
  * @param[in] driver    DataLinkLayer driver structure
  * @param[in] frame     The frame which need to be sent
  *
  */
-bool DLLSendSingleFrameSerial(DLLDriver *driver, FrameStruct *Frame){
-  bool IsLocked = chMtxTryLock(&driver->DLLSerialSendMutex);
-  if(IsLocked){
-    sdWrite(driver->config->SDriver, Frame, FRAME_SIZE_BYTE);
-    palTogglePad(GPIOB, GPIOB_LED1);
-    chMtxUnlock(&driver->DLLSerialSendMutex);
+void DLLSendSingleFrameSerial(DLLDriver *driver, FrameStruct *Frame){
+#if DLL_FRAMING == DLL_FRAMING_COBS
+  uint8_t enc[COBS_ENCODED_SIZE(DLL_WIRE_FRAME_SIZE)];
+  DLLSerialWrite(driver, enc, DLLEncodeFrame(Frame, 0, enc));
+#else
+  DLLSerialWrite(driver, Frame, FRAME_SIZE_BYTE);
+#endif
+  palTogglePad(GPIOB, GPIOB_LED1);
+}
+
+/**
+ * @brief   Takes a frame slot from the free list.
+ * @details The frame slots are shared by the NetworkLayer, which collects
+ *          the frames of the packets in them, and the output ring.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] timeout how long to wait for a free slot
+ * @return            the slot, @p DLL_SLOT_NONE if there was none in time
+ */
+uint8_t DLLSlotAlloc(DLLDriver *dllp, systime_t timeout){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t slot;
+  cnt_t left;
+
+  if(chSemWaitTimeout(&bp->DLLSlotsFree, timeout) != MSG_OK)
+    return DLL_SLOT_NONE;
+
+  chSysLock();
+  slot = bp->DLLSlotFirst;
+  bp->DLLSlotFirst = bp->DLLSlotLinks[slot];
+  if(bp->DLLSlotFirst == DLL_SLOT_NONE)
+    bp->DLLSlotLast = DLL_SLOT_NONE;
+  left = chSemGetCounterI(&bp->DLLSlotsFree);
+  chSysUnlock();
+
+  bp->DLLSlotLinks[slot] = DLL_SLOT_NONE;
+  if(left < dllp->DLLStats.MinFreeSlots)
+    dllp->DLLStats.MinFreeSlots = left;
+  return slot;
+}
+
+/**
+ * @brief   Number of free frame slots.
+ * @details The value may only grow until the caller takes a slot, the
+ *          sending thread frees the slots of the sent frames meanwhile.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ */
+int DLLSlotsAvailable(DLLDriver *dllp){
+  cnt_t n;
+
+  chSysLock();
+  n = chSemGetCounterI(&dllp->DLLBuffers.DLLSlotsFree);
+  chSysUnlock();
+  return n > 0 ? n : 0;
+}
+
+/**
+ * @brief   Gives back a frame slot which was not put into the output ring.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] slot    the slot
+ */
+void DLLSlotFree(DLLDriver *dllp, uint8_t slot){
+  chSysLock();
+  DLLSlotFreeS(dllp, slot);
+  chSchRescheduleS();
+  chSysUnlock();
+}
+
+/**
+ * @brief   Waits until @p n entries of the output ring are free.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] n       number of frames
+ */
+static void DLLRingReserve(DLLDriver *dllp, uint8_t n){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+
+  if((uint8_t)(bp->DLLOutputHead - bp->DLLOutputTail) > OUTPUT_FRAME_BUFFER - n)
+  {
+    chSysLock();
+    while((uint8_t)(bp->DLLOutputHead - bp->DLLOutputTail) > OUTPUT_FRAME_BUFFER - n)
+      (void)chThdSuspendS(&bp->DLLProducer);
+    chSysUnlock();
   }
-  return IsLocked;
 }
 
 /**
- * @brief   Put one 'FrameStruct' type pointer into the mailbox
- * @details This function is one of the APIs between the NetworkLayer and
- *          the DataLinkLayer. When a packet need to be sent the NWL will
- *          call this function individually.
+ * @brief   Links a frame slot into a reserved entry of the output ring and
+ *          computes the CRC of the frame in place.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] pos     position in the ring
+ * @param[in] slot    the slot
+ */
+static void DLLRingFill(DLLDriver *dllp, uint8_t pos, uint8_t slot){
+  FrameStruct *Frame = DLLSlotFrame(dllp, slot);
+
+  dllp->DLLBuffers.DLLOutputQueue[pos & (OUTPUT_FRAME_BUFFER - 1)] = slot;
+#if DLL_USE_ARQ
+  /* The ring position is the sequence number, it is covered by the CRC.*/
+  Frame->CrcHex = UpdateCRC(UpdateCRC(0, &pos, 1), (uint8_t *)Frame, FRAME_SIZE_BYTE - 1);
+#else
+  Frame->CrcHex = CreateCRC(Frame);
+#endif
+}
+
+/**
+ * @brief   Publishes the filled entries to the 'SDSending' thread.
+ *
+ * @param[in] dllp    DataLinkLayer driver structure
+ * @param[in] head    the new head of the ring
+ */
+static void DLLRingCommit(DLLDriver *dllp, uint8_t head){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+
+  __DMB();
+  bp->DLLOutputHead = head;
+  DLLRingWakeup(&bp->DLLConsumer);
+}
+
+/**
+ * @brief   Put one 'FrameStruct' into the output ring
+ * @details The frame is copied into a free slot, the caller may reuse it at
+ *          once.
+ *          The ring is lock free, the caller is blocked only if the ring is
+ *          full or there is no free slot.
+ * @note    The ring has a single producer, only one thread may call this
+ *          function and DLLPutChainInQueue().
  *
  * @param[in] driver    DataLinkLayer driver structure
- * @param[in] frame     The frame which need to be put into the mailbox
+ * @param[in] frame     The frame which need to be put into the ring
  *
  */
 msg_t DLLPutFrameInQueue(DLLDriver *dllp, FrameStruct *Frame){
-  void *pbuf;
-  msg_t ReturnValue = chMBFetch(&dllp->DLLBuffers.DLLFreeOutputBuffer, (msg_t *)&pbuf, TIME_INFINITE);
-  if (ReturnValue == MSG_OK) {
-    FrameStruct *Temp = pbuf;
-    int i;
-    for(i = 0; i < FRAME_SIZE_BYTE; i++)
-      ((char *)Temp)[i] = ((char *)Frame)[i];
+  uint8_t slot = DLLSlotAlloc(dllp, TIME_INFINITE);
+  uint8_t head;
 
-    Temp->CrcHex = CreateCRC(Temp);
+  memcpy(DLLSlotFrame(dllp, slot), Frame, FRAME_SIZE_BYTE);
+  DLLRingReserve(dllp, 1);
+  head = dllp->DLLBuffers.DLLOutputHead;
+  DLLRingFill(dllp, head, slot);
+  DLLRingCommit(dllp, head + 1);
 
-    (void)chMBPost(&dllp->DLLBuffers.DLLFilledOutputBuffer, (msg_t)pbuf, TIME_INFINITE);
-  }
-  return ReturnValue;
+  return MSG_OK;
+}
+
+/**
+ * @brief   Puts a chain of frame slots into the output ring without copying
+ * @details This function is one of the APIs between the NetworkLayer and
+ *          the DataLinkLayer, the NWL passes the frames of a whole packet
+ *          with it. The slots belong to the DataLinkLayer from now on, the
+ *          frames are sent from where they are and every slot returns to the
+ *          free list when its frame is sent (in reliable mode when the peer
+ *          acknowledged it).
+ *          The caller is blocked until the ring has room for the whole chain.
+ * @note    The ring has a single producer, only one thread may call this
+ *          function and DLLPutFrameInQueue().
+ *
+ * @param[in] dllp      DataLinkLayer driver structure
+ * @param[in] first     the first slot of the chain
+ * @param[in] n         number of slots, at most @p OUTPUT_FRAME_BUFFER
+ */
+msg_t DLLPutChainInQueue(DLLDriver *dllp, uint8_t first, uint8_t n){
+  uint8_t head, i;
+
+  osalDbgCheck(n <= OUTPUT_FRAME_BUFFER);
+
+  if(n == 0)
+    return MSG_OK;
+
+  DLLRingReserve(dllp, n);
+  head = dllp->DLLBuffers.DLLOutputHead;
+
+  for(i = 0; i < n; i++, first = DLLSlotNext(dllp, first))
+    DLLRingFill(dllp, head + i, first);
+
+  DLLRingCommit(dllp, head + n);
+
+  return MSG_OK;
+}
+
+#if DLL_USE_PRIORITY_LANE
+/**
+ * @brief   Puts one 'FrameStruct' into the priority lane
+ * @details The frame is copied into a free slot and sent before the frames
+ *          of the output ring. The function never waits, the frame is
+ *          refused if the lane is full or there is no free slot.
+ * @note    The lane has a single producer, only one thread may call this
+ *          function. It may be another thread than the producer of the
+ *          output ring.
+ *
+ * @param[in] dllp      DataLinkLayer driver structure
+ * @param[in] Frame     the frame
+ * @return              MSG_OK, MSG_RESET if the frame was refused
+ */
+msg_t DLLPutPriorityFrame(DLLDriver *dllp, FrameStruct *Frame){
+  DLLBufferPark *bp = &dllp->DLLBuffers;
+  uint8_t head = bp->DLLPriorityHead;
+  uint8_t slot;
+
+  if((uint8_t)(head - bp->DLLPriorityTail) == DLL_PRIORITY_QUEUE)
+    return MSG_RESET;
+  slot = DLLSlotAlloc(dllp, TIME_IMMEDIATE);
+  if(slot == DLL_SLOT_NONE)
+    return MSG_RESET;
+
+  memcpy(DLLSlotFrame(dllp, slot), Frame, FRAME_SIZE_BYTE);
+  DLLSlotFrame(dllp, slot)->CrcHex = CreateCRC(Frame);
+  bp->DLLPriorityQueue[head & (DLL_PRIORITY_QUEUE - 1)] = slot;
+
+  __DMB();
+  bp->DLLPriorityHead = head + 1;
+  DLLRingWakeup(&bp->DLLConsumer);
+
+  return MSG_OK;
 }
 
+/**
+ * @brief   Sets the number of priority frames sent in a row while the output
+ *          ring is waiting.
+ *
+ * @param[in] dllp      DataLinkLayer driver structure
+ * @param[in] weight    the number of frames, 0 is strict priority
+ */
+void DLLSetPriorityWeight(DLLDriver *dllp, uint8_t weight){
+  dllp->DLLPriorityWeight = weight;
+}
+
+/**
+ * @brief   Limits the frames of the output ring sent in one transfer of the
+ *          DMA backend.
+ * @details A priority frame waits for the transfer in progress. The limit is
+ *          meant for the time priority frames may come, without it a
+ *          transfer takes all the consecutive frames of the ring.
+ *
+ * @param[in] dllp      DataLinkLayer driver structure
+ * @param[in] n         the number of frames, 0 is no limit
+ */
+void DLLSetPriorityBatch(DLLDriver *dllp, uint8_t n){
+  dllp->DLLPriorityBatch = n;
+}
+#endif
+
 /**
  * @brief  Gives back the statistics of the DataLink Layer
  */
@@ -208,9 +1497,9 @@ void DLLInit(void) {
  * @brief   Initialize the Data Link Layer object.
  * @details The function starts the DataLinkLayer serial driver
  *          - Check the actual state of the driver
- *          - Configure and start the sdSerial driver
- *          - Init the mutex variable used by the 'DLLSendSingleFrameSerial' function
- *          - Init the mailboxes which are work like a buffer
+ *          - Configure and start the sdSerial driver or the DMA backend
+ *          - Init the sync state machine
+ *          - Init the output ring
  *          - Creates a SyncFrame
  *          - Starts the 'SDReceiving' and 'SDSending' threads which are provide
  *            the whole DLL functionality
@@ -220,37 +1509,70 @@ void DLLInit(void) {
  * @param[in] config  The config contains the speed and the ID of the serial driver
  */
 void DLLStart(DLLDriver *dllp, DLLSerialConfig *config){
+  int i;
+
   osalDbgCheck((dllp != NULL) && (config != NULL));
 
   osalDbgAssert((dllp->state == DLL_UNINIT) || (dllp->state == DLL_ACTIVE),
               "DLLInit(), invalid state");
 
   dllp->config = config;
+#if DLL_USE_DMA_BACKEND
+  DLLDmaStart(dllp->config->DDriver, dllp->config->baudrate);
+#else
   SerialDCfg.speed = dllp->config->baudrate;       //Set the data rate to the given rate
   sdStart(dllp->config->SDriver, &SerialDCfg);     //Start the serial driver for the ESP8266
+#endif
 
 
-  chMtxObjectInit(&dllp->DLLSerialSendMutex);
+#if DLL_FRAMING == DLL_FRAMING_FIXED
+  dllp->DLLSyncState = DLL_SYNC_IDLE;
+#endif
+  dllp->DLLSyncRequest = false;
 
 
-  chMBObjectInit(&dllp->DLLBuffers.DLLFilledOutputBuffer,
-                 dllp->DLLBuffers.DLLFilledOutputBufferQueue, OUTPUT_FRAME_BUFFER);
+  dllp->DLLBuffers.DLLOutputHead = 0;
+  dllp->DLLBuffers.DLLOutputTail = 0;
+  for(i = 0; i < DLL_FRAME_SLOTS; i++)
+    dllp->DLLBuffers.DLLSlotLinks[i] = i + 1;
+  dllp->DLLBuffers.DLLSlotLinks[DLL_FRAME_SLOTS - 1] = DLL_SLOT_NONE;
+  dllp->DLLBuffers.DLLSlotFirst = 0;
+  dllp->DLLBuffers.DLLSlotLast = DLL_FRAME_SLOTS - 1;
+  chSemObjectInit(&dllp->DLLBuffers.DLLSlotsFree, DLL_FRAME_SLOTS);
+  dllp->DLLStats.MinFreeSlots = DLL_FRAME_SLOTS;
+  dllp->DLLBuffers.DLLProducer = NULL;
+  dllp->DLLBuffers.DLLConsumer = NULL;
 
-  chMBObjectInit(&dllp->DLLBuffers.DLLFreeOutputBuffer,
-                 dllp->DLLBuffers.DLLFreeOutputBufferQueue, OUTPUT_FRAME_BUFFER);
+#if DLL_USE_PRIORITY_LANE
+  dllp->DLLBuffers.DLLPriorityHead = 0;
+  dllp->DLLBuffers.DLLPriorityTail = 0;
+  dllp->DLLPriorityWeight = DLL_PRIORITY_WEIGHT;
+  dllp->DLLPriorityRun = 0;
+  dllp->DLLPriorityBatch = 0;
+#endif
 
-  int i;
-  for (i = 0; i < OUTPUT_FRAME_BUFFER; i++)
-    (void)chMBPost(&dllp->DLLBuffers.DLLFreeOutputBuffer,
-                   (msg_t)&dllp->DLLBuffers.DLLOutputBuffer[i], TIME_INFINITE);
+#if DLL_USE_CREDITS
+  dllp->DLLCreditLimit = DLL_CREDIT_INITIAL;
+  dllp->DLLCreditSent = 0;
+  dllp->DLLCreditStarved = false;
+#endif
+
+#if DLL_USE_ARQ
+  dllp->DLLArqSend = 0;
+  memset(dllp->DLLArqAcked, 0, sizeof(dllp->DLLArqAcked));
+  memset(dllp->DLLArqResend, 0, sizeof(dllp->DLLArqResend));
+  dllp->DLLArqResendCount = 0;
+  dllp->DLLArqHoleSent = false;
+  dllp->DLLArqAckPending = false;
+#endif
 
   DLLCreateSyncFrame(dllp);
 
-  dllp->SendingThread = chThdCreateFromHeap(NULL, THD_WORKING_AREA_SIZE(128), NORMALPRIO+1, SDSending, (void *)dllp);
+  dllp->SendingThread = chThdCreateFromHeap(NULL, THD_WORKING_AREA_SIZE(DLL_TX_THREAD_STACK), NORMALPRIO+1, SDSending, (void *)dllp);
   if (dllp->SendingThread == NULL)
     chSysHalt("DualFramework: Starting 'SendingThread' failed - out of memory");
 
-  dllp->ReceivingThread = chThdCreateFromHeap(NULL, THD_WORKING_AREA_SIZE(128), NORMALPRIO+1, SDReceiving, (void *)dllp);
+  dllp->ReceivingThread = chThdCreateFromHeap(NULL, THD_WORKING_AREA_SIZE(DLL_RX_THREAD_STACK), NORMALPRIO+1, SDReceiving, (void *)dllp);
   if (dllp->ReceivingThread == NULL)
     chSysHalt("DualFramework: Starting 'ReceivingThread' failed - out of memory");
 
@@ -19,6 +19,12 @@
  */
 WIFIDriver WIFID1;
 
+/**
+ * @brief   'PacketBuffer' is the memory space (buffer) of the memory_pool
+ *          object which declared in the 'WiFiDriver' structure
+ */
+static PacketStruct PacketBuffer[MAX_AVAILABLE_PACKET] __attribute__((aligned(sizeof(stkalign_t))));
+
 
 
 /*===========================================================================*/
@@ -48,7 +54,10 @@ void wifiObjectInit(WIFIDriver *wifid){
 
   wifid->state  = WIFI_STOP;
   wifid->NWLStats.FrameNumber = 0x00;
+  wifid->NWLStats.PriorityNumber = 0x00;
   wifid->NWLStats.SentPacket = 0x00;
+  wifid->NWLStats.SentPriority = 0x00;
+  wifid->NWLStats.DroppedFrames = 0x00;
 }
 
 /**
@@ -104,10 +113,11 @@ char NWLGetNextFrameNumber(WIFIDriver *wifip){
  */
 void NWLAssignFNtoPacket(WIFIDriver *wifip, PacketStruct *Packet){
   char FN = NWLGetNextFrameNumber(wifip);
+  uint8_t slot = Packet->first;
   int i;
 
-  for(i = 0; i < Packet->length; i++)
-    Packet->FrameSlot[i].FrameNumber = FN;
+  for(i = 0; i < Packet->length; i++, slot = DLLSlotNext(wifip->DLLObject, slot))
+    DLLSlotFrame(wifip->DLLObject, slot)->FrameNumber = FN;
 }
 
 /**
@@ -144,8 +154,9 @@ void NWLCreateControlFrameUDP(FrameStruct *frame, IPAddress *ipaddr, int *portnu
  * @details The following steps defines the sending procedure:
  *          - Check the driver state
  *          - Assign the proper frame number to the frames which are in the packet
- *          - Assign the proper frame id to the frames which are in the packet
- *          - Put the frames each by each into the mailbox
+ *          - Hand over the frame slots of the packet to the DataLinkLayer,
+ *            the frames are sent in place and keep the frame id given by the
+ *            application
  *          - Create and send the control frame with the proper ID
  *          - Free the memory space of the packet
  *          - Increase the 'SentPackets' statistics
@@ -163,12 +174,7 @@ void NWLSendPacketUDP(WIFIDriver *wifip, PacketStruct *Packet, IPAddress ipaddr,
 
   NWLAssignFNtoPacket(wifip, Packet);
 
-  int i;
-  for(i=0; i < Packet->length; i++)
-  {
-    Packet->FrameSlot[i].Id = FTYPE_USERDATA;
-    DLLPutFrameInQueue(wifip->DLLObject, &Packet->FrameSlot[i]);
-  }
+  DLLPutChainInQueue(wifip->DLLObject, Packet->first, Packet->length);
 
   FrameStruct ControlFrame;
   NWLCreateControlFrameUDP(&ControlFrame, &ipaddr, &portnum);
@@ -178,10 +184,41 @@ void NWLSendPacketUDP(WIFIDriver *wifip, PacketStruct *Packet, IPAddress ipaddr,
   wifip->NWLStats.SentPacket++;
 }
 
+#if DLL_USE_PRIORITY_LANE
+/**
+ * @brief   Sends a single frame packet through the priority lane of the
+ *          DataLinkLayer.
+ *
+ * @details The frame overtakes the packets waiting in the output ring, the
+ *          receiver sends it at once in a UDP packet of its own. The single
+ *          frame packets are numbered separately from the other packets,
+ *          the caller may send them from another thread than
+ *          NWLSendPacketUDP().
+ *          The function never waits, the frame is refused if the lane is
+ *          full, the caller may send it in a packet instead.
+ *
+ * @param[in] wifip    pointer to the @p WIFIDriver variable
+ * @param[in] Frame    the frame, its Id is set by the caller
+ * @return             MSG_OK, MSG_RESET if the frame was refused
+ */
+msg_t NWLSendSingleFramePacket(WIFIDriver *wifip, FrameStruct *Frame){
+  osalDbgCheck((wifip != NULL));
+
+  Frame->FrameNumber = wifip->NWLStats.PriorityNumber;
+  if(DLLPutPriorityFrame(wifip->DLLObject, Frame) != MSG_OK)
+    return MSG_RESET;
+
+  wifip->NWLStats.PriorityNumber++;
+  wifip->NWLStats.SentPriority++;
+  return MSG_OK;
+}
+#endif
+
 /**
  * @brief   Return the pointer of a packet
  *
- * @details The function serves pointer from the packet memory pool
+ * @details The function serves pointer from the packet memory pool, the
+ *          frames are added to it later one by one.
  *
  * @param[in] wifip    pointer to the @p WIFIDriver variable
  */
@@ -190,21 +227,43 @@ PacketStruct *NWLCreatePacket(WIFIDriver *wifip)
   PacketStruct *Temp = chPoolAlloc(&wifip->PacketPool);
   if(Temp == NULL)
     return NULL;
+  Temp->wifip = wifip;
   Temp->length = 0;
+  Temp->first = DLL_SLOT_NONE;
+  Temp->last = DLL_SLOT_NONE;
   return Temp;
 }
 
 /**
  * @brief   The function adds a single frame to a packet
+ * @details The frame is copied into a free frame slot of the DataLinkLayer.
+ *          The function never waits, the frame is dropped if the packet is
+ *          full or there is no free slot.
  *
  * @param[out] packet     pointer to the @p PacketStruct object
  * @param[in]  frame     pointer to the @p FrameStruct object
+ * @return               MSG_OK, MSG_RESET if the frame was dropped
  */
-void NWLAddFrameToPacket(PacketStruct *Packet, FrameStruct *Frame){
-  uint8_t l = Packet->length;
-  FrameStruct *Temp = &Packet->FrameSlot[l];
-  memcpy(Temp, Frame, sizeof(FrameStruct));
+msg_t NWLAddFrameToPacket(PacketStruct *Packet, FrameStruct *Frame){
+  WIFIDriver *wifip = Packet->wifip;
+  uint8_t slot = DLL_SLOT_NONE;
+
+  if(Packet->length < MAX_FRAME_PER_PACKET)
+    slot = DLLSlotAlloc(wifip->DLLObject, TIME_IMMEDIATE);
+  if(slot == DLL_SLOT_NONE)
+  {
+    wifip->NWLStats.DroppedFrames++;
+    return MSG_RESET;
+  }
+
+  memcpy(DLLSlotFrame(wifip->DLLObject, slot), Frame, sizeof(FrameStruct));
+  if(Packet->length == 0)
+    Packet->first = slot;
+  else
+    DLLSlotNext(wifip->DLLObject, Packet->last) = slot;
+  Packet->last = slot;
   Packet->length++;
+  return MSG_OK;
 }
 
 
@@ -0,0 +1,118 @@
+/**
+ * @file    cobs.c
+ * @brief   Consistent Overhead Byte Stuffing.
+ * @details COBS removes every 0x00 byte from a frame with at most one byte
+ *          of overhead per 254 bytes, so 0x00 can delimit the frames on the
+ *          serial line. A receiver which lost bytes finds the next frame at
+ *          the next 0x00.
+ *
+ * @addtogroup DUALFRAMEWORK
+ * @{
+ */
+
+#include "cobs.h"
+
+/**
+ * @brief   Encodes a frame and appends the 0x00 delimiter.
+ *
+ * @param[in]  in     the frame
+ * @param[in]  n      size of the frame
+ * @param[out] out    at least @p COBS_ENCODED_SIZE(n) bytes
+ * @return            number of bytes written into @p out
+ */
+size_t CobsEncode(const uint8_t *in, size_t n, uint8_t *out){
+  size_t codepos = 0;
+  size_t o = 1;
+  uint8_t code = 1;
+  size_t i;
+
+  for(i = 0; i < n; i++)
+  {
+    if(in[i] == 0)
+    {
+      out[codepos] = code;
+      codepos = o++;
+      code = 1;
+    }else
+    {
+      out[o++] = in[i];
+      if(++code == 0xFF)
+      {
+        out[codepos] = code;
+        codepos = o++;
+        code = 1;
+      }
+    }
+  }
+  out[codepos] = code;
+  out[o++] = 0x00;
+  return o;
+}
+
+/**
+ * @brief   Resets the decoder.
+ *
+ * @param[out] dp     pointer to the @p CobsDecoder object
+ * @param[in]  buf    buffer of the decoded frame
+ * @param[in]  size   size of the buffer
+ */
+void CobsDecoderInit(CobsDecoder *dp, uint8_t *buf, size_t size){
+  dp->buf = buf;
+  dp->size = size;
+  dp->length = 0;
+  dp->code = 0xFF;
+  dp->left = 0;
+  dp->overflow = false;
+}
+
+/**
+ * @brief   Feeds one received byte into the decoder.
+ * @details Empty frames (consecutive delimiters) are silently skipped.
+ *
+ * @param[in] dp      pointer to the @p CobsDecoder object
+ * @param[in] b       the received byte
+ * @return            the length of the frame in @p dp->buf when a frame is
+ *                    complete, @p COBS_ERROR if the frame had to be dropped,
+ *                    @p COBS_MORE otherwise
+ * @note    The decoded frame is valid until the next call.
+ */
+int CobsDecodeByte(CobsDecoder *dp, uint8_t b){
+  int ret;
+
+  if(b != 0x00)
+  {
+    if(dp->left == 0)
+    {
+      /* Code byte, the previous block ended with an implicit zero unless it
+         was a full one.*/
+      if(dp->code != 0xFF)
+      {
+        if(dp->length < dp->size)
+          dp->buf[dp->length++] = 0x00;
+        else
+          dp->overflow = true;
+      }
+      dp->code = b;
+      dp->left = b - 1;
+    }else
+    {
+      if(dp->length < dp->size)
+        dp->buf[dp->length++] = b;
+      else
+        dp->overflow = true;
+      dp->left--;
+    }
+    return COBS_MORE;
+  }
+
+  if(dp->left != 0 || dp->overflow)
+    ret = COBS_ERROR;
+  else
+    ret = (int)dp->length;
+
+  dp->length = 0;
+  dp->code = 0xFF;
+  dp->left = 0;
+  dp->overflow = false;
+  return ret;
+}
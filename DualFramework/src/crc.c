@@ -7,49 +7,155 @@
  *      Author: Richrd
  */
 
+#include <string.h>
+
 #include "crc.h"
 
-uint8_t crctmb[] = {0, 213, 127, 170, 254, 43, 129, 84, 41, 252,
-                  86, 131, 215, 2, 168, 125, 82, 135, 45, 248,
-                  172, 121, 211, 6, 123, 174, 4, 209, 133, 80,
-                  250, 47, 164, 113, 219, 14, 90, 143, 37, 240,
-                  141, 88, 242, 39, 115, 166, 12, 217, 246, 35,
-                  137, 92, 8, 221, 119, 162, 223, 10, 160, 117,
-                  33, 244, 94, 139, 157, 72, 226, 55, 99, 182,
-                  28, 201, 180, 97, 203, 30, 74, 159, 53, 224,
-                  207, 26, 176, 101, 49, 228, 78, 155, 230, 51,
-                  153, 76, 24, 205, 103, 178, 57, 236, 70, 147,
-                  199, 18, 184, 109, 16, 197, 111, 186, 238, 59,
-                  145, 68, 107, 190, 20, 193, 149, 64, 234, 63,
-                  66, 151, 61, 232, 188, 105, 195, 22, 239, 58,
-                  144, 69, 17, 196, 110, 187, 198, 19, 185, 108,
-                  56, 237, 71, 146, 189, 104, 194, 23, 67, 150,
-                  60, 233, 148, 65, 235, 62, 106, 191, 21, 192,
-                  75, 158, 52, 225, 181, 96, 202, 31, 98, 183,
-                  29, 200, 156, 73, 227, 54, 25, 204, 102, 179,
-                  231, 50, 152, 77, 48, 229, 79, 154, 206, 27,
-                  177, 100, 114, 167, 13, 216, 140, 89, 243, 38,
-                  91, 142, 36, 241, 165, 112, 218, 15, 32, 245,
-                  95, 138, 222, 11, 161, 116, 9, 220, 118, 163,
-                  247, 34, 136, 93, 214, 3, 169, 124, 40, 253,
-                  87, 130, 255, 42, 128, 85, 1, 212, 126, 171,
-                  132, 81, 251, 46, 122, 175, 5, 208, 173, 120,
-                  210, 7, 83, 134, 44, 249};
-
-uint8_t CreateCRC(volatile FrameStruct *s){
-    uint8_t crc = 0;
-    int i=0;
-    for (i = 0; i < FRAME_SIZE_BYTE-1; ++i) {
-        crc = crctmb[crc ^ ((char *)s)[i]];
+/* CRC-8, polynomial 0xD5, processed MSB first.*/
+const uint8_t crctmb[] = {0, 213, 127, 170, 254, 43, 129, 84, 41, 252,
+                          86, 131, 215, 2, 168, 125, 82, 135, 45, 248,
+                          172, 121, 211, 6, 123, 174, 4, 209, 133, 80,
+                          250, 47, 164, 113, 219, 14, 90, 143, 37, 240,
+                          141, 88, 242, 39, 115, 166, 12, 217, 246, 35,
+                          137, 92, 8, 221, 119, 162, 223, 10, 160, 117,
+                          33, 244, 94, 139, 157, 72, 226, 55, 99, 182,
+                          28, 201, 180, 97, 203, 30, 74, 159, 53, 224,
+                          207, 26, 176, 101, 49, 228, 78, 155, 230, 51,
+                          153, 76, 24, 205, 103, 178, 57, 236, 70, 147,
+                          199, 18, 184, 109, 16, 197, 111, 186, 238, 59,
+                          145, 68, 107, 190, 20, 193, 149, 64, 234, 63,
+                          66, 151, 61, 232, 188, 105, 195, 22, 239, 58,
+                          144, 69, 17, 196, 110, 187, 198, 19, 185, 108,
+                          56, 237, 71, 146, 189, 104, 194, 23, 67, 150,
+                          60, 233, 148, 65, 235, 62, 106, 191, 21, 192,
+                          75, 158, 52, 225, 181, 96, 202, 31, 98, 183,
+                          29, 200, 156, 73, 227, 54, 25, 204, 102, 179,
+                          231, 50, 152, 77, 48, 229, 79, 154, 206, 27,
+                          177, 100, 114, 167, 13, 216, 140, 89, 243, 38,
+                          91, 142, 36, 241, 165, 112, 218, 15, 32, 245,
+                          95, 138, 222, 11, 161, 116, 9, 220, 118, 163,
+                          247, 34, 136, 93, 214, 3, 169, 124, 40, 253,
+                          87, 130, 255, 42, 128, 85, 1, 212, 126, 171,
+                          132, 81, 251, 46, 122, 175, 5, 208, 173, 120,
+                          210, 7, 83, 134, 44, 249};
+
+/* Slicing tables: crc8tN[x] is the CRC of x followed by N zero bytes.*/
+static const uint8_t crc8t1[] = {0, 11, 22, 29, 44, 39, 58, 49, 88, 83,
+                                 78, 69, 116, 127, 98, 105, 176, 187, 166, 173,
+                                 156, 151, 138, 129, 232, 227, 254, 245, 196, 207,
+                                 210, 217, 181, 190, 163, 168, 153, 146, 143, 132,
+                                 237, 230, 251, 240, 193, 202, 215, 220, 5, 14,
+                                 19, 24, 41, 34, 63, 52, 93, 86, 75, 64,
+                                 113, 122, 103, 108, 191, 180, 169, 162, 147, 152,
+                                 133, 142, 231, 236, 241, 250, 203, 192, 221, 214,
+                                 15, 4, 25, 18, 35, 40, 53, 62, 87, 92,
+                                 65, 74, 123, 112, 109, 102, 10, 1, 28, 23,
+                                 38, 45, 48, 59, 82, 89, 68, 79, 126, 117,
+                                 104, 99, 186, 177, 172, 167, 150, 157, 128, 139,
+                                 226, 233, 244, 255, 206, 197, 216, 211, 171, 160,
+                                 189, 182, 135, 140, 145, 154, 243, 248, 229, 238,
+                                 223, 212, 201, 194, 27, 16, 13, 6, 55, 60,
+                                 33, 42, 67, 72, 85, 94, 111, 100, 121, 114,
+                                 30, 21, 8, 3, 50, 57, 36, 47, 70, 77,
+                                 80, 91, 106, 97, 124, 119, 174, 165, 184, 179,
+                                 130, 137, 148, 159, 246, 253, 224, 235, 218, 209,
+                                 204, 199, 20, 31, 2, 9, 56, 51, 46, 37,
+                                 76, 71, 90, 81, 96, 107, 118, 125, 164, 175,
+                                 178, 185, 136, 131, 158, 149, 252, 247, 234, 225,
+                                 208, 219, 198, 205, 161, 170, 183, 188, 141, 134,
+                                 155, 144, 249, 242, 239, 228, 213, 222, 195, 200,
+                                 17, 26, 7, 12, 61, 54, 43, 32, 73, 66,
+                                 95, 84, 101, 110, 115, 120};
+
+static const uint8_t crc8t2[] = {0, 131, 211, 80, 115, 240, 160, 35, 230, 101,
+                                 53, 182, 149, 22, 70, 197, 25, 154, 202, 73,
+                                 106, 233, 185, 58, 255, 124, 44, 175, 140, 15,
+                                 95, 220, 50, 177, 225, 98, 65, 194, 146, 17,
+                                 212, 87, 7, 132, 167, 36, 116, 247, 43, 168,
+                                 248, 123, 88, 219, 139, 8, 205, 78, 30, 157,
+                                 190, 61, 109, 238, 100, 231, 183, 52, 23, 148,
+                                 196, 71, 130, 1, 81, 210, 241, 114, 34, 161,
+                                 125, 254, 174, 45, 14, 141, 221, 94, 155, 24,
+                                 72, 203, 232, 107, 59, 184, 86, 213, 133, 6,
+                                 37, 166, 246, 117, 176, 51, 99, 224, 195, 64,
+                                 16, 147, 79, 204, 156, 31, 60, 191, 239, 108,
+                                 169, 42, 122, 249, 218, 89, 9, 138, 200, 75,
+                                 27, 152, 187, 56, 104, 235, 46, 173, 253, 126,
+                                 93, 222, 142, 13, 209, 82, 2, 129, 162, 33,
+                                 113, 242, 55, 180, 228, 103, 68, 199, 151, 20,
+                                 250, 121, 41, 170, 137, 10, 90, 217, 28, 159,
+                                 207, 76, 111, 236, 188, 63, 227, 96, 48, 179,
+                                 144, 19, 67, 192, 5, 134, 214, 85, 118, 245,
+                                 165, 38, 172, 47, 127, 252, 223, 92, 12, 143,
+                                 74, 201, 153, 26, 57, 186, 234, 105, 181, 54,
+                                 102, 229, 198, 69, 21, 150, 83, 208, 128, 3,
+                                 32, 163, 243, 112, 158, 29, 77, 206, 237, 110,
+                                 62, 189, 120, 251, 171, 40, 11, 136, 216, 91,
+                                 135, 4, 84, 215, 244, 119, 39, 164, 97, 226,
+                                 178, 49, 18, 145, 193, 66};
+
+static const uint8_t crc8t3[] = {0, 69, 138, 207, 193, 132, 75, 14, 87, 18,
+                                 221, 152, 150, 211, 28, 89, 174, 235, 36, 97,
+                                 111, 42, 229, 160, 249, 188, 115, 54, 56, 125,
+                                 178, 247, 137, 204, 3, 70, 72, 13, 194, 135,
+                                 222, 155, 84, 17, 31, 90, 149, 208, 39, 98,
+                                 173, 232, 230, 163, 108, 41, 112, 53, 250, 191,
+                                 177, 244, 59, 126, 199, 130, 77, 8, 6, 67,
+                                 140, 201, 144, 213, 26, 95, 81, 20, 219, 158,
+                                 105, 44, 227, 166, 168, 237, 34, 103, 62, 123,
+                                 180, 241, 255, 186, 117, 48, 78, 11, 196, 129,
+                                 143, 202, 5, 64, 25, 92, 147, 214, 216, 157,
+                                 82, 23, 224, 165, 106, 47, 33, 100, 171, 238,
+                                 183, 242, 61, 120, 118, 51, 252, 185, 91, 30,
+                                 209, 148, 154, 223, 16, 85, 12, 73, 134, 195,
+                                 205, 136, 71, 2, 245, 176, 127, 58, 52, 113,
+                                 190, 251, 162, 231, 40, 109, 99, 38, 233, 172,
+                                 210, 151, 88, 29, 19, 86, 153, 220, 133, 192,
+                                 15, 74, 68, 1, 206, 139, 124, 57, 246, 179,
+                                 189, 248, 55, 114, 43, 110, 161, 228, 234, 175,
+                                 96, 37, 156, 217, 22, 83, 93, 24, 215, 146,
+                                 203, 142, 65, 4, 10, 79, 128, 197, 50, 119,
+                                 184, 253, 243, 182, 121, 60, 101, 32, 239, 170,
+                                 164, 225, 46, 107, 21, 80, 159, 218, 212, 145,
+                                 94, 27, 66, 7, 200, 141, 131, 198, 9, 76,
+                                 187, 254, 49, 116, 122, 63, 240, 181, 236, 169,
+                                 102, 35, 45, 104, 167, 226};
+
+/**
+ * @brief   CRC-8 byte at a time.
+ *
+ * @param[in] crc     the CRC of the previous bytes, 0 at the start
+ * @param[in] s       the bytes
+ * @param[in] n       number of bytes
+ * @return            the updated CRC
+ */
+uint8_t Crc8Table(uint8_t crc, const uint8_t *s, size_t n){
+    while (n--) {
+        crc = crctmb[crc ^ *s++];
     }
     return crc;
 }
 
-uint8_t CheckCRC(volatile uint8_t *s){
-    uint8_t crc = 0;
-    int i=0;
-    for (i = 0; i < FRAME_SIZE_BYTE; ++i) {
-        crc = crctmb[crc ^ s[i]];
+/**
+ * @brief   CRC-8 four bytes at a time.
+ * @details Gives the same result as @p Crc8Table(), the four table lookups of
+ *          a word are independent of each other.
+ * @note    The words are read in little endian order.
+ *
+ * @param[in] crc     the CRC of the previous bytes, 0 at the start
+ * @param[in] s       the bytes
+ * @param[in] n       number of bytes
+ * @return            the updated CRC
+ */
+uint8_t Crc8Sliced(uint8_t crc, const uint8_t *s, size_t n){
+    while (n >= 4) {
+        uint32_t w;
+        memcpy(&w, s, 4);
+        w ^= crc;
+        crc = crc8t3[w & 0xFF] ^ crc8t2[(w >> 8) & 0xFF] ^
+              crc8t1[(w >> 16) & 0xFF] ^ crctmb[w >> 24];
+        s += 4;
+        n -= 4;
     }
-    return crc;
+    return Crc8Table(crc, s, n);
 }
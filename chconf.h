@@ -382,8 +382,12 @@
  *          runtime measurement of the used stack.
  *
  * @note    The default is @p FALSE.
+ * @note    Measurement builds enable it from the Makefile, the 'threads'
+ *          shell command then shows the stack never used.
  */
+#if !defined(CH_DBG_FILL_THREADS) || defined(__DOXYGEN__)
 #define CH_DBG_FILL_THREADS                 FALSE
+#endif
 
 /**
  * @brief   Debug option, threads profiling.
@@ -0,0 +1,131 @@
+/**
+ * @file    CanCapture.h
+ * @brief   Interrupt level capture of the received CAN frames.
+ *
+ * @details The capture mode drives the bxCAN directly instead of the HAL CAN
+ *          driver. The RX interrupts of both hardware FIFOs copy the frames
+ *          into a ring at once, so the 3 deep FIFOs never wait for a thread.
+ *          Every entry is timestamped in microseconds when it leaves the
+ *          FIFO. The ring is drained in batches by the forwarding thread,
+ *          which gets an event when the ring becomes non-empty.
+ *          The FIFO overruns (FOVR) are counted per FIFO, the frames lost
+ *          because the ring was full are counted separately.
+ *
+ *          The acceptance filters are set by the filter manager, see
+ *          CanFilter.h.
+ *
+ * @note    The HAL CAN driver must be disabled (HAL_USE_CAN = FALSE) as the
+ *          capture mode owns the CAN1 RX interrupt vectors.
+ */
+
+#ifndef INCLUDE_CANCAPTURE_H_
+#define INCLUDE_CANCAPTURE_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "CanTime.h"
+
+/**
+ * @brief   Enables the interrupt level capture of the CAN frames.
+ */
+#if !defined(CAN_USE_CAPTURE) || defined(__DOXYGEN__)
+#define CAN_USE_CAPTURE             FALSE
+#endif
+
+/**
+ * @brief   Number of entries of the capture ring.
+ * @note    Must be a power of two not greater than 128.
+ */
+#define CAN_CAPTURE_RING_SIZE 64
+
+#if CAN_USE_CAPTURE || defined(__DOXYGEN__)
+
+#if HAL_USE_CAN
+#error "CAN_USE_CAPTURE requires HAL_USE_CAN set to FALSE"
+#endif
+
+#if (CAN_CAPTURE_RING_SIZE & (CAN_CAPTURE_RING_SIZE - 1)) != 0 || CAN_CAPTURE_RING_SIZE > 128
+#error "CAN_CAPTURE_RING_SIZE must be a power of two not greater than 128"
+#endif
+
+/**
+ * @brief   Bit timing register value, the parameters are the register
+ *          fields (value - 1).
+ */
+#define CAN_CAPTURE_BTR(brp, ts1, ts2, sjw) \
+  ((uint32_t)(brp) | ((uint32_t)(ts1) << 16) | ((uint32_t)(ts2) << 20) | ((uint32_t)(sjw) << 24))
+
+/**
+ * @brief   Fields of the RIR register of a captured frame.
+ */
+#define CAN_CAPTURE_IDE(rir)  (((rir) & 0x04) != 0)
+#define CAN_CAPTURE_RTR(rir)  (((rir) & 0x02) != 0)
+#define CAN_CAPTURE_ID(rir)   (CAN_CAPTURE_IDE(rir) ? (rir) >> 3 : (rir) >> 21)
+
+/**
+ * @brief   Field of the RDTR register of a captured frame.
+ */
+#define CAN_CAPTURE_DLC(rdtr) ((rdtr) & 0x0F)
+
+/**
+ * @brief   A captured frame, the mailbox registers as they were read.
+ */
+typedef struct {
+  uint32_t stamp;               /**< CanTimeNow() at the capture.           */
+  uint32_t rir;                 /**< Identifier, IDE and RTR.               */
+  uint32_t rdtr;                /**< DLC and filter match index.            */
+  uint32_t data[2];             /**< Data bytes 0..3 and 4..7.              */
+}CanCaptureEntry;
+
+/**
+ * @brief   Capture configuration.
+ */
+typedef struct {
+  uint32_t mcr;                 /**< CAN_MCR without INRQ and SLEEP.        */
+  uint32_t btr;                 /**< Bit timing, see CAN_CAPTURE_BTR().     */
+}CanCaptureConfig;
+
+/**
+ * @brief   Capture ring and statistics.
+ * @details The head is moved only by the RX interrupts, the tail only by the
+ *          forwarding thread, both are free running 8 bit counters.
+ */
+typedef struct {
+  CanCaptureEntry ring[CAN_CAPTURE_RING_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+
+  /**
+   * @brief The forwarding thread and the event it gets on new frames.
+   */
+  thread_t *thread;
+  eventmask_t events;
+
+  /**
+   * @brief Statistics.
+   */
+  long Captured;
+  long FifoOverruns[2];
+  long RingOverflows;
+  int PeakBatch;
+}CanCaptureRing;
+
+/**
+ * @brief   Entry @p i of the frames waiting in the ring.
+ */
+#define CanCaptureAt(ccp, i) \
+  (&(ccp)->ring[(uint8_t)((ccp)->tail + (i)) & (CAN_CAPTURE_RING_SIZE - 1)])
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+extern CanCaptureRing CanCaptureR;
+
+void CanCaptureStart(CanCaptureRing *ccp, const CanCaptureConfig *config,
+                     thread_t *tp, eventmask_t events);
+uint8_t CanCapturePending(CanCaptureRing *ccp);
+void CanCaptureRelease(CanCaptureRing *ccp, uint8_t n);
+
+#endif /* CAN_USE_CAPTURE */
+
+#endif /* INCLUDE_CANCAPTURE_H_ */
@@ -8,8 +8,27 @@
 #ifndef INCLUDE_CANCOMM_H_
 #define INCLUDE_CANCOMM_H_
 
+#include "CanTime.h"
+#include "CanStream.h"
+#include "CanDelta.h"
+#include "CanCapture.h"
+#include "CanFilter.h"
+#include "CanFlush.h"
+#include "CanOverload.h"
+#include "CanPriority.h"
+
+/*
+ * Default latency budget (ms) and idle gap (us) of the flush policy.
+ */
 #define DATAFREQ 10
+#define CAN_FLUSH_GAP_US 2000
+
+extern CanStreamEncoder CanStreamE;
+#if CAN_USE_DELTA
+extern CanDeltaEncoder CanDeltaE;
+#endif
 
 void CanCommInit();
+void CanCommFrameReceived(const FrameStruct *Frame);
 
 #endif /* INCLUDE_CANCOMM_H_ */
@@ -0,0 +1,91 @@
+/**
+ * @file    CanDelta.h
+ * @brief   Per CAN ID delta compression of the forwarded frames.
+ *
+ * @details The stage sits between the CAN receiver and the stream encoder.
+ *          For every CAN ID it remembers the last payload and forwards only
+ *          the bytes which changed since then as a delta record (see
+ *          CanStream.h), whose body is:
+ *
+ *          | bitmap | changed bytes in order |
+ *
+ *          - bitmap: bit i is set if data byte i changed.
+ *
+ *          The full records are the keyframes: the first frame of an ID,
+ *          every frame whose DLC, IDE or RTR changes, every frame whose bytes
+ *          all changed and every CAN_DELTA_KEYFRAME_INTERVAL-th frame of an
+ *          ID are sent in full, so a receiver which joins late or loses a
+ *          packet recovers. After a frame refused by the packet every ID
+ *          starts again with a keyframe. A delta is applied only on top of
+ *          the last keyframe of the same ID.
+ */
+
+#ifndef INCLUDE_CANDELTA_H_
+#define INCLUDE_CANDELTA_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "CanStream.h"
+
+/**
+ * @brief   Enables the delta compression of the forwarded CAN frames.
+ */
+#if !defined(CAN_USE_DELTA) || defined(__DOXYGEN__)
+#define CAN_USE_DELTA               FALSE
+#endif
+
+/**
+ * @brief   Number of CAN IDs followed by the compression.
+ * @note    Must be a power of two. The frames of the IDs which do not fit
+ *          are sent in full.
+ */
+#define CAN_DELTA_TABLE_SIZE 32
+
+/**
+ * @brief   Every n-th frame of an ID is sent in full.
+ */
+#define CAN_DELTA_KEYFRAME_INTERVAL 32
+
+#if (CAN_DELTA_TABLE_SIZE & (CAN_DELTA_TABLE_SIZE - 1)) != 0
+#error "CAN_DELTA_TABLE_SIZE must be a power of two"
+#endif
+
+/**
+ * @brief   Last known state of a CAN ID.
+ */
+typedef struct {
+  uint32_t key;                 /**< (ID << 1) | IDE.                       */
+  uint8_t info;                 /**< Flags and DLC, 0 if the slot is free.  */
+  uint8_t updates;              /**< Deltas since the last keyframe.        */
+  uint8_t data[8];              /**< Last payload.                          */
+}CanDeltaEntry;
+
+/**
+ * @brief   Delta compression state.
+ */
+typedef struct {
+  /**
+   * @brief The followed CAN IDs, open addressing on the key.
+   */
+  CanDeltaEntry table[CAN_DELTA_TABLE_SIZE];
+
+  /**
+   * @brief RefusedFrames of the stream encoder when last seen.
+   */
+  long refused;
+
+  /**
+   * @brief Statistics.
+   */
+  long Keyframes;
+  long Deltas;
+}CanDeltaEncoder;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+void CanDeltaInit(CanDeltaEncoder *cdp);
+void CanDeltaAddFrame(CanDeltaEncoder *cdp, CanStreamEncoder *csp, PacketStruct *Packet,
+                      const CanStreamFrame *f);
+
+#endif /* INCLUDE_CANDELTA_H_ */
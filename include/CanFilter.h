@@ -0,0 +1,117 @@
+/**
+ * @file    CanFilter.h
+ * @brief   bxCAN acceptance filters compiled from a forwarding rule table.
+ *
+ * @details A rule accepts the identifiers which match @p id on the bits set
+ *          in @p mask, into FIFO0 or FIFO1. A rule with every identifier bit
+ *          set in the mask is an ID-list rule. The rules are packed into the
+ *          14 filter banks as tightly as possible:
+ *
+ *          - standard ID-list rules: 4 per bank (16 bit list mode)
+ *          - standard mask rules: 2 per bank (16 bit mask mode)
+ *          - extended ID-list rules: 2 per bank (32 bit list mode)
+ *          - extended mask rules: 1 per bank (32 bit mask mode)
+ *
+ *          The rules of different FIFOs never share a bank. The leftover
+ *          standard ID-list rules are moved into a mask or a 32 bit list bank
+ *          when that saves a bank. ID-list rules match data frames only,
+ *          remote frames need a mask rule.
+ *          An empty table accepts every frame, the even identifiers into
+ *          FIFO0 and the odd ones into FIFO1.
+ *
+ *          The table can be rebuilt at runtime with the 'filter' shell
+ *          command or with FTYPE_CANFILTER frames from the peer:
+ *
+ *          | op | flags | id (4 byte LE) | mask (4 byte LE) | unused |
+ *
+ *          - op: CAN_FILTER_OP_CLEAR, CAN_FILTER_OP_ADD or
+ *            CAN_FILTER_OP_APPLY.
+ *          - flags: CAN_RULE_IDE, CAN_RULE_FIFO1.
+ *
+ *          The filters take effect only on CAN_FILTER_OP_APPLY, a table
+ *          which does not fit the banks is refused and the filters in use
+ *          are kept.
+ */
+
+#ifndef INCLUDE_CANFILTER_H_
+#define INCLUDE_CANFILTER_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "DataLinkLayer.h"
+
+/**
+ * @brief   Number of filter banks of the STM32F103.
+ */
+#define CAN_FILTER_BANKS 14
+
+/**
+ * @brief   Maximum number of rules in the table.
+ */
+#define CAN_FILTER_MAX_RULES 48
+
+/**
+ * @brief   Rule flags.
+ */
+#define CAN_RULE_IDE    0x01    /**< Extended (29 bit) identifier.          */
+#define CAN_RULE_FIFO1  0x02    /**< Accepted into FIFO1 instead of FIFO0.  */
+
+/**
+ * @brief   Operations of the FTYPE_CANFILTER frames.
+ */
+#define CAN_FILTER_OP_CLEAR 0
+#define CAN_FILTER_OP_ADD   1
+#define CAN_FILTER_OP_APPLY 2
+
+/**
+ * @brief   A forwarding rule.
+ */
+typedef struct {
+  uint32_t id;
+  uint32_t mask;                /**< Bits of @p id which must match.        */
+  uint8_t flags;
+}CanFilterRule;
+
+/**
+ * @brief   Configuration of a filter bank.
+ */
+typedef struct {
+  uint32_t fr1;
+  uint32_t fr2;
+  bool list;                    /**< List mode, mask mode otherwise.        */
+  bool wide;                    /**< 32 bit scale, two 16 bit otherwise.    */
+  bool fifo1;
+}CanFilterBank;
+
+/**
+ * @brief   Rule table.
+ */
+typedef struct {
+  CanFilterRule rules[CAN_FILTER_MAX_RULES];
+  uint8_t count;
+
+  /**
+   * @brief Banks used by the filters in effect.
+   */
+  uint8_t banks;
+
+  /**
+   * @brief The shell and the receiving thread of the DataLinkLayer both
+   *        edit the table.
+   */
+  mutex_t lock;
+}CanFilterTable;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+extern CanFilterTable CanFilterT;
+
+void CanFilterInit(CanFilterTable *cftp);
+void CanFilterClear(CanFilterTable *cftp);
+bool CanFilterAdd(CanFilterTable *cftp, uint32_t id, uint32_t mask, uint8_t flags);
+int CanFilterCompile(const CanFilterRule *rules, int n, CanFilterBank *banks);
+int CanFilterApply(CanFilterTable *cftp);
+void CanFilterControl(CanFilterTable *cftp, const FrameStruct *Frame);
+
+#endif /* INCLUDE_CANFILTER_H_ */
@@ -0,0 +1,98 @@
+/**
+ * @file    CanFlush.h
+ * @brief   Flush policy of the packet being filled with CAN frames.
+ *
+ * @details The receiver thread hands the packet over to the sending thread
+ *          on the first of these triggers:
+ *
+ *          - full: the packet holds @p full frames.
+ *          - deadline: the oldest CAN frame of the packet is @p budget
+ *            microseconds old, the latency budget.
+ *          - idle gap: no CAN frame arrived for @p gap microseconds, 0
+ *            disables the trigger.
+ *
+ *          A packet which cannot be handed over because the previous one is
+ *          still being sent waits for it, its triggers stay active.
+ *          The deadline and the idle gap are checked at the resolution of
+ *          the system tick, or at the next received frame.
+ *
+ *          The configuration is changed at runtime with the 'flush' shell
+ *          command, each field is a single word read by the receiver thread.
+ */
+
+#ifndef INCLUDE_CANFLUSH_H_
+#define INCLUDE_CANFLUSH_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "NetworkLayer.h"
+
+/**
+ * @brief   Frames of a packet kept free for the record being written and the
+ *          last stream frame.
+ */
+#define CAN_FLUSH_RESERVE 3
+
+/**
+ * @brief   Largest latency budget and idle gap in microseconds.
+ */
+#define CAN_FLUSH_MAX_US 1000000UL
+
+/**
+ * @brief   Flush triggers.
+ */
+#define CAN_FLUSH_NONE      0
+#define CAN_FLUSH_FULL      1
+#define CAN_FLUSH_DEADLINE  2
+#define CAN_FLUSH_GAP       3
+
+/**
+ * @brief   Flush policy configuration.
+ */
+typedef struct {
+  uint32_t budget;              /**< Latency budget in microseconds.        */
+  uint32_t gap;                 /**< Idle gap in microseconds, 0 if off.    */
+  uint8_t full;                 /**< Frames of a full packet.               */
+}CanFlushConfig;
+
+/**
+ * @brief   Flush policy state and statistics.
+ */
+typedef struct {
+  CanFlushConfig config;
+
+  /**
+   * @brief The batch of the packet being filled: CAN frames, receive time
+   *        of the first and of the last, sum of the receive times relative
+   *        to the first.
+   */
+  uint16_t frames;
+  uint32_t first;
+  uint32_t last;
+  uint32_t offsets;
+
+  /**
+   * @brief Statistics.
+   */
+  long Flushes[4];              /**< Flushes by trigger.                    */
+  long BatchedFrames;
+  int MinBatch;
+  int MaxBatch;
+  uint64_t DelaySum;            /**< Queueing delay of all the frames (us). */
+  uint32_t MaxDelay;            /**< Oldest frame at a flush (us).          */
+}CanFlushPolicy;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+extern CanFlushPolicy CanFlushP;
+
+void CanFlushInit(CanFlushPolicy *cfp, uint32_t budget, uint32_t gap);
+bool CanFlushConfigure(CanFlushPolicy *cfp, uint32_t budget, uint32_t gap, uint32_t full);
+void CanFlushResetStats(CanFlushPolicy *cfp);
+void CanFlushFrame(CanFlushPolicy *cfp, uint32_t stamp);
+int CanFlushCheck(CanFlushPolicy *cfp, const PacketStruct *Packet, uint32_t now);
+systime_t CanFlushTimeout(CanFlushPolicy *cfp, uint32_t now);
+void CanFlushDone(CanFlushPolicy *cfp, int trigger, uint32_t now);
+
+#endif /* INCLUDE_CANFLUSH_H_ */
@@ -0,0 +1,105 @@
+/**
+ * @file    CanOverload.h
+ * @brief   Overload policy of the forwarded CAN frames.
+ *
+ * @details The received CAN frames wait in a fixed size queue until the
+ *          packet being filled and the frame slots of the DataLinkLayer have
+ *          room for them. When the serial line is slower than the CAN bus
+ *          the queue fills up and the policy chooses the frame to drop:
+ *
+ *          - CAN_OVERLOAD_DROP_NEWEST: the received frame.
+ *          - CAN_OVERLOAD_DROP_OLDEST: the oldest queued frame.
+ *          - CAN_OVERLOAD_SHED: the oldest frame of the lowest priority
+ *            class, the received frame if its class is the lowest.
+ *
+ *          The class of a frame is set by its 11 bit base identifier (the
+ *          top 11 bits of an extended one) against the ascending @p limits:
+ *          class 0, the highest priority, is below limits[0]. The frames
+ *          keep their order, the memory used is fixed.
+ */
+
+#ifndef INCLUDE_CANOVERLOAD_H_
+#define INCLUDE_CANOVERLOAD_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "CanStream.h"
+
+/**
+ * @brief   Number of entries of the queue.
+ * @note    Must be a power of two not greater than 128.
+ */
+#define CAN_OVERLOAD_QUEUE_SIZE 64
+
+/**
+ * @brief   Number of priority classes.
+ */
+#define CAN_OVERLOAD_CLASSES 4
+
+/**
+ * @brief   Frame slots left free for the last frame of the packet and the
+ *          control frame of the NetworkLayer.
+ */
+#define CAN_OVERLOAD_RESERVE 4
+
+#if (CAN_OVERLOAD_QUEUE_SIZE & (CAN_OVERLOAD_QUEUE_SIZE - 1)) != 0 || CAN_OVERLOAD_QUEUE_SIZE > 128
+#error "CAN_OVERLOAD_QUEUE_SIZE must be a power of two not greater than 128"
+#endif
+
+/**
+ * @brief   Overload policies.
+ */
+typedef enum {
+  CAN_OVERLOAD_DROP_NEWEST = 0,
+  CAN_OVERLOAD_DROP_OLDEST,
+  CAN_OVERLOAD_SHED
+}CanOverloadPolicy_t;
+
+/**
+ * @brief   Queue of the frames waiting for room.
+ * @details Used by the receiver thread only.
+ */
+typedef struct {
+  CanStreamFrame queue[CAN_OVERLOAD_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t tail;
+
+  CanOverloadPolicy_t policy;
+  uint16_t limits[CAN_OVERLOAD_CLASSES - 1];
+
+  /**
+   * @brief Statistics.
+   */
+  long DroppedNewest;
+  long DroppedOldest;
+  long Shed[CAN_OVERLOAD_CLASSES];
+  int HighWater;
+}CanOverloadQueue;
+
+/**
+ * @brief   Number of frames in the queue.
+ */
+#define CanOverloadPending(coq) ((uint8_t)((coq)->head - (coq)->tail))
+
+/**
+ * @brief   The oldest frame in the queue.
+ */
+#define CanOverloadPeek(coq) \
+  (&(coq)->queue[(coq)->tail & (CAN_OVERLOAD_QUEUE_SIZE - 1)])
+
+/**
+ * @brief   Removes the oldest frame from the queue.
+ */
+#define CanOverloadPop(coq) ((coq)->tail++)
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+extern CanOverloadQueue CanOverloadQ;
+
+void CanOverloadInit(CanOverloadQueue *coq, CanOverloadPolicy_t policy);
+void CanOverloadResetStats(CanOverloadQueue *coq);
+int CanOverloadClass(const CanOverloadQueue *coq, const CanStreamFrame *f);
+bool CanOverloadPut(CanOverloadQueue *coq, const CanStreamFrame *f);
+
+#endif /* INCLUDE_CANOVERLOAD_H_ */
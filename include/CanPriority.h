@@ -0,0 +1,91 @@
+/**
+ * @file    CanPriority.h
+ * @brief   Cut-through forwarding of the latency critical CAN frames.
+ *
+ * @details The CAN frames whose identifier is in the priority table skip the
+ *          packet being filled. Each one is sent at once as a single frame
+ *          packet through the priority lane of the DataLinkLayer, so it
+ *          overtakes the packets waiting for the serial line:
+ *
+ *          | id (4 byte LE) | data (DLC) | time (0..4 byte LE) | zero |
+ *
+ *          - Id of the frame: FTYPE_CANPRIORITY, the DLC in the low nibble.
+ *          - id: the identifier, CAN_PRIORITY_IDE and CAN_PRIORITY_RTR set
+ *            for an extended identifier and a remote frame. Bits 11..29 of
+ *            a standard identifier hold the low 19 bits of the receive time.
+ *          - data: the DLC data bytes, none for a remote frame.
+ *          - time: the next bits of the receive time in the bytes the data
+ *            leaves free, up to the 32 bits of the time
+ *            (CanPriorityTimeBytes()).
+ *
+ *          The time has 19 bits or more, the receiver takes the missing high
+ *          bits from the last time it got, the stream packets give it one
+ *          at least every flush. An extended frame with more than 5 data
+ *          bytes has no room for the time, the receiver stamps it on
+ *          arrival. A frame which finds the lane full goes into the packet
+ *          with the others.
+ *
+ *          The table is changed at runtime with the 'priority' shell command
+ *          while the receiver thread reads it, a frame received meanwhile
+ *          may still go the way of the old table.
+ */
+
+#ifndef INCLUDE_CANPRIORITY_H_
+#define INCLUDE_CANPRIORITY_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "CanStream.h"
+
+/**
+ * @brief   Maximum number of identifiers in the table.
+ */
+#define CAN_PRIORITY_MAX_IDS 16
+
+/**
+ * @brief   Flags of the identifier.
+ */
+#define CAN_PRIORITY_IDE  0x80000000UL  /**< Extended identifier.           */
+#define CAN_PRIORITY_RTR  0x40000000UL  /**< Remote frame, no data bytes.   */
+
+/**
+ * @brief   Bits of the receive time a standard identifier leaves free.
+ */
+#define CAN_PRIORITY_TIME_SHIFT 11
+#define CAN_PRIORITY_TIME_BITS  19
+
+/**
+ * @brief   Number of bytes of the receive time after @p len data bytes.
+ * @details The bytes fill up the bits of the identifier to the 32 bits of
+ *          the time. An extended frame needs 3 bytes at least, it has no
+ *          time with fewer.
+ */
+#define CanPriorityTimeBytes(ext, len) \
+  ((ext) ? ((len) <= 4 ? 4 : (len) == 5 ? 3 : 0) : ((len) <= 6 ? 2 : 8 - (len)))
+
+/**
+ * @brief   Table of the latency critical identifiers.
+ */
+typedef struct {
+  uint32_t ids[CAN_PRIORITY_MAX_IDS];   /**< With CAN_PRIORITY_IDE.         */
+  volatile uint8_t count;
+
+  /**
+   * @brief Statistics.
+   */
+  long Forwarded;
+  long LaneFull;                /**< Sent in a packet instead.              */
+}CanPriorityTable;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+extern CanPriorityTable CanPriorityT;
+
+void CanPriorityInit(CanPriorityTable *cptp);
+bool CanPriorityAdd(CanPriorityTable *cptp, uint32_t id, bool ext);
+bool CanPriorityRemove(CanPriorityTable *cptp, uint32_t id, bool ext);
+bool CanPriorityMatch(const CanPriorityTable *cptp, const CanStreamFrame *f);
+void CanPriorityEncode(const CanStreamFrame *f, FrameStruct *frame);
+
+#endif /* INCLUDE_CANPRIORITY_H_ */
@@ -0,0 +1,157 @@
+/**
+ * @file    CanStream.h
+ * @brief   Full fidelity encoding of the forwarded CAN frames.
+ *
+ * @details The CAN frames of a packet are written as variable length records
+ *          into one byte stream, the stream is cut into the data bytes of
+ *          FTYPE_CANSTREAM frames. A record may continue in the next frame.
+ *          A record is:
+ *
+ *          | header | id and time (2, 3, 4 or 6 byte LE) | body |
+ *          | header | id (4 byte LE) | time (0, 1, 2 or 4 byte LE) | body |
+ *
+ *          - header: CAN_STREAM_IDE, CAN_STREAM_RTR, the length code of the
+ *            time (0..3) in CAN_STREAM_TIME and the kind in CAN_STREAM_KIND:
+ *            the DLC (0..8) of a full frame or CAN_STREAM_DELTA.
+ *          - id and time, standard identifier: the 11 bit identifier in the
+ *            low bits, the time above it in 5, 13 or 21 bits for the length
+ *            codes 0, 1 and 2. With the length code 3 the identifier takes 2
+ *            bytes and the time the 4 bytes after them.
+ *          - id, extended identifier (CAN_STREAM_IDE): the 29 bit identifier,
+ *            followed by the time in as many bytes as the length code.
+ *          - time: microseconds since the previous record of the stream.
+ *          - body of a full frame: the DLC data bytes, none for a remote
+ *            frame.
+ *          - body of a delta record: a bitmap of the changed data bytes and
+ *            the changed bytes in order, see CanDelta.h.
+ *
+ *          A header byte of CAN_STREAM_BASE is a base record, its body is a
+ *          receive time (4 byte LE) in microseconds, free running modulo
+ *          2^32 (see CanTime.h). The next record is measured from it.
+ *          Without one the first record of a packet is measured from the last
+ *          record of the previous packet. A packet starts with a base record
+ *          if the previous one lost records, and at least every
+ *          CAN_STREAM_BASE_INTERVAL microseconds, so a receiver which joins
+ *          late or loses a packet finds the time again.
+ *
+ *          The low nibble of the Id of a FTYPE_CANSTREAM frame is the offset
+ *          of the first record starting in its data bytes, or
+ *          CAN_STREAM_NOSTART, so a receiver which missed a frame picks the
+ *          stream up again at the next record. The following records have
+ *          no known time until the next base record. A header byte of
+ *          CAN_STREAM_END closes the stream, the rest of the last frame is
+ *          filled with it. A record cut by the end of the packet is
+ *          incomplete and ignored.
+ *
+ *          For a standard data frame of 8 bytes the record is 12 bytes when
+ *          the frames are less than 8.2 ms apart, the size of the user data
+ *          of one frame, and 11 bytes under 32 us.
+ */
+
+#ifndef INCLUDE_CANSTREAM_H_
+#define INCLUDE_CANSTREAM_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "NetworkLayer.h"
+
+/**
+ * @brief   Record header fields.
+ */
+#define CAN_STREAM_IDE    0x80      /**< Extended identifier.               */
+#define CAN_STREAM_RTR    0x40      /**< Remote frame, no data bytes.       */
+#define CAN_STREAM_TIME   0x30      /**< Length code of the time field.     */
+#define CAN_STREAM_KIND   0x0F      /**< DLC or CAN_STREAM_DELTA.           */
+#define CAN_STREAM_DELTA  0x09      /**< Delta record.                      */
+#define CAN_STREAM_BASE   0x0A      /**< Base record, a whole header byte.  */
+#define CAN_STREAM_END    0xFF      /**< No more records.                   */
+
+/**
+ * @brief   Bits of a standard identifier below the time.
+ */
+#define CAN_STREAM_STD_ID_BITS 11
+
+/**
+ * @brief   Offset of the Id of a frame where no record starts.
+ */
+#define CAN_STREAM_NOSTART 0x0F
+
+/**
+ * @brief   Size of the body of a base record.
+ */
+#define CAN_STREAM_BASE_SIZE 4
+
+/**
+ * @brief   Longest time in microseconds between two base records, a packet
+ *          starting later has a base record of its own.
+ */
+#define CAN_STREAM_BASE_INTERVAL 100000
+
+/**
+ * @brief   Largest record.
+ */
+#define CAN_STREAM_RECORD_SIZE (1 + 4 + 4 + 1 + 8)
+
+/**
+ * @brief   A received CAN frame.
+ */
+typedef struct {
+  uint32_t id;                  /**< 11 or 29 bit identifier.               */
+  uint32_t stamp;               /**< Receive time in microseconds.          */
+  uint8_t flags;                /**< CAN_STREAM_IDE, CAN_STREAM_RTR.        */
+  uint8_t dlc;
+  uint8_t data[8];
+}CanStreamFrame;
+
+/**
+ * @brief   Stream encoder state.
+ */
+typedef struct {
+  /**
+   * @brief The frame being filled and the number of bytes used.
+   */
+  FrameStruct pending;
+  uint8_t used;
+
+  /**
+   * @brief A record of the packet is written.
+   */
+  bool started;
+
+  /**
+   * @brief The receiver knows the time of the last record, the next packet
+   *        goes on from it.
+   */
+  bool timed;
+
+  /**
+   * @brief A frame of the packet was refused, the rest of the packet is
+   *        dropped.
+   */
+  bool dropping;
+
+  /**
+   * @brief Time of the previous record and of the last base record.
+   */
+  uint32_t last;
+  uint32_t base;
+
+  /**
+   * @brief Statistics.
+   */
+  long Records;
+  long StreamFrames;
+  long RefusedFrames;
+  long DroppedRecords;
+}CanStreamEncoder;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+void CanStreamInit(CanStreamEncoder *csp);
+void CanStreamAddFrame(CanStreamEncoder *csp, PacketStruct *Packet, const CanStreamFrame *f);
+void CanStreamAddDelta(CanStreamEncoder *csp, PacketStruct *Packet, const CanStreamFrame *f,
+                       uint8_t bitmap);
+void CanStreamEnd(CanStreamEncoder *csp, PacketStruct *Packet);
+
+#endif /* INCLUDE_CANSTREAM_H_ */
@@ -0,0 +1,41 @@
+/**
+ * @file    CanTime.h
+ * @brief   Free running microsecond time base of the CAN frames.
+ *
+ * @details TIM3 counts microseconds, its update event clocks TIM4, the two
+ *          16 bit counters form a 32 bit counter in hardware which wraps
+ *          every 71.6 minutes. No interrupt is needed, the counter is read
+ *          from any context.
+ *
+ *          In capture mode the frames are stamped in the RX interrupts when
+ *          they leave the hardware FIFO, with the HAL CAN driver they are
+ *          stamped by the receiver thread. The time goes with the frames
+ *          of the record stream and, where they have room, with the frames
+ *          of the priority lane (see CanPriority.h).
+ *
+ * @note    TIM2 is the system tick, TIM3 and TIM4 must not be used by the
+ *          GPT, ICU or PWM drivers.
+ */
+
+#ifndef INCLUDE_CANTIME_H_
+#define INCLUDE_CANTIME_H_
+
+#include "ch.h"
+#include "hal.h"
+
+#if STM32_GPT_USE_TIM3 || STM32_ICU_USE_TIM3 || STM32_PWM_USE_TIM3 || \
+    STM32_GPT_USE_TIM4 || STM32_ICU_USE_TIM4 || STM32_PWM_USE_TIM4
+#error "TIM3 and TIM4 are the CAN time base"
+#endif
+
+#if (STM32_TIMCLK1 % 1000000) != 0
+#error "the TIM3 clock must be a multiple of 1 MHz"
+#endif
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+void CanTimeStart(void);
+uint32_t CanTimeNow(void);
+
+#endif /* INCLUDE_CANTIME_H_ */
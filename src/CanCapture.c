@@ -0,0 +1,144 @@
+/**
+ * @file    CanCapture.c
+ * @brief   Interrupt level capture of the received CAN frames.
+ */
+
+#include <string.h>
+
+#include "CanCapture.h"
+
+#if CAN_USE_CAPTURE || defined(__DOXYGEN__)
+
+/**
+ * @brief   Capture ring of CAN1.
+ */
+CanCaptureRing CanCaptureR;
+
+/**
+ * @brief   Empties a hardware FIFO into the capture ring.
+ * @note    Both RX interrupts have the same priority, they never preempt
+ *          each other so the ring has a single producer.
+ *
+ * @param[in] ccp     pointer to the @p CanCaptureRing object
+ * @param[in] fifo    0 or 1
+ * @param[in] rfr     the RF0R or RF1R register, their bits are the same
+ */
+static void CanCaptureFifo(CanCaptureRing *ccp, int fifo, volatile uint32_t *rfr){
+  CAN_FIFOMailBox_TypeDef *mb = &CAN1->sFIFOMailBox[fifo];
+  bool wake = ccp->head == ccp->tail;
+  uint8_t n = 0;
+
+  if(*rfr & CAN_RF0R_FOVR0)
+  {
+    *rfr = CAN_RF0R_FOVR0;
+    ccp->FifoOverruns[fifo]++;
+  }
+
+  while((*rfr & CAN_RF0R_FMP0) != 0)
+  {
+    uint8_t head = ccp->head;
+
+    if((uint8_t)(head - ccp->tail) == CAN_CAPTURE_RING_SIZE)
+      ccp->RingOverflows++;
+    else
+    {
+      CanCaptureEntry *e = &ccp->ring[head & (CAN_CAPTURE_RING_SIZE - 1)];
+      e->stamp = CanTimeNow();
+      e->rir = mb->RIR;
+      e->rdtr = mb->RDTR;
+      e->data[0] = mb->RDLR;
+      e->data[1] = mb->RDHR;
+      __DMB();
+      ccp->head = head + 1;
+      n++;
+    }
+
+    /* The next frame is in the output mailbox once RFOM is cleared.*/
+    *rfr = CAN_RF0R_RFOM0;
+    while((*rfr & CAN_RF0R_RFOM0) != 0)
+      ;
+  }
+
+  ccp->Captured += n;
+  if(wake && n > 0)
+  {
+    chSysLockFromISR();
+    chEvtSignalI(ccp->thread, ccp->events);
+    chSysUnlockFromISR();
+  }
+}
+
+/**
+ * @brief   CAN1 FIFO0 interrupt handler.
+ */
+OSAL_IRQ_HANDLER(STM32_CAN1_RX0_HANDLER) {
+  OSAL_IRQ_PROLOGUE();
+  CanCaptureFifo(&CanCaptureR, 0, &CAN1->RF0R);
+  OSAL_IRQ_EPILOGUE();
+}
+
+/**
+ * @brief   CAN1 FIFO1 interrupt handler.
+ */
+OSAL_IRQ_HANDLER(STM32_CAN1_RX1_HANDLER) {
+  OSAL_IRQ_PROLOGUE();
+  CanCaptureFifo(&CanCaptureR, 1, &CAN1->RF1R);
+  OSAL_IRQ_EPILOGUE();
+}
+
+/**
+ * @brief   Starts CAN1 in capture mode.
+ *
+ * @param[out] ccp    pointer to the @p CanCaptureRing object
+ * @param[in] config  bit timing and mode
+ * @param[in] tp      the forwarding thread
+ * @param[in] events  the events signalled to @p tp on new frames
+ */
+void CanCaptureStart(CanCaptureRing *ccp, const CanCaptureConfig *config,
+                     thread_t *tp, eventmask_t events){
+  memset(ccp, 0, sizeof(CanCaptureRing));
+  ccp->thread = tp;
+  ccp->events = events;
+
+  rccEnableCAN1(FALSE);
+  CAN1->MCR = CAN_MCR_INRQ;
+  while((CAN1->MSR & CAN_MSR_INAK) == 0)
+    chThdSleepMilliseconds(1);
+  CAN1->BTR = config->btr;
+
+  CAN1->IER = CAN_IER_FMPIE0 | CAN_IER_FOVIE0 | CAN_IER_FMPIE1 | CAN_IER_FOVIE1;
+  nvicEnableVector(STM32_CAN1_RX0_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+  nvicEnableVector(STM32_CAN1_RX1_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+
+  /* Leaves the initialization mode.*/
+  CAN1->MCR = config->mcr & ~(CAN_MCR_INRQ | CAN_MCR_SLEEP);
+}
+
+/**
+ * @brief   Number of captured frames waiting in the ring.
+ * @details The frames are read with CanCaptureAt() and given back at once
+ *          with CanCaptureRelease().
+ *
+ * @param[in] ccp     pointer to the @p CanCaptureRing object
+ */
+uint8_t CanCapturePending(CanCaptureRing *ccp){
+  uint8_t n = ccp->head - ccp->tail;
+
+  __DMB();
+  if(n > ccp->PeakBatch)
+    ccp->PeakBatch = n;
+  return n;
+}
+
+/**
+ * @brief   Gives back the oldest @p n entries of the ring.
+ *
+ * @param[in] ccp     pointer to the @p CanCaptureRing object
+ * @param[in] n       number of entries
+ */
+void CanCaptureRelease(CanCaptureRing *ccp, uint8_t n){
+  __DMB();
+  ccp->tail += n;
+}
+
+#endif /* CAN_USE_CAPTURE */
@@ -5,6 +5,8 @@
  *      Author: srich
  */
 
+#include <string.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "CanComm.h"
@@ -12,18 +14,54 @@
 #include "NetworkLayer.h"
 #include "DataLinkLayer.h"
 
-PacketStruct *packet;
 IPAddress ipcim = {192, 168, 4, 255};
 #define PORTNUMBER 4000
 
-static binary_semaphore_t SendSync;
+/*
+ * Ping-pong packets: the receiver thread fills 'CanFill' and owns it
+ * alone. The sending thread offers an empty packet in 'CanSpare' and
+ * signals CAN_EVENT_SPARE. When the flush policy (CanFlush.h) fires, the
+ * receiver takes the spare packet in place of 'CanFill', hands the filled
+ * one over in 'CanFull' and signals 'CanFlushed', then the sending thread
+ * sends it. The receiver never waits for the serial line.
+ */
+#define CAN_EVENT_SPARE EVENT_MASK(1)
+#define CAN_EVENT_CONTROL EVENT_MASK(2)
+
+static PacketStruct *CanFill;
+static PacketStruct * volatile CanSpare;
+static PacketStruct *CanFull;
+static binary_semaphore_t CanFlushed;
+static thread_t *CanRxThread;
+
+/*
+ * Control frames of the peer, queued by the receiving thread of the
+ * DataLinkLayer and executed by the receiver thread.
+ */
+#define CAN_CONTROL_QUEUE 8
 
+static FrameStruct CanControlQueue[CAN_CONTROL_QUEUE];
+static volatile uint8_t CanControlHead;
+static volatile uint8_t CanControlTail;
 
+CanStreamEncoder CanStreamE;
+#if CAN_USE_DELTA
+CanDeltaEncoder CanDeltaE;
+#endif
+
+
+#if CAN_USE_CAPTURE
+static const CanCaptureConfig capcfg = {
+ CAN_MCR_ABOM,
+ CAN_CAPTURE_BTR(11, 8, 1, 0)
+};
+#else
 static const CANConfig cancfg = {
  CAN_MCR_ABOM,
  CAN_BTR_SJW(0) | CAN_BTR_TS2(1) |
  CAN_BTR_TS1(8) | CAN_BTR_BRP(11)
 };
+#endif
 /*
 static const CANConfig cancfg = {
   CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
@@ -40,68 +78,163 @@ static const CANConfig cancfg = {
 
 static THD_WORKING_AREA(waSendingThread, 256);
 static THD_FUNCTION(SendingThread, arg) {
+  (void)arg;
   chRegSetThreadName("Sending Thread");
-  systime_t time;
-  time = chVTGetSystemTime();
   int divider = 0;
   while(true)
   {
-    time += MS2ST(DATAFREQ);
-    chBSemWait(&SendSync);
+    PacketStruct *packet;
+    while ((packet = NWLCreatePacket(&WIFID1)) == NULL)
+      chThdSleepMilliseconds(1);
+    CanSpare = packet;
+    chEvtSignal(CanRxThread, CAN_EVENT_SPARE);
+    chBSemWait(&CanFlushed);
+
+    NWLSendPacketUDP(&WIFID1, CanFull, ipcim, PORTNUMBER);
+
+    divider++;
+    if(divider == 5)
+    {
+      divider = 0;
+      palTogglePad(GPIOB, GPIOB_LED1);
+    }
+  }
+}
 
-    if(packet->length > 0){
+/*
+ * Queues a received CAN frame, the overload policy may drop a frame. The
+ * latency critical frames are sent at once through the priority lane.
+ */
+static void CanForward(uint32_t id, bool ide, bool rtr, uint8_t dlc, const uint8_t *data,
+                       uint32_t stamp) {
+  CanStreamFrame frame;
 
-      wifiSendUDP(&WIFID1, packet, ipcim, PORTNUMBER);
-      packet = NWLCreatePacket(&WIFID1);
+  frame.id = id;
+  frame.stamp = stamp;
+  frame.flags = 0;
+  if(ide)
+    frame.flags |= CAN_STREAM_IDE;
+  if(rtr)
+    frame.flags |= CAN_STREAM_RTR;
+  frame.dlc = dlc;
+  memcpy(frame.data, data, 8);
 
-      divider++;
-      if(divider == 5)
-      {
-        divider = 0;
-        palTogglePad(GPIOB, GPIOB_LED1);
-      }
+#if DLL_USE_PRIORITY_LANE
+  if (CanPriorityMatch(&CanPriorityT, &frame)) {
+    FrameStruct single;
 
+    CanPriorityEncode(&frame, &single);
+    if (NWLSendSingleFramePacket(&WIFID1, &single) == MSG_OK) {
+      CanPriorityT.Forwarded++;
+      return;
     }
+    CanPriorityT.LaneFull++;
+  }
+#endif
+  (void)CanOverloadPut(&CanOverloadQ, &frame);
+}
+
+/*
+ * Hands the packet being filled over to the sending thread if the flush
+ * policy fires and the sending thread offers a new packet.
+ */
+static void CanFlush(void) {
+  uint32_t now = CanTimeNow();
+  int trigger = CanFlushCheck(&CanFlushP, CanFill, now);
+
+  if (trigger == CAN_FLUSH_NONE || CanSpare == NULL)
+    return;
+  CanStreamEnd(&CanStreamE, CanFill);
+  CanFull = CanFill;
+  CanFill = CanSpare;
+  CanSpare = NULL;
+  CanFlushDone(&CanFlushP, trigger, now);
+  chBSemSignal(&CanFlushed);
+}
 
-    chBSemSignal(&SendSync);
-    chThdSleepUntil(time);
+/*
+ * Packs the queued frames into the packet being filled while it and the
+ * frame slots have room for them.
+ */
+static void CanDrain(void) {
+  while (CanOverloadPending(&CanOverloadQ) > 0) {
+    const CanStreamFrame *frame = CanOverloadPeek(&CanOverloadQ);
+
+    if (CanFill->length >= CanFlushP.config.full ||
+        DLLSlotsAvailable(WIFID1.DLLObject) < CAN_OVERLOAD_RESERVE) {
+      CanFlush();
+      return;
+    }
+#if CAN_USE_DELTA
+    CanDeltaAddFrame(&CanDeltaE, &CanStreamE, CanFill, frame);
+#else
+    CanStreamAddFrame(&CanStreamE, CanFill, frame);
+#endif
+    CanFlushFrame(&CanFlushP, frame->stamp);
+    CanOverloadPop(&CanOverloadQ);
+    CanFlush();
   }
+  CanFlush();
 }
 
 /*
  * Receiver thread.
+ * In capture mode the frames are taken from the capture ring in batches,
+ * the RX interrupts signal event 0 when the ring becomes non-empty.
  */
-static THD_WORKING_AREA(can_rx_wa, 256);
+static THD_WORKING_AREA(can_rx_wa, 512);
 static THD_FUNCTION(can_rx, p) {
+#if !CAN_USE_CAPTURE
   event_listener_t el;
   CANRxFrame rxmsg;
+#endif
 
   (void)p;
   chRegSetThreadName("receiver");
+#if !CAN_USE_CAPTURE
   chEvtRegister(&CAND1.rxfull_event, &el, 0);
+#endif
   while(!chThdShouldTerminateX()) {
-    if (chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(100)) == 0)
-      continue;
+    systime_t timeout = MS2ST(100);
+    if (CanSpare != NULL) {
+      systime_t left = CanFlushTimeout(&CanFlushP, CanTimeNow());
+      if (left < timeout)
+        timeout = left;
+    }
+    /* The frame slots are freed by the sending thread of the DataLinkLayer
+       without an event.*/
+    if (CanOverloadPending(&CanOverloadQ) > 0 && timeout > 1)
+      timeout = 1;
+    eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS, timeout);
+    if (events & CAN_EVENT_CONTROL) {
+      while (CanControlTail != CanControlHead) {
+        CanFilterControl(&CanFilterT, &CanControlQueue[CanControlTail & (CAN_CONTROL_QUEUE - 1)]);
+        CanControlTail++;
+      }
+    }
+#if CAN_USE_CAPTURE
+    uint8_t n, i;
+    while ((n = CanCapturePending(&CanCaptureR)) > 0) {
+      for (i = 0; i < n; i++) {
+        const CanCaptureEntry *e = CanCaptureAt(&CanCaptureR, i);
+        CanForward(CAN_CAPTURE_ID(e->rir), CAN_CAPTURE_IDE(e->rir), CAN_CAPTURE_RTR(e->rir),
+                   CAN_CAPTURE_DLC(e->rdtr), (const uint8_t *)e->data, e->stamp);
+        CanDrain();
+      }
+      CanCaptureRelease(&CanCaptureR, n);
+    }
+#else
     while (canReceive(&CAND1, CAN_ANY_MAILBOX, &rxmsg, TIME_IMMEDIATE) == MSG_OK) {
-      chBSemWait(&SendSync);
-      FrameStruct frame;
-      frame.Id = FTYPE_USERDATA;
-
-      int i;
-      for(i = 0; i < 8; i++)
-        frame.data[i] = rxmsg.data8[i];
-
-      frame.data[8] = (uint8_t)rxmsg.EID;
-      frame.data[9] = rxmsg.EID >> 8;
-      frame.data[10] = rxmsg.EID >> 16;
-
-      NWLAddFrameToPacket(packet, &frame);
-
-      rxmsg.EID = 0x00;
-      chBSemSignal(&SendSync);
+      CanForward(rxmsg.IDE ? rxmsg.EID : rxmsg.SID, rxmsg.IDE, rxmsg.RTR, rxmsg.DLC,
+                 rxmsg.data8, CanTimeNow());
+      CanDrain();
     }
+#endif
+    CanDrain();
   }
+#if !CAN_USE_CAPTURE
   chEvtUnregister(&CAND1.rxfull_event, &el);
+#endif
 }
 
 /*
@@ -132,18 +265,59 @@ static THD_FUNCTION(can_tx, p) {
 }*/
 
 
+/*
+ * Receive callback of the DataLinkLayer.
+ */
+void CanCommFrameReceived(const FrameStruct *Frame){
+  uint8_t head = CanControlHead;
+
+  if (Frame->Id != FTYPE_CANFILTER || CanRxThread == NULL ||
+      (uint8_t)(head - CanControlTail) == CAN_CONTROL_QUEUE)
+    return;
+  memcpy(&CanControlQueue[head & (CAN_CONTROL_QUEUE - 1)], Frame, sizeof(FrameStruct));
+  __DMB();
+  CanControlHead = head + 1;
+  chEvtSignal(CanRxThread, CAN_EVENT_CONTROL);
+}
+
 void CanCommInit(){
-  packet = NWLCreatePacket(&WIFID1);
-  chBSemSignal(&SendSync);
+  CanFill = NWLCreatePacket(&WIFID1);
+  CanStreamInit(&CanStreamE);
+#if CAN_USE_DELTA
+  CanDeltaInit(&CanDeltaE);
+#endif
+  chBSemObjectInit(&CanFlushed, true);
+  CanFlushInit(&CanFlushP, DATAFREQ * 1000, CAN_FLUSH_GAP_US);
+  CanOverloadInit(&CanOverloadQ, CAN_OVERLOAD_DROP_OLDEST);
+  CanPriorityInit(&CanPriorityT);
+  /*
+   * The rule table is ready before the receiver thread runs, the
+   * FTYPE_CANFILTER frames are taken since wifiStart().
+   */
+  CanFilterInit(&CanFilterT);
+  CanTimeStart();
+#if !CAN_USE_CAPTURE
   /*
    * Activates the CAN driver 1.
    */
   canStart(&CAND1, &cancfg);
+#endif
 
   /*
    * Starting the transmitter and receiver threads.
    */
-  chThdCreateStatic(can_rx_wa, sizeof(can_rx_wa), NORMALPRIO+7, can_rx, NULL);
+  CanRxThread = chThdCreateStatic(can_rx_wa, sizeof(can_rx_wa), NORMALPRIO+7, can_rx, NULL);
+#if CAN_USE_CAPTURE
+  /*
+   * Activates CAN1 in capture mode, the frames go to the receiver thread.
+   */
+  CanCaptureStart(&CanCaptureR, &capcfg, CanRxThread, EVENT_MASK(0));
+#endif
+
+  /*
+   * Loads the acceptance filters, the empty table accepts every frame.
+   */
+  CanFilterApply(&CanFilterT);
   chThdCreateStatic(waSendingThread, sizeof(waSendingThread), NORMALPRIO + 7, SendingThread, NULL);
   //chThdCreateStatic(can_tx_wa, sizeof(can_tx_wa), NORMALPRIO + 7, can_tx, NULL);
 }
@@ -0,0 +1,119 @@
+/**
+ * @file    CanDelta.c
+ * @brief   Per CAN ID delta compression of the forwarded frames.
+ */
+
+#include <string.h>
+
+#include "CanDelta.h"
+
+#if CAN_USE_DELTA || defined(__DOXYGEN__)
+
+/**
+ * @brief   Marks the used entries of the table.
+ */
+#define CAN_DELTA_USED 0x10
+
+/**
+ * @brief   Looks up the entry of a CAN ID, a free slot is taken for a new ID.
+ *
+ * @param[in] cdp     pointer to the @p CanDeltaEncoder object
+ * @param[in] key     (ID << 1) | IDE
+ * @param[out] isnew  true if the slot was free
+ * @return            the entry, NULL if the table is full
+ */
+static CanDeltaEntry *CanDeltaLookup(CanDeltaEncoder *cdp, uint32_t key, bool *isnew){
+  uint32_t i = (key * 2654435761U) >> 16;
+  int n;
+
+  for(n = 0; n < CAN_DELTA_TABLE_SIZE; n++, i++)
+  {
+    CanDeltaEntry *e = &cdp->table[i & (CAN_DELTA_TABLE_SIZE - 1)];
+    if(e->info == 0)
+    {
+      e->key = key;
+      *isnew = true;
+      return e;
+    }
+    if(e->key == key)
+    {
+      *isnew = false;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief   Resets the compression state.
+ *
+ * @param[out] cdp    pointer to the @p CanDeltaEncoder object
+ */
+void CanDeltaInit(CanDeltaEncoder *cdp){
+  memset(cdp, 0, sizeof(CanDeltaEncoder));
+}
+
+/**
+ * @brief   Adds a received CAN frame to the stream, in full or as a delta
+ *          record.
+ *
+ * @param[in] cdp     pointer to the @p CanDeltaEncoder object
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ * @param[in] f       the CAN frame
+ */
+void CanDeltaAddFrame(CanDeltaEncoder *cdp, CanStreamEncoder *csp, PacketStruct *Packet,
+                      const CanStreamFrame *f){
+  uint8_t dlc = f->dlc > 8 ? 8 : f->dlc;
+  uint8_t info = CAN_DELTA_USED | f->flags | dlc;
+  uint8_t bitmap = 0;
+  CanDeltaEntry *e = NULL;
+  bool isnew = false;
+  int i;
+
+  /* A packet refused a frame, the receiver missed records, the next frame
+     of every ID is sent in full.*/
+  if(cdp->refused != csp->RefusedFrames)
+  {
+    cdp->refused = csp->RefusedFrames;
+    for(i = 0; i < CAN_DELTA_TABLE_SIZE; i++)
+      cdp->table[i].updates = CAN_DELTA_KEYFRAME_INTERVAL - 1;
+  }
+  if(csp->dropping)
+  {
+    CanStreamAddFrame(csp, Packet, f);
+    return;
+  }
+
+  if(!(f->flags & CAN_STREAM_RTR))
+    e = CanDeltaLookup(cdp, (f->id << 1) | ((f->flags & CAN_STREAM_IDE) ? 1 : 0), &isnew);
+  if(e == NULL)
+  {
+    CanStreamAddFrame(csp, Packet, f);
+    cdp->Keyframes++;
+    return;
+  }
+
+  for(i = 0; i < dlc; i++)
+    if(f->data[i] != e->data[i])
+      bitmap |= 1 << i;
+
+  if(isnew || e->info != info || e->updates >= CAN_DELTA_KEYFRAME_INTERVAL - 1 ||
+     bitmap == (1 << dlc) - 1)
+  {
+    e->info = info;
+    e->updates = 0;
+    memcpy(e->data, f->data, 8);
+    CanStreamAddFrame(csp, Packet, f);
+    cdp->Keyframes++;
+  }else
+  {
+    for(i = 0; i < dlc; i++)
+      e->data[i] = f->data[i];
+    e->updates++;
+    CanStreamAddDelta(csp, Packet, f, bitmap);
+    cdp->Deltas++;
+  }
+}
+
+#endif /* CAN_USE_DELTA */
@@ -0,0 +1,322 @@
+/**
+ * @file    CanFilter.c
+ * @brief   bxCAN acceptance filters compiled from a forwarding rule table.
+ */
+
+#include "CanFilter.h"
+
+/**
+ * @brief   Rule table of CAN1.
+ */
+CanFilterTable CanFilterT;
+
+/**
+ * @brief   Identifier bits of the standard and extended frames.
+ */
+#define CAN_STD_MASK  0x7FFUL
+#define CAN_EXT_MASK  0x1FFFFFFFUL
+
+/**
+ * @brief   Filter register encodings.
+ */
+#define CAN_F16_IDE           0x08
+#define CAN_F16(id)           ((id) << 5)
+#define CAN_F32_IDE           0x04
+#define CAN_F32_STD(id)       ((id) << 21)
+#define CAN_F32_EXT(id)       (((id) << 3) | CAN_F32_IDE)
+
+/**
+ * @brief   Collects the values of the filter bank being packed.
+ */
+typedef struct {
+  uint32_t v[4];
+  int n;
+  int size;                     /**< Values per bank.                       */
+  bool list;
+  bool wide;
+}CanFilterPack;
+
+/**
+ * @brief   Writes the values collected so far into a new bank.
+ * @details The unused places repeat the first value.
+ *
+ * @param[in] pk      the values
+ * @param[out] banks  the banks
+ * @param[in,out] nb  number of banks used
+ * @param[in] fifo1   the bank feeds FIFO1
+ * @return            false if there is no free bank
+ */
+static bool CanFilterFlush(CanFilterPack *pk, CanFilterBank *banks, int *nb, bool fifo1){
+  CanFilterBank *b;
+  int i;
+
+  if(pk->n == 0)
+    return true;
+  if(*nb == CAN_FILTER_BANKS)
+    return false;
+
+  for(i = pk->n; i < pk->size; i++)
+    pk->v[i] = pk->v[0];
+
+  b = &banks[(*nb)++];
+  b->list = pk->list;
+  b->wide = pk->wide;
+  b->fifo1 = fifo1;
+  if(pk->size == 4)
+  {
+    b->fr1 = pk->v[0] | (pk->v[1] << 16);
+    b->fr2 = pk->v[2] | (pk->v[3] << 16);
+  }else
+  {
+    b->fr1 = pk->v[0];
+    b->fr2 = pk->v[1];
+  }
+  pk->n = 0;
+  return true;
+}
+
+/**
+ * @brief   Adds a value to the bank being packed, a full bank is written.
+ */
+static bool CanFilterPut(CanFilterPack *pk, uint32_t v, CanFilterBank *banks, int *nb, bool fifo1){
+  pk->v[pk->n++] = v;
+  if(pk->n < pk->size)
+    return true;
+  return CanFilterFlush(pk, banks, nb, fifo1);
+}
+
+/**
+ * @brief   Accepts every frame, even identifiers into FIFO0, odd ones into
+ *          FIFO1.
+ * @details A frame matching more banks goes by the lowest one.
+ */
+static int CanFilterDefault(CanFilterBank *banks){
+  banks[0].fr1 = CAN_F32_IDE;
+  banks[0].fr2 = CAN_F32_EXT(1);
+  banks[1].fr1 = 0;
+  banks[1].fr2 = CAN_F32_IDE | CAN_F32_STD(1);
+  banks[2].fr1 = 0;
+  banks[2].fr2 = 0;
+  banks[0].list = banks[1].list = banks[2].list = false;
+  banks[0].wide = banks[1].wide = banks[2].wide = true;
+  banks[0].fifo1 = banks[1].fifo1 = false;
+  banks[2].fifo1 = true;
+  return 3;
+}
+
+/**
+ * @brief   Compiles rules into filter banks.
+ *
+ * @param[in] rules   the rules
+ * @param[in] n       number of rules
+ * @param[out] banks  @p CAN_FILTER_BANKS banks
+ * @return            number of banks used, -1 if the rules do not fit
+ */
+int CanFilterCompile(const CanFilterRule *rules, int n, CanFilterBank *banks){
+  int nb = 0, fifo, i;
+
+  if(n == 0)
+    return CanFilterDefault(banks);
+
+  for(fifo = 0; fifo < 2; fifo++)
+  {
+    CanFilterPack l16 = {{0}, 0, 4, true, false};
+    CanFilterPack m16 = {{0}, 0, 2, false, false};
+    CanFilterPack l32 = {{0}, 0, 2, true, true};
+    CanFilterPack m32 = {{0}, 0, 2, false, true};
+    int e = 0, m = 0, x = 0, y = 0, r, moveto = 0, listed = 0;
+    bool ok = true;
+
+    /* Counts the rules by kind, the leftover standard ID-list rules may
+       share a mask or a 32 bit list bank if that saves a bank.*/
+    for(i = 0; i < n; i++)
+    {
+      const CanFilterRule *rp = &rules[i];
+      if(((rp->flags & CAN_RULE_FIFO1) != 0) != fifo)
+        continue;
+      if(rp->flags & CAN_RULE_IDE)
+      {
+        if(rp->mask == CAN_EXT_MASK)
+          x++;
+        else
+          y++;
+      }else if(rp->mask == CAN_STD_MASK)
+        e++;
+      else
+        m++;
+    }
+    r = e % 4;
+    if(r != 0)
+    {
+      int a = (e + 3) / 4 + (m + 1) / 2 + (x + 1) / 2;
+      int b = e / 4 + (m + r + 1) / 2 + (x + 1) / 2;
+      int c = e / 4 + (m + 1) / 2 + (x + r + 1) / 2;
+      if(b < a && b <= c)
+        moveto = 1;
+      else if(c < a)
+        moveto = 2;
+    }
+
+    for(i = 0; i < n && ok; i++)
+    {
+      const CanFilterRule *rp = &rules[i];
+      if(((rp->flags & CAN_RULE_FIFO1) != 0) != fifo)
+        continue;
+      if(rp->flags & CAN_RULE_IDE)
+      {
+        if(rp->mask == CAN_EXT_MASK)
+          ok = CanFilterPut(&l32, CAN_F32_EXT(rp->id), banks, &nb, fifo);
+        else
+          ok = CanFilterPut(&m32, CAN_F32_EXT(rp->id), banks, &nb, fifo) &&
+               CanFilterPut(&m32, CAN_F32_EXT(rp->mask), banks, &nb, fifo);
+      }else if(rp->mask != CAN_STD_MASK)
+        ok = CanFilterPut(&m16, CAN_F16(rp->id) | ((CAN_F16(rp->mask) | CAN_F16_IDE) << 16),
+                          banks, &nb, fifo);
+      else if(moveto == 1 && listed++ >= e - r)
+        ok = CanFilterPut(&m16, CAN_F16(rp->id) | ((CAN_F16(CAN_STD_MASK) | CAN_F16_IDE) << 16),
+                          banks, &nb, fifo);
+      else if(moveto == 2 && listed++ >= e - r)
+        ok = CanFilterPut(&l32, CAN_F32_STD(rp->id), banks, &nb, fifo);
+      else
+        ok = CanFilterPut(&l16, CAN_F16(rp->id), banks, &nb, fifo);
+    }
+
+    if(!ok || !CanFilterFlush(&l16, banks, &nb, fifo) || !CanFilterFlush(&m16, banks, &nb, fifo) ||
+       !CanFilterFlush(&l32, banks, &nb, fifo) || !CanFilterFlush(&m32, banks, &nb, fifo))
+      return -1;
+  }
+  return nb;
+}
+
+/**
+ * @brief   Loads the filter banks into the bxCAN.
+ * @note    The reception stops for the few cycles of the filter
+ *          initialization mode.
+ */
+static void CanFilterLoad(const CanFilterBank *banks, int n){
+  uint32_t fm1r = 0, fs1r = 0, ffa1r = 0;
+  int i;
+
+  for(i = 0; i < n; i++)
+  {
+    if(banks[i].list)
+      fm1r |= 1UL << i;
+    if(banks[i].wide)
+      fs1r |= 1UL << i;
+    if(banks[i].fifo1)
+      ffa1r |= 1UL << i;
+  }
+
+  CAN1->FMR |= CAN_FMR_FINIT;
+  CAN1->FA1R = 0;
+  CAN1->FM1R = fm1r;
+  CAN1->FS1R = fs1r;
+  CAN1->FFA1R = ffa1r;
+  for(i = 0; i < n; i++)
+  {
+    CAN1->sFilterRegister[i].FR1 = banks[i].fr1;
+    CAN1->sFilterRegister[i].FR2 = banks[i].fr2;
+  }
+  CAN1->FA1R = (1UL << n) - 1;
+  CAN1->FMR &= ~CAN_FMR_FINIT;
+}
+
+/**
+ * @brief   Initializes an empty table.
+ *
+ * @param[out] cftp   pointer to the @p CanFilterTable object
+ */
+void CanFilterInit(CanFilterTable *cftp){
+  cftp->count = 0;
+  cftp->banks = 0;
+  chMtxObjectInit(&cftp->lock);
+}
+
+/**
+ * @brief   Removes every rule, the filters in effect are kept until
+ *          CanFilterApply().
+ *
+ * @param[in] cftp    pointer to the @p CanFilterTable object
+ */
+void CanFilterClear(CanFilterTable *cftp){
+  chMtxLock(&cftp->lock);
+  cftp->count = 0;
+  chMtxUnlock(&cftp->lock);
+}
+
+/**
+ * @brief   Adds a rule to the table.
+ *
+ * @param[in] cftp    pointer to the @p CanFilterTable object
+ * @param[in] id      the identifier
+ * @param[in] mask    the bits of @p id which must match
+ * @param[in] flags   CAN_RULE_IDE, CAN_RULE_FIFO1
+ * @return            false if the table is full
+ */
+bool CanFilterAdd(CanFilterTable *cftp, uint32_t id, uint32_t mask, uint8_t flags){
+  bool ret = false;
+
+  mask &= (flags & CAN_RULE_IDE) ? CAN_EXT_MASK : CAN_STD_MASK;
+
+  chMtxLock(&cftp->lock);
+  if(cftp->count < CAN_FILTER_MAX_RULES)
+  {
+    CanFilterRule *rp = &cftp->rules[cftp->count++];
+    rp->id = id & mask;
+    rp->mask = mask;
+    rp->flags = flags & (CAN_RULE_IDE | CAN_RULE_FIFO1);
+    ret = true;
+  }
+  chMtxUnlock(&cftp->lock);
+  return ret;
+}
+
+/**
+ * @brief   Compiles the table and loads it into the bxCAN.
+ * @note    CAN1 must be started.
+ *
+ * @param[in] cftp    pointer to the @p CanFilterTable object
+ * @return            number of banks used, -1 if the table does not fit
+ *                    and the filters in effect are kept
+ */
+int CanFilterApply(CanFilterTable *cftp){
+  static CanFilterBank banks[CAN_FILTER_BANKS];
+  int n;
+
+  chMtxLock(&cftp->lock);
+  n = CanFilterCompile(cftp->rules, cftp->count, banks);
+  if(n >= 0)
+  {
+    CanFilterLoad(banks, n);
+    cftp->banks = n;
+  }
+  chMtxUnlock(&cftp->lock);
+  return n;
+}
+
+/**
+ * @brief   Executes a FTYPE_CANFILTER frame of the peer.
+ *
+ * @param[in] cftp    pointer to the @p CanFilterTable object
+ * @param[in] Frame   the frame
+ */
+void CanFilterControl(CanFilterTable *cftp, const FrameStruct *Frame){
+  const uint8_t *d = (const uint8_t *)Frame->data;
+  uint32_t id = d[2] | (d[3] << 8) | ((uint32_t)d[4] << 16) | ((uint32_t)d[5] << 24);
+  uint32_t mask = d[6] | (d[7] << 8) | ((uint32_t)d[8] << 16) | ((uint32_t)d[9] << 24);
+
+  switch(d[0])
+  {
+    case CAN_FILTER_OP_CLEAR:
+      CanFilterClear(cftp);
+      break;
+    case CAN_FILTER_OP_ADD:
+      (void)CanFilterAdd(cftp, id, mask, d[1]);
+      break;
+    case CAN_FILTER_OP_APPLY:
+      (void)CanFilterApply(cftp);
+      break;
+    default:
+      break;
+  }
+}
@@ -0,0 +1,148 @@
+/**
+ * @file    CanFlush.c
+ * @brief   Flush policy of the packet being filled with CAN frames.
+ */
+
+#include <string.h>
+
+#include "CanFlush.h"
+
+/**
+ * @brief   Flush policy of the forwarded CAN frames.
+ */
+CanFlushPolicy CanFlushP;
+
+/**
+ * @brief   Resets the policy with a full packet of MAX_FRAME_PER_PACKET
+ *          frames.
+ *
+ * @param[out] cfp    pointer to the @p CanFlushPolicy object
+ * @param[in] budget  latency budget in microseconds
+ * @param[in] gap     idle gap in microseconds, 0 disables the trigger
+ */
+void CanFlushInit(CanFlushPolicy *cfp, uint32_t budget, uint32_t gap){
+  memset(cfp, 0, sizeof(CanFlushPolicy));
+  CanFlushResetStats(cfp);
+  (void)CanFlushConfigure(cfp, budget, gap, MAX_FRAME_PER_PACKET - CAN_FLUSH_RESERVE);
+}
+
+/**
+ * @brief   Changes the configuration.
+ *
+ * @param[in] cfp     pointer to the @p CanFlushPolicy object
+ * @param[in] budget  latency budget in microseconds
+ * @param[in] gap     idle gap in microseconds, 0 disables the trigger
+ * @param[in] full    frames of a full packet
+ * @return            false if a value is out of range, the configuration
+ *                    is kept
+ */
+bool CanFlushConfigure(CanFlushPolicy *cfp, uint32_t budget, uint32_t gap, uint32_t full){
+  if(budget == 0 || budget > CAN_FLUSH_MAX_US || gap > CAN_FLUSH_MAX_US ||
+     full == 0 || full > MAX_FRAME_PER_PACKET - CAN_FLUSH_RESERVE)
+    return false;
+  cfp->config.budget = budget;
+  cfp->config.gap = gap;
+  cfp->config.full = full;
+  return true;
+}
+
+/**
+ * @brief   Resets the statistics.
+ *
+ * @param[in] cfp     pointer to the @p CanFlushPolicy object
+ */
+void CanFlushResetStats(CanFlushPolicy *cfp){
+  memset(cfp->Flushes, 0, sizeof(cfp->Flushes));
+  cfp->BatchedFrames = 0;
+  cfp->MinBatch = 0x7FFF;
+  cfp->MaxBatch = 0;
+  cfp->DelaySum = 0;
+  cfp->MaxDelay = 0;
+}
+
+/**
+ * @brief   Notes a CAN frame added to the packet.
+ *
+ * @param[in] cfp     pointer to the @p CanFlushPolicy object
+ * @param[in] stamp   receive time of the frame
+ */
+void CanFlushFrame(CanFlushPolicy *cfp, uint32_t stamp){
+  if(cfp->frames == 0)
+  {
+    cfp->first = stamp;
+    cfp->offsets = 0;
+  }
+  cfp->offsets += stamp - cfp->first;
+  cfp->last = stamp;
+  cfp->frames++;
+}
+
+/**
+ * @brief   Checks the triggers.
+ *
+ * @param[in] cfp     pointer to the @p CanFlushPolicy object
+ * @param[in] Packet  the packet being filled
+ * @param[in] now     CanTimeNow()
+ * @return            the trigger, CAN_FLUSH_NONE if the packet is kept
+ */
+int CanFlushCheck(CanFlushPolicy *cfp, const PacketStruct *Packet, uint32_t now){
+  if(cfp->frames == 0)
+    return CAN_FLUSH_NONE;
+  if(Packet->length >= cfp->config.full)
+    return CAN_FLUSH_FULL;
+  if(now - cfp->first >= cfp->config.budget)
+    return CAN_FLUSH_DEADLINE;
+  if(cfp->config.gap != 0 && now - cfp->last >= cfp->config.gap)
+    return CAN_FLUSH_GAP;
+  return CAN_FLUSH_NONE;
+}
+
+/**
+ * @brief   Time until the next deadline or idle gap.
+ *
+ * @param[in] cfp     pointer to the @p CanFlushPolicy object
+ * @param[in] now     CanTimeNow()
+ * @return            system ticks, TIME_INFINITE if the packet is empty
+ */
+systime_t CanFlushTimeout(CanFlushPolicy *cfp, uint32_t now){
+  uint32_t left, age;
+
+  if(cfp->frames == 0)
+    return TIME_INFINITE;
+
+  age = now - cfp->first;
+  left = age >= cfp->config.budget ? 0 : cfp->config.budget - age;
+  if(cfp->config.gap != 0)
+  {
+    age = now - cfp->last;
+    if(age >= cfp->config.gap)
+      left = 0;
+    else if(cfp->config.gap - age < left)
+      left = cfp->config.gap - age;
+  }
+  if(left == 0)
+    return TIME_IMMEDIATE;
+  return US2ST(left);
+}
+
+/**
+ * @brief   Notes the packet handed over and starts a new batch.
+ *
+ * @param[in] cfp     pointer to the @p CanFlushPolicy object
+ * @param[in] trigger the trigger of the flush
+ * @param[in] now     CanTimeNow()
+ */
+void CanFlushDone(CanFlushPolicy *cfp, int trigger, uint32_t now){
+  uint32_t oldest = now - cfp->first;
+
+  cfp->Flushes[trigger]++;
+  cfp->BatchedFrames += cfp->frames;
+  if(cfp->frames < cfp->MinBatch)
+    cfp->MinBatch = cfp->frames;
+  if(cfp->frames > cfp->MaxBatch)
+    cfp->MaxBatch = cfp->frames;
+  cfp->DelaySum += (uint64_t)oldest * cfp->frames - cfp->offsets;
+  if(oldest > cfp->MaxDelay)
+    cfp->MaxDelay = oldest;
+  cfp->frames = 0;
+}
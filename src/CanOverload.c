@@ -0,0 +1,125 @@
+/**
+ * @file    CanOverload.c
+ * @brief   Overload policy of the forwarded CAN frames.
+ */
+
+#include <string.h>
+
+#include "CanOverload.h"
+
+/**
+ * @brief   Overload queue of the forwarded CAN frames.
+ */
+CanOverloadQueue CanOverloadQ;
+
+/**
+ * @brief   Entry @p i of the queue counted from the oldest.
+ */
+#define CanOverloadAt(coq, i) \
+  (&(coq)->queue[(uint8_t)((coq)->tail + (i)) & (CAN_OVERLOAD_QUEUE_SIZE - 1)])
+
+/**
+ * @brief   Removes entry @p i of the queue, the newer entries move down.
+ */
+static void CanOverloadRemove(CanOverloadQueue *coq, uint8_t i){
+  uint8_t n = CanOverloadPending(coq);
+
+  for(; i + 1 < n; i++)
+    *CanOverloadAt(coq, i) = *CanOverloadAt(coq, i + 1);
+  coq->head--;
+}
+
+/**
+ * @brief   Resets the queue, the class limits split the identifiers evenly.
+ *
+ * @param[out] coq    pointer to the @p CanOverloadQueue object
+ * @param[in] policy  the overload policy
+ */
+void CanOverloadInit(CanOverloadQueue *coq, CanOverloadPolicy_t policy){
+  int i;
+
+  memset(coq, 0, sizeof(CanOverloadQueue));
+  coq->policy = policy;
+  for(i = 0; i < CAN_OVERLOAD_CLASSES - 1; i++)
+    coq->limits[i] = (i + 1) * (0x800 / CAN_OVERLOAD_CLASSES);
+}
+
+/**
+ * @brief   Resets the statistics.
+ *
+ * @param[in] coq     pointer to the @p CanOverloadQueue object
+ */
+void CanOverloadResetStats(CanOverloadQueue *coq){
+  coq->DroppedNewest = 0;
+  coq->DroppedOldest = 0;
+  memset(coq->Shed, 0, sizeof(coq->Shed));
+  coq->HighWater = CanOverloadPending(coq);
+}
+
+/**
+ * @brief   Priority class of a frame, 0 is the highest.
+ *
+ * @param[in] coq     pointer to the @p CanOverloadQueue object
+ * @param[in] f       the frame
+ */
+int CanOverloadClass(const CanOverloadQueue *coq, const CanStreamFrame *f){
+  uint32_t base = (f->flags & CAN_STREAM_IDE) ? f->id >> 18 : f->id;
+  int c;
+
+  for(c = 0; c < CAN_OVERLOAD_CLASSES - 1; c++)
+    if(base < coq->limits[c])
+      break;
+  return c;
+}
+
+/**
+ * @brief   Queues a received frame, the policy drops a frame if the queue
+ *          is full.
+ *
+ * @param[in] coq     pointer to the @p CanOverloadQueue object
+ * @param[in] f       the frame
+ * @return            false if @p f was dropped
+ */
+bool CanOverloadPut(CanOverloadQueue *coq, const CanStreamFrame *f){
+  uint8_t n = CanOverloadPending(coq);
+
+  if(n == CAN_OVERLOAD_QUEUE_SIZE)
+  {
+    switch(coq->policy)
+    {
+      case CAN_OVERLOAD_DROP_OLDEST:
+        coq->tail++;
+        coq->DroppedOldest++;
+        break;
+      case CAN_OVERLOAD_SHED:
+      {
+        int c = CanOverloadClass(coq, f), worst = c, wc;
+        uint8_t i, victim = 0;
+
+        for(i = 0; i < n; i++)
+        {
+          wc = CanOverloadClass(coq, CanOverloadAt(coq, i));
+          if(wc > worst)
+          {
+            worst = wc;
+            victim = i;
+          }
+        }
+        coq->Shed[worst]++;
+        if(worst == c)
+          return false;
+        CanOverloadRemove(coq, victim);
+        break;
+      }
+      default:
+        coq->DroppedNewest++;
+        return false;
+    }
+  }
+
+  *CanOverloadAt(coq, CanOverloadPending(coq)) = *f;
+  coq->head++;
+  if(CanOverloadPending(coq) > coq->HighWater)
+    coq->HighWater = CanOverloadPending(coq);
+  return true;
+}
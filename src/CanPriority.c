@@ -0,0 +1,129 @@
+/**
+ * @file    CanPriority.c
+ * @brief   Cut-through forwarding of the latency critical CAN frames.
+ */
+
+#include <string.h>
+
+#include "CanPriority.h"
+
+/**
+ * @brief   Table of the latency critical identifiers.
+ */
+CanPriorityTable CanPriorityT;
+
+/**
+ * @brief   The identifier with its flag as stored in the table.
+ */
+#define CanPriorityKey(id, ext) \
+  ((ext) ? ((id) & 0x1FFFFFFFUL) | CAN_PRIORITY_IDE : (id) & 0x7FFUL)
+
+/**
+ * @brief   Empties the table and resets the statistics.
+ *
+ * @param[out] cptp   pointer to the @p CanPriorityTable object
+ */
+void CanPriorityInit(CanPriorityTable *cptp){
+  memset(cptp, 0, sizeof(CanPriorityTable));
+}
+
+/**
+ * @brief   Adds an identifier to the table.
+ *
+ * @param[in] cptp    pointer to the @p CanPriorityTable object
+ * @param[in] id      the identifier
+ * @param[in] ext     true for an extended identifier
+ * @return            false if the table is full
+ */
+bool CanPriorityAdd(CanPriorityTable *cptp, uint32_t id, bool ext){
+  uint32_t key = CanPriorityKey(id, ext);
+  uint8_t i;
+
+  for(i = 0; i < cptp->count; i++)
+    if(cptp->ids[i] == key)
+      return true;
+  if(cptp->count == CAN_PRIORITY_MAX_IDS)
+    return false;
+
+  cptp->ids[cptp->count] = key;
+  __DMB();
+  cptp->count++;
+  return true;
+}
+
+/**
+ * @brief   Removes an identifier from the table, the last one takes its
+ *          place.
+ *
+ * @param[in] cptp    pointer to the @p CanPriorityTable object
+ * @param[in] id      the identifier
+ * @param[in] ext     true for an extended identifier
+ * @return            false if the identifier is not in the table
+ */
+bool CanPriorityRemove(CanPriorityTable *cptp, uint32_t id, bool ext){
+  uint32_t key = CanPriorityKey(id, ext);
+  uint8_t i;
+
+  for(i = 0; i < cptp->count; i++)
+  {
+    if(cptp->ids[i] == key)
+    {
+      cptp->ids[i] = cptp->ids[cptp->count - 1];
+      __DMB();
+      cptp->count--;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief   Tells whether a frame is latency critical.
+ *
+ * @param[in] cptp    pointer to the @p CanPriorityTable object
+ * @param[in] f       the frame
+ */
+bool CanPriorityMatch(const CanPriorityTable *cptp, const CanStreamFrame *f){
+  uint32_t key = CanPriorityKey(f->id, f->flags & CAN_STREAM_IDE);
+  uint8_t i, n = cptp->count;
+
+  for(i = 0; i < n; i++)
+    if(cptp->ids[i] == key)
+      return true;
+  return false;
+}
+
+/**
+ * @brief   Builds the single frame packet of a frame.
+ * @details The receive time goes in the bits the identifier and the data
+ *          leave free.
+ *
+ * @param[in]  f      the CAN frame
+ * @param[out] frame  the FTYPE_CANPRIORITY frame
+ */
+void CanPriorityEncode(const CanStreamFrame *f, FrameStruct *frame){
+  bool ext = f->flags & CAN_STREAM_IDE;
+  uint32_t id = CanPriorityKey(f->id, ext);
+  uint32_t t = f->stamp;
+  uint8_t dlc = f->dlc > 8 ? 8 : f->dlc;
+  uint8_t len = (f->flags & CAN_STREAM_RTR) ? 0 : dlc;
+  uint8_t i, n = CanPriorityTimeBytes(ext, len);
+
+  if(f->flags & CAN_STREAM_RTR)
+    id |= CAN_PRIORITY_RTR;
+  if(!ext)
+  {
+    id |= (t & ((1UL << CAN_PRIORITY_TIME_BITS) - 1)) << CAN_PRIORITY_TIME_SHIFT;
+    t >>= CAN_PRIORITY_TIME_BITS;
+  }
+
+  memset(frame, 0, sizeof(FrameStruct));
+  frame->Id = FTYPE_CANPRIORITY | dlc;
+  frame->data[0] = (char)id;
+  frame->data[1] = (char)(id >> 8);
+  frame->data[2] = (char)(id >> 16);
+  frame->data[3] = (char)(id >> 24);
+  memcpy(&frame->data[4], f->data, len);
+  for(i = 0; i < n; i++, t >>= 8)
+    frame->data[4 + len + i] = (char)t;
+}
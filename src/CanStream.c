@@ -0,0 +1,207 @@
+/**
+ * @file    CanStream.c
+ * @brief   Full fidelity encoding of the forwarded CAN frames.
+ */
+
+#include <string.h>
+
+#include "CanStream.h"
+
+/**
+ * @brief   Starts a new frame.
+ */
+static void CanStreamReset(CanStreamEncoder *csp){
+  csp->pending.Id = FTYPE_CANSTREAM | CAN_STREAM_NOSTART;
+  csp->used = 0;
+}
+
+/**
+ * @brief   Adds the frame being filled to the packet.
+ * @details If the packet refuses it the rest of the packet is dropped, the
+ *          receiver would misread the stream otherwise.
+ *
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ */
+static void CanStreamEmit(CanStreamEncoder *csp, PacketStruct *Packet){
+  if(NWLAddFrameToPacket(Packet, &csp->pending) == MSG_OK)
+    csp->StreamFrames++;
+  else
+  {
+    csp->RefusedFrames++;
+    csp->dropping = true;
+  }
+  CanStreamReset(csp);
+}
+
+/**
+ * @brief   Appends bytes to the stream.
+ *
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ * @param[in] p       the bytes
+ * @param[in] n       number of bytes
+ * @param[in] record  the first byte is a record header
+ */
+static void CanStreamWrite(CanStreamEncoder *csp, PacketStruct *Packet,
+                           const uint8_t *p, uint8_t n, bool record){
+  uint8_t i;
+
+  for(i = 0; i < n && !csp->dropping; i++)
+  {
+    if(csp->used == sizeof(csp->pending.data))
+    {
+      CanStreamEmit(csp, Packet);
+      if(csp->dropping)
+        break;
+    }
+    if(i == 0 && record && (csp->pending.Id & CAN_STREAM_NOSTART) == CAN_STREAM_NOSTART)
+      csp->pending.Id = FTYPE_CANSTREAM | csp->used;
+    csp->pending.data[csp->used++] = p[i];
+  }
+}
+
+/**
+ * @brief   Appends a record.
+ *
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ * @param[in] f       the CAN frame
+ * @param[in] kind    the DLC or CAN_STREAM_DELTA
+ * @param[in] body    the body of the record
+ * @param[in] n       length of the body
+ */
+static void CanStreamPut(CanStreamEncoder *csp, PacketStruct *Packet, const CanStreamFrame *f,
+                         uint8_t kind, const uint8_t *body, uint8_t n){
+  uint8_t rec[CAN_STREAM_RECORD_SIZE];
+  uint8_t len = 1, tlen, code, i;
+  uint32_t delta, v;
+
+  if(csp->dropping)
+  {
+    csp->DroppedRecords++;
+    return;
+  }
+
+  /* The time goes on from the previous packet unless the receiver may have
+     lost it.*/
+  if(!csp->started)
+  {
+    if(!csp->timed || f->stamp - csp->base >= CAN_STREAM_BASE_INTERVAL)
+    {
+      rec[0] = CAN_STREAM_BASE;
+      rec[1] = (uint8_t)f->stamp;
+      rec[2] = f->stamp >> 8;
+      rec[3] = f->stamp >> 16;
+      rec[4] = f->stamp >> 24;
+      CanStreamWrite(csp, Packet, rec, 1 + CAN_STREAM_BASE_SIZE, true);
+      csp->timed = true;
+      csp->base = f->stamp;
+      csp->last = f->stamp;
+    }
+    csp->started = true;
+  }
+
+  delta = f->stamp - csp->last;
+  csp->last = f->stamp;
+  if(f->flags & CAN_STREAM_IDE)
+  {
+    code = delta == 0 ? 0 : delta < 0x100 ? 1 : delta < 0x10000 ? 2 : 3;
+    tlen = code == 3 ? 4 : code;
+    v = f->id;
+    i = 4;
+  }
+  else
+  {
+    /* The time shares the bytes of the identifier.*/
+    code = delta < (1UL << 5) ? 0 : delta < (1UL << 13) ? 1 : delta < (1UL << 21) ? 2 : 3;
+    tlen = code == 3 ? 4 : 0;
+    v = f->id & ((1UL << CAN_STREAM_STD_ID_BITS) - 1);
+    if(code < 3)
+      v |= delta << CAN_STREAM_STD_ID_BITS;
+    i = code < 3 ? 2 + code : 2;
+  }
+
+  rec[0] = (f->flags & (CAN_STREAM_IDE | CAN_STREAM_RTR)) | (code << 4) | kind;
+  for(; i > 0; i--, v >>= 8)
+    rec[len++] = (uint8_t)v;
+  while(tlen-- > 0)
+  {
+    rec[len++] = (uint8_t)delta;
+    delta >>= 8;
+  }
+  memcpy(&rec[len], body, n);
+  len += n;
+
+  CanStreamWrite(csp, Packet, rec, len, true);
+  if(csp->dropping)
+    csp->DroppedRecords++;
+  else
+    csp->Records++;
+}
+
+/**
+ * @brief   Resets the encoder.
+ *
+ * @param[out] csp    pointer to the @p CanStreamEncoder object
+ */
+void CanStreamInit(CanStreamEncoder *csp){
+  memset(csp, 0, sizeof(CanStreamEncoder));
+  CanStreamReset(csp);
+}
+
+/**
+ * @brief   Adds a CAN frame in full.
+ * @note    A DLC above 8 is sent as 8, the frame has 8 data bytes.
+ *
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ * @param[in] f       the CAN frame
+ */
+void CanStreamAddFrame(CanStreamEncoder *csp, PacketStruct *Packet, const CanStreamFrame *f){
+  uint8_t dlc = f->dlc > 8 ? 8 : f->dlc;
+
+  CanStreamPut(csp, Packet, f, dlc, f->data, (f->flags & CAN_STREAM_RTR) ? 0 : dlc);
+}
+
+/**
+ * @brief   Adds a CAN frame as a delta record.
+ *
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ * @param[in] f       the CAN frame, a data frame
+ * @param[in] bitmap  bit i is set if data byte i changed
+ */
+void CanStreamAddDelta(CanStreamEncoder *csp, PacketStruct *Packet, const CanStreamFrame *f,
+                       uint8_t bitmap){
+  uint8_t body[1 + 8];
+  uint8_t n = 1;
+  int i;
+
+  body[0] = bitmap;
+  for(i = 0; i < 8; i++)
+    if(bitmap & (1 << i))
+      body[n++] = f->data[i];
+  CanStreamPut(csp, Packet, f, CAN_STREAM_DELTA, body, n);
+}
+
+/**
+ * @brief   Closes the stream of the packet.
+ * @details Must be called before the packet is sent, the next record starts
+ *          the stream of a new packet.
+ *
+ * @param[in] csp     pointer to the @p CanStreamEncoder object
+ * @param[out] Packet pointer to the @p PacketStruct object
+ */
+void CanStreamEnd(CanStreamEncoder *csp, PacketStruct *Packet){
+  if(csp->used > 0 && !csp->dropping)
+  {
+    memset(&csp->pending.data[csp->used], CAN_STREAM_END, sizeof(csp->pending.data) - csp->used);
+    CanStreamEmit(csp, Packet);
+  }
+  CanStreamReset(csp);
+  if(csp->dropping)
+    csp->timed = false;
+  csp->started = false;
+  csp->dropping = false;
+}
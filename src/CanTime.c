@@ -0,0 +1,48 @@
+/**
+ * @file    CanTime.c
+ * @brief   Free running microsecond time base of the CAN frames.
+ */
+
+#include "CanTime.h"
+
+/**
+ * @brief   Starts the time base from zero.
+ */
+void CanTimeStart(void){
+  rccEnableTIM3(FALSE);
+  rccEnableTIM4(FALSE);
+
+  /* TIM3 ticks at 1 MHz, its update event is the trigger output.*/
+  TIM3->CR1 = 0;
+  TIM3->CR2 = TIM_CR2_MMS_1;
+  TIM3->PSC = STM32_TIMCLK1 / 1000000 - 1;
+  TIM3->ARR = 0xFFFF;
+  TIM3->EGR = TIM_EGR_UG;
+
+  /* TIM4 is clocked by the trigger output of TIM3 (ITR2).*/
+  TIM4->CR1 = 0;
+  TIM4->SMCR = TIM_SMCR_TS_1 | TIM_SMCR_SMS;
+  TIM4->PSC = 0;
+  TIM4->ARR = 0xFFFF;
+  TIM4->EGR = TIM_EGR_UG;
+
+  TIM4->CR1 = TIM_CR1_CEN;
+  TIM3->CR1 = TIM_CR1_CEN;
+}
+
+/**
+ * @brief   Current time in microseconds.
+ * @details If TIM4 changed while TIM3 was read, TIM3 wrapped in between: a
+ *          low TIM3 value goes with the new TIM4 value, a high one with the
+ *          old.
+ * @note    Can be called from any context.
+ */
+uint32_t CanTimeNow(void){
+  uint16_t hi = TIM4->CNT;
+  uint16_t lo = TIM3->CNT;
+  uint16_t hi2 = TIM4->CNT;
+
+  if(hi2 != hi && lo < 0x8000)
+    hi = hi2;
+  return ((uint32_t)hi << 16) | lo;
+}
@@ -9,6 +9,7 @@
 #include "ch.h"
 #include "hal.h"
 #include "at_mode.h"
+#include "DataLinkDma.h"
 
 static SerialConfig uartCfg1 =
 {
@@ -39,7 +40,11 @@ static THD_FUNCTION(Send, arg) {
       char c;
       sdRead(&SD2, &c, 1);
       palSetPad(GPIOB, GPIOB_LED1);
+#if DLL_USE_DMA_BACKEND
+      DLLDmaWrite(&DLLDMA1, &c, 1);
+#else
       sdPut(&SD1, c);
+#endif
   }
 }
 
@@ -54,7 +59,11 @@ static THD_FUNCTION(Receive, arg) {
   {
       palClearPad(GPIOB, GPIOB_LED1);
       char c;
+#if DLL_USE_DMA_BACKEND
+      DLLDmaReadTimeout(&DLLDMA1, &c, 1, TIME_INFINITE);
+#else
       sdRead(&SD1, &c, 1);
+#endif
       palSetPad(GPIOB, GPIOB_LED1);
       sdPut(&SD2, c);
   }
@@ -67,7 +76,11 @@ static THD_FUNCTION(Receive, arg) {
 void init_atmode()
 {
   sdInit();
+#if DLL_USE_DMA_BACKEND
+  DLLDmaStart(&DLLDMA1, uartCfg1.speed);     //Start the DMA backend on USART1
+#else
   sdStart(&SD1, &uartCfg1);     //Start Serial Driver 1
+#endif
   sdStart(&SD2, &uartCfg2);     //Start Serial Driver 2
 
   chThdCreateStatic(waSend, sizeof(waSend), NORMALPRIO, Send, NULL);
@@ -20,6 +20,11 @@
 
 #include "console.h"
 #include "EspUart.h"
+#include "crc.h"
+#include "CanFilter.h"
+#include "CanFlush.h"
+#include "CanOverload.h"
+#include "CanPriority.h"
 
 /*===========================================================================*/
 /* Command line related.                                                     */
@@ -42,6 +47,23 @@ static void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
   chprintf(chp, "heap free total  : %u bytes\r\n", size);
 }
 
+#if CH_DBG_FILL_THREADS
+/*
+ * Bytes of the working area never used by the thread, the fill pattern is
+ * still there. The stack grows down towards the thread structure.
+ */
+static size_t stack_unused(thread_t *tp) {
+  const uint8_t *p = (const uint8_t *)(tp + 1);
+  size_t n = 0;
+
+  if (tp == &ch.mainthread)
+    return 0;
+  while (p[n] == CH_DBG_STACK_FILL_VALUE)
+    n++;
+  return n;
+}
+#endif
+
 static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
   static const char *states[] = {CH_STATE_NAMES};
   thread_t *tp;
@@ -51,13 +73,21 @@ static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
     chprintf(chp, "Usage: threads\r\n");
     return;
   }
-  chprintf(chp, "    addr    stack prio refs     state\r\n");
+  chprintf(chp, "    addr    stack prio refs     state");
+#if CH_DBG_FILL_THREADS
+  chprintf(chp, "  unused");
+#endif
+  chprintf(chp, "\r\n");
   tp = chRegFirstThread();
   do {
-    chprintf(chp, "%08lx %08lx %4lu %4lu %9s %lu\r\n",
+    chprintf(chp, "%08lx %08lx %4lu %4lu %9s",
              (uint32_t)tp, (uint32_t)tp->p_ctx.r13,
              (uint32_t)tp->p_prio, (uint32_t)(tp->p_refs - 1),
              states[tp->p_state]);
+#if CH_DBG_FILL_THREADS
+    chprintf(chp, " %7u", stack_unused(tp));
+#endif
+    chprintf(chp, "\r\n");
     tp = chRegNextThread(tp);
   } while (tp != NULL);
 }
@@ -79,11 +109,224 @@ static void cmd_test(BaseSequentialStream *chp, int argc, char *argv[]) {
   chThdWait(tp);
 }
 
+static void cmd_crc(BaseSequentialStream *chp, int argc, char *argv[]) {
+  static uint32_t block[256];
+  volatile uint32_t sink;
+  rtcnt_t t;
+  size_t i;
+
+  (void)argv;
+  if (argc > 0) {
+    chprintf(chp, "Usage: crc\r\n");
+    return;
+  }
+  for (i = 0; i < 256; i++)
+    block[i] = i * 0x9E3779B9;
+
+  t = chSysGetRealtimeCounterX();
+  sink = Crc8Table(0, (uint8_t *)block, 15);
+  chprintf(chp, "crc8-table    15 byte: %u cycles\r\n", chSysGetRealtimeCounterX() - t);
+  t = chSysGetRealtimeCounterX();
+  sink = Crc8Sliced(0, (uint8_t *)block, 15);
+  chprintf(chp, "crc8-sliced   15 byte: %u cycles\r\n", chSysGetRealtimeCounterX() - t);
+  t = chSysGetRealtimeCounterX();
+  sink = Crc8Table(0, (uint8_t *)block, sizeof(block));
+  chprintf(chp, "crc8-table  1024 byte: %u cycles\r\n", chSysGetRealtimeCounterX() - t);
+  t = chSysGetRealtimeCounterX();
+  sink = Crc8Sliced(0, (uint8_t *)block, sizeof(block));
+  chprintf(chp, "crc8-sliced 1024 byte: %u cycles\r\n", chSysGetRealtimeCounterX() - t);
+  (void)sink;
+}
+
+static void cmd_filter(BaseSequentialStream *chp, int argc, char *argv[]) {
+  CanFilterRule rules[CAN_FILTER_MAX_RULES];
+  uint8_t flags = 0, count, banks;
+  uint32_t mask;
+  int i;
+
+  if (argc == 0) {
+    /* A copy, the receiving thread of the DataLinkLayer is not held up by
+       the output.*/
+    chMtxLock(&CanFilterT.lock);
+    count = CanFilterT.count;
+    banks = CanFilterT.banks;
+    memcpy(rules, CanFilterT.rules, count * sizeof(CanFilterRule));
+    chMtxUnlock(&CanFilterT.lock);
+    for (i = 0; i < count; i++)
+      chprintf(chp, "%s %08x/%08x fifo%d\r\n",
+               (rules[i].flags & CAN_RULE_IDE) ? "ext" : "std",
+               rules[i].id, rules[i].mask,
+               (rules[i].flags & CAN_RULE_FIFO1) ? 1 : 0);
+    chprintf(chp, "%d rules, %d banks in use\r\n", count, banks);
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "clear") == 0) {
+    CanFilterClear(&CanFilterT);
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "apply") == 0) {
+    i = CanFilterApply(&CanFilterT);
+    if (i < 0)
+      chprintf(chp, "The rules do not fit the filter banks\r\n");
+    else
+      chprintf(chp, "%d banks in use\r\n", i);
+    return;
+  }
+  if (argc >= 2 && strcmp(argv[0], "add") == 0) {
+    mask = 0xFFFFFFFF;
+    for (i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "ext") == 0)
+        flags |= CAN_RULE_IDE;
+      else if (strcmp(argv[i], "fifo1") == 0)
+        flags |= CAN_RULE_FIFO1;
+      else
+        mask = strtoul(argv[i], NULL, 0);
+    }
+    if (!CanFilterAdd(&CanFilterT, strtoul(argv[1], NULL, 0), mask, flags))
+      chprintf(chp, "The rule table is full\r\n");
+    return;
+  }
+  chprintf(chp, "Usage: filter [clear | apply | add id [mask] [ext] [fifo1]]\r\n");
+}
+
+static void cmd_flush(BaseSequentialStream *chp, int argc, char *argv[]) {
+  CanFlushPolicy *cfp = &CanFlushP;
+  long batches;
+
+  if (argc == 0) {
+    batches = cfp->Flushes[CAN_FLUSH_FULL] + cfp->Flushes[CAN_FLUSH_DEADLINE] +
+              cfp->Flushes[CAN_FLUSH_GAP];
+    chprintf(chp, "budget %d us, gap %d us, full %d frames\r\n",
+             cfp->config.budget, cfp->config.gap, cfp->config.full);
+    chprintf(chp, "flushes: %d full, %d deadline, %d gap\r\n",
+             cfp->Flushes[CAN_FLUSH_FULL], cfp->Flushes[CAN_FLUSH_DEADLINE],
+             cfp->Flushes[CAN_FLUSH_GAP]);
+    if (batches > 0) {
+      chprintf(chp, "batch: min %d, avg %d, max %d CAN frames\r\n",
+               cfp->MinBatch, cfp->BatchedFrames / batches, cfp->MaxBatch);
+      chprintf(chp, "queueing delay: avg %d us, max %d us\r\n",
+               (long)(cfp->DelaySum / cfp->BatchedFrames), cfp->MaxDelay);
+    }
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "reset") == 0) {
+    CanFlushResetStats(cfp);
+    return;
+  }
+  if (argc == 2 || argc == 3) {
+    if (!CanFlushConfigure(cfp, strtoul(argv[0], NULL, 0), strtoul(argv[1], NULL, 0),
+                           argc == 3 ? strtoul(argv[2], NULL, 0) : cfp->config.full))
+      chprintf(chp, "Out of range, budget 1..%d us, gap 0..%d us, full 1..%d frames\r\n",
+               CAN_FLUSH_MAX_US, CAN_FLUSH_MAX_US, MAX_FRAME_PER_PACKET - CAN_FLUSH_RESERVE);
+    return;
+  }
+  chprintf(chp, "Usage: flush [reset | budget_us gap_us [full_frames]]\r\n");
+}
+
+static void cmd_overload(BaseSequentialStream *chp, int argc, char *argv[]) {
+  static const char *const names[] = {"newest", "oldest", "shed"};
+  CanOverloadQueue *coq = &CanOverloadQ;
+  int i;
+
+  if (argc == 0) {
+    chprintf(chp, "policy %s, class limits", names[coq->policy]);
+    for (i = 0; i < CAN_OVERLOAD_CLASSES - 1; i++)
+      chprintf(chp, " %03x", coq->limits[i]);
+    chprintf(chp, "\r\nqueued %d/%d, high-water %d\r\n",
+             CanOverloadPending(coq), CAN_OVERLOAD_QUEUE_SIZE, coq->HighWater);
+    chprintf(chp, "dropped: %d newest, %d oldest, shed",
+             coq->DroppedNewest, coq->DroppedOldest);
+    for (i = 0; i < CAN_OVERLOAD_CLASSES; i++)
+      chprintf(chp, " %d", coq->Shed[i]);
+    chprintf(chp, "\r\n");
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "reset") == 0) {
+    CanOverloadResetStats(coq);
+    return;
+  }
+  for (i = 0; i < 3; i++) {
+    if (strcmp(argv[0], names[i]) == 0)
+      break;
+  }
+  if (i < 3 && (argc == 1 || argc == CAN_OVERLOAD_CLASSES)) {
+    if (argc == CAN_OVERLOAD_CLASSES) {
+      int c;
+      for (c = 1; c < CAN_OVERLOAD_CLASSES; c++)
+        coq->limits[c - 1] = strtoul(argv[c], NULL, 0);
+    }
+    coq->policy = (CanOverloadPolicy_t)i;
+    return;
+  }
+  chprintf(chp, "Usage: overload [reset | newest | oldest | shed [limit ...]]\r\n");
+}
+
+#if DLL_USE_PRIORITY_LANE
+/*
+ * The DMA transfers of the output ring are cut only while there are
+ * priority identifiers.
+ */
+static void priority_batch(DLLDriver *dllp, const CanPriorityTable *cptp) {
+  DLLSetPriorityBatch(dllp, cptp->count > 0 ? DLL_PRIORITY_BULK_BATCH : 0);
+}
+
+static void cmd_priority(BaseSequentialStream *chp, int argc, char *argv[]) {
+  CanPriorityTable *cptp = &CanPriorityT;
+  DLLDriver *dllp = WIFID1.DLLObject;
+  bool ext;
+  int i;
+
+  if (argc == 0) {
+    for (i = 0; i < cptp->count; i++)
+      chprintf(chp, (cptp->ids[i] & CAN_PRIORITY_IDE) ? "ext %08x\r\n" : "std %03x\r\n",
+               cptp->ids[i] & ~CAN_PRIORITY_IDE);
+    chprintf(chp, "%d identifiers, weight %d\r\n", cptp->count, dllp->DLLPriorityWeight);
+    chprintf(chp, "forwarded %d, lane full %d\r\n", cptp->Forwarded, cptp->LaneFull);
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "clear") == 0) {
+    cptp->count = 0;
+    priority_batch(dllp, cptp);
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "reset") == 0) {
+    cptp->Forwarded = 0;
+    cptp->LaneFull = 0;
+    return;
+  }
+  if (argc == 2 && strcmp(argv[0], "weight") == 0) {
+    DLLSetPriorityWeight(dllp, strtoul(argv[1], NULL, 0));
+    return;
+  }
+  ext = argc == 3 && strcmp(argv[2], "ext") == 0;
+  if ((argc == 2 || ext) && strcmp(argv[0], "add") == 0) {
+    if (!CanPriorityAdd(cptp, strtoul(argv[1], NULL, 0), ext))
+      chprintf(chp, "The priority table is full\r\n");
+    priority_batch(dllp, cptp);
+    return;
+  }
+  if ((argc == 2 || ext) && strcmp(argv[0], "del") == 0) {
+    if (!CanPriorityRemove(cptp, strtoul(argv[1], NULL, 0), ext))
+      chprintf(chp, "Not in the priority table\r\n");
+    priority_batch(dllp, cptp);
+    return;
+  }
+  chprintf(chp, "Usage: priority [clear | reset | weight n | add id [ext] | del id [ext]]\r\n");
+}
+#endif
+
 static const ShellCommand commands[] = {
   {"mem", cmd_mem},
   {"threads", cmd_threads},
   {"test", cmd_test},
   {"getdllstats", GetDllStats},
+  {"crc", cmd_crc},
+  {"filter", cmd_filter},
+  {"flush", cmd_flush},
+  {"overload", cmd_overload},
+#if DLL_USE_PRIORITY_LANE
+  {"priority", cmd_priority},
+#endif
   {NULL, NULL}
 };
 
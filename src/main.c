@@ -26,8 +26,13 @@
 #include "DataLinkLayer.h"
 
 static DLLSerialConfig WIFICfg = {
+#if DLL_USE_DMA_BACKEND
+  &DLLDMA1,
+#else
   &SD1,
-  921600
+#endif
+  921600,
+  CanCommFrameReceived
 };
 
 
@@ -48,13 +53,40 @@ void GetDllStats(BaseSequentialStream *chp, int argc, char *argv[]) {
     chprintf(chp, "Sync: %d\r\n", Stats->SyncCounter);
     chprintf(chp, "SyncFrameSentCounter: %d\r\n", Stats->SyncFrameSentCounter);
     chprintf(chp, "SyncTimeout: %d\r\n", Stats->SyncTimeout);
-    chprintf(chp, "FreeFilledBuffer: %d\r\n", Stats->FreeFilledBuffer);
-    chprintf(chp, "FreeFreeBuffer: %d\r\n", Stats->FreeFreeBuffer);
+    chprintf(chp, "DmaTransfers: %d\r\n", Stats->DmaTransfers);
+    chprintf(chp, "Realign: %d\r\n", Stats->RealignCounter);
+    chprintf(chp, "FrameErrors: %d\r\n", Stats->FrameErrors);
+    chprintf(chp, "RxOverruns: %d\r\n", Stats->RxOverruns);
+    chprintf(chp, "Retransmissions: %d\r\n", Stats->Retransmissions);
+    chprintf(chp, "ArqTimeouts: %d\r\n", Stats->ArqTimeouts);
+    chprintf(chp, "CreditStalls: %d\r\n", Stats->CreditStalls);
+    chprintf(chp, "CreditStarvedMs: %d\r\n", Stats->CreditStarvedMs);
+    chprintf(chp, "SentBytes: %d\r\n", Stats->SentBytes);
+    chprintf(chp, "PriorityFrames: %d\r\n", Stats->PriorityFrames);
+    chprintf(chp, "QueuedFrames: %d\r\n", Stats->QueuedFrames);
+    chprintf(chp, "PeakQueuedFrames: %d\r\n", Stats->PeakQueuedFrames);
+    chprintf(chp, "MinFreeSlots: %d\r\n", Stats->MinFreeSlots);
     chprintf(chp, "CalculatedLostFrames: %d\r\n", lost);
 
     chprintf(chp, "\r\n");
     chprintf(chp, "SentPacket: %d\r\n", NWLStats->SentPacket);
+    chprintf(chp, "SentPriority: %d\r\n", NWLStats->SentPriority);
     chprintf(chp, "FrameNumber: %d\r\n", NWLStats->FrameNumber);
+    chprintf(chp, "DroppedFrames: %d\r\n", NWLStats->DroppedFrames);
+    chprintf(chp, "CanRecords: %d\r\n", CanStreamE.Records);
+    chprintf(chp, "StreamFrames: %d\r\n", CanStreamE.StreamFrames);
+    chprintf(chp, "DroppedRecords: %d\r\n", CanStreamE.DroppedRecords);
+#if CAN_USE_DELTA
+    chprintf(chp, "Keyframes: %d\r\n", CanDeltaE.Keyframes);
+    chprintf(chp, "Deltas: %d\r\n", CanDeltaE.Deltas);
+#endif
+#if CAN_USE_CAPTURE
+    chprintf(chp, "Captured: %d\r\n", CanCaptureR.Captured);
+    chprintf(chp, "Fifo0Overruns: %d\r\n", CanCaptureR.FifoOverruns[0]);
+    chprintf(chp, "Fifo1Overruns: %d\r\n", CanCaptureR.FifoOverruns[1]);
+    chprintf(chp, "RingOverflows: %d\r\n", CanCaptureR.RingOverflows);
+    chprintf(chp, "PeakBatch: %d\r\n", CanCaptureR.PeakBatch);
+#endif
 
     chThdSleepMilliseconds(100);
   }
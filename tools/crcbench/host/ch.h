@@ -0,0 +1,18 @@
+/*
+ * ch.h
+ *
+ * Host replacement of the ChibiOS header, it gives only what the CRC
+ * module needs to build on the PC.
+ */
+
+#ifndef HOST_CH_H_
+#define HOST_CH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FALSE 0
+#define TRUE  1
+
+#endif /* HOST_CH_H_ */
@@ -0,0 +1,12 @@
+/*
+ * hal.h
+ *
+ * Host replacement of the ChibiOS HAL header.
+ */
+
+#ifndef HOST_HAL_H_
+#define HOST_HAL_H_
+
+#include "ch.h"
+
+#endif /* HOST_HAL_H_ */
@@ -0,0 +1,843 @@
+/*
+ * dcdecode.c
+ *
+ * Reference decoder of the DualCom frame stream, see dcdecode.h.
+ *
+ * The CRC-8 of a frame is linear, so the check of a whole frame is the XOR
+ * of one table lookup per byte position. The lookups of a frame and of the
+ * following frames do not depend on each other and DcCheckFrames() verifies
+ * the frames of a fixed framing stream in batches of four in place, the
+ * bytes are copied only around a damaged frame.
+ *
+ * A frame with its CRC byte is valid if its 120 bit polynomial is a
+ * multiple of the CRC polynomial. On the x86 hosts with PCLMULQDQ the
+ * batches are checked with carry-less multiplications instead, a fold of
+ * the frame to 64 bits and a Barrett reduction, three multiplications per
+ * frame and no table.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "dcdecode.h"
+#include "crc.h"
+#include "CanStream.h"
+#include "CanPriority.h"
+#include "NetworkLayer.h"
+#include "DataLinkLayer.h"
+
+/*
+ * Builds the carry-less multiplication check, used if the processor has
+ * it. FALSE builds the table check only.
+ */
+#if !defined(DC_USE_CLMUL)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DC_USE_CLMUL        TRUE
+#else
+#define DC_USE_CLMUL        FALSE
+#endif
+#endif
+
+#if DC_USE_CLMUL
+#include <immintrin.h>
+#endif
+
+#if DC_FRAME_SIZE != FRAME_SIZE_BYTE || DC_PACKET_FRAMES != MAX_FRAME_PER_PACKET || \
+    DC_RECORD_SIZE != CAN_STREAM_RECORD_SIZE || DC_FRAMING_COBS != DLL_FRAMING_COBS
+#error "dcdecode.h does not match the firmware"
+#endif
+
+#if DC_CAN_IDE != CAN_STREAM_IDE || DC_CAN_RTR != CAN_STREAM_RTR
+#error "the flags of dcdecode.h do not match CanStream.h"
+#endif
+
+#if (DC_IDS & (DC_IDS - 1)) != 0
+#error "DC_IDS must be a power of two"
+#endif
+
+/* dccrcpos[i][x] is the CRC-8 of a frame whose only nonzero byte is x at
+   position i.*/
+static uint8_t dccrcpos[DC_FRAME_SIZE][256];
+static pthread_once_t dccrconce = PTHREAD_ONCE_INIT;
+#if DC_USE_CLMUL
+static bool dcclmul;
+#endif
+
+static void DcCrcInit(void){
+  int i, j, x;
+
+  for (i = 0; i < DC_FRAME_SIZE; i++)
+    for (x = 0; x < 256; x++) {
+      uint8_t c = crctmb[x];
+      for (j = i + 1; j < DC_FRAME_SIZE; j++)
+        c = crctmb[c];
+      dccrcpos[i][x] = c;
+    }
+#if DC_USE_CLMUL
+  dcclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#endif
+}
+
+/*
+ * CRC-8 of a whole frame, zero if the frame is valid.
+ */
+static inline uint8_t DcFrameCrc(const uint8_t *p){
+  uint8_t c = 0;
+  int i;
+
+  for (i = 0; i < DC_FRAME_SIZE; i++)
+    c ^= dccrcpos[i][p[i]];
+  return c;
+}
+
+#if DC_USE_CLMUL
+/* The CRC polynomial x^8+x^7+x^6+x^4+x^2+1, x^64 mod P and x^64 / P.*/
+#define DC_CRC_POLY         0x1D5
+#define DC_CRC_FOLD         0x43
+#define DC_CRC_BARRETT      0x1A70FD16EF8C4CFULL
+
+/*
+ * Remainder of the frame at @p p in the low byte, the 16 byte load takes
+ * the first byte of the next frame and drops it.
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i DcFrameRem(const uint8_t *p, __m128i rev, __m128i k, __m128i poly){
+  __m128i v, r, q;
+
+  /* Byte 0 becomes the most significant, the frame is H * x^64 + L.*/
+  v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), rev);
+  /* R = H * (x^64 mod P) + L, the same remainder in 64 bits.*/
+  r = _mm_xor_si128(_mm_clmulepi64_si128(v, k, 0x01), v);
+  /* Q = (R / x^8) * (x^64 / P) / x^56, the quotient of R / P.*/
+  q = _mm_srli_si128(_mm_clmulepi64_si128(_mm_srli_epi64(r, 8), k, 0x10), 7);
+  return _mm_xor_si128(r, _mm_clmulepi64_si128(q, poly, 0x00));
+}
+
+/*
+ * Valid frames in batches of four, the frame after the batch must exist.
+ */
+__attribute__((target("pclmul,ssse3")))
+static size_t DcCheckClmul(const uint8_t *p, size_t n){
+  const __m128i rev = _mm_setr_epi8(14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, -1);
+  const __m128i k = _mm_set_epi64x(DC_CRC_BARRETT, DC_CRC_FOLD);
+  const __m128i poly = _mm_set_epi64x(0, DC_CRC_POLY);
+  size_t i;
+
+  for (i = 0; i + 4 < n; i += 4, p += 4 * DC_FRAME_SIZE) {
+    __m128i r = _mm_or_si128(
+        _mm_or_si128(DcFrameRem(p, rev, k, poly), DcFrameRem(p + DC_FRAME_SIZE, rev, k, poly)),
+        _mm_or_si128(DcFrameRem(p + 2 * DC_FRAME_SIZE, rev, k, poly),
+                     DcFrameRem(p + 3 * DC_FRAME_SIZE, rev, k, poly)));
+    if ((uint8_t)_mm_cvtsi128_si32(r) != 0)
+      break;
+  }
+  return i;
+}
+#endif
+
+/**
+ * @brief   Checks the CRC of consecutive frames.
+ *
+ * @param[in] p       the frames
+ * @param[in] n       number of frames
+ * @return            the number of valid frames before the first damaged one
+ */
+size_t DcCheckFrames(const uint8_t *p, size_t n){
+  size_t i = 0;
+
+  pthread_once(&dccrconce, DcCrcInit);
+#if DC_USE_CLMUL
+  if (dcclmul) {
+    i = DcCheckClmul(p, n);
+    p += i * DC_FRAME_SIZE;
+  }
+#endif
+  for (; i + 4 <= n; i += 4, p += 4 * DC_FRAME_SIZE)
+    if ((DcFrameCrc(p) | DcFrameCrc(p + DC_FRAME_SIZE) |
+         DcFrameCrc(p + 2 * DC_FRAME_SIZE) | DcFrameCrc(p + 3 * DC_FRAME_SIZE)) != 0)
+      break;
+  for (; i < n; i++, p += DC_FRAME_SIZE)
+    if (DcFrameCrc(p) != 0)
+      break;
+  return i;
+}
+
+/**
+ * @brief   Initializes a decoder.
+ *
+ * @param[out] dp       the decoder
+ * @param[in] framing   DC_FRAMING_FIXED or DC_FRAMING_COBS
+ * @param[in] cb        called for every decoded CAN frame
+ * @param[in] arg       argument of the callbacks
+ */
+void DcDecoderInit(DcDecoder *dp, unsigned framing, DcFrameCallback cb, void *arg){
+  pthread_once(&dccrconce, DcCrcInit);
+  memset(dp, 0, sizeof(DcDecoder));
+  dp->framing = framing;
+  dp->cb = cb;
+  dp->arg = arg;
+  dp->cobscode = 0xFF;
+  dp->gen = 1;
+}
+
+/*
+ * The fields are read as whole words and masked, the lengths coded in the
+ * record headers cost no branches. The 4 or 8 bytes read must be there,
+ * the stream buffer has room behind its end. &dcones[8 - n] is a mask of
+ * n bytes.
+ */
+static const uint8_t dcones[16] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/*
+ * Little endian field of @p n bytes, at most four.
+ */
+static inline uint32_t DcLE(const uint8_t *p, size_t n){
+  uint32_t v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+
+  return v & (uint32_t)((1ULL << (8 * n)) - 1);
+}
+
+/*
+ * The first @p n bytes of @p p, the rest of the 8 bytes zero.
+ */
+static inline uint64_t DcBytes(const uint8_t *p, size_t n){
+  uint64_t v, m;
+
+  memcpy(&v, p, 8);
+  memcpy(&m, &dcones[8 - n], 8);
+  return v & m;
+}
+
+static void DcGap(DcDecoder *dp, unsigned kind, unsigned lost, uint8_t number){
+  if (dp->gapcb != NULL)
+    dp->gapcb(dp->arg, kind, lost, number);
+}
+
+/*
+ * Extends a receive time to 64 bits, the times come in order apart from
+ * the jitter of the records.
+ */
+static uint64_t DcTime(DcDecoder *dp, uint32_t t){
+  if (!dp->timeknown) {
+    dp->time = t;
+    dp->timeknown = true;
+  }else
+    dp->time += (int64_t)(int32_t)(t - (uint32_t)dp->time);
+  return dp->time;
+}
+
+/*
+ * Extends the low @p w bits of a receive time, w < 32, to the nearest time
+ * of the last one known. False if there is none yet.
+ */
+static bool DcTimeLow(DcDecoder *dp, uint32_t t, unsigned w){
+  uint32_t m = (1UL << w) - 1, d;
+
+  if (!dp->timeknown)
+    return false;
+  d = (t - (uint32_t)dp->time) & m;
+  dp->time += d > (m >> 1) ? (int64_t)d - m - 1 : (int64_t)d;
+  return true;
+}
+
+/*
+ * Payload of a CAN ID for the delta records, NULL if unknown or if the
+ * table is full.
+ */
+static uint8_t *DcState(DcDecoder *dp, uint32_t key, uint8_t *dlc, bool add){
+  uint32_t h = (key * 2654435761U) >> 16;
+  unsigned n, i = 0;
+
+  for (n = 0; n < DC_IDS; n++) {
+    i = (h + n) & (DC_IDS - 1);
+    if (dp->ids[i].gen != dp->gen) {
+      if (!add || dp->nids >= DC_IDS * 3 / 4)
+        return NULL;
+      dp->ids[i].gen = dp->gen;
+      dp->ids[i].key = key;
+      dp->nids++;
+      break;
+    }
+    if (dp->ids[i].key == key)
+      break;
+  }
+  if (add)
+    dp->ids[i].dlc = *dlc;
+  else
+    *dlc = dp->ids[i].dlc;
+  return dp->ids[i].data;
+}
+
+/*
+ * Forgets the payloads and the time of the stream, the following delta
+ * records have no keyframe and the records no time until a base record.
+ */
+static void DcForget(DcDecoder *dp){
+  dp->gen++;
+  dp->nids = 0;
+  dp->streamtimed = false;
+}
+
+static void DcEmit(DcDecoder *dp, DcCanFrame *f){
+  dp->CanFrames++;
+  dp->cb(dp->arg, f);
+}
+
+/*
+ * Checks the start of the record following the one at @p from against the
+ * offsets of the frames: the first record starting in a frame is where its
+ * offset tells, a frame with no start is covered by one record. A frame
+ * missing from the stream shifts the records after it.
+ */
+static bool DcAnchored(DcDecoder *dp, size_t from, size_t to){
+  unsigned j = from / DC_FRAME_DATA, m = to / DC_FRAME_DATA, i;
+
+  if (m >= dp->nframes)
+    return true;
+  for (i = j + 1; i < m; i++)
+    if (dp->offs[i] != CAN_STREAM_NOSTART)
+      return false;
+  if (dp->stream[to] == CAN_STREAM_END)
+    return m == j || dp->offs[m] == CAN_STREAM_NOSTART;
+  return (m == j) | (dp->offs[m] == to % DC_FRAME_DATA);
+}
+
+/*
+ * Position of the first record starting after the frame of @p p, the
+ * length of the stream if none.
+ */
+static size_t DcNextAnchor(DcDecoder *dp, size_t p){
+  unsigned i;
+
+  for (i = p / DC_FRAME_DATA + 1; i < dp->nframes; i++)
+    if (dp->offs[i] != CAN_STREAM_NOSTART)
+      return i * DC_FRAME_DATA + dp->offs[i];
+  return dp->len;
+}
+
+/*
+ * Decodes the records of the stream received so far. A record which does
+ * not fit the offsets of the frames is dropped, the decoding continues at
+ * the next record start of a frame without time and keyframes. The time
+ * of the last record is kept for the next packet.
+ */
+static void DcParse(DcDecoder *dp){
+  const uint8_t *s = dp->stream;
+  size_t p = dp->off0, len = dp->len;
+  bool timed = dp->timed;
+  uint32_t t = dp->streamtime, v;
+
+  while (p < len) {
+    uint8_t h = s[p], kind = h & CAN_STREAM_KIND, code = (h & CAN_STREAM_TIME) >> 4;
+    bool ext = h & CAN_STREAM_IDE;
+    size_t idlen = ext ? 4 : code == 3 ? 2 : 2 + code, tlen = code == 3 ? 4 : ext ? code : 0;
+    size_t q = p + 1 + idlen + tlen, blen = 0;
+    bool shifted = false;
+    uint8_t *state;
+    DcCanFrame f;
+    int i;
+
+    if (h == CAN_STREAM_END) {
+      if (DcNextAnchor(dp, p) == len) {
+        p = len;
+        break;
+      }
+      shifted = true;
+    }else if (h == CAN_STREAM_BASE) {
+      q = p + 1;
+      blen = CAN_STREAM_BASE_SIZE;
+    }else if (q > len)
+      break;
+    else if (kind <= 8)
+      blen = (h & CAN_STREAM_RTR) ? 0 : kind;
+    else if (kind == CAN_STREAM_DELTA && q < len)
+      blen = 1 + __builtin_popcount(s[q]);
+    else if (kind == CAN_STREAM_DELTA)
+      break;
+    else
+      shifted = true;
+    if (!shifted && q + blen > len)
+      break;
+
+    if (shifted || !DcAnchored(dp, p, q + blen)) {
+      dp->LostRecords++;
+      DcForget(dp);
+      timed = false;
+      p = DcNextAnchor(dp, p);
+      continue;
+    }
+    if (h == CAN_STREAM_BASE) {
+      t = DcLE(&s[q], CAN_STREAM_BASE_SIZE);
+      timed = true;
+      p = q + blen;
+      continue;
+    }
+
+    /* The time of a standard identifier is above it in the same bytes.*/
+    memset(&f, 0, sizeof(f));
+    f.flags = h & (CAN_STREAM_IDE | CAN_STREAM_RTR);
+    v = DcLE(&s[p + 1], idlen);
+    f.id = ext ? v : v & ((1U << CAN_STREAM_STD_ID_BITS) - 1);
+    f.number = dp->number;
+    t += (ext ? 0 : v >> CAN_STREAM_STD_ID_BITS) + DcLE(&s[p + 1 + idlen], tlen);
+    if (timed) {
+      f.flags |= DC_CAN_TIMED;
+      f.time = DcTime(dp, t);
+    }else
+      f.time = dp->time;
+    p = q;
+
+    if (kind <= 8) {
+      uint64_t v = DcBytes(&s[p], blen);
+
+      f.dlc = kind;
+      memcpy(f.data, &v, 8);
+      if (!(h & CAN_STREAM_RTR)) {
+        state = DcState(dp, (f.id << 1) | !!(h & CAN_STREAM_IDE), &f.dlc, true);
+        if (state != NULL)
+          memcpy(state, f.data, 8);
+      }
+    }else {
+      const uint8_t *d = &s[p + 1];
+      state = DcState(dp, (f.id << 1) | !!(h & CAN_STREAM_IDE), &f.dlc, false);
+      if (state == NULL) {
+        dp->LostRecords++;
+        p += blen;
+        continue;
+      }
+      /* The new byte i follows the changes below it, the iterations do
+         not depend on each other.*/
+      for (i = 0; i < 8; i++) {
+        uint8_t b = d[__builtin_popcount(s[p] & ((1U << i) - 1))];
+
+        state[i] = (s[p] & (1U << i)) ? b : state[i];
+      }
+      memcpy(f.data, state, 8);
+    }
+    p += blen;
+    DcEmit(dp, &f);
+  }
+  if (p < len) {
+    dp->LostRecords++;
+    timed = false;
+  }
+  dp->streamtime = t;
+  dp->streamtimed = timed;
+}
+
+/*
+ * Starts the stream of a packet with a frame, after a gap at the first
+ * record starting in the frame. The stream keeps the bytes before it, the
+ * positions in the stream and in the frames stay the same.
+ */
+static void DcStreamStart(DcDecoder *dp, const uint8_t *fp){
+  uint8_t off = 0;
+
+  dp->len = 0;
+  dp->timed = !dp->gap && dp->streamtimed;
+  if (dp->gap) {
+    off = fp[0] & 0x0F;
+    if (off == CAN_STREAM_NOSTART || off >= DC_FRAME_DATA)
+      return;
+    DcForget(dp);
+    dp->gap = false;
+  }
+  dp->streaming = true;
+  dp->off0 = off;
+  dp->offs[0] = fp[0] & 0x0F;
+  dp->nframes = 1;
+  memcpy(dp->stream, &fp[2], DC_FRAME_DATA);
+  dp->len = DC_FRAME_DATA;
+}
+
+/*
+ * Closes the packet being received, complete if its control frame arrived.
+ * The missing packets are counted by the numbers of the complete packets
+ * and of the packets which follow them, so a stray number in a damaged
+ * stream is not taken for a gap.
+ */
+static void DcPacketEnd(DcDecoder *dp, bool complete){
+  if (dp->streaming)
+    DcParse(dp);
+  if (complete) {
+    dp->Packets++;
+    dp->PacketFill[dp->frames <= DC_PACKET_FRAMES ? dp->frames : DC_PACKET_FRAMES]++;
+  }
+  if ((complete || dp->number == (uint8_t)(dp->last + 1)) &&
+      (!dp->numbered || dp->number != dp->last)) {
+    uint8_t lost = dp->number - dp->last - 1;
+    if (dp->numbered && lost > 0) {
+      dp->LostPackets += lost;
+      DcGap(dp, DC_GAP_PACKETS, lost, dp->number);
+    }
+    dp->numbered = true;
+    dp->last = dp->number;
+  }
+  dp->open = false;
+  dp->streaming = false;
+}
+
+/*
+ * Accounts a frame of a packet. The delta records of a packet which does
+ * not follow the last one may refer to the missing packets, the payloads
+ * are forgotten.
+ */
+static void DcPacketFrame(DcDecoder *dp, uint8_t number){
+  /* A new FrameNumber without the control frame, it was lost.*/
+  if (dp->open && number != dp->number) {
+    DcPacketEnd(dp, false);
+    dp->gap = true;
+  }
+  if (!dp->open) {
+    if (dp->numbered && number != (uint8_t)(dp->last + 1))
+      DcForget(dp);
+    dp->number = number;
+    dp->open = true;
+    dp->frames = 0;
+  }
+  if (dp->frames < 0xFF)
+    dp->frames++;
+}
+
+/*
+ * The fields of a frame with valid CRC are checked too, the CRC-8 of a
+ * damaged stream is valid once in 256 frames. dclow[] holds the low
+ * nibbles of the Id each frame type may have, the DLC of the priority
+ * frames.
+ */
+static const uint16_t dclow[16] = {
+  [FTYPE_USERDATA >> 4]    = 1U << 0,
+  [FTYPE_CANSTREAM >> 4]   = ((1U << DC_FRAME_DATA) - 1) | (1U << CAN_STREAM_NOSTART),
+  [FTYPE_UDPSEND >> 4]     = 1U << 0,
+  [FTYPE_CANPRIORITY >> 4] = (1U << 9) - 1,
+};
+
+static inline bool DcLowValid(uint8_t id){
+  return (dclow[id >> 4] >> (id & 0x0F)) & 1;
+}
+
+/*
+ * The number of data bytes of a priority frame.
+ */
+static inline unsigned DcPriorityLen(const uint8_t *fp, uint32_t cid){
+  return (cid & CAN_PRIORITY_RTR) ? 0 : fp[0] & 0x0F;
+}
+
+/*
+ * The identifier of a priority frame and its bytes past the data and the
+ * time, which are zero. The time is in bits 11..29 of a standard
+ * identifier.
+ */
+static bool DcPriorityValid(const uint8_t *fp){
+  uint32_t cid = DcLE(&fp[2], 4);
+  bool ext = cid & CAN_PRIORITY_IDE;
+  uint32_t mask = ext ? 0x1FFFFFFFUL : 0x3FFFFFFFUL;
+  unsigned len = DcPriorityLen(fp, cid);
+  uint64_t v;
+
+  if ((cid & ~(mask | CAN_PRIORITY_IDE | CAN_PRIORITY_RTR)) != 0)
+    return false;
+  memcpy(&v, &fp[2 + 4], 8);
+  return (v & ~DcBytes(&fp[2 + 4], len + CanPriorityTimeBytes(ext, len))) == 0;
+}
+
+static bool DcPlausible(const uint8_t *fp){
+  return DcLowValid(fp[0]) && ((fp[0] & 0xF0) != FTYPE_CANPRIORITY || DcPriorityValid(fp));
+}
+
+/*
+ * Decodes a frame with valid CRC, false if it is not plausible. The check
+ * of DcPlausible() is done on the way, the type is switched on once.
+ */
+static bool DcFrame(DcDecoder *dp, const uint8_t *fp){
+  uint8_t id = fp[0], number = fp[1];
+  const uint8_t *d = &fp[2];
+  DcCanFrame f;
+
+  if (!DcLowValid(id))
+    return false;
+  switch (id & 0xF0) {
+  case FTYPE_CANSTREAM:
+    DcPacketFrame(dp, number);
+    if (dp->streaming && dp->gap) {
+      DcParse(dp);
+      dp->streaming = false;
+    }
+    if (!dp->streaming)
+      DcStreamStart(dp, fp);
+    else if (dp->nframes < DC_PACKET_FRAMES) {
+      memcpy(&dp->stream[dp->len], d, DC_FRAME_DATA);
+      dp->len += DC_FRAME_DATA;
+      dp->offs[dp->nframes++] = id & 0x0F;
+    }
+    break;
+  case FTYPE_USERDATA:
+    DcPacketFrame(dp, number);
+    if (!(d[DLL_CANINFO_INDEX] & DLL_CANINFO_VALID) ||
+        (d[DLL_CANINFO_INDEX] & DLL_CANINFO_DLC) > 8)
+      break;
+    memset(&f, 0, sizeof(f));
+    f.time = dp->time;
+    f.id = DcLE(&d[8], 3);
+    f.flags = DC_CAN_USERDATA | ((d[DLL_CANINFO_INDEX] & DLL_CANINFO_IDE) ? DC_CAN_IDE : 0) |
+              ((d[DLL_CANINFO_INDEX] & DLL_CANINFO_RTR) ? DC_CAN_RTR : 0);
+    f.dlc = d[DLL_CANINFO_INDEX] & DLL_CANINFO_DLC;
+    f.number = number;
+    if (!(f.flags & DC_CAN_RTR))
+      memcpy(f.data, d, f.dlc);
+    dp->UserFrames++;
+    DcEmit(dp, &f);
+    break;
+  case FTYPE_CANPRIORITY: {
+    uint32_t cid = DcLE(d, 4), t = 0;
+    bool ext = cid & CAN_PRIORITY_IDE;
+    unsigned len = DcPriorityLen(fp, cid), w = 0, i;
+
+    if (!DcPriorityValid(fp))
+      return false;
+    if (dp->prionumbered && number != (uint8_t)(dp->prionumber + 1)) {
+      uint8_t lost = number - dp->prionumber - 1;
+      dp->LostPriority += lost;
+      DcGap(dp, DC_GAP_PRIORITY, lost, number);
+    }
+    dp->prionumbered = true;
+    dp->prionumber = number;
+
+    /* The time bits of the identifier, then of the bytes after the data.*/
+    memset(&f, 0, sizeof(f));
+    if (!ext) {
+      t = (cid >> CAN_PRIORITY_TIME_SHIFT) & ((1UL << CAN_PRIORITY_TIME_BITS) - 1);
+      w = CAN_PRIORITY_TIME_BITS;
+      cid &= 0x7FFUL | CAN_PRIORITY_RTR;
+    }
+    for (i = 0; i < CanPriorityTimeBytes(ext, len); i++, w += 8)
+      t |= (uint32_t)d[4 + len + i] << w;
+    if (w >= 32) {
+      DcTime(dp, t);
+      f.flags = DC_CAN_TIMED;
+    }else if (w > 0 && DcTimeLow(dp, t, w))
+      f.flags = DC_CAN_TIMED;
+    f.time = dp->time;
+    f.id = cid & ~(CAN_PRIORITY_IDE | CAN_PRIORITY_RTR);
+    f.flags |= DC_CAN_PRIORITY | (ext ? DC_CAN_IDE : 0) |
+               ((cid & CAN_PRIORITY_RTR) ? DC_CAN_RTR : 0);
+    f.dlc = id & 0x0F;
+    f.number = number;
+    memcpy(f.data, &d[4], len);
+    dp->PriorityFrames++;
+    DcEmit(dp, &f);
+    break;
+  }
+  case FTYPE_UDPSEND:
+    if (dp->open)
+      DcPacketEnd(dp, true);
+    dp->gap = false;
+    break;
+  default:
+    break;
+  }
+  dp->Frames++;
+  return true;
+}
+
+static void DcDamaged(DcDecoder *dp){
+  dp->CrcErrors++;
+  dp->gap = true;
+  DcGap(dp, DC_GAP_FRAME, 0, dp->number);
+}
+
+/*===========================================================================*/
+/* Fixed framing.                                                            */
+/*===========================================================================*/
+
+static bool DcIsSync(const uint8_t *p){
+  int i;
+
+  for (i = 0; i < DC_FRAME_SIZE; i++)
+    if (p[i] != 0xFF)
+      return false;
+  return true;
+}
+
+static bool DcIsFrame(const uint8_t *p){
+  return DcIsSync(p) || (DcFrameCrc(p) == 0 && DcPlausible(p));
+}
+
+/*
+ * Sync frames are counted and reported, the other frames decoded.
+ */
+static void DcFixedFrame(DcDecoder *dp, const uint8_t *p){
+  if (DcIsSync(p)) {
+    dp->SyncFrames++;
+    if (dp->synccb != NULL)
+      dp->synccb(dp->arg);
+  }else
+    (void)DcFrame(dp, p);
+}
+
+/*
+ * After a damaged frame the boundary is looked for byte by byte. The CRC-8
+ * of a misaligned frame is valid once in 256 tries, so a boundary is taken
+ * only where two frames in a row are valid.
+ */
+static void DcFixedFeed(DcDecoder *dp, const uint8_t *p, size_t n){
+  for (;;) {
+    size_t need, k;
+
+    /* Aligned, the frames are checked in place.*/
+    if (!dp->skipping && dp->fill == 0 && n >= DC_FRAME_SIZE) {
+      size_t i = 0, valid = DcCheckFrames(p, n / DC_FRAME_SIZE);
+
+      while (i < valid && DcFrame(dp, p)) {
+        i++;
+        p += DC_FRAME_SIZE;
+      }
+      n -= i * DC_FRAME_SIZE;
+    }
+
+    need = dp->skipping ? 2 * DC_FRAME_SIZE : DC_FRAME_SIZE;
+    k = need - dp->fill;
+    if (k > n)
+      k = n;
+    memcpy(&dp->raw[dp->fill], p, k);
+    dp->fill += k;
+    p += k;
+    n -= k;
+    if (dp->fill < need)
+      break;
+
+    if (!dp->skipping) {
+      if (DcIsFrame(dp->raw)) {
+        DcFixedFrame(dp, dp->raw);
+        dp->fill = 0;
+        continue;
+      }
+      DcDamaged(dp);
+      dp->skipping = true;
+    }else if (DcIsFrame(dp->raw) && DcIsFrame(&dp->raw[DC_FRAME_SIZE])) {
+      DcFixedFrame(dp, dp->raw);
+      memmove(dp->raw, &dp->raw[DC_FRAME_SIZE], DC_FRAME_SIZE);
+      dp->fill = DC_FRAME_SIZE;
+      dp->skipping = false;
+      continue;
+    }
+    memmove(dp->raw, &dp->raw[1], dp->fill - 1);
+    dp->fill--;
+  }
+}
+
+/*===========================================================================*/
+/* COBS framing.                                                             */
+/*===========================================================================*/
+
+static void DcCobsPut(DcDecoder *dp, const uint8_t *p, size_t n){
+  if (dp->fill + n > DC_FRAME_SIZE)
+    dp->cobsbad = true;
+  else {
+    memcpy(&dp->raw[dp->fill], p, n);
+    dp->fill += n;
+  }
+}
+
+/*
+ * Restores a user data frame from its compact form, as the DataLinkLayer
+ * does, see DLLCompactDecode().
+ */
+static bool DcCompact(const uint8_t *p, size_t n, uint8_t *frame){
+  uint8_t hdr = p[0], dlc = hdr & DLL_CANINFO_DLC;
+  size_t idlen = (hdr & DLL_COMPACT_WIDE) ? 3 : 2;
+
+  if (n < 2 || dlc > 8 || UpdateCRC(0, p, n) != 0)
+    return false;
+  if (hdr & DLL_CANINFO_RTR)
+    dlc = 0;
+  if (n != 2 + idlen + dlc + 1)
+    return false;
+
+  memset(frame, 0, DC_FRAME_SIZE);
+  frame[0] = FTYPE_USERDATA;
+  frame[1] = p[1];
+  memcpy(&frame[2 + 8], &p[2], idlen);
+  memcpy(&frame[2], &p[2 + idlen], dlc);
+  frame[2 + DLL_CANINFO_INDEX] = hdr & ~DLL_COMPACT_WIDE;
+  return true;
+}
+
+static void DcCobsFrame(DcDecoder *dp){
+  uint8_t frame[DC_FRAME_SIZE];
+
+  if (dp->cobsbad || dp->cobsleft != 0)
+    DcDamaged(dp);
+  else if (dp->fill == DC_FRAME_SIZE) {
+    if (DcFrameCrc(dp->raw) != 0 || !DcFrame(dp, dp->raw))
+      DcDamaged(dp);
+  }else if (dp->fill > 0 && (dp->raw[0] & DLL_CANINFO_VALID) &&
+            DcCompact(dp->raw, dp->fill, frame))
+    (void)DcFrame(dp, frame);
+  else if (dp->fill > 0)
+    DcDamaged(dp);
+  dp->fill = 0;
+  dp->cobscode = 0xFF;
+  dp->cobsleft = 0;
+  dp->cobsbad = false;
+}
+
+static void DcCobsFeed(DcDecoder *dp, const uint8_t *p, size_t n){
+  static const uint8_t zero = 0x00;
+
+  while (n > 0) {
+    const uint8_t *z;
+    size_t k;
+
+    if (*p == 0x00) {
+      DcCobsFrame(dp);
+      p++;
+      n--;
+      continue;
+    }
+    if (dp->cobsleft == 0) {
+      /* Code byte, the previous block ended with an implicit zero unless it
+         was a full one.*/
+      if (dp->cobscode != 0xFF)
+        DcCobsPut(dp, &zero, 1);
+      dp->cobscode = *p;
+      dp->cobsleft = *p - 1;
+      p++;
+      n--;
+      continue;
+    }
+    k = dp->cobsleft < n ? dp->cobsleft : n;
+    z = memchr(p, 0x00, k);
+    if (z != NULL)
+      k = z - p;
+    DcCobsPut(dp, p, k);
+    dp->cobsleft -= k;
+    p += k;
+    n -= k;
+  }
+}
+
+/**
+ * @brief   Decodes the bytes of the stream.
+ *
+ * @param[in] dp      the decoder
+ * @param[in] p       the bytes
+ * @param[in] n       number of bytes
+ */
+void DcDecoderFeed(DcDecoder *dp, const uint8_t *p, size_t n){
+  dp->Bytes += n;
+  if (dp->framing == DC_FRAMING_COBS)
+    DcCobsFeed(dp, p, n);
+  else
+    DcFixedFeed(dp, p, n);
+}
+
+/**
+ * @brief   Decodes the records of a packet cut by the end of the stream.
+ *
+ * @param[in] dp      the decoder
+ */
+void DcDecoderEnd(DcDecoder *dp){
+  if (dp->open)
+    DcPacketEnd(dp, false);
+}
@@ -0,0 +1,178 @@
+/*
+ * dcdecode.h
+ *
+ * Reference decoder of the frame stream sent by the DualCom board, on the
+ * serial line or in the UDP packets of the WiFi module: finds the 15 byte
+ * frames in the bytes (fixed or COBS framing, compact frames), checks their
+ * CRC-8 and decodes the CAN frames of the FTYPE_CANSTREAM packets, of the
+ * FTYPE_CANPRIORITY frames and of the FTYPE_USERDATA frames carrying a CAN
+ * descriptor.
+ *
+ * The packets and the priority frames are numbered by their FrameNumber,
+ * the packets missing from the stream are counted and reported. A stream
+ * cut by a damaged frame is picked up again at the next record.
+ *
+ * The decoder keeps no global state, the bytes may be fed in pieces of any
+ * size. The reliable mode of the DataLinkLayer (DLL_USE_ARQ) is not
+ * supported.
+ *
+ * The header does not depend on the firmware headers and may be included
+ * from C++.
+ */
+
+#ifndef DCDECODE_H_
+#define DCDECODE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Framing of the stream, the values of DLL_FRAMING.
+ */
+#define DC_FRAMING_FIXED    0       /* 15 byte frames, 0xFF sync frames.    */
+#define DC_FRAMING_COBS     1       /* COBS encoded, 0x00 delimited.        */
+
+/*
+ * Sizes of the firmware, checked against its headers in dcdecode.c.
+ */
+#define DC_FRAME_SIZE       15      /* FRAME_SIZE_BYTE                      */
+#define DC_FRAME_DATA       12      /* Data bytes of a frame.               */
+#define DC_PACKET_FRAMES    97      /* MAX_FRAME_PER_PACKET                 */
+#define DC_RECORD_SIZE      18      /* CAN_STREAM_RECORD_SIZE               */
+
+/*
+ * Number of CAN IDs followed for the delta records, a power of two.
+ */
+#define DC_IDS              512
+
+/*
+ * Flags of a decoded CAN frame.
+ */
+#define DC_CAN_IDE          0x80    /* Extended identifier.                 */
+#define DC_CAN_RTR          0x40    /* Remote frame, no data bytes.         */
+#define DC_CAN_PRIORITY     0x01    /* In a FTYPE_CANPRIORITY frame.        */
+#define DC_CAN_USERDATA     0x02    /* In a FTYPE_USERDATA frame.           */
+#define DC_CAN_TIMED        0x04    /* The time is the receive time.        */
+
+/*
+ * Kinds of the gaps reported to the gap callback.
+ */
+#define DC_GAP_PACKETS      0       /* Packets missing by FrameNumber.      */
+#define DC_GAP_PRIORITY     1       /* Priority frames missing.             */
+#define DC_GAP_FRAME        2       /* A damaged frame, number unknown.     */
+
+/*
+ * A decoded CAN frame.
+ *
+ * time is the receive time in microseconds on the time base of the board
+ * (CanTime.h), extended to 64 bits. Only the frames with DC_CAN_TIMED have
+ * a time of their own, the others carry the time of the last one which had.
+ * An extended priority frame with more than 5 data bytes has none, a
+ * priority frame with a part of the time has none before the first time.
+ */
+typedef struct {
+  uint64_t time;
+  uint32_t id;                  /* 11 or 29 bit identifier.                 */
+  uint8_t flags;
+  uint8_t dlc;
+  uint8_t number;               /* FrameNumber of the packet or frame.      */
+  uint8_t data[8];
+} DcCanFrame;
+
+typedef void (*DcFrameCallback)(void *arg, const DcCanFrame *f);
+
+/*
+ * Called for every gap with the number of packets or priority frames
+ * missing, zero for DC_GAP_FRAME, and the FrameNumber after the gap.
+ */
+typedef void (*DcGapCallback)(void *arg, unsigned kind, unsigned lost, uint8_t number);
+
+/*
+ * Called for every sync frame of the fixed framing, the peer of the board
+ * answers it with a sync frame.
+ */
+typedef void (*DcSyncCallback)(void *arg);
+
+typedef struct {
+  /* Set by DcDecoderInit(), gapcb and synccb may be set afterwards.*/
+  unsigned framing;
+  DcFrameCallback cb;
+  DcGapCallback gapcb;
+  DcSyncCallback synccb;
+  void *arg;
+
+  /* Framing.*/
+  uint8_t raw[2 * DC_FRAME_SIZE];
+  size_t fill;
+  bool skipping;                /* Looking for the frame boundary.          */
+  uint8_t cobscode;             /* Code byte of the COBS block.             */
+  uint8_t cobsleft;             /* Bytes left in the COBS block.            */
+  bool cobsbad;                 /* The COBS frame is too long.              */
+
+  /* The packet being received and the record stream of its frames.*/
+  bool open;
+  uint8_t number;
+  bool numbered;
+  uint8_t last;                 /* Number of the last packet counted.       */
+  uint8_t frames;
+  bool streaming;
+  bool timed;                   /* The time is known at the start.          */
+  bool gap;                     /* Frames were lost since the last one.     */
+  uint8_t stream[DC_PACKET_FRAMES * DC_FRAME_DATA + DC_RECORD_SIZE];
+  size_t len;
+  uint8_t offs[DC_PACKET_FRAMES];   /* Offsets of the stream frames.      */
+  unsigned nframes;
+  uint8_t off0;                 /* First record, after a gap.               */
+
+  /* Priority frames.*/
+  bool prionumbered;
+  uint8_t prionumber;
+
+  /* Time base, and the time of the last record of the stream which the
+     next packet goes on from.*/
+  bool timeknown;
+  uint64_t time;
+  bool streamtimed;
+  uint32_t streamtime;
+
+  /* Last payload of the CAN IDs, for the delta records. An entry of an
+     older generation is free.*/
+  struct {
+    uint32_t key;
+    uint32_t gen;
+    uint8_t dlc;
+    uint8_t data[8];
+  } ids[DC_IDS];
+  uint32_t gen;
+  unsigned nids;
+
+  /* Statistics.*/
+  uint64_t Bytes;
+  long Frames;
+  long CrcErrors;
+  long SyncFrames;
+  long Packets;
+  long PriorityFrames;
+  long UserFrames;
+  long CanFrames;
+  long LostPackets;             /* By FrameNumber.                          */
+  long LostPriority;            /* By FrameNumber.                          */
+  long LostRecords;             /* Cut by a gap or delta without keyframe.  */
+  long PacketFill[DC_PACKET_FRAMES + 1]; /* Packets by frames.             */
+} DcDecoder;
+
+void DcDecoderInit(DcDecoder *dp, unsigned framing, DcFrameCallback cb, void *arg);
+void DcDecoderFeed(DcDecoder *dp, const uint8_t *p, size_t n);
+void DcDecoderEnd(DcDecoder *dp);
+size_t DcCheckFrames(const uint8_t *p, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DCDECODE_H_ */
@@ -0,0 +1,367 @@
+/*
+ * dcdump.c
+ *
+ * Decodes captured DualCom streams with the reference decoder (dcdecode.h)
+ * and writes the CAN frames as a candump log, as CSV or as a pcap file with
+ * the SocketCAN link type:
+ *
+ *   dcdump [-f candump|csv|pcap] [-c] [-o out] [-I name] [-n] [-v] [-q] [file...]
+ *
+ * The input is the bytes of the serial line, or the payloads of the UDP
+ * packets one after the other, read from the files or from the standard
+ * input. The times are the receive times of the board in seconds.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dcdecode.h"
+
+#define DUMP_READ_SIZE    (4 * 1024 * 1024)
+#define DUMP_WRITE_SIZE   (1024 * 1024)
+#define DUMP_LINE_MAX     128
+
+/* Link type of the pcap files, the frames are struct can_frame with the
+   identifier in network byte order.*/
+#define PCAP_LINKTYPE_CAN_SOCKETCAN 227
+#define PCAP_CAN_EFF_FLAG 0x80000000UL
+#define PCAP_CAN_RTR_FLAG 0x40000000UL
+
+enum { DUMP_CANDUMP, DUMP_CSV, DUMP_PCAP, DUMP_NONE };
+
+static struct {
+  int format;
+  unsigned framing;
+  const char *output;
+  const char *ifname;
+  bool verbose;
+  bool quiet;
+} opt = {DUMP_CANDUMP, DC_FRAMING_FIXED, NULL, "can0", false, false};
+
+static DcDecoder dec;
+static FILE *out;
+static char wbuf[DUMP_WRITE_SIZE];
+static size_t wfill;
+
+static const char hex[] = "0123456789ABCDEF";
+
+static void Flush(void){
+  if (wfill > 0 && fwrite(wbuf, 1, wfill, out) != wfill) {
+    perror("dcdump: write");
+    exit(1);
+  }
+  wfill = 0;
+}
+
+static char *Reserve(size_t n){
+  if (wfill + n > sizeof(wbuf))
+    Flush();
+  return &wbuf[wfill];
+}
+
+static char *PutDec(char *s, uint64_t v, int width){
+  char tmp[24];
+  int n = 0;
+
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v > 0 || n < width);
+  while (n > 0)
+    *s++ = tmp[--n];
+  return s;
+}
+
+static char *PutHex(char *s, uint32_t v, int digits){
+  while (digits-- > 0)
+    *s++ = hex[(v >> (4 * digits)) & 0x0F];
+  return s;
+}
+
+static char *PutData(char *s, const DcCanFrame *f){
+  int i;
+
+  for (i = 0; i < f->dlc; i++) {
+    *s++ = hex[f->data[i] >> 4];
+    *s++ = hex[f->data[i] & 0x0F];
+  }
+  return s;
+}
+
+static char *PutTime(char *s, uint64_t us){
+  s = PutDec(s, us / 1000000, 1);
+  *s++ = '.';
+  return PutDec(s, us % 1000000, 6);
+}
+
+/*
+ * (1436509053.850870) can0 123#DEADBEEF
+ */
+static void WriteCandump(const DcCanFrame *f){
+  char *s = Reserve(DUMP_LINE_MAX), *start = s;
+  size_t n = strlen(opt.ifname);
+
+  *s++ = '(';
+  s = PutTime(s, f->time);
+  *s++ = ')';
+  *s++ = ' ';
+  memcpy(s, opt.ifname, n);
+  s += n;
+  *s++ = ' ';
+  s = PutHex(s, f->id, (f->flags & DC_CAN_IDE) ? 8 : 3);
+  *s++ = '#';
+  if (f->flags & DC_CAN_RTR) {
+    *s++ = 'R';
+    if (f->dlc > 0)
+      *s++ = '0' + f->dlc;
+  }else
+    s = PutData(s, f);
+  *s++ = '\n';
+  wfill += s - start;
+}
+
+/*
+ * time,id,ide,rtr,dlc,data,path,timed,number
+ */
+static void WriteCsv(const DcCanFrame *f){
+  char *s = Reserve(DUMP_LINE_MAX), *start = s;
+  const char *path = (f->flags & DC_CAN_PRIORITY) ? "priority" :
+                     (f->flags & DC_CAN_USERDATA) ? "user" : "stream";
+  size_t n = strlen(path);
+
+  s = PutTime(s, f->time);
+  *s++ = ',';
+  s = PutHex(s, f->id, (f->flags & DC_CAN_IDE) ? 8 : 3);
+  *s++ = ',';
+  *s++ = (f->flags & DC_CAN_IDE) ? '1' : '0';
+  *s++ = ',';
+  *s++ = (f->flags & DC_CAN_RTR) ? '1' : '0';
+  *s++ = ',';
+  *s++ = '0' + f->dlc;
+  *s++ = ',';
+  if (!(f->flags & DC_CAN_RTR))
+    s = PutData(s, f);
+  *s++ = ',';
+  memcpy(s, path, n);
+  s += n;
+  *s++ = ',';
+  *s++ = (f->flags & DC_CAN_TIMED) ? '1' : '0';
+  *s++ = ',';
+  s = PutDec(s, f->number, 1);
+  *s++ = '\n';
+  wfill += s - start;
+}
+
+static void PutLE32(char *s, uint32_t v){
+  s[0] = v;
+  s[1] = v >> 8;
+  s[2] = v >> 16;
+  s[3] = v >> 24;
+}
+
+static void WritePcapHeader(void){
+  char *s = Reserve(24);
+
+  PutLE32(s, 0xA1B2C3D4);
+  s[4] = 2;                     /* Version 2.4.                             */
+  s[5] = 0;
+  s[6] = 4;
+  s[7] = 0;
+  PutLE32(s + 8, 0);
+  PutLE32(s + 12, 0);
+  PutLE32(s + 16, 16);          /* Snapshot length.                         */
+  PutLE32(s + 20, PCAP_LINKTYPE_CAN_SOCKETCAN);
+  wfill += 24;
+}
+
+static void WritePcap(const DcCanFrame *f){
+  char *s = Reserve(32);
+  uint32_t id = f->id;
+
+  if (f->flags & DC_CAN_IDE)
+    id |= PCAP_CAN_EFF_FLAG;
+  if (f->flags & DC_CAN_RTR)
+    id |= PCAP_CAN_RTR_FLAG;
+  PutLE32(s, f->time / 1000000);
+  PutLE32(s + 4, f->time % 1000000);
+  PutLE32(s + 8, 16);
+  PutLE32(s + 12, 16);
+  s[16] = id >> 24;
+  s[17] = id >> 16;
+  s[18] = id >> 8;
+  s[19] = id;
+  s[20] = f->dlc;
+  memset(s + 21, 0, 3);
+  memcpy(s + 24, f->data, 8);
+  if (f->flags & DC_CAN_RTR)
+    memset(s + 24, 0, 8);
+  wfill += 32;
+}
+
+static void Frame(void *arg, const DcCanFrame *f){
+  (void)arg;
+
+  switch (opt.format) {
+  case DUMP_CANDUMP:
+    WriteCandump(f);
+    break;
+  case DUMP_CSV:
+    WriteCsv(f);
+    break;
+  case DUMP_PCAP:
+    WritePcap(f);
+    break;
+  default:
+    break;
+  }
+}
+
+static void Gap(void *arg, unsigned kind, unsigned lost, uint8_t number){
+  (void)arg;
+
+  switch (kind) {
+  case DC_GAP_PACKETS:
+    fprintf(stderr, "gap: %u packets lost before packet %u\n", lost, number);
+    break;
+  case DC_GAP_PRIORITY:
+    fprintf(stderr, "gap: %u priority frames lost before frame %u\n", lost, number);
+    break;
+  default:
+    fprintf(stderr, "gap: damaged frame after packet %u\n", number);
+    break;
+  }
+}
+
+static int Decode(const char *name){
+  static uint8_t rbuf[DUMP_READ_SIZE];
+  int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY);
+  ssize_t n;
+
+  if (fd < 0) {
+    fprintf(stderr, "dcdump: %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  while ((n = read(fd, rbuf, sizeof(rbuf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "dcdump: %s: %s\n", name, strerror(errno));
+      break;
+    }
+    DcDecoderFeed(&dec, rbuf, n);
+  }
+  if (fd != STDIN_FILENO)
+    close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+static double Now(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Usage(void){
+  fprintf(stderr,
+          "usage: dcdump [options] [file...]\n"
+          "  -f format    candump (default), csv or pcap\n"
+          "  -c           COBS framing, default the fixed 15 byte frames\n"
+          "  -o file      output file, default the standard output\n"
+          "  -I name      interface name of the candump lines, default can0\n"
+          "  -n           no output, statistics only\n"
+          "  -v           report the gaps on the standard error\n"
+          "  -q           no statistics\n");
+  exit(2);
+}
+
+int main(int argc, char **argv){
+  double start, wall;
+  int c, i, ret = 0;
+
+  while ((c = getopt(argc, argv, "f:co:I:nvq")) != -1) {
+    switch (c) {
+    case 'f':
+      if (strcmp(optarg, "candump") == 0)
+        opt.format = DUMP_CANDUMP;
+      else if (strcmp(optarg, "csv") == 0)
+        opt.format = DUMP_CSV;
+      else if (strcmp(optarg, "pcap") == 0)
+        opt.format = DUMP_PCAP;
+      else
+        Usage();
+      break;
+    case 'c':
+      opt.framing = DC_FRAMING_COBS;
+      break;
+    case 'o':
+      opt.output = optarg;
+      break;
+    case 'I':
+      if (strlen(optarg) > 16)
+        Usage();
+      opt.ifname = optarg;
+      break;
+    case 'n':
+      opt.format = DUMP_NONE;
+      break;
+    case 'v':
+      opt.verbose = true;
+      break;
+    case 'q':
+      opt.quiet = true;
+      break;
+    default:
+      Usage();
+    }
+  }
+
+  out = stdout;
+  if (opt.output != NULL && (out = fopen(opt.output, "wb")) == NULL) {
+    perror(opt.output);
+    return 1;
+  }
+
+  DcDecoderInit(&dec, opt.framing, Frame, NULL);
+  if (opt.verbose)
+    dec.gapcb = Gap;
+  if (opt.format == DUMP_PCAP)
+    WritePcapHeader();
+  else if (opt.format == DUMP_CSV) {
+    static const char head[] = "time,id,ide,rtr,dlc,data,path,timed,number\n";
+    memcpy(Reserve(sizeof(head)), head, sizeof(head) - 1);
+    wfill += sizeof(head) - 1;
+  }
+
+  start = Now();
+  if (optind == argc)
+    ret = Decode("-");
+  for (i = optind; i < argc; i++)
+    if (Decode(argv[i]) != 0)
+      ret = -1;
+  DcDecoderEnd(&dec);
+  Flush();
+  wall = Now() - start;
+  if (out != stdout)
+    fclose(out);
+  else
+    fflush(out);
+
+  if (!opt.quiet) {
+    fprintf(stderr, "%llu bytes in %.3f s, %.1f MB/s\n", (unsigned long long)dec.Bytes, wall,
+            wall > 0 ? dec.Bytes / wall / 1e6 : 0);
+    fprintf(stderr, "frames:  %ld, %ld crc errors, %ld sync frames\n", dec.Frames, dec.CrcErrors,
+            dec.SyncFrames);
+    fprintf(stderr, "packets: %ld, %ld lost\n", dec.Packets, dec.LostPackets);
+    fprintf(stderr, "can:     %ld frames, %ld priority (%ld lost), %ld user data, "
+            "%ld lost records\n", dec.CanFrames, dec.PriorityFrames, dec.LostPriority,
+            dec.UserFrames, dec.LostRecords);
+  }
+  return ret != 0 ? 1 : 0;
+}
@@ -0,0 +1,759 @@
+/*
+ * dctest.c
+ *
+ * Round trip test of the reference decoder: CAN frames go through the
+ * stream encoder of the firmware (CanStream.c, CanDelta.c), the
+ * NetworkLayer and the output ring of the DataLinkLayer, the frames taken
+ * from the ring are fed to libdcdecode in the fixed framing and the decoded
+ * CAN frames are compared with the input:
+ * - 11 and 29 bit identifiers, remote frames, DLC 0..8 and the four length
+ *   codes of the time field, fed in pieces of any size,
+ * - a packet which refuses a frame, the records after it are dropped,
+ * - a damaged frame at every position of a packet, the decoder picks the
+ *   stream up at the next record start told by the Id of a frame,
+ * - the delta records, the keyframes after a refused frame and the delta
+ *   records whose keyframe was lost,
+ * - the priority frames with the bits of their receive time, which the
+ *   decoder extends with the last time it got.
+ *
+ * The threads of the DataLinkLayer are held, the test is the consumer of
+ * the output ring. It exits with 1 if a check fails.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "NetworkLayer.h"
+#include "DataLinkLayer.h"
+#include "CanStream.h"
+#include "CanDelta.h"
+#include "CanFlush.h"
+#include "CanPriority.h"
+#include "dcdecode.h"
+
+#if DLL_FRAMING != DLL_FRAMING_FIXED || DLL_USE_ARQ || DLL_USE_CREDITS || DLL_USE_DMA_BACKEND
+#error "the test takes the frames of the plain serial backend in the fixed framing"
+#endif
+
+#if !CAN_USE_DELTA
+#error "the test needs CAN_USE_DELTA"
+#endif
+
+#if !DLL_USE_PRIORITY_LANE
+#error "the test needs DLL_USE_PRIORITY_LANE"
+#endif
+
+#define TEST_LINE_SIZE    (1024 * 1024)
+#define TEST_RECORDS      8192
+
+/* An input CAN frame and where its record is in the stream of the packet.*/
+typedef struct {
+  CanStreamFrame f;
+  bool delta;                   /* Sent as a delta record.                  */
+  uint32_t start, end;          /* Stream positions, Put() only.            */
+} TestRecord;
+
+static DLLSerialConfig TestCfg = {
+  &SD1,
+  921600,
+  NULL
+};
+
+static IPAddress TestIp = {192, 168, 4, 255};
+
+static CanStreamEncoder enc;
+static CanDeltaEncoder delta;
+
+/* The bytes of the frames taken from the output ring.*/
+static uint8_t line[TEST_LINE_SIZE];
+static size_t linelen;
+
+/* The input, and the stream of the packet being filled for Put().*/
+static TestRecord recs[TEST_RECORDS];
+static size_t nrecs;
+static uint32_t streampos, streamlast;
+static bool streamstarted;
+static unsigned timecodes;      /* Length codes of the time, extended << 4. */
+
+/* The decoded CAN frames.*/
+static DcDecoder dec;
+static DcCanFrame out[TEST_RECORDS];
+static size_t nout;
+
+static uint64_t randstate = 1;
+static int failures;
+static const char *testname;
+
+static uint32_t Rand(void){
+  randstate ^= randstate >> 12;
+  randstate ^= randstate << 25;
+  randstate ^= randstate >> 27;
+  return (randstate * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static bool Check(bool ok, const char *fmt, ...){
+  va_list ap;
+
+  if (ok)
+    return true;
+  failures++;
+  fprintf(stderr, "%s: ", testname);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  return false;
+}
+
+/*===========================================================================*/
+/* Encoding.                                                                 */
+/*===========================================================================*/
+
+static void Reset(const char *name){
+  testname = name;
+  CanStreamInit(&enc);
+  CanDeltaInit(&delta);
+  linelen = 0;
+  nrecs = 0;
+  streampos = 0;
+  streamstarted = false;
+}
+
+/* The sending thread of the plain serial backend for the frames in the ring.*/
+static void Drain(void){
+  DLLBufferPark *bp = &DLLS1.DLLBuffers;
+
+  while (bp->DLLOutputTail != bp->DLLOutputHead) {
+    uint8_t slot = bp->DLLOutputQueue[bp->DLLOutputTail & (OUTPUT_FRAME_BUFFER - 1)];
+
+    if (linelen + FRAME_SIZE_BYTE > sizeof(line)) {
+      fprintf(stderr, "%s: line buffer full\n", testname);
+      exit(1);
+    }
+    memcpy(&line[linelen], DLLSlotFrame(&DLLS1, slot), FRAME_SIZE_BYTE);
+    linelen += FRAME_SIZE_BYTE;
+    DLLRingRelease(&DLLS1, 1);
+  }
+}
+
+static PacketStruct *Open(void){
+  PacketStruct *p = NWLCreatePacket(&WIFID1);
+
+  if (p == NULL) {
+    fprintf(stderr, "%s: no packet\n", testname);
+    exit(1);
+  }
+  return p;
+}
+
+/* Closes the stream and sends the packet as CanComm does.*/
+static void Send(PacketStruct *p){
+  CanStreamEnd(&enc, p);
+  NWLSendPacketUDP(&WIFID1, p, TestIp, 4000);
+  Drain();
+  streampos = 0;
+  streamstarted = false;
+}
+
+static TestRecord *Add(const CanStreamFrame *f, bool isdelta){
+  TestRecord *r;
+
+  if (nrecs == TEST_RECORDS) {
+    fprintf(stderr, "%s: too many records\n", testname);
+    exit(1);
+  }
+  r = &recs[nrecs++];
+  r->f = *f;
+  r->delta = isdelta;
+  r->start = r->end = 0;
+  return r;
+}
+
+/*
+ * Adds a frame to the packet in full, or as a delta record if @p bitmap is
+ * not negative, and works out the position of its record from the format
+ * in CanStream.h.
+ */
+static void Put(PacketStruct *p, const CanStreamFrame *f, int bitmap){
+  TestRecord *r = Add(f, bitmap >= 0);
+  uint32_t dt, len;
+  unsigned code;
+
+  /* The time goes on from the previous packet unless there is a base.*/
+  if (!streamstarted) {
+    streampos = 0;
+    if (!enc.timed || f->stamp - enc.base >= CAN_STREAM_BASE_INTERVAL) {
+      streampos = 1 + CAN_STREAM_BASE_SIZE;
+      streamlast = f->stamp;
+    }
+    streamstarted = true;
+  }
+  dt = f->stamp - streamlast;
+  streamlast = f->stamp;
+  if (f->flags & CAN_STREAM_IDE) {
+    code = dt == 0 ? 0 : dt < 0x100 ? 1 : dt < 0x10000 ? 2 : 3;
+    len = 1 + 4 + (code == 3 ? 4 : code);
+    timecodes |= 0x10 << code;
+  }else {
+    code = dt < (1U << 5) ? 0 : dt < (1U << 13) ? 1 : dt < (1U << 21) ? 2 : 3;
+    len = 1 + (code == 3 ? 2 + 4 : 2 + code);
+    timecodes |= 1 << code;
+  }
+
+  if (bitmap >= 0)
+    len += 1 + __builtin_popcount(bitmap);
+  else if (!(f->flags & CAN_STREAM_RTR))
+    len += f->dlc > 8 ? 8 : f->dlc;
+  r->start = streampos;
+  r->end = streampos + len;
+  streampos += len;
+
+  if (bitmap >= 0)
+    CanStreamAddDelta(&enc, p, f, bitmap);
+  else
+    CanStreamAddFrame(&enc, p, f);
+}
+
+/* Adds a frame through the delta compression, tells if it was a delta.*/
+static bool PutDelta(PacketStruct *p, const CanStreamFrame *f){
+  long deltas = delta.Deltas;
+
+  CanDeltaAddFrame(&delta, &enc, p, f);
+  Add(f, delta.Deltas != deltas);
+  return delta.Deltas != deltas;
+}
+
+/* The priority lane, which the sending thread serves first.*/
+static void DrainLane(void){
+  DLLBufferPark *bp = &DLLS1.DLLBuffers;
+
+  while (bp->DLLPriorityTail != bp->DLLPriorityHead) {
+    uint8_t slot = bp->DLLPriorityQueue[bp->DLLPriorityTail & (DLL_PRIORITY_QUEUE - 1)];
+
+    if (linelen + FRAME_SIZE_BYTE > sizeof(line)) {
+      fprintf(stderr, "%s: line buffer full\n", testname);
+      exit(1);
+    }
+    memcpy(&line[linelen], DLLSlotFrame(&DLLS1, slot), FRAME_SIZE_BYTE);
+    linelen += FRAME_SIZE_BYTE;
+    DLLSlotFree(&DLLS1, slot);
+    bp->DLLPriorityTail++;
+  }
+}
+
+/* Sends a frame through the priority lane as CanComm does.*/
+static void PutPriority(const CanStreamFrame *f){
+  FrameStruct single;
+
+  Add(f, false);
+  CanPriorityEncode(f, &single);
+  if (NWLSendSingleFramePacket(&WIFID1, &single) != MSG_OK) {
+    fprintf(stderr, "%s: priority lane full\n", testname);
+    exit(1);
+  }
+  DrainLane();
+}
+
+static void RandomFrame(CanStreamFrame *f, uint32_t stamp){
+  int i;
+
+  memset(f, 0, sizeof(*f));
+  f->flags = Rand() & 1 ? CAN_STREAM_IDE : 0;
+  f->id = Rand() & (f->flags & CAN_STREAM_IDE ? 0x1FFFFFFF : 0x7FF);
+  f->dlc = 8;
+  f->stamp = stamp;
+  for (i = 0; i < 8; i++)
+    f->data[i] = Rand();
+}
+
+/*===========================================================================*/
+/* Decoding.                                                                 */
+/*===========================================================================*/
+
+static void Collect(void *arg, const DcCanFrame *f){
+  (void)arg;
+  if (nout < TEST_RECORDS)
+    out[nout++] = *f;
+}
+
+/* Feeds the bytes in pieces of 1 to @p piece bytes, at once if 0.*/
+static void Decode(const uint8_t *p, size_t n, size_t piece){
+  DcDecoderInit(&dec, DC_FRAMING_FIXED, Collect, NULL);
+  nout = 0;
+  while (n > 0) {
+    size_t k = piece == 0 ? n : 1 + Rand() % piece;
+
+    if (k > n)
+      k = n;
+    DcDecoderFeed(&dec, p, k);
+    p += k;
+    n -= k;
+  }
+  DcDecoderEnd(&dec);
+}
+
+/* Compares a decoded frame with the input, with its time if @p timed.*/
+static bool Same(size_t i, const DcCanFrame *d, const TestRecord *r, bool timed){
+  const CanStreamFrame *f = &r->f;
+  uint8_t dlc = f->dlc > 8 ? 8 : f->dlc;
+  uint8_t flags = (f->flags & CAN_STREAM_IDE ? DC_CAN_IDE : 0) |
+                  (f->flags & CAN_STREAM_RTR ? DC_CAN_RTR : 0);
+
+  if (!Check(d->id == f->id && (d->flags & (DC_CAN_IDE | DC_CAN_RTR)) == flags &&
+             d->dlc == dlc, "frame %zu: id %x flags %02x dlc %u, expected id %x flags %02x dlc %u",
+             i, d->id, d->flags, d->dlc, f->id, flags, dlc))
+    return false;
+  if (!(f->flags & CAN_STREAM_RTR) &&
+      !Check(memcmp(d->data, f->data, dlc) == 0, "frame %zu: id %x: wrong data", i, f->id))
+    return false;
+  if (timed)
+    return Check((d->flags & DC_CAN_TIMED) && (uint32_t)d->time == f->stamp,
+                 "frame %zu: time %u, expected %u", i, (uint32_t)d->time, f->stamp);
+  return Check(!(d->flags & DC_CAN_TIMED), "frame %zu: timed after a gap", i);
+}
+
+/*
+ * Compares the decoded frames with the expected records, the records
+ * before @p untimed come with their time.
+ */
+static bool Compare(const TestRecord *const *exp, size_t n, size_t untimed){
+  size_t i;
+
+  if (!Check(nout == n, "%zu frames decoded, expected %zu", nout, n))
+    return false;
+  for (i = 0; i < n; i++)
+    if (!Same(i, &out[i], exp[i], i < untimed))
+      return false;
+  return true;
+}
+
+/*===========================================================================*/
+/* Tests.                                                                    */
+/*===========================================================================*/
+
+/*
+ * All the kinds of CAN frames with the time deltas of the four length codes
+ * across the wrap of the 32 bit time, in full packets.
+ */
+static void TestRoundTrip(void){
+  static const uint32_t steps[] = {0, 1, 255, 256, 65535, 65536, 3000000, 17, 0, 120};
+  static const TestRecord *exp[TEST_RECORDS];
+  uint32_t stamp = 0xFFFF0000UL;
+  size_t frames = 0, i;
+  PacketStruct *p;
+  int piece;
+
+  Reset("round-trip");
+  timecodes = 0;
+  p = Open();
+  for (i = 0; i < 3000; i++) {
+    CanStreamFrame f;
+
+    stamp += steps[i % (sizeof(steps) / sizeof(steps[0]))];
+    RandomFrame(&f, stamp);
+    f.flags = (i / 10) & 1 ? CAN_STREAM_IDE : 0;
+    f.id &= f.flags & CAN_STREAM_IDE ? 0x1FFFFFFF : 0x7FF;
+    f.dlc = i % 10 == 9 ? 15 : i % 10;
+    if (i % 7 == 3)
+      f.flags |= CAN_STREAM_RTR;
+    Put(p, &f, -1);
+    if (p->length >= MAX_FRAME_PER_PACKET - CAN_FLUSH_RESERVE) {
+      /* The model of the record sizes must fill as many frames.*/
+      frames += p->length;
+      Check(p->length == (streampos + sizeof(enc.pending.data) - 1) / sizeof(enc.pending.data) - 1,
+            "packet of %u frames for %u stream bytes", p->length, streampos);
+      Send(p);
+      p = Open();
+    }
+  }
+  Send(p);
+  Check(timecodes == 0xFF, "time length codes %x used", timecodes);
+  Check(enc.RefusedFrames == 0, "%ld frames refused", enc.RefusedFrames);
+  Check(frames > 0, "no full packet");
+
+  for (i = 0; i < nrecs; i++)
+    exp[i] = &recs[i];
+  for (piece = 0; piece <= 40; piece += 20) {
+    Decode(line, linelen, piece);
+    Compare(exp, nrecs, nrecs);
+    Check(dec.CrcErrors == 0 && dec.LostPackets == 0 && dec.LostRecords == 0,
+          "pieces of %d: %ld crc errors, %ld packets and %ld records lost",
+          piece, dec.CrcErrors, dec.LostPackets, dec.LostRecords);
+  }
+}
+
+/*
+ * A packet which refuses a frame: the records in the frames it took are
+ * decoded, the rest of the packet is dropped, the next packet is whole.
+ */
+static void TestRefused(void){
+  static const TestRecord *exp[TEST_RECORDS];
+  uint32_t stamp = 1000, taken;
+  size_t first, n = 0, i;
+  PacketStruct *p;
+  CanStreamFrame f;
+
+  Reset("refused");
+  p = Open();
+  while (enc.RefusedFrames == 0) {
+    RandomFrame(&f, stamp += 100);
+    Put(p, &f, -1);
+  }
+  for (i = 0; i < 5; i++) {
+    RandomFrame(&f, stamp += 100);
+    Put(p, &f, -1);
+  }
+  taken = p->length * sizeof(enc.pending.data);
+  Check(enc.DroppedRecords > 0, "no record dropped");
+  Send(p);
+  first = nrecs;
+  p = Open();
+  for (i = 0; i < 20; i++) {
+    RandomFrame(&f, stamp += 300);
+    Put(p, &f, -1);
+  }
+  Send(p);
+
+  for (i = 0; i < first; i++)
+    if (recs[i].end <= taken)
+      exp[n++] = &recs[i];
+  Check(n > 0 && n < first, "%zu of %zu records in the frames taken", n, first);
+  for (i = first; i < nrecs; i++)
+    exp[n++] = &recs[i];
+  Decode(line, linelen, 0);
+  Compare(exp, n, n);
+  Check(dec.LostPackets == 0, "%ld packets lost", dec.LostPackets);
+}
+
+/*
+ * A packet of records longer than the data of a frame, so some frames have
+ * no record start, with delta records. Every frame in turn is damaged, the
+ * decoder resumes at the first record start of a later frame without the
+ * time and the payloads.
+ */
+static void TestResync(void){
+  static const TestRecord *exp[TEST_RECORDS];
+  static uint8_t damaged[TEST_LINE_SIZE];
+  static const uint8_t sync[2 * FRAME_SIZE_BYTE] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  const size_t fd = sizeof(enc.pending.data);
+  uint8_t offs[MAX_FRAME_PER_PACKET];
+  uint32_t stamp = 5000, known[4];
+  unsigned nostart = 0, nframes, k, j;
+  CanStreamFrame f, last[4];
+  PacketStruct *p;
+  size_t i, n;
+
+  Reset("resync");
+  p = Open();
+  for (i = 0; i < 80; i++) {
+    unsigned id = i % 4;
+
+    if (i >= 4 && i % 3 == 1) {
+      /* A delta on top of the last record of the ID.*/
+      int bitmap = 1 << (Rand() % 8) | 1 << (Rand() % 8);
+      f = last[id];
+      f.stamp = stamp += 40;
+      for (j = 0; j < 8; j++)
+        if (bitmap & (1 << j))
+          f.data[j] ^= 1 + Rand() % 255;
+      Put(p, &f, bitmap);
+    }else {
+      RandomFrame(&f, stamp += i % 5 == 0 ? 70000 : 40);
+      f.id = 0x100 + id;
+      f.flags = id & 1 ? CAN_STREAM_IDE : 0;
+      if (i % 11 == 10)
+        f.flags |= CAN_STREAM_RTR;
+      Put(p, &f, -1);
+    }
+    if (!(f.flags & CAN_STREAM_RTR))
+      last[id] = f;
+  }
+  nframes = (streampos + fd - 1) / fd;
+  Send(p);
+  if (!Check(linelen == (nframes + 1) * FRAME_SIZE_BYTE && nframes <= MAX_FRAME_PER_PACKET,
+             "%zu bytes for %u stream frames", linelen, nframes))
+    return;
+
+  /* The record starts of the frames, as the encoder must tell them. The
+     base record before the first frame record is a record too.*/
+  for (k = 0; k < nframes; k++) {
+    offs[k] = k == 0 && recs[0].start > 0 ? 0 : CAN_STREAM_NOSTART;
+    for (i = 0; i < nrecs && offs[k] == CAN_STREAM_NOSTART; i++)
+      if (recs[i].start / fd == k) {
+        offs[k] = recs[i].start % fd;
+        break;
+      }
+    nostart += offs[k] == CAN_STREAM_NOSTART;
+    Check(line[k * FRAME_SIZE_BYTE] == (FTYPE_CANSTREAM | offs[k]),
+          "frame %u: Id %02x, expected %02x", k, line[k * FRAME_SIZE_BYTE],
+          FTYPE_CANSTREAM | offs[k]);
+  }
+  Check(nostart >= 2, "%u frames without a record start", nostart);
+
+  for (k = 0; k < nframes; k++) {
+    uint32_t resume = UINT32_MAX;
+    size_t untimed;
+
+    memcpy(damaged, line, linelen);
+    damaged[k * FRAME_SIZE_BYTE + 2 + Rand() % fd] ^= 1 << (Rand() % 8);
+    memcpy(&damaged[linelen], sync, sizeof(sync));
+
+    for (j = k + 1; j < nframes; j++)
+      if (offs[j] != CAN_STREAM_NOSTART) {
+        resume = j * fd + offs[j];
+        break;
+      }
+    n = 0;
+    for (i = 0; i < nrecs && recs[i].end <= k * fd; i++)
+      exp[n++] = &recs[i];
+    untimed = n;
+    memset(known, 0, sizeof(known));
+    for (; i < nrecs; i++) {
+      if (recs[i].start < resume)
+        continue;
+      j = recs[i].f.id & 3;
+      if (!recs[i].delta && !(recs[i].f.flags & CAN_STREAM_RTR))
+        known[j] = 1;
+      if (!recs[i].delta || known[j])
+        exp[n++] = &recs[i];
+    }
+
+    Decode(damaged, linelen + sizeof(sync), 0);
+    if (!Compare(exp, n, untimed) ||
+        !Check(dec.CrcErrors == 1 && dec.Packets == 1,
+               "%ld crc errors, %ld packets", dec.CrcErrors, dec.Packets))
+      fprintf(stderr, "%s: damaged frame %u of %u\n", testname, k, nframes);
+  }
+}
+
+/*
+ * The delta compression: a long run of a few IDs, a packet which refuses a
+ * frame after which every ID starts with a keyframe, and the delta records
+ * of a packet whose keyframes were lost.
+ */
+static void TestDelta(void){
+  static const TestRecord *exp[TEST_RECORDS];
+  CanStreamFrame ids[8];
+  uint32_t stamp = 0;
+  size_t first, second, n, i, j;
+  size_t skipfrom, skipto;
+  long keyframes;
+  PacketStruct *p;
+
+  /* Small changes and now and then a new DLC or a whole new payload.*/
+  Reset("delta");
+  for (i = 0; i < 8; i++) {
+    RandomFrame(&ids[i], 0);
+    ids[i].id = 0x200 + i;
+    ids[i].flags = i & 4 ? CAN_STREAM_IDE : 0;
+  }
+  p = Open();
+  for (i = 0; i < 3000; i++) {
+    CanStreamFrame *e = &ids[Rand() % 8];
+
+    e->stamp = stamp += 50 + Rand() % 500;
+    e->data[Rand() % 8] = Rand();
+    if (Rand() % 64 == 0)
+      e->dlc = 1 + Rand() % 8;
+    if (Rand() % 64 == 0)
+      for (j = 0; j < 8; j++)
+        e->data[j] = ~e->data[j];
+    PutDelta(p, e);
+    if (p->length >= MAX_FRAME_PER_PACKET - CAN_FLUSH_RESERVE) {
+      Send(p);
+      p = Open();
+    }
+  }
+  Send(p);
+  Check(delta.Deltas > 1000 && delta.Keyframes > 3000 / CAN_DELTA_KEYFRAME_INTERVAL,
+        "%ld deltas, %ld keyframes", delta.Deltas, delta.Keyframes);
+  for (i = 0; i < nrecs; i++)
+    exp[i] = &recs[i];
+  Decode(line, linelen, 33);
+  Compare(exp, nrecs, nrecs);
+  Check(dec.LostRecords == 0, "%ld records lost", dec.LostRecords);
+
+  /* After the refused frame the first record of every ID is a keyframe,
+     the records of the dropped rest of the packet are not applied.*/
+  Reset("delta-refused");
+  p = Open();
+  for (i = 0; i < 8; i++) {
+    ids[i].stamp = stamp += 100;
+    PutDelta(p, &ids[i]);
+  }
+  for (i = 0; enc.RefusedFrames == 0 || i % 8 != 0; i++) {
+    CanStreamFrame *e = &ids[i % 8];
+
+    e->stamp = stamp += 100;
+    e->data[Rand() % 8] = Rand();
+    PutDelta(p, e);
+  }
+  Send(p);
+  first = nrecs;
+  p = Open();
+  for (i = 0; i < 32; i++) {
+    CanStreamFrame *e = &ids[i % 8];
+
+    e->stamp = stamp += 100;
+    e->data[Rand() % 8] = Rand();
+    keyframes = delta.Keyframes;
+    PutDelta(p, e);
+    if (i < 8)
+      Check(delta.Keyframes == keyframes + 1, "ID %x: no keyframe after the refused frame",
+            e->id);
+  }
+  Send(p);
+  Decode(line, linelen, 0);
+  /* A prefix of the refused packet and all of the next one.*/
+  for (i = 0; i < first && i < nout && (uint32_t)out[i].time == recs[i].f.stamp; i++)
+    Same(i, &out[i], &recs[i], true);
+  Check(i < first, "all %zu frames of the refused packet decoded", first);
+  if (Check(nout - i == nrecs - first, "%zu frames after the refused packet, expected %zu",
+            nout - i, nrecs - first))
+    for (j = first; j < nrecs; j++, i++)
+      Same(i, &out[i], &recs[j], true);
+
+  /* The packet with the keyframes of IDs 0..3 is lost, only the keyframe
+     of the ID 4 new in the next packet is decoded.*/
+  Reset("delta-lost");
+  for (i = 0; i < 8; i++)
+    ids[i].dlc = 8;
+  p = Open();
+  for (i = 4; i < 8; i++) {
+    ids[i].stamp = stamp += 100;
+    PutDelta(p, &ids[i]);
+  }
+  Send(p);
+  first = nrecs;
+  skipfrom = linelen;
+  p = Open();
+  for (i = 0; i < 4; i++) {
+    ids[i].stamp = stamp += 100;
+    ids[i].data[0]++;
+    PutDelta(p, &ids[i]);
+  }
+  Send(p);
+  second = nrecs;
+  skipto = linelen;
+  p = Open();
+  ids[4].id = 0x300;
+  for (i = 0; i < 5; i++) {
+    ids[i].stamp = stamp += 100;
+    ids[i].data[1]++;
+    Check(PutDelta(p, &ids[i]) == (i < 4), "ID %x: %s expected", ids[i].id,
+          i < 4 ? "delta" : "keyframe");
+  }
+  Send(p);
+  memmove(&line[skipfrom], &line[skipto], linelen - skipto);
+  linelen -= skipto - skipfrom;
+
+  n = 0;
+  for (i = 0; i < first; i++)
+    exp[n++] = &recs[i];
+  for (i = second; i < nrecs; i++)
+    if (!recs[i].delta)
+      exp[n++] = &recs[i];
+  /* The time of the packet after the lost one waits for a base record.*/
+  Decode(line, linelen, 0);
+  Compare(exp, n, first);
+  Check(dec.LostPackets == 1 && dec.LostRecords == 4, "%ld packets and %ld records lost",
+        dec.LostPackets, dec.LostRecords);
+}
+
+/*
+ * The priority frames of every kind around a stream packet, across the
+ * wrap of the 32 bit time. The frames before the packet have a time only
+ * if it is whole, the extended frames with more than 5 data bytes have
+ * none.
+ */
+static void TestPriority(void){
+  static const TestRecord *exp[TEST_RECORDS];
+  static bool timed[TEST_RECORDS];
+  uint32_t base = 0xFFFFF000UL;
+  size_t first, i;
+  PacketStruct *p;
+  unsigned k;
+
+  Reset("priority");
+  for (k = 0; k < 4; k++) {
+    CanStreamFrame f;
+
+    RandomFrame(&f, base - 1000 * k);
+    f.flags = k & 1 ? CAN_STREAM_IDE : 0;
+    f.id &= f.flags & CAN_STREAM_IDE ? 0x1FFFFFFF : 0x7FF;
+    f.dlc = k < 2 ? 8 : 2;
+    timed[nrecs] = f.flags & CAN_STREAM_IDE ? f.dlc <= 4 : f.dlc <= 6;
+    PutPriority(&f);
+  }
+  first = nrecs;
+
+  p = Open();
+  for (k = 0; k < 4; k++) {
+    CanStreamFrame f;
+
+    RandomFrame(&f, base + 10 * k);
+    timed[nrecs] = true;
+    Put(p, &f, -1);
+  }
+  Send(p);
+
+  for (i = 0; i < 2000; i++) {
+    CanStreamFrame f;
+
+    /* Up to 200 ms either way of the last time the decoder got.*/
+    RandomFrame(&f, base + Rand() % 400000 - 200000);
+    f.flags = i & 1 ? CAN_STREAM_IDE : 0;
+    f.id &= f.flags & CAN_STREAM_IDE ? 0x1FFFFFFF : 0x7FF;
+    f.dlc = (i >> 1) % 9;
+    if ((i >> 1) % 11 == 5)
+      f.flags |= CAN_STREAM_RTR;
+    timed[nrecs] = !(f.flags & CAN_STREAM_IDE) || (f.flags & CAN_STREAM_RTR) || f.dlc <= 5;
+    if (timed[nrecs])
+      base = f.stamp;
+    PutPriority(&f);
+  }
+
+  for (i = 0; i < nrecs; i++)
+    exp[i] = &recs[i];
+  Decode(line, linelen, 25);
+  if (!Check(nout == nrecs, "%zu frames decoded, expected %zu", nout, nrecs))
+    return;
+  for (i = 0; i < nrecs; i++) {
+    bool prio = i < first || i >= first + 4;
+
+    if (!Check(!!(out[i].flags & DC_CAN_PRIORITY) == prio, "frame %zu: flags %02x",
+               i, out[i].flags) ||
+        !Same(i, &out[i], exp[i], timed[i]))
+      break;
+  }
+  Check(dec.CrcErrors == 0 && dec.LostPriority == 0 && dec.PriorityFrames == (long)nrecs - 4,
+        "%ld crc errors, %ld of %ld priority frames lost", dec.CrcErrors, dec.LostPriority,
+        dec.PriorityFrames);
+}
+
+int main(void) {
+  chSysInit();
+  chSimHoldThreads(true);
+  sdSimAttach(&SD1, -1, false);
+  wifiInit();
+  wifiStart(&WIFID1, &DLLS1, &TestCfg);
+
+  TestRoundTrip();
+  TestRefused();
+  TestResync();
+  TestDelta();
+  TestPriority();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
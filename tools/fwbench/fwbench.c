@@ -0,0 +1,358 @@
+/*
+ * fwbench.c
+ *
+ * Host benchmark of the hot paths of the DualFramework, built from the
+ * framework sources on the OSAL shim of tools/hostsim:
+ * - CreateCRC() and CheckCRC() of a frame,
+ * - packet assembly with NWLAddFrameToPacket() and NWLAssignFNtoPacket(),
+ * - DLLPutFrameInQueue() and DLLRingRelease() of the frame by the consumer,
+ * - a CAN frame through the stream encoder, the NetworkLayer and the
+ *   DataLinkLayer into the bytes written to the serial line.
+ * The threads of the DataLinkLayer are held, this program is the consumer of
+ * the output ring and does what the sending thread does for one frame.
+ *
+ * Every benchmark runs the warm-up rounds, then the measured rounds. The
+ * median and the fastest round are reported, with -j as one JSON document
+ * which carries the revision and the configuration of the build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "NetworkLayer.h"
+#include "DataLinkLayer.h"
+#include "CanStream.h"
+#include "CanDelta.h"
+#include "CanFlush.h"
+
+#if DLL_USE_ARQ || DLL_USE_CREDITS || DLL_USE_DMA_BACKEND
+#error "the benchmark replaces the sending thread of the plain serial backend"
+#endif
+
+#if !defined(BENCH_REVISION)
+#define BENCH_REVISION "unknown"
+#endif
+
+#define BENCH_FRAMES    256         /* Distinct input frames, a power of two. */
+#define BENCH_BATCH     64          /* Frames in the ring at once.            */
+#define BENCH_MAX_ROUNDS 1000
+
+static struct {
+  uint32_t frames;              /* Frames per round.                        */
+  uint32_t warmup;
+  uint32_t rounds;
+  bool json;
+} opt = {200000, 3, 15, false};
+
+static DLLSerialConfig BenchCfg = {
+  &SD1,
+  921600,
+  NULL
+};
+
+static IPAddress BenchIp = {192, 168, 4, 255};
+
+static FrameStruct frames[BENCH_FRAMES];
+static CanStreamFrame canframes[BENCH_FRAMES];
+static volatile uint8_t sink;
+
+typedef struct {
+  const char *name;
+  uint32_t (*run)(uint32_t n);  /* Processes about n frames, returns how many. */
+  double median, best;          /* ns per frame.                            */
+  double bytes;                 /* Serial bytes per frame, 0 if none.       */
+} Bench;
+
+static double Now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*===========================================================================*/
+/* Consumer of the output ring.                                              */
+/*===========================================================================*/
+
+/*
+ * The sending thread of the plain serial backend for the frames in the
+ * ring: writes them to the line one by one and gives each back with
+ * DLLRingRelease() as the thread does.
+ */
+static void RingDrain(bool write){
+  DLLBufferPark *bp = &DLLS1.DLLBuffers;
+
+  while (bp->DLLOutputTail != bp->DLLOutputHead) {
+    if (write) {
+      uint8_t slot = bp->DLLOutputQueue[bp->DLLOutputTail & (OUTPUT_FRAME_BUFFER - 1)];
+      DLLSendSingleFrameSerial(&DLLS1, DLLSlotFrame(&DLLS1, slot));
+    }
+    DLLRingRelease(&DLLS1, 1);
+  }
+}
+
+/*===========================================================================*/
+/* Benchmarks.                                                               */
+/*===========================================================================*/
+
+static uint32_t BenchCreateCRC(uint32_t n){
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    FrameStruct *f = &frames[i & (BENCH_FRAMES - 1)];
+    f->CrcHex = CreateCRC(f);
+  }
+  return n;
+}
+
+static uint32_t BenchCheckCRC(uint32_t n){
+  uint8_t acc = 0;
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    acc |= CheckCRC((const uint8_t *)&frames[i & (BENCH_FRAMES - 1)]);
+  sink = acc;
+  return n;
+}
+
+/*
+ * Fills whole packets, the slots go back to the free list afterwards as
+ * they would after the transmission.
+ */
+static uint32_t BenchPacket(uint32_t n){
+  uint32_t done = 0, k = 0;
+
+  while (done < n) {
+    PacketStruct *p = NWLCreatePacket(&WIFID1);
+    uint8_t slot, next;
+    int i;
+
+    while (p->length < MAX_FRAME_PER_PACKET)
+      (void)NWLAddFrameToPacket(p, &frames[k++ & (BENCH_FRAMES - 1)]);
+    NWLAssignFNtoPacket(&WIFID1, p);
+
+    for (i = 0, slot = p->first; i < p->length; i++, slot = next) {
+      next = DLLSlotNext(&DLLS1, slot);
+      DLLSlotFree(&DLLS1, slot);
+    }
+    done += p->length;
+    chPoolFree(&WIFID1.PacketPool, p);
+  }
+  return done;
+}
+
+static uint32_t BenchRing(uint32_t n){
+  uint32_t done = 0, k = 0;
+  int i;
+
+  while (done < n) {
+    for (i = 0; i < BENCH_BATCH; i++)
+      (void)DLLPutFrameInQueue(&DLLS1, &frames[k++ & (BENCH_FRAMES - 1)]);
+    RingDrain(false);
+    done += BENCH_BATCH;
+  }
+  return done;
+}
+
+/*
+ * The receiver and the sending thread of CanComm with a full packet as the
+ * only flush trigger.
+ */
+static CanStreamEncoder BenchStream;
+#if CAN_USE_DELTA
+static CanDeltaEncoder BenchDelta;
+#endif
+static uint32_t BenchStamp;
+
+static uint32_t BenchEncode(uint32_t n){
+  PacketStruct *p = NWLCreatePacket(&WIFID1);
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    CanStreamFrame *f = &canframes[i & (BENCH_FRAMES - 1)];
+
+    BenchStamp += 100;
+    f->stamp = BenchStamp;
+#if CAN_USE_DELTA
+    CanDeltaAddFrame(&BenchDelta, &BenchStream, p, f);
+#else
+    CanStreamAddFrame(&BenchStream, p, f);
+#endif
+    if (p->length >= MAX_FRAME_PER_PACKET - CAN_FLUSH_RESERVE || i == n - 1) {
+      CanStreamEnd(&BenchStream, p);
+      NWLSendPacketUDP(&WIFID1, p, BenchIp, 4000);
+      RingDrain(true);
+      if (i != n - 1)
+        p = NWLCreatePacket(&WIFID1);
+    }
+  }
+  return n;
+}
+
+static Bench benches[] = {
+  {"crc-create",      BenchCreateCRC, 0, 0, 0},
+  {"crc-check",       BenchCheckCRC,  0, 0, 0},
+  {"packet-assembly", BenchPacket,    0, 0, 0},
+  {"ring-enqueue",    BenchRing,      0, 0, 0},
+  {"can-to-serial",   BenchEncode,    0, 0, 0},
+};
+
+/*===========================================================================*/
+/* Measurement and report.                                                   */
+/*===========================================================================*/
+
+static int CompareDouble(const void *a, const void *b){
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void Measure(Bench *bp){
+  static double ns[BENCH_MAX_ROUNDS];
+  uint64_t written = 0, total = 0;
+  uint32_t r;
+
+  for (r = 0; r < opt.warmup; r++)
+    (void)bp->run(opt.frames);
+  for (r = 0; r < opt.rounds; r++) {
+    uint64_t w = SD1.written;
+    double t = Now();
+    uint32_t done = bp->run(opt.frames);
+
+    ns[r] = (Now() - t) / done;
+    written += SD1.written - w;
+    total += done;
+  }
+  qsort(ns, opt.rounds, sizeof(double), CompareDouble);
+  bp->median = ns[opt.rounds / 2];
+  bp->best = ns[0];
+  bp->bytes = (double)written / total;
+}
+
+static void PrintText(void){
+  size_t i;
+
+  printf("%u rounds of %u frames after %u warm-up rounds, revision %s\n\n",
+         opt.rounds, opt.frames, opt.warmup, BENCH_REVISION);
+  printf("%-16s %10s %10s %12s %10s\n", "benchmark", "ns/frame", "best", "frames/s", "bytes/fr");
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    Bench *bp = &benches[i];
+    printf("%-16s %10.1f %10.1f %12.0f", bp->name, bp->median, bp->best, 1e9 / bp->median);
+    if (bp->bytes > 0)
+      printf(" %10.2f", bp->bytes);
+    printf("\n");
+  }
+}
+
+static void PrintJson(void){
+  size_t i, n = sizeof(benches) / sizeof(benches[0]);
+
+  printf("{\n");
+  printf("  \"revision\": \"%s\",\n", BENCH_REVISION);
+  printf("  \"compiler\": \"%s\",\n", __VERSION__);
+  printf("  \"config\": {\"DLL_FRAMING\": %d, \"DLL_CRC8_ENGINE\": %d, "
+         "\"DLL_USE_COMPACT_FRAMES\": %d, \"DLL_USE_PRIORITY_LANE\": %d, "
+         "\"CAN_USE_DELTA\": %d, \"MAX_FRAME_PER_PACKET\": %d},\n",
+         DLL_FRAMING, DLL_CRC8_ENGINE, DLL_USE_COMPACT_FRAMES, DLL_USE_PRIORITY_LANE,
+         CAN_USE_DELTA, MAX_FRAME_PER_PACKET);
+  printf("  \"frames\": %u, \"warmup\": %u, \"rounds\": %u,\n",
+         opt.frames, opt.warmup, opt.rounds);
+  printf("  \"results\": [\n");
+  for (i = 0; i < n; i++) {
+    Bench *bp = &benches[i];
+    printf("    {\"name\": \"%s\", \"ns_per_frame\": %.2f, \"ns_per_frame_best\": %.2f, "
+           "\"frames_per_s\": %.0f, \"bytes_per_frame\": %.3f}%s\n",
+           bp->name, bp->median, bp->best, 1e9 / bp->median, bp->bytes, i + 1 < n ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+/*===========================================================================*/
+/* Setup.                                                                    */
+/*===========================================================================*/
+
+/*
+ * Random frames with a valid CRC, and 16 CAN IDs with 8 data bytes of
+ * which 2 change from one frame of an ID to the next.
+ */
+static void FillFrames(void){
+  uint8_t data[16][8];
+  int i, j;
+
+  srand(1);
+  for (i = 0; i < BENCH_FRAMES; i++) {
+    uint8_t *p = (uint8_t *)&frames[i];
+    for (j = 0; j < FRAME_SIZE_BYTE - 1; j++)
+      p[j] = (uint8_t)rand();
+    frames[i].Id = FTYPE_CANSTREAM;
+    frames[i].CrcHex = CreateCRC(&frames[i]);
+  }
+  for (i = 0; i < 16; i++)
+    for (j = 0; j < 8; j++)
+      data[i][j] = (uint8_t)rand();
+  for (i = 0; i < BENCH_FRAMES; i++) {
+    CanStreamFrame *f = &canframes[i];
+    f->id = 0x100 + (i & 15);
+    f->flags = 0;
+    f->dlc = 8;
+    data[i & 15][rand() & 7] = (uint8_t)rand();
+    data[i & 15][rand() & 7] = (uint8_t)rand();
+    memcpy(f->data, data[i & 15], 8);
+  }
+}
+
+static void Usage(const char *name){
+  fprintf(stderr,
+          "Usage: %s [-n frames] [-w warmup] [-r rounds] [-j]\n"
+          "  -n frames   frames per round (%u)\n"
+          "  -w rounds   warm-up rounds (%u)\n"
+          "  -r rounds   measured rounds (%u)\n"
+          "  -j          JSON output\n",
+          name, opt.frames, opt.warmup, opt.rounds);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  size_t i;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:w:r:j")) != -1) {
+    switch (c) {
+    case 'n': opt.frames = strtoul(optarg, NULL, 0); break;
+    case 'w': opt.warmup = strtoul(optarg, NULL, 0); break;
+    case 'r': opt.rounds = strtoul(optarg, NULL, 0); break;
+    case 'j': opt.json = true; break;
+    default: Usage(argv[0]);
+    }
+  }
+  if (opt.frames == 0 || opt.rounds == 0 || opt.rounds > BENCH_MAX_ROUNDS)
+    Usage(argv[0]);
+
+  chSysInit();
+  chSimHoldThreads(true);
+  sdSimAttach(&SD1, -1, false);
+  wifiInit();
+  wifiStart(&WIFID1, &DLLS1, &BenchCfg);
+  CanStreamInit(&BenchStream);
+#if CAN_USE_DELTA
+  CanDeltaInit(&BenchDelta);
+#endif
+  FillFrames();
+
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    Measure(&benches[i]);
+  /* A refused frame makes the figures too good.*/
+  if (WIFID1.NWLStats.DroppedFrames != 0 || BenchStream.RefusedFrames != 0) {
+    fprintf(stderr, "frames were dropped: %ld by the NetworkLayer, %ld by the stream\n",
+            WIFID1.NWLStats.DroppedFrames, BenchStream.RefusedFrames);
+    return 1;
+  }
+  if (opt.json)
+    PrintJson();
+  else
+    PrintText();
+  return 0;
+}
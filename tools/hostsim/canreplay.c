@@ -0,0 +1,735 @@
+/*
+ * canreplay.c
+ *
+ * Replays a recorded CAN trace into the host build of the forwarding (see
+ * hostsim.c): the frames enter the virtual CAN controller at their recorded
+ * time, or N times faster, and go through CanComm, the NetworkLayer and the
+ * DataLinkLayer into the pseudo-terminal. The sink on the other side decodes
+ * the serial line and finds every forwarded frame in the trace again, by its
+ * identifier and data, for the forwarding latency.
+ *
+ * Trace formats:
+ * - candump -L:  (1436509052.249713) can0 123#DEADBEEF
+ * - candump -ta: (1436509052.249713)  can0  123   [4]  DE AD BE EF
+ * - Vector ASC:  0.010000 1  1ABCDEF0x  Rx   d 8 11 22 33 44 55 66 77 88
+ * CAN FD frames, error frames and the other events are skipped.
+ *
+ * The report gives the throughput, the latency percentiles of the bulk and
+ * of the priority frames, the lost frames by cause and the fill of the
+ * packets.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "CanComm.h"
+#include "NetworkLayer.h"
+#include "DataLinkLayer.h"
+#include "CanFilter.h"
+#include "dcdecode.h"
+#include "simstats.h"
+
+/* The sink does not answer the peer.*/
+#if DLL_USE_ARQ || DLL_USE_CREDITS
+#error "the sink does not support DLL_USE_ARQ and DLL_USE_CREDITS"
+#endif
+
+/*
+ * A received frame is looked for among the pending frames of its ID up to
+ * this age, the older ones count as lost.
+ */
+#define REPLAY_MAX_AGE_NS   (5000000000ULL)
+
+#define REPLAY_NONE         (-1)
+
+typedef struct {
+  uint64_t t;                   /* Since the first frame of the trace (ns). */
+  uint64_t injected;            /* When it entered the controller (ns).     */
+  uint32_t id;
+  int32_t key;                  /* Index of the (id, ide) pair.             */
+  int32_t next;                 /* Next pending frame of the same key.      */
+  uint8_t ide, rtr, dlc;
+  uint8_t data[8];
+} ReplayFrame;
+
+typedef struct {
+  uint32_t id;
+  uint8_t ide;
+  int32_t head, tail;           /* Pending frames, oldest first.            */
+} ReplayKey;
+
+static struct {
+  double speed;
+  uint32_t bitrate;             /* Spacing of the frames, 0 as recorded.    */
+  uint32_t baudrate;
+  bool paced;
+  uint32_t budget;
+  uint32_t gap;
+  uint32_t interval;
+  const char *iface;
+  const char *output;
+} opt = {1.0, 0, 921600, true, 0, 0, 1, NULL, NULL};
+
+static DLLSerialConfig ReplayCfg = {
+  &SD1,
+  921600,
+  CanCommFrameReceived
+};
+
+/* The trace.*/
+static ReplayFrame *trace;
+static size_t frames, skipped;
+static ReplayKey *keys;
+static size_t nkeys;
+static int32_t *hash;
+static size_t hashsize;
+
+/* Replay state, under statlock.*/
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+static DcDecoder sink;
+static SimLatency latbulk, latprio;
+static size_t injected, refused;
+static long matched, unmatched, missing;
+static volatile bool finished;
+static int slave;
+static FILE *capture;
+
+/*===========================================================================*/
+/* Trace loading.                                                            */
+/*===========================================================================*/
+
+static uint64_t Hash(uint32_t id, uint8_t ide){
+  uint64_t h = ((uint64_t)id << 1 | ide) * 0x9E3779B97F4A7C15ULL;
+  return h >> 32;
+}
+
+static int32_t KeyFind(uint32_t id, uint8_t ide){
+  size_t i = Hash(id, ide) & (hashsize - 1);
+
+  while (hash[i] != REPLAY_NONE) {
+    if (keys[hash[i]].id == id && keys[hash[i]].ide == ide)
+      return hash[i];
+    i = (i + 1) & (hashsize - 1);
+  }
+  return REPLAY_NONE;
+}
+
+/*
+ * Numbers the (id, ide) pairs of the trace.
+ */
+static void KeysBuild(void){
+  size_t i;
+
+  for (hashsize = 64; hashsize < 2 * frames; hashsize *= 2)
+    ;
+  hash = malloc(hashsize * sizeof(int32_t));
+  keys = malloc((frames + 1) * sizeof(ReplayKey));
+  if (hash == NULL || keys == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  memset(hash, 0xFF, hashsize * sizeof(int32_t));
+
+  for (i = 0; i < frames; i++) {
+    ReplayFrame *rf = &trace[i];
+    int32_t k = KeyFind(rf->id, rf->ide);
+
+    if (k == REPLAY_NONE) {
+      size_t h = Hash(rf->id, rf->ide) & (hashsize - 1);
+      while (hash[h] != REPLAY_NONE)
+        h = (h + 1) & (hashsize - 1);
+      k = nkeys++;
+      hash[h] = k;
+      keys[k].id = rf->id;
+      keys[k].ide = rf->ide;
+      keys[k].head = keys[k].tail = REPLAY_NONE;
+    }
+    rf->key = k;
+    rf->next = REPLAY_NONE;
+  }
+}
+
+static int Hex(int c){
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/*
+ * candump -L: 123#DEADBEEF, 12345678#R, 123#R4. False on CAN FD frames and
+ * errors.
+ */
+static bool ParseCompact(const char *s, ReplayFrame *rf){
+  const char *hashp = strchr(s, '#');
+  char *end;
+
+  if (hashp == NULL || hashp[1] == '#')
+    return false;
+  rf->id = strtoul(s, &end, 16);
+  if (end != hashp)
+    return false;
+  rf->ide = hashp - s > 3;
+  s = hashp + 1;
+  if (*s == 'R' || *s == 'r') {
+    rf->rtr = 1;
+    rf->dlc = isdigit((unsigned char)s[1]) ? s[1] - '0' : 0;
+    return rf->dlc <= 8;
+  }
+  while (Hex(s[0]) >= 0 && Hex(s[1]) >= 0) {
+    if (rf->dlc == 8)
+      return false;
+    rf->data[rf->dlc++] = Hex(s[0]) << 4 | Hex(s[1]);
+    s += 2;
+    if (*s == '.')
+      s++;
+  }
+  return true;
+}
+
+/*
+ * candump with a timestamp option: the identifier, then [dlc] and the data
+ * bytes or "remote request".
+ */
+static bool ParseSpaced(const char *id, char *rest, ReplayFrame *rf){
+  char *end;
+  unsigned dlc, i;
+
+  rf->id = strtoul(id, &end, 16);
+  if (*end != '\0')
+    return false;
+  rf->ide = strlen(id) > 3;
+  if (sscanf(rest, " [%u]", &dlc) != 1 || dlc > 8)
+    return false;
+  rf->dlc = dlc;
+  rest = strchr(rest, ']') + 1;
+  if (strstr(rest, "remote") != NULL) {
+    rf->rtr = 1;
+    return true;
+  }
+  for (i = 0; i < dlc; i++) {
+    unsigned long b = strtoul(rest, &end, 16);
+    if (end == rest)
+      return false;
+    rf->data[i] = b;
+    rest = end;
+  }
+  return true;
+}
+
+/*
+ * One line of a candump log, true if it is a CAN frame.
+ */
+static bool ParseCandump(char *line, ReplayFrame *rf, double *t){
+  char iface[32], id[64];
+  int n;
+
+  if (sscanf(line, " (%lf) %31s %63s %n", t, iface, id, &n) < 3)
+    return false;
+  if (opt.iface != NULL && strcmp(opt.iface, iface) != 0)
+    return false;
+  if (strchr(id, '#') != NULL)
+    return ParseCompact(id, rf);
+  return ParseSpaced(id, line + n, rf);
+}
+
+/*
+ * One line of a Vector ASC log, true if it is a CAN frame.
+ */
+static bool ParseAsc(char *line, ReplayFrame *rf, double *t, bool dec){
+  char chan[16], id[32], dir[8], type[8];
+  unsigned dlc, i;
+  char *end, *p;
+  int n;
+
+  if (sscanf(line, " %lf %15s %31s %7s %7s %n", t, chan, id, dir, type, &n) < 5)
+    return false;
+  if (!isdigit((unsigned char)chan[0]) || (opt.iface != NULL && strcmp(opt.iface, chan) != 0))
+    return false;
+  if (strcmp(dir, "Rx") != 0 && strcmp(dir, "Tx") != 0)
+    return false;
+  rf->id = strtoul(id, &end, dec ? 10 : 16);
+  if (end == id)
+    return false;
+  rf->ide = *end == 'x' || *end == 'X';
+  if (*end != '\0' && !rf->ide)
+    return false;
+
+  p = line + n;
+  if (strcmp(type, "r") == 0) {
+    rf->rtr = 1;
+    /* The DLC of a remote frame is optional.*/
+    dlc = strtoul(p, &end, dec ? 10 : 16);
+    rf->dlc = end != p && dlc <= 8 ? dlc : 0;
+    return true;
+  }
+  if (strcmp(type, "d") != 0)
+    return false;
+  dlc = strtoul(p, &end, 16);
+  if (end == p || dlc > 8)
+    return false;
+  rf->dlc = dlc;
+  p = end;
+  for (i = 0; i < dlc; i++) {
+    unsigned long b = strtoul(p, &end, dec ? 10 : 16);
+    if (end == p)
+      return false;
+    rf->data[i] = b;
+    p = end;
+  }
+  return true;
+}
+
+static void TraceLoad(const char *name){
+  FILE *f = strcmp(name, "-") == 0 ? stdin : fopen(name, "r");
+  char line[512];
+  size_t cap = 0;
+  double t, first = 0, prev = 0, last = 0;
+  bool dec = false, relative = false;
+
+  if (f == NULL) {
+    perror(name);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    ReplayFrame rf;
+    bool ok;
+
+    /* ASC header.*/
+    if (strncmp(line, "base ", 5) == 0) {
+      dec = strstr(line, "base dec") != NULL;
+      relative = strstr(line, "relative") != NULL;
+      continue;
+    }
+    memset(&rf, 0, sizeof(rf));
+    if (line[strspn(line, " \t")] == '(')
+      ok = ParseCandump(line, &rf, &t);
+    else
+      ok = ParseAsc(line, &rf, &t, dec);
+    if (!ok) {
+      if (line[strspn(line, " \t\r\n")] != '\0')
+        skipped++;
+      continue;
+    }
+
+    if (relative)
+      t += prev;
+    prev = t;
+    if (frames == 0)
+      first = last = t;
+    /* Merged logs may go back a little.*/
+    if (t < last)
+      t = last;
+    last = t;
+    rf.t = (uint64_t)((t - first) * 1e9 + 0.5);
+
+    if (frames == cap) {
+      cap = cap ? 2 * cap : 65536;
+      trace = realloc(trace, cap * sizeof(ReplayFrame));
+      if (trace == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    trace[frames++] = rf;
+  }
+  if (f != stdin)
+    fclose(f);
+  if (frames == 0) {
+    fprintf(stderr, "%s: no CAN frames\n", name);
+    exit(1);
+  }
+  KeysBuild();
+}
+
+/*
+ * Largest number of frames of the trace in a window of @p ns.
+ */
+static size_t TracePeak(uint64_t ns){
+  size_t i, j = 0, peak = 0;
+
+  for (i = 0; i < frames; i++) {
+    while (trace[i].t - trace[j].t >= ns)
+      j++;
+    if (i - j + 1 > peak)
+      peak = i - j + 1;
+  }
+  return peak;
+}
+
+/*===========================================================================*/
+/* Replay and matching.                                                      */
+/*===========================================================================*/
+
+static uint64_t NowNs(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static THD_WORKING_AREA(waSource, 256);
+static THD_FUNCTION(Source, arg) {
+  uint64_t start = NowNs(), last = 0;
+  size_t i;
+
+  (void)arg;
+  chRegSetThreadName("can replay");
+  for (i = 0; i < frames; i++) {
+    ReplayFrame *rf = &trace[i];
+    uint64_t due = start + (uint64_t)(rf->t / opt.speed);
+    struct timespec ts;
+    CANRxFrame f;
+
+    if (opt.bitrate != 0) {
+      uint64_t onbus = (uint64_t)((rf->ide ? 67 : 47) + 8 * (rf->rtr ? 0 : rf->dlc)) *
+                       1000000000ULL / opt.bitrate;
+      if (due < last + onbus)
+        due = last + onbus;
+    }
+    last = due;
+    ts.tv_sec = due / 1000000000ULL;
+    ts.tv_nsec = due % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+    memset(&f, 0, sizeof(f));
+    f.IDE = rf->ide ? CAN_IDE_EXT : CAN_IDE_STD;
+    f.RTR = rf->rtr ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    if (rf->ide)
+      f.EID = rf->id;
+    else
+      f.SID = rf->id;
+    f.DLC = rf->dlc;
+    memcpy(f.data8, rf->data, 8);
+
+    pthread_mutex_lock(&statlock);
+    rf->injected = NowNs();
+    if (canSimInject(&CAND1, &f)) {
+      ReplayKey *k = &keys[rf->key];
+      if (k->tail == REPLAY_NONE)
+        k->head = i;
+      else
+        trace[k->tail].next = i;
+      k->tail = i;
+      injected++;
+    }else
+      refused++;
+    pthread_mutex_unlock(&statlock);
+  }
+  finished = true;
+}
+
+/*
+ * Finds a forwarded frame among the pending frames of its ID. The frames
+ * of an ID arrive in order unless the priority lane was full, so the frame
+ * is usually the first one.
+ * Called by DcDecoderFeed() with statlock held.
+ */
+static void SinkFrame(void *arg, const DcCanFrame *f){
+  int32_t k = KeyFind(f->id, !!(f->flags & DC_CAN_IDE)), i, prev = REPLAY_NONE;
+  uint64_t now = NowNs();
+  uint8_t rtr = !!(f->flags & DC_CAN_RTR);
+
+  (void)arg;
+  if (k == REPLAY_NONE) {
+    unmatched++;
+    return;
+  }
+  for (i = keys[k].head; i != REPLAY_NONE; ) {
+    ReplayFrame *rf = &trace[i];
+    int32_t next = rf->next;
+    bool old = now - rf->injected > REPLAY_MAX_AGE_NS;
+    bool same = rf->rtr == rtr && rf->dlc == f->dlc &&
+                (rtr || memcmp(rf->data, f->data, rf->dlc) == 0);
+
+    if (same || old) {
+      if (prev == REPLAY_NONE)
+        keys[k].head = next;
+      else
+        trace[prev].next = next;
+      if (keys[k].tail == i)
+        keys[k].tail = prev;
+      if (same) {
+        SimLatencyAdd((f->flags & DC_CAN_PRIORITY) ? &latprio : &latbulk,
+                      (uint32_t)((now - rf->injected) / 1000));
+        matched++;
+        return;
+      }
+      missing++;
+    }else
+      prev = i;
+    i = next;
+  }
+  unmatched++;
+}
+
+static THD_WORKING_AREA(waSink, 256);
+static THD_FUNCTION(Sink, arg) {
+  uint8_t buf[512];
+
+  (void)arg;
+  chRegSetThreadName("sink");
+  while (true) {
+    ssize_t n = read(slave, buf, sizeof(buf));
+    if (n <= 0)
+      continue;
+    if (capture != NULL)
+      fwrite(buf, 1, n, capture);
+    pthread_mutex_lock(&statlock);
+    DcDecoderFeed(&sink, buf, n);
+    pthread_mutex_unlock(&statlock);
+  }
+}
+
+/*===========================================================================*/
+/* Report.                                                                   */
+/*===========================================================================*/
+
+static void PrintLatency(const char *name, const SimLatency *slp){
+  printf("  %-9s n %llu, avg %u, p50 %u, p90 %u, p99 %u, p99.9 %u, max %u us\n", name,
+         (unsigned long long)slp->count, SimLatencyAverage(slp),
+         SimLatencyPercentile(slp, 0.50), SimLatencyPercentile(slp, 0.90),
+         SimLatencyPercentile(slp, 0.99), SimLatencyPercentile(slp, 0.999), slp->max);
+}
+
+/*
+ * Stream frames per packet at quantile @p q.
+ */
+static int FillPercentile(double q){
+  long n = 0, want = (long)(q * sink.Packets + 0.5);
+  int i;
+
+  for (i = 0; i <= MAX_FRAME_PER_PACKET; i++) {
+    n += sink.PacketFill[i];
+    if (n >= want && n > 0)
+      return i;
+  }
+  return MAX_FRAME_PER_PACKET;
+}
+
+static void PrintReport(const char *name, double wall){
+  double span = trace[frames - 1].t / 1e9;
+  long shed = 0, fill = 0, pending = 0;
+  size_t k;
+  int32_t j;
+  int i;
+
+  for (i = 0; i < CAN_OVERLOAD_CLASSES; i++)
+    shed += CanOverloadQ.Shed[i];
+  for (i = 0; i <= MAX_FRAME_PER_PACKET; i++)
+    fill += (long)i * sink.PacketFill[i];
+
+  pthread_mutex_lock(&statlock);
+  for (k = 0; k < nkeys; k++)
+    for (j = keys[k].head; j != REPLAY_NONE; j = trace[j].next)
+      pending++;
+  printf("\ntrace %s: %zu frames, %zu IDs, %.3f s, %.0f frames/s, peak %zu in 1 ms, "
+         "%zu in 10 ms, %zu lines skipped\n", name, frames, nkeys, span,
+         span > 0 ? frames / span : 0, TracePeak(1000000), TracePeak(10000000), skipped);
+  printf("replay: %.2fx, %.3f s, %s threads\n", opt.speed, wall,
+         chSimRealtime() ? "SCHED_FIFO" : "time shared");
+
+  printf("throughput:\n");
+  printf("  can in    %zu frames, %.0f frames/s\n", injected + refused, (injected + refused) / wall);
+  printf("  forwarded %ld frames, %.0f frames/s\n", matched, matched / wall);
+  printf("  serial    %llu bytes, %.0f B/s, %.1f%% of the line\n",
+         (unsigned long long)SD1.written, SD1.written / wall,
+         100.0 * SD1.written * 10 / wall / opt.baudrate);
+
+  printf("latency:\n");
+  PrintLatency("bulk", &latbulk);
+  if (latprio.count > 0)
+    PrintLatency("priority", &latprio);
+
+  printf("lost frames:\n");
+  printf("  filter banks       %ld\n", CAND1.Filtered);
+  printf("  can fifo overrun   %ld\n", CAND1.Overruns);
+  printf("  overload queue     %ld newest, %ld oldest, %ld shed\n",
+         CanOverloadQ.DroppedNewest, CanOverloadQ.DroppedOldest, shed);
+  printf("  stream encoder     %ld records\n", CanStreamE.DroppedRecords);
+  printf("  serial link        %ld crc errors, %ld records\n", sink.CrcErrors, sink.LostRecords);
+  /* The frames dropped on the way are never received either, what is left
+     over has no counted cause.*/
+  printf("  never received     %ld, %ld without a cause above, %ld received frames not "
+         "in the trace\n", missing + pending,
+         missing + pending - CanOverloadQ.DroppedNewest - CanOverloadQ.DroppedOldest - shed -
+         CanStreamE.DroppedRecords, unmatched);
+#if DLL_USE_PRIORITY_LANE
+  printf("  (priority lane full, sent in packets: %ld)\n", CanPriorityT.LaneFull);
+#endif
+
+  printf("packets:\n");
+  printf("  %ld packets, %ld priority frames\n", sink.Packets, sink.PriorityFrames);
+  if (sink.Packets > 0)
+    printf("  %.1f stream frames (%.1f%% full), %.1f CAN frames per packet, "
+           "p10 %d p50 %d p90 %d frames\n",
+           (double)fill / sink.Packets, 100.0 * fill / sink.Packets / MAX_FRAME_PER_PACKET,
+           (double)(sink.CanFrames - sink.PriorityFrames) / sink.Packets,
+           FillPercentile(0.10), FillPercentile(0.50), FillPercentile(0.90));
+  printf("  flushes: %ld full, %ld deadline, %ld gap\n", CanFlushP.Flushes[CAN_FLUSH_FULL],
+         CanFlushP.Flushes[CAN_FLUSH_DEADLINE], CanFlushP.Flushes[CAN_FLUSH_GAP]);
+  pthread_mutex_unlock(&statlock);
+}
+
+/*===========================================================================*/
+/* Setup.                                                                    */
+/*===========================================================================*/
+
+static int OpenPty(void){
+  struct termios tio;
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    perror("posix_openpt");
+    exit(1);
+  }
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave < 0 || tcgetattr(slave, &tio) != 0) {
+    perror(ptsname(master));
+    exit(1);
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  return master;
+}
+
+static void Usage(const char *name){
+  fprintf(stderr,
+          "Usage: %s [options] trace\n"
+          "  -s speed     replay speed factor (%.1f)\n"
+          "  -I iface     only the frames of this interface or ASC channel\n"
+          "  -c bitrate   space the frames at least by their time on this bus\n"
+          "  -b baud      serial line speed (%u)\n"
+          "  -u           unpaced serial line\n"
+          "  -B us        latency budget of the flush policy\n"
+          "  -G us        idle gap of the flush policy\n"
+          "  -P id[x]     latency critical CAN ID, x for extended, repeatable\n"
+          "  -F id[x][/mask] forwarding rule of the acceptance filters, repeatable\n"
+          "  -o file      write the serial output into a file\n"
+          "  -i seconds   progress interval, 0 for none (%u)\n",
+          name, opt.speed, opt.baudrate, opt.interval);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t prio[CAN_PRIORITY_MAX_IDS];
+  bool prioext[CAN_PRIORITY_MAX_IDS];
+  CanFilterRule rules[CAN_FILTER_MAX_RULES];
+  int nrules = 0;
+  int c, nprio = 0, master;
+  uint64_t start, report, changed, idle;
+  long seen = -1;
+
+  while ((c = getopt(argc, argv, "s:I:c:b:uB:G:P:F:o:i:")) != -1) {
+    char *end;
+
+    switch (c) {
+    case 's': opt.speed = strtod(optarg, NULL); break;
+    case 'I': opt.iface = optarg; break;
+    case 'c': opt.bitrate = strtoul(optarg, NULL, 0); break;
+    case 'b': opt.baudrate = strtoul(optarg, NULL, 0); break;
+    case 'u': opt.paced = false; break;
+    case 'B': opt.budget = strtoul(optarg, NULL, 0); break;
+    case 'G': opt.gap = strtoul(optarg, NULL, 0); break;
+    case 'P':
+      if (nprio < CAN_PRIORITY_MAX_IDS) {
+        prio[nprio] = strtoul(optarg, &end, 0);
+        prioext[nprio++] = *end == 'x' || *end == 'X';
+      }
+      break;
+    case 'F':
+      if (nrules < CAN_FILTER_MAX_RULES) {
+        CanFilterRule *rp = &rules[nrules++];
+        rp->id = strtoul(optarg, &end, 0);
+        rp->flags = (*end == 'x' || *end == 'X') ? CAN_RULE_IDE : 0;
+        if (rp->flags)
+          end++;
+        rp->mask = *end == '/' ? strtoul(end + 1, NULL, 0) :
+                   rp->flags ? 0x1FFFFFFFUL : 0x7FFUL;
+      }
+      break;
+    case 'o': opt.output = optarg; break;
+    case 'i': opt.interval = strtoul(optarg, NULL, 0); break;
+    default: Usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || opt.speed <= 0)
+    Usage(argv[0]);
+
+  TraceLoad(argv[optind]);
+  if (opt.output != NULL && (capture = fopen(opt.output, "wb")) == NULL) {
+    perror(opt.output);
+    return 1;
+  }
+
+  chSysInit();
+  master = OpenPty();
+  sdSimAttach(&SD1, master, opt.paced);
+  ReplayCfg.baudrate = opt.baudrate;
+  DcDecoderInit(&sink, DLL_FRAMING, SinkFrame, NULL);
+  chThdCreateStatic(waSink, sizeof(waSink), NORMALPRIO, Sink, NULL);
+
+  wifiInit();
+  wifiStart(&WIFID1, &DLLS1, &ReplayCfg);
+  CanCommInit();
+  if (opt.budget != 0 || opt.gap != 0)
+    (void)CanFlushConfigure(&CanFlushP, opt.budget != 0 ? opt.budget : CanFlushP.config.budget,
+                            opt.gap, CanFlushP.config.full);
+  if (nrules > 0) {
+    int i;
+    for (i = 0; i < nrules; i++)
+      (void)CanFilterAdd(&CanFilterT, rules[i].id, rules[i].mask, rules[i].flags);
+    if (CanFilterApply(&CanFilterT) < 0) {
+      fprintf(stderr, "the forwarding rules do not fit the filter banks\n");
+      return 1;
+    }
+  }
+  while (nprio > 0) {
+    nprio--;
+    (void)CanPriorityAdd(&CanPriorityT, prio[nprio], prioext[nprio]);
+  }
+
+  start = report = NowNs();
+  changed = start;
+  chThdCreateStatic(waSource, sizeof(waSource), NORMALPRIO, Source, NULL);
+
+  /* Runs until the trace is replayed and the serial line is quiet for
+     longer than a packet may wait.*/
+  idle = 2ULL * CanFlushP.config.budget * 1000 + 200000000ULL;
+  while (true) {
+    uint64_t now;
+
+    chThdSleepMilliseconds(50);
+    now = NowNs();
+    pthread_mutex_lock(&statlock);
+    if (sink.Frames != seen) {
+      seen = sink.Frames;
+      changed = now;
+    }
+    if (opt.interval != 0 && now - report >= opt.interval * 1000000000ULL) {
+      report = now;
+      printf("%7.1f s: replayed %zu/%zu, forwarded %ld, bulk p99 %u us\n",
+             (now - start) / 1e9, injected + refused, frames, matched,
+             SimLatencyPercentile(&latbulk, 0.99));
+      fflush(stdout);
+    }
+    pthread_mutex_unlock(&statlock);
+    if (finished && now - changed > idle)
+      break;
+  }
+  if (capture != NULL)
+    fclose(capture);
+  PrintReport(argv[optind], (changed - start) / 1e9);
+  return 0;
+}
@@ -0,0 +1,730 @@
+/*
+ * espsim.c
+ *
+ * Simulates the ESP side of the serial line against the host build of the
+ * forwarding (see hostsim.c). The peer on the other side of the
+ * pseudo-terminal sends numbered frames to the board, answers its sync
+ * frames with a sync frame as DLLStartSync() expects, and decodes the
+ * frames of the board. A synthetic CAN load keeps the board sending.
+ *
+ * Faults are injected at random times into the bytes of either direction:
+ * a dropped byte, a flipped bit, a burst of random bytes or a wait in the
+ * middle of a frame. A fault hits the next byte on the line. For every
+ * fault the report gives the time until the receiver takes a frame again
+ * and the frames lost until the next fault of the same direction:
+ * - up, peer to board: the frames of the peer the board never received,
+ *   the resync is the reception of the first frame after the fault.
+ * - down, board to peer: the frames and the CAN frames the decoder of the
+ *   peer lost against a reference decoder fed the bytes without the
+ *   faults, the resync is the line time to the end of the first frame it
+ *   took after the fault.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "CanComm.h"
+#include "NetworkLayer.h"
+#include "DataLinkLayer.h"
+#include "dcdecode.h"
+#include "simstats.h"
+
+/* The peer does not answer the acknowledgements and the credits.*/
+#if DLL_USE_ARQ || DLL_USE_CREDITS
+#error "the peer does not support DLL_USE_ARQ and DLL_USE_CREDITS"
+#endif
+
+/*
+ * Traffic without faults at the end of the run, several sync timeouts so
+ * the last faults are resolved.
+ */
+#define SIM_DRAIN_MS        500
+
+enum { DIR_UP, DIR_DOWN, DIRS };
+enum { FAULT_DROP, FAULT_FLIP, FAULT_BURST, FAULT_WAIT, FAULTS };
+
+static const char *const dirnames[DIRS] = {"up", "down"};
+static const char *const faultnames[FAULTS] = {"drop", "flip", "burst", "wait"};
+static const char faultkeys[] = "dfbw";
+
+typedef struct {
+  uint8_t dir;
+  uint8_t kind;
+  uint64_t t;                   /* When the fault hit the line (ns).        */
+  uint32_t seq;                 /* Up: first frame of the peer it may hit.  */
+  long frames;                  /* Down: frames and CAN frames behind the   */
+  long can;                     /* reference decoder before the fault.      */
+  uint64_t resync;              /* Until a frame is taken (ns), 0 if never. */
+  long lost;                    /* Frames lost until the next fault.        */
+  long lostcan;
+} SimFault;
+
+typedef struct {
+  uint64_t state;               /* Random generator.                        */
+  uint64_t next;                /* Time of the next fault (ns).             */
+  unsigned burst;               /* Bytes of the burst still to overwrite.   */
+  uint64_t burstend;            /* When the burst is over on the line (ns). */
+  long faults;
+} SimInjector;
+
+static struct {
+  uint32_t rate;                /* CAN frames per second.                   */
+  uint32_t peerrate;            /* Frames per second sent by the peer.      */
+  uint32_t baudrate;
+  uint32_t seconds;
+  double faults;                /* Faults per second in each direction.     */
+  unsigned dirs;                /* Faulted directions.                      */
+  unsigned kinds;               /* Kinds of the faults.                     */
+  unsigned burst;               /* Bytes.                                   */
+  unsigned wait;                /* Milliseconds.                            */
+  uint64_t seed;
+  bool verbose;
+} opt = {1000, 200, 921600, 10, 2.0, 1 << DIR_UP, (1 << FAULTS) - 1, 8, 20, 1, false};
+
+static void PeerFrameReceived(const FrameStruct *Frame);
+
+static DLLSerialConfig SimCfg = {
+  &SD1,
+  921600,
+  PeerFrameReceived
+};
+
+static SerialDriver SDPeer;
+static int slave;
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+static binary_semaphore_t peerwake;
+static volatile bool echo, faulting = true, sending = true;
+static SimInjector injectors[DIRS];
+static long injected;
+
+/* The faults, under statlock.*/
+static SimFault *faults;
+static size_t nfaults, maxfaults;
+
+/* Up: reception time of the frames of the peer by sequence number.*/
+static uint64_t *received;
+static uint32_t maxseq, sentseq;
+static long bogus, echoes;
+
+/* Down: the decoder of the peer and the reference.*/
+static DcDecoder peerdec, refdec;
+static long lastdown = -1, resyncing = -1;
+static long resyncbase;
+static uint64_t resyncbytes, resyncwait;
+
+static uint64_t NowNs(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void SleepUntil(uint64_t t){
+  struct timespec ts;
+
+  ts.tv_sec = t / 1000000000ULL;
+  ts.tv_nsec = t % 1000000000ULL;
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/*===========================================================================*/
+/* Fault injection.                                                          */
+/*===========================================================================*/
+
+static uint64_t Random(SimInjector *sip){
+  uint64_t x = sip->state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  sip->state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* The faults of a direction are a Poisson process.*/
+static void FaultSchedule(SimInjector *sip, uint64_t now){
+  double u = (Random(sip) >> 11) * (1.0 / 9007199254740992.0);
+
+  sip->next = now + (uint64_t)(-log(1.0 - u) / opt.faults * 1e9);
+}
+
+static unsigned FaultKind(SimInjector *sip){
+  unsigned n = __builtin_popcount(opt.kinds), k = Random(sip) % n, i;
+
+  for (i = 0; i < FAULTS; i++)
+    if ((opt.kinds & (1 << i)) && k-- == 0)
+      break;
+  return i;
+}
+
+/*
+ * Injects the fault due and the rest of a burst into bytes going on the
+ * line at @p now. Returns the new number of bytes, the kind of the fault,
+ * FAULTS if none, and its position in @p at. A wait is left to the caller.
+ */
+static size_t FaultApply(unsigned dir, uint8_t *p, size_t n, uint64_t now,
+                         unsigned *kind, size_t *at){
+  SimInjector *sip = &injectors[dir];
+  size_t i = 0;
+
+  *kind = FAULTS;
+  /* The bytes after a pause of the line are past the burst.*/
+  if (now >= sip->burstend)
+    sip->burst = 0;
+  while (sip->burst > 0 && i < n) {
+    p[i++] = Random(sip);
+    sip->burst--;
+  }
+  if (!faulting || !(opt.dirs & (1 << dir)) || n == 0 || now < sip->next)
+    return n;
+
+  FaultSchedule(sip, now);
+  *kind = FaultKind(sip);
+  *at = i = Random(sip) % n;
+  switch (*kind) {
+  case FAULT_DROP:
+    memmove(&p[i], &p[i + 1], n - i - 1);
+    return n - 1;
+  case FAULT_FLIP:
+    p[i] ^= 1 << (Random(sip) & 7);
+    break;
+  case FAULT_BURST:
+    sip->burst = opt.burst;
+    sip->burstend = now + (i + opt.burst) * 10000000000ULL / opt.baudrate;
+    while (sip->burst > 0 && i < n) {
+      p[i++] = Random(sip);
+      sip->burst--;
+    }
+    break;
+  default:
+    break;
+  }
+  return n;
+}
+
+/* Called with statlock held.*/
+static size_t FaultAdd(unsigned dir, unsigned kind, uint64_t t){
+  SimFault *sfp;
+
+  if (nfaults == maxfaults) {
+    maxfaults = maxfaults > 0 ? 2 * maxfaults : 1024;
+    faults = realloc(faults, maxfaults * sizeof(SimFault));
+    if (faults == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  sfp = &faults[nfaults];
+  memset(sfp, 0, sizeof(SimFault));
+  sfp->dir = dir;
+  sfp->kind = kind;
+  sfp->t = t;
+  injectors[dir].faults++;
+  if (opt.verbose)
+    printf("fault %s %s at %.6f s\n", dirnames[dir], faultnames[kind], t / 1e9);
+  return nfaults++;
+}
+
+/*===========================================================================*/
+/* CAN load.                                                                 */
+/*===========================================================================*/
+
+static THD_WORKING_AREA(waSource, 256);
+static THD_FUNCTION(Source, arg) {
+  uint64_t start = NowNs(), k = 0;
+
+  (void)arg;
+  chRegSetThreadName("can source");
+  while (true) {
+    CANRxFrame f;
+
+    SleepUntil(start + k * 1000000000ULL / opt.rate);
+
+    memset(&f, 0, sizeof(f));
+    f.IDE = CAN_IDE_STD;
+    f.SID = 0x100 + k % 16;
+    f.DLC = 8;
+    f.data32[0] = (uint32_t)k;
+    f.data32[1] = (uint32_t)(k >> 32);
+    (void)canSimInject(&CAND1, &f);
+    injected++;
+    k++;
+  }
+}
+
+/*===========================================================================*/
+/* Peer to board.                                                            */
+/*===========================================================================*/
+
+/*
+ * Called by the 'SDReceiving' thread of the board for every frame taken.
+ * The frames of the peer are user data frames with their sequence number
+ * in data[0..3] and the low byte of it as FrameNumber.
+ */
+static void PeerFrameReceived(const FrameStruct *Frame){
+  static const uint8_t zero[8];
+  const uint8_t *fp = (const uint8_t *)Frame;
+  uint32_t seq = fp[2] | fp[3] << 8 | fp[4] << 16 | (uint32_t)fp[5] << 24;
+
+  if (fp[0] != FTYPE_USERDATA) {
+    CanCommFrameReceived(Frame);
+    return;
+  }
+  pthread_mutex_lock(&statlock);
+  if (seq < sentseq && fp[1] == (uint8_t)seq && memcmp(&fp[6], zero, 8) == 0 &&
+      received[seq] == 0)
+    received[seq] = NowNs();
+  else
+    bogus++;
+  pthread_mutex_unlock(&statlock);
+}
+
+/*
+ * Writes bytes of the peer once they are through the line, the board
+ * takes a frame when its last byte arrived as from the UART.
+ */
+static void PeerSend(const uint8_t *p, size_t n){
+  uint64_t now = NowNs();
+
+  SDPeer.linefree = (SDPeer.linefree > now ? SDPeer.linefree : now) +
+                    n * 10000000000ULL / opt.baudrate;
+  SleepUntil(SDPeer.linefree);
+  sdWrite(&SDPeer, p, n);
+}
+
+/*
+ * Sends bytes of the peer through the faults of the up direction, a fault
+ * loses the frames from @p seq on.
+ */
+static void PeerWrite(const uint8_t *p, size_t n, uint32_t seq){
+  uint8_t buf[COBS_ENCODED_SIZE(FRAME_SIZE_BYTE)];
+  uint64_t now = NowNs(), byte = 10000000000ULL / opt.baudrate;
+  unsigned kind;
+  size_t at;
+
+  /* The bytes go on the line after the ones still queued.*/
+  if (SDPeer.linefree > now)
+    now = SDPeer.linefree;
+  memcpy(buf, p, n);
+  n = FaultApply(DIR_UP, buf, n, now, &kind, &at);
+  if (kind != FAULTS) {
+    size_t k;
+
+    pthread_mutex_lock(&statlock);
+    k = FaultAdd(DIR_UP, kind, now + at * byte);
+    faults[k].seq = seq;
+    pthread_mutex_unlock(&statlock);
+  }
+  if (kind == FAULT_WAIT) {
+    PeerSend(buf, at);
+    chThdSleepMilliseconds(opt.wait);
+    PeerSend(&buf[at], n - at);
+  }else
+    PeerSend(buf, n);
+}
+
+static THD_WORKING_AREA(waPeerWriter, 256);
+static THD_FUNCTION(PeerWriter, arg) {
+  uint8_t sync[FRAME_SIZE_BYTE];
+  uint64_t start = NowNs();
+  uint32_t seq = 0;
+
+  (void)arg;
+  chRegSetThreadName("peer writer");
+  memset(sync, 0xFF, sizeof(sync));
+  while (sending && seq < maxseq) {
+    uint64_t now = NowNs(), due = start + (uint64_t)seq * 1000000000ULL /
+                                  (opt.peerrate > 0 ? opt.peerrate : 1);
+    uint8_t buf[COBS_ENCODED_SIZE(FRAME_SIZE_BYTE)];
+    FrameStruct frame;
+    size_t n;
+
+    /* The echo goes between two frames, as the sync frame of the board.*/
+    if (echo) {
+      echo = false;
+      echoes++;
+      PeerWrite(sync, sizeof(sync), seq);
+      continue;
+    }
+    if (opt.peerrate == 0 || now < due) {
+      (void)chBSemWaitTimeout(&peerwake, opt.peerrate == 0 || due - now > 100000000ULL ?
+                                         MS2ST(100) : US2ST((due - now + 999) / 1000));
+      continue;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.Id = FTYPE_USERDATA;
+    frame.FrameNumber = seq;
+    frame.data[0] = seq;
+    frame.data[1] = seq >> 8;
+    frame.data[2] = seq >> 16;
+    frame.data[3] = seq >> 24;
+    frame.CrcHex = CreateCRC(&frame);
+#if DLL_FRAMING == DLL_FRAMING_COBS
+    n = CobsEncode((const uint8_t *)&frame, FRAME_SIZE_BYTE, buf);
+#else
+    memcpy(buf, &frame, FRAME_SIZE_BYTE);
+    n = FRAME_SIZE_BYTE;
+#endif
+    pthread_mutex_lock(&statlock);
+    sentseq = seq + 1;
+    pthread_mutex_unlock(&statlock);
+    PeerWrite(buf, n, seq);
+    seq++;
+  }
+}
+
+/*===========================================================================*/
+/* Board to peer.                                                            */
+/*===========================================================================*/
+
+static void PeerCanFrame(void *arg, const DcCanFrame *f){
+  (void)arg;
+  (void)f;
+}
+
+/* Called by DcDecoderFeed() with statlock held.*/
+static void PeerSync(void *arg){
+  (void)arg;
+  echo = true;
+  chBSemSignal(&peerwake);
+}
+
+static long PeerFrames(const DcDecoder *dp){
+  return dp->Frames + dp->SyncFrames;
+}
+
+/*
+ * Feeds the decoder of the peer. While a fault waits for the resync the
+ * bytes go one by one, for the position of the first frame taken.
+ */
+static void PeerFeed(const uint8_t *p, size_t n){
+  while (resyncing >= 0 && n > 0) {
+    DcDecoderFeed(&peerdec, p++, 1);
+    n--;
+    resyncbytes++;
+    if (PeerFrames(&peerdec) > resyncbase) {
+      faults[resyncing].resync = resyncwait + resyncbytes * 10000000000ULL / opt.baudrate;
+      resyncing = -1;
+    }
+  }
+  DcDecoderFeed(&peerdec, p, n);
+}
+
+/*
+ * Closes the last fault of the down direction with the frames lost since,
+ * and opens the next one if @p k is not negative. Called with statlock
+ * held.
+ */
+static void DownFault(long k){
+  long frames = PeerFrames(&refdec) - PeerFrames(&peerdec);
+  long can = refdec.CanFrames - peerdec.CanFrames;
+
+  if (lastdown >= 0) {
+    faults[lastdown].lost = frames - faults[lastdown].frames;
+    faults[lastdown].lostcan = can - faults[lastdown].can;
+  }
+  lastdown = k;
+  resyncing = k;
+  if (k < 0)
+    return;
+  faults[k].frames = frames;
+  faults[k].can = can;
+  resyncbase = PeerFrames(&peerdec);
+  resyncbytes = 0;
+  resyncwait = faults[k].kind == FAULT_WAIT ? opt.wait * 1000000ULL : 0;
+}
+
+static THD_WORKING_AREA(waPeerReader, 256);
+static THD_FUNCTION(PeerReader, arg) {
+  uint8_t clean[512], buf[512];
+
+  (void)arg;
+  chRegSetThreadName("peer reader");
+  while (true) {
+    ssize_t n = read(slave, clean, sizeof(clean));
+    unsigned kind;
+    size_t m, at;
+
+    if (n <= 0)
+      continue;
+    /* The bytes of the board are taken once they are through the line.*/
+    SleepUntil(SD1.linefree);
+    memcpy(buf, clean, n);
+    m = FaultApply(DIR_DOWN, buf, n, NowNs(), &kind, &at);
+
+    pthread_mutex_lock(&statlock);
+    if (kind == FAULTS) {
+      DcDecoderFeed(&refdec, clean, n);
+      PeerFeed(buf, m);
+      pthread_mutex_unlock(&statlock);
+      continue;
+    }
+    DcDecoderFeed(&refdec, clean, at);
+    PeerFeed(buf, at);
+    DownFault(FaultAdd(DIR_DOWN, kind, NowNs()));
+    pthread_mutex_unlock(&statlock);
+    if (kind == FAULT_WAIT)
+      chThdSleepMilliseconds(opt.wait);
+    pthread_mutex_lock(&statlock);
+    DcDecoderFeed(&refdec, &clean[at], n - at);
+    PeerFeed(&buf[at], m - at);
+    pthread_mutex_unlock(&statlock);
+  }
+}
+
+/*===========================================================================*/
+/* Report.                                                                   */
+/*===========================================================================*/
+
+/*
+ * Counts the frames of the peer lost after every fault of the up
+ * direction, until the next one, and finds the first frame received.
+ */
+static void UpFinish(void){
+  uint32_t stop = sentseq, s;
+  size_t i = nfaults;
+
+  while (i-- > 0) {
+    SimFault *sfp = &faults[i];
+
+    if (sfp->dir != DIR_UP)
+      continue;
+    for (s = sfp->seq; s < stop; s++)
+      if (received[s] == 0)
+        sfp->lost++;
+    for (s = sfp->seq; s < stop; s++)
+      if (received[s] != 0) {
+        sfp->resync = received[s] > sfp->t ? received[s] - sfp->t : 1;
+        break;
+      }
+    stop = sfp->seq;
+  }
+}
+
+static void PrintFaults(unsigned dir){
+  static SimLatency resync;
+  unsigned kind;
+
+  for (kind = 0; kind < FAULTS; kind++) {
+    long n = 0, lost = 0, maxlost = 0, lostcan = 0, unresolved = 0;
+    size_t i;
+
+    SimLatencyReset(&resync);
+    for (i = 0; i < nfaults; i++) {
+      SimFault *sfp = &faults[i];
+
+      if (sfp->dir != dir || sfp->kind != kind)
+        continue;
+      n++;
+      lost += sfp->lost;
+      lostcan += sfp->lostcan;
+      if (sfp->lost > maxlost)
+        maxlost = sfp->lost;
+      if (sfp->resync == 0)
+        unresolved++;
+      else
+        SimLatencyAdd(&resync, (uint32_t)(sfp->resync / 1000));
+    }
+    if (n == 0)
+      continue;
+    printf("  %-4s %-5s %5ld faults, lost %.2f frames each (max %ld)", dirnames[dir],
+           faultnames[kind], n, (double)lost / n, maxlost);
+    if (dir == DIR_DOWN)
+      printf(", %.2f CAN frames", (double)lostcan / n);
+    printf("\n             resync p50 %u, p90 %u, p99 %u, max %u us, %ld without resync\n",
+           SimLatencyPercentile(&resync, 0.50), SimLatencyPercentile(&resync, 0.90),
+           SimLatencyPercentile(&resync, 0.99), resync.max, unresolved);
+  }
+}
+
+static void PrintReport(void){
+  DataLinkStatistics *dls = &DLLS1.DLLStats;
+  long lost = 0;
+  uint32_t s;
+  unsigned kind;
+
+  pthread_mutex_lock(&statlock);
+  DownFault(-1);
+  UpFinish();
+  for (s = 0; s < sentseq; s++)
+    if (received[s] == 0)
+      lost++;
+
+  printf("\n%u s, %s framing, %u baud, %s threads\n", opt.seconds,
+         DLL_FRAMING == DLL_FRAMING_COBS ? "COBS" : "fixed", opt.baudrate,
+         chSimRealtime() ? "SCHED_FIFO" : "time shared");
+  printf("faults: %.2f/s %s%s%s, kinds", opt.faults,
+         (opt.dirs & (1 << DIR_UP)) ? "up" : "",
+         opt.dirs == ((1 << DIR_UP) | (1 << DIR_DOWN)) ? " and " : "",
+         (opt.dirs & (1 << DIR_DOWN)) ? "down" : "");
+  for (kind = 0; kind < FAULTS; kind++)
+    if (opt.kinds & (1 << kind))
+      printf(" %s", faultnames[kind]);
+  printf(", bursts of %u bytes, waits of %u ms\n", opt.burst, opt.wait);
+
+  printf("up:   peer sent %u frames, board took %ld, lost %ld, %ld not sent by the peer\n",
+         sentseq, dls->ReceivedFrames, lost, bogus);
+  printf("      board: %ld syncs, %ld sync timeouts, %ld sync frames sent, %ld frame errors; "
+         "peer: %ld echoes\n", dls->SyncCounter, dls->SyncTimeout, dls->SyncFrameSentCounter,
+         dls->FrameErrors, echoes);
+  /* The sync frames are not in SentFrames.*/
+  printf("down: board sent %ld frames, peer took %ld (reference %ld), lost %ld\n",
+         dls->SentFrames, peerdec.Frames, refdec.Frames, refdec.Frames - peerdec.Frames);
+  printf("      board sent %ld sync frames, peer took %ld (reference %ld), lost %ld; "
+         "%ld crc errors, %ld packets lost\n", dls->SyncFrameSentCounter, peerdec.SyncFrames,
+         refdec.SyncFrames, refdec.SyncFrames - peerdec.SyncFrames, peerdec.CrcErrors,
+         peerdec.LostPackets);
+  printf("      CAN frames: %ld injected, peer decoded %ld (reference %ld), %ld lost records\n",
+         injected, peerdec.CanFrames, refdec.CanFrames, peerdec.LostRecords);
+
+  printf("by fault:\n");
+  PrintFaults(DIR_UP);
+  PrintFaults(DIR_DOWN);
+  pthread_mutex_unlock(&statlock);
+}
+
+/*===========================================================================*/
+/* Setup.                                                                    */
+/*===========================================================================*/
+
+static int OpenPty(void){
+  struct termios tio;
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    perror("posix_openpt");
+    exit(1);
+  }
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave < 0 || tcgetattr(slave, &tio) != 0) {
+    perror(ptsname(master));
+    exit(1);
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  return master;
+}
+
+static void Usage(const char *name){
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -r rate      CAN frames per second, 0 for none (%u)\n"
+          "  -f rate      frames per second sent by the peer (%u)\n"
+          "  -b baud      serial line speed (%u)\n"
+          "  -t seconds   duration (%u)\n"
+          "  -e rate      faults per second in each faulted direction (%.1f)\n"
+          "  -d dir       faulted direction: up, down or both (up)\n"
+          "  -k kinds     d drop, f flip, b burst, w wait (dfbw)\n"
+          "  -L bytes     length of the bursts (%u)\n"
+          "  -D ms        length of the waits (%u)\n"
+          "  -s seed      random seed (%llu)\n"
+          "  -v           print every fault\n",
+          name, opt.rate, opt.peerrate, opt.baudrate, opt.seconds, opt.faults, opt.burst,
+          opt.wait, (unsigned long long)opt.seed);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  int c, master;
+  unsigned dir;
+  uint32_t t;
+
+  while ((c = getopt(argc, argv, "r:f:b:t:e:d:k:L:D:s:v")) != -1) {
+    const char *k;
+
+    switch (c) {
+    case 'r': opt.rate = strtoul(optarg, NULL, 0); break;
+    case 'f': opt.peerrate = strtoul(optarg, NULL, 0); break;
+    case 'b': opt.baudrate = strtoul(optarg, NULL, 0); break;
+    case 't': opt.seconds = strtoul(optarg, NULL, 0); break;
+    case 'e': opt.faults = strtod(optarg, NULL); break;
+    case 'd':
+      if (strcmp(optarg, "up") == 0)
+        opt.dirs = 1 << DIR_UP;
+      else if (strcmp(optarg, "down") == 0)
+        opt.dirs = 1 << DIR_DOWN;
+      else if (strcmp(optarg, "both") == 0)
+        opt.dirs = (1 << DIR_UP) | (1 << DIR_DOWN);
+      else
+        Usage(argv[0]);
+      break;
+    case 'k':
+      opt.kinds = 0;
+      for (k = optarg; *k != '\0'; k++) {
+        const char *p = strchr(faultkeys, *k);
+        if (p == NULL)
+          Usage(argv[0]);
+        opt.kinds |= 1 << (p - faultkeys);
+      }
+      break;
+    case 'L': opt.burst = strtoul(optarg, NULL, 0); break;
+    case 'D': opt.wait = strtoul(optarg, NULL, 0); break;
+    case 's': opt.seed = strtoull(optarg, NULL, 0); break;
+    case 'v': opt.verbose = true; break;
+    default: Usage(argv[0]);
+    }
+  }
+  if (opt.baudrate == 0 || opt.seconds == 0 || opt.faults <= 0 || opt.kinds == 0 ||
+      opt.burst == 0)
+    Usage(argv[0]);
+
+  chSysInit();
+  chBSemObjectInit(&peerwake, true);
+  master = OpenPty();
+  sdSimAttach(&SD1, master, true);
+  SimCfg.baudrate = opt.baudrate;
+  sdSimAttach(&SDPeer, slave, false);
+
+  maxseq = opt.peerrate * (opt.seconds + SIM_DRAIN_MS / 1000 + 1) + 1;
+  received = calloc(maxseq, sizeof(uint64_t));
+  if (received == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (dir = 0; dir < DIRS; dir++) {
+    injectors[dir].state = (opt.seed + dir + 1) * 0x9E3779B97F4A7C15ULL;
+    FaultSchedule(&injectors[dir], NowNs());
+  }
+  DcDecoderInit(&peerdec, DLL_FRAMING, PeerCanFrame, NULL);
+  peerdec.synccb = PeerSync;
+  DcDecoderInit(&refdec, DLL_FRAMING, PeerCanFrame, NULL);
+  chThdCreateStatic(waPeerReader, sizeof(waPeerReader), NORMALPRIO, PeerReader, NULL);
+
+  wifiInit();
+  wifiStart(&WIFID1, &DLLS1, &SimCfg);
+  CanCommInit();
+
+  chThdCreateStatic(waPeerWriter, sizeof(waPeerWriter), NORMALPRIO, PeerWriter, NULL);
+  if (opt.rate > 0)
+    chThdCreateStatic(waSource, sizeof(waSource), NORMALPRIO, Source, NULL);
+
+  for (t = 1; t <= opt.seconds; t++) {
+    chThdSleepMilliseconds(1000);
+    pthread_mutex_lock(&statlock);
+    printf("%4u s: peer sent %u, board took %ld, %ld syncs; board sent %ld, peer took %ld; "
+           "faults %ld up, %ld down\n", t, sentseq, DLLS1.DLLStats.ReceivedFrames,
+           DLLS1.DLLStats.SyncCounter, DLLS1.DLLStats.SentFrames, peerdec.Frames,
+           injectors[DIR_UP].faults, injectors[DIR_DOWN].faults);
+    pthread_mutex_unlock(&statlock);
+    fflush(stdout);
+  }
+
+  /* The last faults are resolved on a clean line.*/
+  faulting = false;
+  chThdSleepMilliseconds(SIM_DRAIN_MS);
+  sending = false;
+  chThdSleepMilliseconds(100);
+  PrintReport();
+  return 0;
+}
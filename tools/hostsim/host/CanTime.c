@@ -0,0 +1,27 @@
+/*
+ * CanTime.c
+ *
+ * Host replacement of src/CanTime.c, the microsecond time base is the
+ * monotonic clock of the host.
+ */
+
+#include <time.h>
+
+#include "CanTime.h"
+
+static uint64_t CanTimeZero;
+
+static uint64_t CanTimeHost(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void CanTimeStart(void){
+  CanTimeZero = CanTimeHost();
+}
+
+uint32_t CanTimeNow(void){
+  return (uint32_t)(CanTimeHost() - CanTimeZero);
+}
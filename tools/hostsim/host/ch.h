@@ -0,0 +1,216 @@
+/*
+ * ch.h
+ *
+ * Host replacement of the ChibiOS kernel header. The subset of the kernel
+ * API used by the DualFramework and the CAN forwarding runs on POSIX
+ * threads, see chsim.c.
+ *
+ * The threads run in parallel and their priorities are not enforced, the
+ * system lock is a single mutex. The system tick has the frequency of the
+ * target so the timeouts have the same resolution.
+ */
+
+#ifndef HOST_CH_H_
+#define HOST_CH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <string.h>
+
+#define FALSE 0
+#define TRUE  1
+
+typedef int32_t msg_t;
+typedef uint32_t systime_t;
+typedef uint32_t eventmask_t;
+typedef int32_t cnt_t;
+typedef int tprio_t;
+typedef uint64_t stkalign_t;
+
+#define MSG_OK        ((msg_t)0)
+#define MSG_TIMEOUT   ((msg_t)-1)
+#define MSG_RESET     ((msg_t)-2)
+
+#define TIME_IMMEDIATE ((systime_t)0)
+#define TIME_INFINITE  ((systime_t)-1)
+
+#define ALL_EVENTS    ((eventmask_t)-1)
+#define EVENT_MASK(eid) ((eventmask_t)1 << (eventmask_t)(eid))
+
+#define IDLEPRIO      1
+#define LOWPRIO       2
+#define NORMALPRIO    64
+#define HIGHPRIO      127
+
+/*===========================================================================*/
+/* System tick, the same as the target (chconf.h).                           */
+/*===========================================================================*/
+
+#define CH_CFG_ST_FREQUENCY 2000
+
+#define S2ST(sec)   ((systime_t)((uint32_t)(sec) * (uint32_t)CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec) ((systime_t)((((uint32_t)(msec) * (uint32_t)CH_CFG_ST_FREQUENCY) + \
+                                  999UL) / 1000UL))
+#define US2ST(usec) ((systime_t)((((uint32_t)(usec) * (uint32_t)CH_CFG_ST_FREQUENCY) + \
+                                  999999UL) / 1000000UL))
+#define ST2MS(n)    (((uint32_t)(n) * 1000UL + CH_CFG_ST_FREQUENCY - 1UL) / CH_CFG_ST_FREQUENCY)
+#define ST2US(n)    (((uint32_t)(n) * 1000000UL + CH_CFG_ST_FREQUENCY - 1UL) / CH_CFG_ST_FREQUENCY)
+
+/*===========================================================================*/
+/* Threads.                                                                  */
+/*===========================================================================*/
+
+typedef void (*tfunc_t)(void *p);
+
+typedef struct thread {
+  pthread_t pt;
+  pthread_cond_t cond;          /* Signalled on resume and on events.       */
+  const char *name;
+  tprio_t prio;
+  tfunc_t func;
+  void *arg;
+  bool resumed;
+  msg_t rdymsg;
+  eventmask_t epending;
+  struct thread *next;          /* Registry.                                */
+} thread_t;
+
+typedef thread_t *thread_reference_t;
+
+#define THD_WORKING_AREA_SIZE(n) (n)
+#define THD_WORKING_AREA(s, n) \
+  stkalign_t s[((n) + sizeof(stkalign_t) - 1) / sizeof(stkalign_t)]
+#define THD_FUNCTION(tname, arg) void tname(void *arg)
+
+/*===========================================================================*/
+/* Synchronization objects.                                                  */
+/*===========================================================================*/
+
+typedef struct {
+  cnt_t cnt;
+  pthread_cond_t cond;
+} semaphore_t;
+
+typedef struct {
+  semaphore_t sem;
+} binary_semaphore_t;
+
+typedef struct {
+  pthread_mutex_t m;
+} mutex_t;
+
+typedef struct event_listener {
+  struct event_listener *next;
+  thread_t *listener;
+  eventmask_t events;
+} event_listener_t;
+
+typedef struct {
+  event_listener_t *next;
+} event_source_t;
+
+typedef struct {
+  void *next;
+  size_t object_size;
+} memory_pool_t;
+
+/*===========================================================================*/
+/* Debug.                                                                    */
+/*===========================================================================*/
+
+void chSysHalt(const char *reason);
+
+/* Same switches as chconf.h of the firmware, the NetworkLayer asserts on
+   states it does not reach with them disabled.*/
+#if !defined(CH_DBG_ENABLE_CHECKS)
+#define CH_DBG_ENABLE_CHECKS  FALSE
+#endif
+#if !defined(CH_DBG_ENABLE_ASSERTS)
+#define CH_DBG_ENABLE_ASSERTS FALSE
+#endif
+
+#if CH_DBG_ENABLE_CHECKS
+#define chDbgCheck(c) do {                                                  \
+  if (!(c))                                                                 \
+    chSysHalt(__func__);                                                    \
+} while (false)
+#else
+#define chDbgCheck(c) do { (void)(c); } while (false)
+#endif
+#if CH_DBG_ENABLE_ASSERTS
+#define chDbgAssert(c, r) do {                                              \
+  if (!(c))                                                                 \
+    chSysHalt(r);                                                           \
+} while (false)
+#else
+#define chDbgAssert(c, r) do { (void)(c); (void)(r); } while (false)
+#endif
+#define osalDbgCheck(c)     chDbgCheck(c)
+#define osalDbgAssert(c, r) chDbgAssert(c, r)
+#define osalSysHalt(r)      chSysHalt(r)
+
+/*===========================================================================*/
+/* API.                                                                      */
+/*===========================================================================*/
+
+void chSysInit(void);
+bool chSimRealtime(void);
+void chSimHoldThreads(bool hold);
+void chSysLock(void);
+void chSysUnlock(void);
+#define chSysLockFromISR()    chSysLock()
+#define chSysUnlockFromISR()  chSysUnlock()
+#define chSchRescheduleS()    ((void)0)
+
+systime_t chVTGetSystemTimeX(void);
+#define chVTGetSystemTime()   chVTGetSystemTimeX()
+#define chVTTimeElapsedSinceX(start) ((systime_t)(chVTGetSystemTimeX() - (start)))
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg);
+thread_t *chThdCreateFromHeap(void *heapp, size_t size, tprio_t prio, tfunc_t pf, void *arg);
+thread_t *chThdGetSelfX(void);
+void chRegSetThreadName(const char *name);
+#define chThdShouldTerminateX() false
+void chThdSleep(systime_t time);
+#define chThdSleepMilliseconds(msec) chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec) chThdSleep(US2ST(usec))
+msg_t chThdSuspendS(thread_reference_t *trp);
+msg_t chThdSuspendTimeoutS(thread_reference_t *trp, systime_t timeout);
+void chThdResumeI(thread_reference_t *trp, msg_t msg);
+#define chThdResumeS(trp, msg) chThdResumeI(trp, msg)
+void chThdResume(thread_reference_t *trp, msg_t msg);
+
+void chSemObjectInit(semaphore_t *sp, cnt_t n);
+msg_t chSemWaitTimeout(semaphore_t *sp, systime_t timeout);
+#define chSemWait(sp) chSemWaitTimeout(sp, TIME_INFINITE)
+void chSemSignalI(semaphore_t *sp);
+void chSemSignal(semaphore_t *sp);
+#define chSemGetCounterI(sp) ((sp)->cnt)
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken);
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t timeout);
+#define chBSemWait(bsp) chBSemWaitTimeout(bsp, TIME_INFINITE)
+void chBSemSignalI(binary_semaphore_t *bsp);
+void chBSemSignal(binary_semaphore_t *bsp);
+
+void chMtxObjectInit(mutex_t *mp);
+void chMtxLock(mutex_t *mp);
+void chMtxUnlock(mutex_t *mp);
+
+void chEvtRegisterMask(event_source_t *esp, event_listener_t *elp, eventmask_t events);
+#define chEvtRegister(esp, elp, eid) chEvtRegisterMask(esp, elp, EVENT_MASK(eid))
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp);
+void chEvtBroadcastI(event_source_t *esp);
+void chEvtSignalI(thread_t *tp, eventmask_t events);
+void chEvtSignal(thread_t *tp, eventmask_t events);
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t timeout);
+#define chEvtWaitAny(events) chEvtWaitAnyTimeout(events, TIME_INFINITE)
+
+void chPoolObjectInit(memory_pool_t *mp, size_t size, void *provider);
+void chPoolLoadArray(memory_pool_t *mp, void *p, size_t n);
+void *chPoolAlloc(memory_pool_t *mp);
+void chPoolFree(memory_pool_t *mp, void *objp);
+
+#endif /* HOST_CH_H_ */
@@ -0,0 +1,596 @@
+/*
+ * chsim.c
+ *
+ * Host implementation of the ChibiOS subset declared in ch.h and hal.h.
+ *
+ * Every kernel object is protected by the system lock, a single mutex.
+ * A waiting thread sleeps on its own condition variable, the semaphores
+ * have one each.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+
+static pthread_mutex_t ch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_condattr_t ch_condattr;
+static uint64_t ch_start;
+static __thread thread_t *ch_self;
+static thread_t ch_main;
+static thread_t *ch_registry;
+
+SerialDriver SD1;
+CANDriver CAND1;
+CAN_TypeDef CANSimRegisters;
+
+/*===========================================================================*/
+/* Time.                                                                     */
+/*===========================================================================*/
+
+static uint64_t ch_now_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ch_sleep_until_ns(uint64_t t){
+  struct timespec ts;
+
+  ts.tv_sec = t / 1000000000ULL;
+  ts.tv_nsec = t % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static uint64_t ch_ticks_ns(systime_t ticks){
+  return (uint64_t)ticks * 1000000000ULL / CH_CFG_ST_FREQUENCY;
+}
+
+systime_t chVTGetSystemTimeX(void){
+  return (systime_t)((ch_now_ns() - ch_start) * CH_CFG_ST_FREQUENCY / 1000000000ULL);
+}
+
+/*
+ * Waits on a condition variable with the system lock held, false on
+ * timeout.
+ */
+static bool ch_wait(pthread_cond_t *cond, systime_t timeout, uint64_t deadline){
+  struct timespec ts;
+
+  if (timeout == TIME_INFINITE) {
+    pthread_cond_wait(cond, &ch_lock);
+    return true;
+  }
+  ts.tv_sec = deadline / 1000000000ULL;
+  ts.tv_nsec = deadline % 1000000000ULL;
+  return pthread_cond_timedwait(cond, &ch_lock, &ts) != ETIMEDOUT;
+}
+
+/*===========================================================================*/
+/* System.                                                                   */
+/*===========================================================================*/
+
+static void ch_thread_init(thread_t *tp, tprio_t prio, tfunc_t pf, void *arg){
+  memset(tp, 0, sizeof(thread_t));
+  pthread_cond_init(&tp->cond, &ch_condattr);
+  tp->name = "noname";
+  tp->prio = prio;
+  tp->func = pf;
+  tp->arg = arg;
+  chSysLock();
+  tp->next = ch_registry;
+  ch_registry = tp;
+  chSysUnlock();
+}
+
+void chSysInit(void){
+  pthread_condattr_init(&ch_condattr);
+  pthread_condattr_setclock(&ch_condattr, CLOCK_MONOTONIC);
+  ch_start = ch_now_ns();
+  ch_thread_init(&ch_main, NORMALPRIO, NULL, NULL);
+  ch_main.pt = pthread_self();
+  ch_main.name = "main";
+  ch_self = &ch_main;
+}
+
+void chSysHalt(const char *reason){
+  fprintf(stderr, "chSysHalt: %s\n", reason);
+  abort();
+}
+
+void chSysLock(void){
+  pthread_mutex_lock(&ch_lock);
+}
+
+void chSysUnlock(void){
+  pthread_mutex_unlock(&ch_lock);
+}
+
+/*===========================================================================*/
+/* Threads.                                                                  */
+/*===========================================================================*/
+
+static bool ch_realtime = true;
+static bool ch_hold;
+
+/*
+ * While @p hold the created threads are registered but never run, a single
+ * threaded test drives the code they would run itself.
+ */
+void chSimHoldThreads(bool hold){
+  ch_hold = hold;
+}
+
+/*
+ * True if the threads run with SCHED_FIFO priorities.
+ */
+bool chSimRealtime(void){
+  return ch_realtime;
+}
+
+static void *ch_thread_start(void *p){
+  thread_t *tp = p;
+
+  ch_self = tp;
+  tp->func(tp->arg);
+  return NULL;
+}
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg){
+  thread_t *tp = malloc(sizeof(thread_t));
+
+  (void)wsp;
+  (void)size;
+  if (tp == NULL)
+    return NULL;
+  ch_thread_init(tp, prio, pf, arg);
+  if (ch_hold)
+    return tp;
+  /* The ChibiOS priorities become real time priorities where the host
+     allows them, else the host scheduler decides alone.*/
+  if (ch_realtime) {
+    pthread_attr_t attr;
+    struct sched_param sp;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    sp.sched_priority = 1 + prio * (sched_get_priority_max(SCHED_FIFO) - 2) / HIGHPRIO;
+    pthread_attr_setschedparam(&attr, &sp);
+    ret = pthread_create(&tp->pt, &attr, ch_thread_start, tp);
+    pthread_attr_destroy(&attr);
+    if (ret == 0) {
+      pthread_detach(tp->pt);
+      return tp;
+    }
+    ch_realtime = false;
+  }
+  if (pthread_create(&tp->pt, NULL, ch_thread_start, tp) != 0)
+    chSysHalt("pthread_create");
+  pthread_detach(tp->pt);
+  return tp;
+}
+
+thread_t *chThdCreateFromHeap(void *heapp, size_t size, tprio_t prio, tfunc_t pf, void *arg){
+  (void)heapp;
+  return chThdCreateStatic(NULL, size, prio, pf, arg);
+}
+
+thread_t *chThdGetSelfX(void){
+  return ch_self;
+}
+
+void chRegSetThreadName(const char *name){
+  char buf[16];
+
+  ch_self->name = name;
+  strncpy(buf, name, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  pthread_setname_np(pthread_self(), buf);
+}
+
+void chThdSleep(systime_t time){
+  ch_sleep_until_ns(ch_now_ns() + ch_ticks_ns(time));
+}
+
+msg_t chThdSuspendTimeoutS(thread_reference_t *trp, systime_t timeout){
+  thread_t *tp = ch_self;
+  uint64_t deadline = ch_now_ns() + ch_ticks_ns(timeout);
+
+  if (timeout == TIME_IMMEDIATE)
+    return MSG_TIMEOUT;
+  *trp = tp;
+  tp->resumed = false;
+  while (!tp->resumed) {
+    if (!ch_wait(&tp->cond, timeout, deadline) && !tp->resumed) {
+      *trp = NULL;
+      return MSG_TIMEOUT;
+    }
+  }
+  return tp->rdymsg;
+}
+
+msg_t chThdSuspendS(thread_reference_t *trp){
+  return chThdSuspendTimeoutS(trp, TIME_INFINITE);
+}
+
+void chThdResumeI(thread_reference_t *trp, msg_t msg){
+  thread_t *tp = *trp;
+
+  if (tp != NULL) {
+    *trp = NULL;
+    tp->rdymsg = msg;
+    tp->resumed = true;
+    pthread_cond_signal(&tp->cond);
+  }
+}
+
+void chThdResume(thread_reference_t *trp, msg_t msg){
+  chSysLock();
+  chThdResumeI(trp, msg);
+  chSysUnlock();
+}
+
+/*===========================================================================*/
+/* Semaphores and mutexes.                                                   */
+/*===========================================================================*/
+
+void chSemObjectInit(semaphore_t *sp, cnt_t n){
+  sp->cnt = n;
+  pthread_cond_init(&sp->cond, &ch_condattr);
+}
+
+static msg_t ch_sem_wait_s(semaphore_t *sp, systime_t timeout){
+  uint64_t deadline = ch_now_ns() + ch_ticks_ns(timeout);
+
+  while (sp->cnt <= 0) {
+    if (timeout == TIME_IMMEDIATE || (!ch_wait(&sp->cond, timeout, deadline) && sp->cnt <= 0))
+      return MSG_TIMEOUT;
+  }
+  sp->cnt--;
+  return MSG_OK;
+}
+
+msg_t chSemWaitTimeout(semaphore_t *sp, systime_t timeout){
+  msg_t msg;
+
+  chSysLock();
+  msg = ch_sem_wait_s(sp, timeout);
+  chSysUnlock();
+  return msg;
+}
+
+void chSemSignalI(semaphore_t *sp){
+  sp->cnt++;
+  pthread_cond_signal(&sp->cond);
+}
+
+void chSemSignal(semaphore_t *sp){
+  chSysLock();
+  chSemSignalI(sp);
+  chSysUnlock();
+}
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken){
+  chSemObjectInit(&bsp->sem, taken ? 0 : 1);
+}
+
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t timeout){
+  return chSemWaitTimeout(&bsp->sem, timeout);
+}
+
+void chBSemSignalI(binary_semaphore_t *bsp){
+  if (bsp->sem.cnt < 1)
+    chSemSignalI(&bsp->sem);
+}
+
+void chBSemSignal(binary_semaphore_t *bsp){
+  chSysLock();
+  chBSemSignalI(bsp);
+  chSysUnlock();
+}
+
+void chMtxObjectInit(mutex_t *mp){
+  pthread_mutex_init(&mp->m, NULL);
+}
+
+void chMtxLock(mutex_t *mp){
+  pthread_mutex_lock(&mp->m);
+}
+
+void chMtxUnlock(mutex_t *mp){
+  pthread_mutex_unlock(&mp->m);
+}
+
+/*===========================================================================*/
+/* Events.                                                                   */
+/*===========================================================================*/
+
+void chEvtRegisterMask(event_source_t *esp, event_listener_t *elp, eventmask_t events){
+  chSysLock();
+  elp->listener = ch_self;
+  elp->events = events;
+  elp->next = esp->next;
+  esp->next = elp;
+  chSysUnlock();
+}
+
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp){
+  event_listener_t **pp;
+
+  chSysLock();
+  for (pp = &esp->next; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == elp) {
+      *pp = elp->next;
+      break;
+    }
+  }
+  chSysUnlock();
+}
+
+void chEvtBroadcastI(event_source_t *esp){
+  event_listener_t *elp;
+
+  for (elp = esp->next; elp != NULL; elp = elp->next)
+    chEvtSignalI(elp->listener, elp->events);
+}
+
+void chEvtSignalI(thread_t *tp, eventmask_t events){
+  tp->epending |= events;
+  pthread_cond_signal(&tp->cond);
+}
+
+void chEvtSignal(thread_t *tp, eventmask_t events){
+  chSysLock();
+  chEvtSignalI(tp, events);
+  chSysUnlock();
+}
+
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t timeout){
+  thread_t *tp = ch_self;
+  uint64_t deadline = ch_now_ns() + ch_ticks_ns(timeout);
+  eventmask_t m;
+
+  chSysLock();
+  while ((tp->epending & events) == 0) {
+    if (timeout == TIME_IMMEDIATE || !ch_wait(&tp->cond, timeout, deadline))
+      break;
+  }
+  m = tp->epending & events;
+  tp->epending &= ~m;
+  chSysUnlock();
+  return m;
+}
+
+/*===========================================================================*/
+/* Memory pools.                                                             */
+/*===========================================================================*/
+
+void chPoolObjectInit(memory_pool_t *mp, size_t size, void *provider){
+  (void)provider;
+  mp->next = NULL;
+  mp->object_size = size;
+}
+
+void chPoolLoadArray(memory_pool_t *mp, void *p, size_t n){
+  while (n-- > 0) {
+    chPoolFree(mp, p);
+    p = (uint8_t *)p + mp->object_size;
+  }
+}
+
+void *chPoolAlloc(memory_pool_t *mp){
+  void *objp;
+
+  chSysLock();
+  objp = mp->next;
+  if (objp != NULL)
+    mp->next = *(void **)objp;
+  chSysUnlock();
+  return objp;
+}
+
+void chPoolFree(memory_pool_t *mp, void *objp){
+  chSysLock();
+  *(void **)objp = mp->next;
+  mp->next = objp;
+  chSysUnlock();
+}
+
+/*===========================================================================*/
+/* Serial driver.                                                            */
+/*===========================================================================*/
+
+/*
+ * Attaches a file descriptor to a SerialDriver. If @p paced the writes take
+ * as long as on a line of the configured speed (10 bits per byte). With a
+ * negative @p fd the written bytes are only counted.
+ */
+void sdSimAttach(SerialDriver *sdp, int fd, bool paced){
+  sdp->fd = fd;
+  sdp->paced = paced;
+  sdp->linefree = 0;
+  sdp->written = 0;
+}
+
+void sdStart(SerialDriver *sdp, const SerialConfig *config){
+  sdp->speed = config->speed;
+}
+
+size_t sdWrite(SerialDriver *sdp, const void *bp, size_t n){
+  const uint8_t *p = bp;
+  size_t left = n;
+
+  while (sdp->fd >= 0 && left > 0) {
+    ssize_t l = write(sdp->fd, p, left);
+    if (l < 0) {
+      if (errno == EINTR)
+        continue;
+      chSysHalt("sdWrite");
+    }
+    p += l;
+    left -= l;
+  }
+  sdp->written += n;
+
+  if (sdp->paced && sdp->speed != 0) {
+    uint64_t now = ch_now_ns();
+    uint64_t byte = 10000000000ULL / sdp->speed;
+
+    if (sdp->linefree < now)
+      sdp->linefree = now;
+    sdp->linefree += n * byte;
+    /* The writer is blocked while the transmit queue is full.*/
+    if (sdp->linefree > now + SERIAL_BUFFERS_SIZE * byte)
+      ch_sleep_until_ns(sdp->linefree - SERIAL_BUFFERS_SIZE * byte);
+  }
+  return n;
+}
+
+size_t sdReadTimeout(SerialDriver *sdp, void *bp, size_t n, systime_t timeout){
+  uint8_t *p = bp;
+  size_t done = 0;
+  uint64_t deadline = ch_now_ns() + ch_ticks_ns(timeout);
+
+  while (done < n) {
+    struct pollfd pfd = {sdp->fd, POLLIN, 0};
+    int ms = -1;
+    ssize_t l;
+
+    if (timeout != TIME_INFINITE) {
+      uint64_t now = ch_now_ns();
+      if (now >= deadline && timeout != TIME_IMMEDIATE)
+        break;
+      ms = timeout == TIME_IMMEDIATE ? 0 : (int)((deadline - now + 999999) / 1000000);
+    }
+    if (poll(&pfd, 1, ms) <= 0) {
+      if (timeout == TIME_IMMEDIATE)
+        break;
+      continue;
+    }
+    l = read(sdp->fd, p + done, n - done);
+    if (l > 0)
+      done += l;
+    else if (l == 0 || errno != EINTR)
+      ch_sleep_until_ns(ch_now_ns() + 10000000ULL);
+  }
+  return done;
+}
+
+msg_t sdGet(SerialDriver *sdp){
+  uint8_t c;
+
+  (void)sdReadTimeout(sdp, &c, 1, TIME_INFINITE);
+  return c;
+}
+
+size_t sdAsynchronousRead(SerialDriver *sdp, void *bp, size_t n){
+  return sdReadTimeout(sdp, bp, n, TIME_IMMEDIATE);
+}
+
+/*===========================================================================*/
+/* CAN driver.                                                               */
+/*===========================================================================*/
+
+void canStart(CANDriver *canp, const CANConfig *config){
+  canp->config = config;
+  /* The default filter of the low level driver: bank 0 takes everything.*/
+  if (CAN1->FA1R == 0) {
+    CAN1->FS1R = 1;
+    CAN1->FM1R = 0;
+    CAN1->sFilterRegister[0].FR1 = 0;
+    CAN1->sFilterRegister[0].FR2 = 0;
+    CAN1->FA1R = 1;
+  }
+}
+
+/*
+ * The acceptance filters of the bxCAN on the loaded filter banks, the
+ * FIFO assignment is ignored.
+ */
+static bool can_filter_match(const CANRxFrame *crfp){
+  uint32_t v32, v16;
+  int i, j;
+
+  if (CAN1->FMR & CAN_FMR_FINIT)
+    return false;
+  if (crfp->IDE)
+    v32 = (crfp->EID << 3) | 4;
+  else
+    v32 = crfp->SID << 21;
+  v32 |= crfp->RTR << 1;
+  /* STID, RTR, IDE and EXID[17:15].*/
+  v16 = ((v32 >> 21) << 5) | (crfp->RTR << 4) | ((v32 >> 2 & 1) << 3) | ((v32 >> 18) & 7);
+
+  for (i = 0; i < 28; i++) {
+    uint32_t fr1 = CAN1->sFilterRegister[i].FR1, fr2 = CAN1->sFilterRegister[i].FR2;
+    bool list = (CAN1->FM1R >> i) & 1;
+
+    if (!((CAN1->FA1R >> i) & 1))
+      continue;
+    if ((CAN1->FS1R >> i) & 1) {
+      if (list ? (v32 == fr1 || v32 == fr2) : ((v32 ^ fr1) & fr2) == 0)
+        return true;
+      continue;
+    }
+    for (j = 0; j < 2; j++) {
+      uint32_t r = j == 0 ? fr1 : fr2, lo = r & 0xFFFF, hi = r >> 16;
+      if (list ? (v16 == lo || v16 == hi) : ((v16 ^ lo) & hi) == 0)
+        return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Only TIME_IMMEDIATE is supported, the receiver waits on rxfull_event.
+ */
+msg_t canReceive(CANDriver *canp, int mailbox, CANRxFrame *crfp, systime_t timeout){
+  msg_t msg = MSG_TIMEOUT;
+
+  (void)mailbox;
+  if (timeout != TIME_IMMEDIATE)
+    chSysHalt("canReceive(), timeout");
+  chSysLock();
+  if (canp->tail != canp->head) {
+    *crfp = canp->fifo[canp->tail % CAN_SIM_FIFO_SIZE];
+    canp->tail++;
+    msg = MSG_OK;
+  }
+  chSysUnlock();
+  return msg;
+}
+
+/*
+ * Puts a frame into the receive FIFO as the bus would, false if the filter
+ * banks refused it or it was lost on a full FIFO.
+ */
+bool canSimInject(CANDriver *canp, const CANRxFrame *crfp){
+  chSysLock();
+  if (!can_filter_match(crfp)) {
+    canp->Filtered++;
+    chSysUnlock();
+    return false;
+  }
+  if (canp->head - canp->tail == CAN_SIM_FIFO_SIZE) {
+    canp->Overruns++;
+    chSysUnlock();
+    return false;
+  }
+  canp->fifo[canp->head % CAN_SIM_FIFO_SIZE] = *crfp;
+  canp->head++;
+  chEvtBroadcastI(&canp->rxfull_event);
+  chSysUnlock();
+  return true;
+}
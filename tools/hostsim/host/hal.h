@@ -0,0 +1,155 @@
+/*
+ * hal.h
+ *
+ * Host replacement of the ChibiOS HAL header, see chsim.c.
+ *
+ * - SD1 writes and reads a file descriptor, a pseudo-terminal or a socket.
+ *   The writes are paced at the configured baud rate.
+ * - CAND1 is a virtual CAN controller, the frames are injected by the host
+ *   with canSimInject() into a receive FIFO as deep as the two bxCAN FIFOs.
+ * - The CAN1 registers are plain memory, the injected frames go through
+ *   the acceptance filters loaded into them as on the bxCAN.
+ * - The pads are not simulated.
+ */
+
+#ifndef HOST_HAL_H_
+#define HOST_HAL_H_
+
+#include "ch.h"
+
+#define HAL_USE_CAN                 TRUE
+#define HAL_USE_SERIAL              TRUE
+
+#define __DMB()                     __sync_synchronize()
+
+/*===========================================================================*/
+/* PAL.                                                                      */
+/*===========================================================================*/
+
+#define GPIOA                       0
+#define GPIOB                       1
+#define GPIOB_LED1                  0
+#define GPIOB_LED2                  1
+#define PAL_HIGH                    1
+#define PAL_LOW                     0
+
+#define palTogglePad(port, pad)     ((void)(port), (void)(pad))
+#define palSetPad(port, pad)        ((void)(port), (void)(pad))
+#define palClearPad(port, pad)      ((void)(port), (void)(pad))
+#define palReadPad(port, pad)       PAL_LOW
+
+/*===========================================================================*/
+/* Serial driver.                                                            */
+/*===========================================================================*/
+
+typedef struct {
+  uint32_t speed;
+  uint16_t cr1;
+  uint16_t cr2;
+  uint16_t cr3;
+} SerialConfig;
+
+typedef struct {
+  int fd;
+  uint32_t speed;               /* Pacing of the writes, 0 if off.          */
+  bool paced;
+  uint64_t linefree;            /* When the last byte leaves the line (ns). */
+  uint64_t written;
+} SerialDriver;
+
+extern SerialDriver SD1;
+
+void sdSimAttach(SerialDriver *sdp, int fd, bool paced);
+void sdStart(SerialDriver *sdp, const SerialConfig *config);
+size_t sdWrite(SerialDriver *sdp, const void *bp, size_t n);
+msg_t sdGet(SerialDriver *sdp);
+size_t sdAsynchronousRead(SerialDriver *sdp, void *bp, size_t n);
+size_t sdReadTimeout(SerialDriver *sdp, void *bp, size_t n, systime_t timeout);
+
+/*
+ * Bytes of the transmit queue of the SerialDriver (SERIAL_BUFFERS_SIZE),
+ * sdWrite() returns when the rest of the write fits into it.
+ */
+#define SERIAL_BUFFERS_SIZE         16
+
+/*===========================================================================*/
+/* CAN driver.                                                               */
+/*===========================================================================*/
+
+typedef struct {
+  volatile uint32_t FR1;
+  volatile uint32_t FR2;
+} CAN_FilterRegister_TypeDef;
+
+typedef struct {
+  volatile uint32_t FMR;
+  volatile uint32_t FM1R;
+  volatile uint32_t FS1R;
+  volatile uint32_t FFA1R;
+  volatile uint32_t FA1R;
+  CAN_FilterRegister_TypeDef sFilterRegister[28];
+} CAN_TypeDef;
+
+extern CAN_TypeDef CANSimRegisters;
+#define CAN1                        (&CANSimRegisters)
+
+#define CAN_FMR_FINIT               0x00000001
+#define CAN_MCR_ABOM                0x00000040
+#define CAN_BTR_SJW(n)              ((uint32_t)(n) << 24)
+#define CAN_BTR_TS2(n)              ((uint32_t)(n) << 20)
+#define CAN_BTR_TS1(n)              ((uint32_t)(n) << 16)
+#define CAN_BTR_BRP(n)              ((uint32_t)(n) << 0)
+#define CAN_BTR_LBKM                0x40000000
+
+#define CAN_ANY_MAILBOX             0
+#define CAN_IDE_STD                 0
+#define CAN_IDE_EXT                 1
+#define CAN_RTR_DATA                0
+#define CAN_RTR_REMOTE              1
+
+/*
+ * Depth of the receive FIFO, the two FIFOs of the bxCAN hold 3 frames each.
+ */
+#if !defined(CAN_SIM_FIFO_SIZE)
+#define CAN_SIM_FIFO_SIZE           6
+#endif
+
+typedef struct {
+  uint32_t mcr;
+  uint32_t btr;
+} CANConfig;
+
+typedef struct {
+  uint8_t FMI;
+  uint16_t TIME;
+  uint8_t DLC:4;
+  uint8_t RTR:1;
+  uint8_t IDE:1;
+  union {
+    uint32_t SID:11;
+    uint32_t EID:29;
+  };
+  union {
+    uint8_t data8[8];
+    uint16_t data16[4];
+    uint32_t data32[2];
+  };
+} CANRxFrame;
+
+typedef struct {
+  event_source_t rxfull_event;
+  const CANConfig *config;
+  CANRxFrame fifo[CAN_SIM_FIFO_SIZE];
+  unsigned head;
+  unsigned tail;
+  long Overruns;                /* Frames lost on a full FIFO.              */
+  long Filtered;                /* Frames refused by the filter banks.      */
+} CANDriver;
+
+extern CANDriver CAND1;
+
+void canStart(CANDriver *canp, const CANConfig *config);
+msg_t canReceive(CANDriver *canp, int mailbox, CANRxFrame *crfp, systime_t timeout);
+bool canSimInject(CANDriver *canp, const CANRxFrame *crfp);
+
+#endif /* HOST_HAL_H_ */
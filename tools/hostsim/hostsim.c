@@ -0,0 +1,285 @@
+/*
+ * hostsim.c
+ *
+ * Runs the CAN forwarding of the firmware (CanComm, NetworkLayer,
+ * DataLinkLayer) on the host. SD1 is a pseudo-terminal, CAND1 a virtual
+ * CAN controller fed by a synthetic load.
+ *
+ * Every CAN frame carries its injection time in data bytes 0..3, the sink
+ * on the other side of the pseudo-terminal decodes the frames and measures
+ * the forwarding latency from it. With -p the sink is not started and the
+ * pseudo-terminal is left to an external peer.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "CanComm.h"
+#include "NetworkLayer.h"
+#include "DataLinkLayer.h"
+#include "dcdecode.h"
+#include "simstats.h"
+
+/* The sink does not answer the peer.*/
+#if DLL_USE_ARQ || DLL_USE_CREDITS
+#error "the sink does not support DLL_USE_ARQ and DLL_USE_CREDITS"
+#endif
+
+static struct {
+  uint32_t rate;                /* CAN frames per second.                   */
+  uint32_t ids;                 /* Number of CAN IDs.                       */
+  uint32_t base;                /* First CAN ID.                            */
+  bool ext;                     /* Extended identifiers.                    */
+  uint8_t dlc;
+  uint32_t seconds;
+  uint32_t bitrate;             /* CAN bus, limits the catch up bursts.     */
+  uint32_t baudrate;
+  bool paced;
+  bool peer;
+  uint32_t budget;
+  uint32_t gap;
+} opt = {1000, 16, 0x100, false, 8, 10, 500000, 921600, true, false, 0, 0};
+
+static DLLSerialConfig SimCfg = {
+  &SD1,
+  921600,
+  CanCommFrameReceived
+};
+
+static int slave;
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+static DcDecoder sink;
+static SimLatency latbulk, latprio;
+static long injected;
+
+/*===========================================================================*/
+/* CAN load and sink.                                                        */
+/*===========================================================================*/
+
+static THD_WORKING_AREA(waSource, 256);
+static THD_FUNCTION(Source, arg) {
+  struct timespec ts;
+  uint64_t k = 0, start, last;
+  /* Length of a frame on the bus without stuff bits. When the host
+     deschedules this thread the late frames follow each other at this
+     pace, not all at once.*/
+  uint64_t onbus = (uint64_t)((opt.ext ? 67 : 47) + 8 * opt.dlc) * 1000000000ULL / opt.bitrate;
+
+  (void)arg;
+  chRegSetThreadName("can source");
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  start = last = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  while (true) {
+    uint64_t due = start + k * 1000000000ULL / opt.rate;
+    CANRxFrame f;
+    uint32_t now;
+
+    if (due < last + onbus)
+      due = last + onbus;
+    last = due;
+    ts.tv_sec = due / 1000000000ULL;
+    ts.tv_nsec = due % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+    memset(&f, 0, sizeof(f));
+    f.IDE = opt.ext ? CAN_IDE_EXT : CAN_IDE_STD;
+    if (opt.ext)
+      f.EID = opt.base + k % opt.ids;
+    else
+      f.SID = opt.base + k % opt.ids;
+    f.DLC = opt.dlc;
+    now = CanTimeNow();
+    memcpy(&f.data8[0], &now, 4);
+    f.data32[1] = (uint32_t)k;
+    (void)canSimInject(&CAND1, &f);
+    injected++;
+    k++;
+  }
+}
+
+/* Called by DcDecoderFeed() with statlock held.*/
+static void SinkFrame(void *arg, const DcCanFrame *f){
+  uint32_t stamp;
+
+  (void)arg;
+  if (f->dlc < 4 || (f->flags & DC_CAN_RTR))
+    return;
+  memcpy(&stamp, f->data, 4);
+  SimLatencyAdd((f->flags & DC_CAN_PRIORITY) ? &latprio : &latbulk, CanTimeNow() - stamp);
+}
+
+static THD_WORKING_AREA(waSink, 256);
+static THD_FUNCTION(Sink, arg) {
+  uint8_t buf[512];
+
+  (void)arg;
+  chRegSetThreadName("sink");
+  while (true) {
+    ssize_t n = read(slave, buf, sizeof(buf));
+    if (n <= 0)
+      continue;
+    pthread_mutex_lock(&statlock);
+    DcDecoderFeed(&sink, buf, n);
+    pthread_mutex_unlock(&statlock);
+  }
+}
+
+/*===========================================================================*/
+/* Reports.                                                                  */
+/*===========================================================================*/
+
+static void PrintLatency(const char *name, const SimLatency *slp){
+  printf("%s latency: n %llu avg %u p50 %u p90 %u p99 %u max %u us\n", name,
+         (unsigned long long)slp->count, SimLatencyAverage(slp),
+         SimLatencyPercentile(slp, 0.50), SimLatencyPercentile(slp, 0.90),
+         SimLatencyPercentile(slp, 0.99), slp->max);
+}
+
+static void PrintSummary(double seconds){
+  DataLinkStatistics *dls = &DLLS1.DLLStats;
+
+  pthread_mutex_lock(&statlock);
+  printf("\n%.1f s, %u CAN frames/s offered, %s threads\n", seconds, opt.rate,
+         chSimRealtime() ? "SCHED_FIFO" : "time shared");
+  printf("can: injected %ld, fifo overruns %ld, overload dropped %ld/%ld/%ld\n",
+         injected, CAND1.Overruns, CanOverloadQ.DroppedNewest, CanOverloadQ.DroppedOldest,
+         CanOverloadQ.Shed[0] + CanOverloadQ.Shed[1] + CanOverloadQ.Shed[2] + CanOverloadQ.Shed[3]);
+  printf("packets: %ld sent, %ld records, %ld stream frames, %ld dropped records\n",
+         WIFID1.NWLStats.SentPacket, CanStreamE.Records, CanStreamE.StreamFrames,
+         CanStreamE.DroppedRecords);
+  printf("flushes: %ld full, %ld deadline, %ld gap\n", CanFlushP.Flushes[CAN_FLUSH_FULL],
+         CanFlushP.Flushes[CAN_FLUSH_DEADLINE], CanFlushP.Flushes[CAN_FLUSH_GAP]);
+  printf("serial: %ld frames, %llu bytes, %.0f B/s, peak queued %d, min free slots %d\n",
+         dls->SentFrames, (unsigned long long)SD1.written, SD1.written / seconds,
+         dls->PeakQueuedFrames, dls->MinFreeSlots);
+  if (!opt.peer) {
+    printf("sink: %ld frames, %ld crc errors, %ld packets, %ld CAN frames (%.0f/s), %ld lost records\n",
+           sink.Frames, sink.CrcErrors, sink.Packets, sink.CanFrames, sink.CanFrames / seconds,
+           sink.LostRecords);
+    PrintLatency("bulk", &latbulk);
+    if (latprio.count > 0)
+      PrintLatency("priority", &latprio);
+  }
+  pthread_mutex_unlock(&statlock);
+}
+
+/*===========================================================================*/
+/* Setup.                                                                    */
+/*===========================================================================*/
+
+static int OpenPty(void){
+  struct termios tio;
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    perror("posix_openpt");
+    exit(1);
+  }
+  /* The slave stays open so the master never reads EIO.*/
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave < 0 || tcgetattr(slave, &tio) != 0) {
+    perror(ptsname(master));
+    exit(1);
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  return master;
+}
+
+static void Usage(const char *name){
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -r rate      CAN frames per second (%u)\n"
+          "  -n ids       number of CAN IDs (%u)\n"
+          "  -i id        first CAN ID (0x%x)\n"
+          "  -x           extended identifiers\n"
+          "  -l dlc       data length (%u), at least 4 for the latency\n"
+          "  -t seconds   duration, 0 runs until killed (%u)\n"
+          "  -c bitrate   CAN bus bit rate (%u)\n"
+          "  -b baud      serial line speed (%u)\n"
+          "  -u           unpaced serial line\n"
+          "  -B us        latency budget of the flush policy\n"
+          "  -G us        idle gap of the flush policy\n"
+          "  -P id        latency critical CAN ID, repeatable\n"
+          "  -p           external peer on the pseudo-terminal, no sink\n",
+          name, opt.rate, opt.ids, opt.base, opt.dlc, opt.seconds, opt.bitrate,
+          opt.baudrate);
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t prio[CAN_PRIORITY_MAX_IDS];
+  int c, nprio = 0, master;
+  uint32_t t;
+
+  while ((c = getopt(argc, argv, "r:n:i:xl:t:c:b:uB:G:P:p")) != -1) {
+    switch (c) {
+    case 'r': opt.rate = strtoul(optarg, NULL, 0); break;
+    case 'n': opt.ids = strtoul(optarg, NULL, 0); break;
+    case 'i': opt.base = strtoul(optarg, NULL, 0); break;
+    case 'x': opt.ext = true; break;
+    case 'l': opt.dlc = strtoul(optarg, NULL, 0); break;
+    case 't': opt.seconds = strtoul(optarg, NULL, 0); break;
+    case 'c': opt.bitrate = strtoul(optarg, NULL, 0); break;
+    case 'b': opt.baudrate = strtoul(optarg, NULL, 0); break;
+    case 'u': opt.paced = false; break;
+    case 'B': opt.budget = strtoul(optarg, NULL, 0); break;
+    case 'G': opt.gap = strtoul(optarg, NULL, 0); break;
+    case 'P':
+      if (nprio < CAN_PRIORITY_MAX_IDS)
+        prio[nprio++] = strtoul(optarg, NULL, 0);
+      break;
+    case 'p': opt.peer = true; break;
+    default: Usage(argv[0]);
+    }
+  }
+  if (opt.rate == 0 || opt.ids == 0 || opt.bitrate == 0 || opt.dlc > 8)
+    Usage(argv[0]);
+
+  chSysInit();
+  master = OpenPty();
+  sdSimAttach(&SD1, master, opt.paced);
+  SimCfg.baudrate = opt.baudrate;
+  if (opt.peer)
+    printf("serial line: %s\n", ptsname(master));
+  else {
+    DcDecoderInit(&sink, DLL_FRAMING, SinkFrame, NULL);
+    chThdCreateStatic(waSink, sizeof(waSink), NORMALPRIO, Sink, NULL);
+  }
+
+  wifiInit();
+  wifiStart(&WIFID1, &DLLS1, &SimCfg);
+  CanCommInit();
+  if (opt.budget != 0 || opt.gap != 0)
+    (void)CanFlushConfigure(&CanFlushP, opt.budget != 0 ? opt.budget : CanFlushP.config.budget,
+                            opt.gap, CanFlushP.config.full);
+  while (nprio > 0)
+    (void)CanPriorityAdd(&CanPriorityT, prio[--nprio], opt.ext);
+
+  chThdCreateStatic(waSource, sizeof(waSource), NORMALPRIO, Source, NULL);
+
+  for (t = 1; opt.seconds == 0 || t <= opt.seconds; t++) {
+    chThdSleepMilliseconds(1000);
+    pthread_mutex_lock(&statlock);
+    printf("%4u s: injected %ld, serial %llu bytes", t, injected,
+           (unsigned long long)SD1.written);
+    if (!opt.peer)
+      printf(", forwarded %ld, bulk p99 %u us", sink.CanFrames,
+             SimLatencyPercentile(&latbulk, 0.99));
+    printf("\n");
+    pthread_mutex_unlock(&statlock);
+    fflush(stdout);
+  }
+  PrintSummary(opt.seconds);
+  return 0;
+}
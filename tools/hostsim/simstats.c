@@ -0,0 +1,49 @@
+/*
+ * simstats.c
+ *
+ * Latency histogram of the host simulation.
+ */
+
+#include <string.h>
+
+#include "simstats.h"
+
+void SimLatencyReset(SimLatency *slp){
+  memset(slp, 0, sizeof(SimLatency));
+}
+
+void SimLatencyAdd(SimLatency *slp, uint32_t us){
+  uint32_t b = us / SIM_LATENCY_STEP_US;
+
+  slp->buckets[b < SIM_LATENCY_BUCKETS ? b : SIM_LATENCY_BUCKETS - 1]++;
+  slp->count++;
+  slp->sum += us;
+  if (us > slp->max)
+    slp->max = us;
+}
+
+/*
+ * Upper bound of the bucket holding the q-th quantile (0 < q <= 1), at
+ * most the largest latency seen.
+ */
+uint32_t SimLatencyPercentile(const SimLatency *slp, double q){
+  uint64_t rank = (uint64_t)(q * slp->count + 0.5), seen = 0;
+  uint32_t b;
+
+  if (slp->count == 0)
+    return 0;
+  if (rank == 0)
+    rank = 1;
+  for (b = 0; b < SIM_LATENCY_BUCKETS; b++) {
+    seen += slp->buckets[b];
+    if (seen >= rank)
+      break;
+  }
+  if (b >= SIM_LATENCY_BUCKETS - 1 || (b + 1) * SIM_LATENCY_STEP_US > slp->max)
+    return slp->max;
+  return (b + 1) * SIM_LATENCY_STEP_US;
+}
+
+uint32_t SimLatencyAverage(const SimLatency *slp){
+  return slp->count == 0 ? 0 : (uint32_t)(slp->sum / slp->count);
+}
@@ -0,0 +1,31 @@
+/*
+ * simstats.h
+ *
+ * Latency histogram of the host simulation.
+ */
+
+#ifndef SIMSTATS_H_
+#define SIMSTATS_H_
+
+#include <stdint.h>
+
+/*
+ * Resolution and range of the histogram, the longer latencies are counted
+ * in the last bucket.
+ */
+#define SIM_LATENCY_STEP_US   10
+#define SIM_LATENCY_BUCKETS   100000
+
+typedef struct {
+  uint32_t buckets[SIM_LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint32_t max;
+} SimLatency;
+
+void SimLatencyReset(SimLatency *slp);
+void SimLatencyAdd(SimLatency *slp, uint32_t us);
+uint32_t SimLatencyPercentile(const SimLatency *slp, double q);
+uint32_t SimLatencyAverage(const SimLatency *slp);
+
+#endif /* SIMSTATS_H_ */